@@ -29,6 +29,7 @@ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISE
 OF THE POSSIBILITY OF SUCH DAMAGE.
 ********************************************************************************/
 
+#include <algorithm>
 #include <boost/date_time.hpp>
 #include <sns_ik/sns_ik.hpp>
 #include <sns_ik/sns_vel_ik_base.hpp>
@@ -146,6 +147,15 @@ double standardDeviation(std::vector<double> values, double mean){
   return std::pow(val_sum/double(values.size()), 0.5);
 }
 
+double median(std::vector<int> values){
+  if (values.empty()) {
+    return 0.0;
+  }
+  std::sort(values.begin(), values.end());
+  size_t n = values.size();
+  return n % 2 ? values[n/2] : 0.5 * (values[n/2 - 1] + values[n/2]);
+}
+
 
 void test(ros::NodeHandle& nh, double num_samples_pos, double num_samples_vel,
           std::string chain_start, std::string chain_end, double timeout, double loop_period,
@@ -373,6 +383,7 @@ void test(ros::NodeHandle& nh, double num_samples_pos, double num_samples_vel,
 
   // SNS Position Tests
   snsik_solver.setNullspaceGain(nullspace_gain);
+  snsik_solver.setTimeout(timeout);
   struct velocitySolverData {
     sns_ik::VelocitySolveType type;
     std::string               name;
@@ -384,6 +395,7 @@ void test(ros::NodeHandle& nh, double num_samples_pos, double num_samples_vel,
     double             avg_ns_time;
     std::vector<double>  indiv_time;
     std::vector<double>  indiv_ns_time;
+    std::vector<int>     indiv_iterations;  // position solver iterations of the successful solves
   };
 
   std::vector<velocitySolverData> vel_solver_data;
@@ -402,6 +414,8 @@ void test(ros::NodeHandle& nh, double num_samples_pos, double num_samples_vel,
 
   for(auto& vst: vel_solver_data){
     snsik_solver.setVelocitySolveType(vst.type);
+    std::shared_ptr<sns_ik::SNSPositionIK> pos_solver;
+    snsik_solver.getPositionSolver(pos_solver);
     // Initialize Solver Variables
     total_time=0;
     ns_total_time=0;
@@ -427,6 +441,7 @@ void test(ros::NodeHandle& nh, double num_samples_pos, double num_samples_vel,
                 && Equal(end_effector_pose, end_effector_pose_check, 1e-3)){
         success++;
         both_success++;
+        vst.indiv_iterations.push_back(pos_solver->getLastIterationCount());
        }
 
       if(use_nullspace_bias_task) {
@@ -456,7 +471,8 @@ void test(ros::NodeHandle& nh, double num_samples_pos, double num_samples_vel,
     vst.avg_time = total_time/num_samples_pos;
     ROS_INFO_STREAM(vst.name << " found " << success << " solutions ("
                     << 100*vst.successRate << "\%) with an average of " << vst.avg_time
-                    << " secs per sample");
+                    << " secs per sample and a median of " << median(vst.indiv_iterations)
+                    << " iterations");
     if(use_nullspace_bias_task) {
         vst.avg_ns_l2_norm_ratio = total_ns_l2_norm_ratio/both_success_cnt;
         vst.avg_ns_success = ns_success/num_samples_pos;
@@ -471,8 +487,9 @@ void test(ros::NodeHandle& nh, double num_samples_pos, double num_samples_vel,
   ROS_INFO("Position IK Summary:");
   for(auto& vst: vel_solver_data){
       double std_dev = standardDeviation(vst.indiv_time, vst.avg_time);
-      ROS_INFO("%s: %.2f%% success rate with (time: %.2f \u00b1 %.2f ms)",
-               vst.name.c_str(), 100*vst.successRate, 1000*vst.avg_time, 1000*std_dev);
+      ROS_INFO("%s: %.2f%% success rate with (time: %.2f \u00b1 %.2f ms, median iterations: %.1f)",
+               vst.name.c_str(), 100*vst.successRate, 1000*vst.avg_time, 1000*std_dev,
+               median(vst.indiv_iterations));
   }
   ROS_INFO("KDL: %.2f%% success rate with (time: %.2f \u00b1 %.2f ms)",
            100.*kdlPos_successRate, 1000*kdlPos_avgTime, 1000*kdlPos_stdDev);
@@ -24,7 +24,7 @@
 #define FOSNS_IK_VELOCITY_IK
 
 #include <Eigen/Dense>
-#include <forward_list>
+#include <vector>
 
 #include "sns_ik/sns_velocity_ik.hpp"
 #include "sns_ik/fsns_velocity_ik.hpp"
@@ -37,8 +37,9 @@ class FOSNSVelocityIK : public FSNSVelocityIK {
     virtual ~FOSNSVelocityIK() {};
 
     // Optimal SNS Velocity IK
-    virtual double getJointVelocity(Eigen::VectorXd *jointVelocity, const std::vector<Task> &sot,
-                  const Eigen::VectorXd &jointConfiguration);
+    using SNSVelocityIK::getJointVelocity;
+    virtual double getJointVelocity(Eigen::VectorXd *jointVelocity, const std::vector<TaskView> &sot,
+                  const Eigen::Ref<const Eigen::VectorXd> &jointConfiguration);
 
     virtual void setNumberOfTasks(int ntasks, int dof);
 
@@ -53,16 +54,17 @@ class FOSNSVelocityIK : public FSNSVelocityIK {
     // For the FastOpt version of the SNS
     // TODO: should these be member variables?
     Eigen::MatrixXd B;  //update matrix
-    std::vector<std::forward_list<int>> satList;
+    std::vector<std::vector<int>> satList;  // most recently saturated joint first
     Eigen::VectorXd lagrangeMu;
     Eigen::VectorXd lagrangeMu1;
     Eigen::VectorXd lagrangeMup2w;
-    std::forward_list<int>::iterator it, prev_it;
+    std::vector<int>::iterator it;
 
     // Perform the SNS for a single task
     virtual double SNSsingle(int priority, const Eigen::VectorXd &higherPriorityJointVelocity,
-                   const Eigen::MatrixXd &higherPriorityNull, const Eigen::MatrixXd &jacobian,
-                   const Eigen::VectorXd &task, Eigen::VectorXd *jointVelocity, Eigen::MatrixXd *nullSpaceProjector);
+                   const Eigen::MatrixXd &higherPriorityNull, const TaskView &sotTask,
+                   const Eigen::Ref<const Eigen::VectorXd> &task, Eigen::VectorXd *jointVelocity,
+                   Eigen::MatrixXd *nullSpaceProjector);
 };
 
 }  // namespace sns_ik
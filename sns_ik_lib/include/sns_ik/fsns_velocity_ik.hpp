@@ -35,14 +35,41 @@ class FSNSVelocityIK : public SNSVelocityIK {
     virtual ~FSNSVelocityIK() {};
 
     // Optimal SNS Velocity IK
-    virtual double getJointVelocity(Eigen::VectorXd *jointVelocity, const std::vector<Task> &sot,
-                  const Eigen::VectorXd &jointConfiguration);
+    using SNSVelocityIK::getJointVelocity;
+    virtual double getJointVelocity(Eigen::VectorXd *jointVelocity, const std::vector<TaskView> &sot,
+                  const Eigen::Ref<const Eigen::VectorXd> &jointConfiguration);
 
   protected:
+    /*! \struct FastTaskWorkspace
+     *  Storage for the intermediate results of the fast SNSsingle(), one for each task.
+     */
+    struct FastTaskWorkspace {
+      PinvWorkspace pinv;  // used to compute (J P)^# and the basis of its null space
+      PinvWorkspace pinvZws;  // used to invert the saturated rows of tildeZ (FOSNS only)
+      Eigen::MatrixXd JZ;  // J_k Z_{k-1}
+      Eigen::MatrixXd JPinverse;  // (J_k P_{k-1})^#
+      Eigen::MatrixXd tildeZ;  // basis of the null space
+      Eigen::VectorXd dq1, dq2, dqw;
+      Eigen::VectorXd best_dq1, best_dq2, best_dqw;
+      Eigen::VectorXd bin, bout;
+      Eigen::RowVectorXd zin, zinScaled;
+      Eigen::VectorXd taskTmp;  // -J * higherPriorityJointVelocity
+      Eigen::ArrayXd a, b;  // used to compute the task scaling factor
+      Eigen::VectorXi noSat;  // all zeros: no joint is saturated
+
+      // FOSNS only. The matrices that depend on the number of saturated joints are allocated for
+      // the worst case (all joints saturated) and only the top-left blocks are used.
+      Eigen::VectorXd dq1_base, dq2_base, dqn, scaledMU;
+      Eigen::RowVectorXd ZX;
+      Eigen::MatrixXd Zws, invZws, Bws, forMu;
+      Eigen::VectorXd dq1_ws, dq2_ws, dqw_ws;
+    };
+
     // Perform the SNS for a single task
     virtual double SNSsingle(int priority, const Eigen::VectorXd &higherPriorityJointVelocity,
-                  const Eigen::MatrixXd &higherPriorityNull, const Eigen::MatrixXd &jacobian,
-                  const Eigen::VectorXd &task, Eigen::VectorXd *jointVelocity, Eigen::MatrixXd *nullSpaceProjector);
+                  const Eigen::MatrixXd &higherPriorityNull, const TaskView &sotTask,
+                  const Eigen::Ref<const Eigen::VectorXd> &task, Eigen::VectorXd *jointVelocity,
+                  Eigen::MatrixXd *nullSpaceProjector);
 
     void getTaskScalingFactor(const Eigen::ArrayXd &a,
                   const Eigen::ArrayXd &b,
@@ -51,6 +78,8 @@ class FSNSVelocityIK : public SNSVelocityIK {
 
     // TODO: Does this need to be a member variable?
     std::vector<Eigen::VectorXi> S;  //the i-th element is zero if the i-th joint is not saturate, otherwise contains the position in B
+
+    std::vector<FastTaskWorkspace> m_fastTaskWs;
 };
 
 }  // namespace sns_ik
@@ -35,8 +35,9 @@ class OSNS_sm_VelocityIK : public OSNSVelocityIK {
     virtual ~OSNS_sm_VelocityIK() {};
 
     // Optimal SNS Velocity IK
-    virtual double getJointVelocity(Eigen::VectorXd *jointVelocity, const std::vector<Task> &sot,
-                            const Eigen::VectorXd &jointConfiguration);
+    using SNSVelocityIK::getJointVelocity;
+    virtual double getJointVelocity(Eigen::VectorXd *jointVelocity, const std::vector<TaskView> &sot,
+                            const Eigen::Ref<const Eigen::VectorXd> &jointConfiguration);
 
     void setScaleMargin(double scale)
       { m_scaleMargin = scale; }
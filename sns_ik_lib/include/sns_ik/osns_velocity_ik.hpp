@@ -35,18 +35,28 @@ class OSNSVelocityIK : public SNSVelocityIK {
     virtual ~OSNSVelocityIK() {};
 
     // Optimal SNS Velocity IK
-    virtual double getJointVelocity(Eigen::VectorXd *jointVelocity, const std::vector<Task> &sot,
-                            const Eigen::VectorXd &jointConfiguration);
+    using SNSVelocityIK::getJointVelocity;
+    virtual double getJointVelocity(Eigen::VectorXd *jointVelocity, const std::vector<TaskView> &sot,
+                            const Eigen::Ref<const Eigen::VectorXd> &jointConfiguration);
 
   protected:
     // Perform the SNS for a single task
     virtual double SNSsingle(int priority, const Eigen::VectorXd &higherPriorityJointVelocity,
-                     const Eigen::MatrixXd &higherPriorityNull, const Eigen::MatrixXd &jacobian,
-                     const Eigen::VectorXd &task, Eigen::VectorXd *jointVelocity, Eigen::MatrixXd *nullSpaceProjector);
+                     const Eigen::MatrixXd &higherPriorityNull, const TaskView &sotTask,
+                     const Eigen::Ref<const Eigen::VectorXd> &task, Eigen::VectorXd *jointVelocity,
+                     Eigen::MatrixXd *nullSpaceProjector);
 
     bool isOptimal(int priority, const Eigen::VectorXd& dotQ,
-                   const Eigen::MatrixXd& tildeP, Eigen::MatrixXd* W,
+                   const Eigen::MatrixXd& tildeP, JointMask* W,
                    Eigen::VectorXd* dotQn, double eps = 1e-8);
+
+    // dotQ = higherPriorityJointVelocity + invJP * (scale * task - jacobian * higherPriorityJointVelocity)
+    //        + tildeP * dotQn
+    void computeSolution(int priority, const Eigen::VectorXd &higherPriorityJointVelocity,
+                         const Eigen::Ref<const Eigen::MatrixXd> &jacobian,
+                         const Eigen::Ref<const Eigen::VectorXd> &task, double scale,
+                         const Eigen::MatrixXd &invJP, const Eigen::MatrixXd &tildeP,
+                         const Eigen::VectorXd &dotQn, Eigen::VectorXd *dotQ);
 };
 
 }  // namespace sns_ik
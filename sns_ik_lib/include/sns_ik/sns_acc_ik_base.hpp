@@ -27,11 +27,12 @@
 
 #include "sns_linear_solver.hpp"
 #include "sns_ik_base.hpp"
+#include "sns_ik_kernel.hpp"
 
 namespace sns_ik {
 
 
-class SnsAccIkBase : SnsIkBase{
+class SnsAccIkBase : public SnsIkBase{
 
 public:
 
@@ -50,10 +51,14 @@ public:
    * Create a default solver with nJnt joints and infinite bounds on the joint acceleration.
    * @param ddqLow: lower bound on the acceleration of each joint
    * @param ddqUpp: upper bound on the acceleration of each joint
+   * @param useFixedSizeKernel: if true and the robot has 6, 7, or 8 joints, then a six-dimensional
+   *                            task is solved by a kernel with compile-time matrix sizes.
+   *                            Other problem sizes always use the dynamic kernel.
    * @return: acceleration solver iff successful, nullptr otherwise
    */
   static std::unique_ptr<SnsAccIkBase> create(const Eigen::ArrayXd& ddqLow,
-                                              const Eigen::ArrayXd& ddqUpp);
+                                              const Eigen::ArrayXd& ddqUpp,
+                                              bool useFixedSizeKernel = true);
 
   // Make sure that class is cleaned-up correctly
   virtual ~SnsAccIkBase() {};
@@ -123,10 +128,19 @@ protected:
   /*
    * protected constructor: require factory method to create an object.
    */
+  SnsAccIkBase(int nJnt) : SnsIkBase(nJnt) {};
+
+  /*
+   * Run the main loop of the solver. The inputs have already been validated by solve().
+   * The default implementation uses the dynamic kernel. The solvers for common problem sizes
+   * override this method to run a fixed-size kernel instead.
+   */
+  virtual ExitCode solveKernel(const Eigen::MatrixXd& J, const Eigen::VectorXd& dJdq,
+                               const Eigen::VectorXd& ddx, Eigen::VectorXd* ddq, double* taskScale);
 
 private:
 
-  SnsAccIkBase(int nJnt) : SnsIkBase(nJnt) {};
+  SnsIkKernel<Eigen::Dynamic, Eigen::Dynamic> kernel_;  //!< general-purpose SNS-IK kernel
 
 };  // class SnsAccIkBase
 
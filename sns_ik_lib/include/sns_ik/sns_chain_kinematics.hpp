@@ -0,0 +1,96 @@
+/** @file sns_chain_kinematics.hpp
+ *
+ * @brief Forward kinematics and Jacobian of a serial chain, computed in a single pass
+ *
+ *    Copyright 2018 Rethink Robotics
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef SNS_IK_LIB__SNS_CHAIN_KINEMATICS_H_
+#define SNS_IK_LIB__SNS_CHAIN_KINEMATICS_H_
+
+#include <Eigen/Dense>
+#include <kdl/chain.hpp>
+#include <kdl/frames.hpp>
+#include <vector>
+
+#include <sns_ik/sns_kinematics_backend.hpp>
+
+namespace sns_ik {
+
+/*
+ * Kinematic model of a serial chain. The model is built once from a KDL chain: fixed segments are
+ * merged into the joints that follow them, so that each joint is described by one fixed transform
+ * and its axis of motion. The tip frame and the Jacobian are then computed in one sweep over the
+ * joints, instead of the two passes of KDL::ChainFkSolverPos_recursive and
+ * KDL::ChainJntToJacSolver. The Jacobian is the same as the one from KDL::ChainJntToJacSolver:
+ * it is expressed in the base frame, with the reference point at the tip.
+ *
+ * The model is immutable after construction, so one object can be used by several threads.
+ * This is the kinematics backend for chains that do not have a generated one.
+ */
+class ChainKinematics : public KinematicsBackend {
+
+public:
+
+  // Motion of a joint, in the frame of the joint
+  enum class Motion { Rotation, Translation };
+
+  // The frame of a joint moves with the joint; the fixed transform is relative to the frame of the
+  // previous joint (after its motion), or to the base for the first joint.
+  struct Joint {
+    Eigen::Matrix3d R;  // rotation of this joint frame relative to the previous one (q = 0)
+    Eigen::Vector3d p;  // position of this joint frame in the previous one
+    Eigen::Vector3d axis;  // unit axis of motion, in this joint frame
+    double scale;  // motion along the axis per unit of the joint coordinate
+    Motion motion;
+  };
+
+  /*
+   * Build the kinematic model
+   * @param chain: kinematic chain, with joints of any of the KDL joint types
+   */
+  explicit ChainKinematics(const KDL::Chain& chain);
+
+  /*
+   * @return: number of (non-fixed) joints in the chain
+   */
+  int getNrOfJoints() const override { return joints_.size(); }
+
+  void computePose(const Eigen::Ref<const Eigen::VectorXd>& q, KDL::Frame* pose) const override;
+
+  void computePoseAndJacobian(const Eigen::Ref<const Eigen::VectorXd>& q,
+                              KDL::Frame* pose, Eigen::MatrixXd* jacobian) const override;
+
+  void computeJacobianDotQdot(const Eigen::Ref<const Eigen::VectorXd>& q,
+                              const Eigen::Ref<const Eigen::VectorXd>& qd,
+                              Eigen::VectorXd* jdotQdot) const override;
+
+  /*
+   * Access to the model, for generateKinematicsCode()
+   */
+  const std::vector<Joint>& getJoints() const { return joints_; }
+  const Eigen::Matrix3d& getTipRotation() const { return tipR_; }
+  const Eigen::Vector3d& getTipPosition() const { return tipP_; }
+
+private:
+
+  std::vector<Joint> joints_;  // contiguous array, in the order of the chain
+  Eigen::Matrix3d tipR_;  // rotation from the last joint frame to the tip
+  Eigen::Vector3d tipP_;  // position of the tip in the last joint frame
+
+};  // class ChainKinematics
+
+}  // namespace sns_ik
+
+#endif  // SNS_IK_LIB__SNS_CHAIN_KINEMATICS_H_
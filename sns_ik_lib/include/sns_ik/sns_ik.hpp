@@ -17,13 +17,18 @@
 #ifndef SNS_IK_HPP
 #define SNS_IK_HPP
 
+#include <algorithm>
 #include <string>
 #include <memory>
+#include <vector>
 #include <kdl/chain.hpp>
 #include <kdl/frames.hpp>
+#include <kdl/jacobian.hpp>
 #include <kdl/jntarray.hpp>
 #include <kdl/chainfksolverpos_recursive.hpp>
+#include <sns_ik/sns_kinematics_backend.hpp>
 #include <sns_ik/sns_position_ik.hpp>
+#include <sns_ik/sns_velocity_ik.hpp>
 
 namespace sns_ik {
 
@@ -36,6 +41,13 @@ namespace sns_ik {
                          };
 
 
+  /*
+   * Which solution CartToJntMultiSeed() returns when several seeds converge
+   */
+  enum MultiSeedMode { FirstSolution,  // the first one found: the other seeds are cancelled
+                       NearestSolution  // the one closest to the user's seed: all seeds are solved
+                     };
+
   /*
    * Convert velocity solver type to a string (for logging)
    * @param solverType: solve type to convert
@@ -43,11 +55,82 @@ namespace sns_ik {
    */
   std::string toStr(const sns_ik::VelocitySolveType& type);
 
-  // Forward declare SNS Velocity Base Class
-  class SNSVelocityIK;
   class SNS_IK
   {
   public:
+    /*
+     * Mutable state of a solve: the velocity and position solvers and the workspace for
+     * CartToJntVel(). The const overloads of CartToJnt() and CartToJntVel() write only to the
+     * context that they are given, so several threads can share one SNS_IK object when each
+     * thread has its own context. A context follows the settings of the SNS_IK that created it:
+     * setting changes are applied at the start of the next solve, and must not be made while a
+     * solve is running on another thread.
+     */
+    class SolveContext
+    {
+    public:
+      ~SolveContext() {}
+
+    private:
+      friend class SNS_IK;
+      SolveContext();
+
+      int m_settingsVersion;  // value of SNS_IK::m_settingsVersion when the solvers were updated
+      VelocitySolveType m_solvetype;
+      std::shared_ptr<SNSVelocityIK> m_ik_vel_solver;
+      std::shared_ptr<SNSPositionIK> m_ik_pos_solver;
+
+      // Workspace for CartToJntVel(), reused between calls
+      std::vector<Task> m_sot;
+      std::vector<int> m_biasIndices;
+      Eigen::VectorXd m_qdot;  // solution of the velocity solver
+    };
+
+    /*
+     * Persistent state of a velocity control loop, created by createVelocitySession(): its own
+     * solve context, and a task stack whose shape and bias joints are set once. step() only
+     * overwrites the task data, so that a control cycle costs the Jacobian and the velocity solve.
+     * The session uses the current settings of the SNS_IK object that created it, and must not
+     * outlive it. Like a solve context, a session must only be used by one thread at a time.
+     */
+    class VelocityIkSession
+    {
+    public:
+      ~VelocityIkSession() {}
+
+      /*
+       * Solve the velocity IK for one control cycle. The result is the same as CartToJntVel()
+       * with the same inputs and the bias joint names of the session.
+       * @param q_in: joint angles
+       * @param v_in: task velocity
+       * @param q_bias: nullspace bias of the bias joints of the session; empty if it has none
+       * @param q_vel_bias: joint velocity bias; empty if the session has none
+       * @param[out] qdot_out: joint velocities
+       * @return: the return code of the velocity solver, or -1 if the inputs do not match the
+       *          session
+       */
+      int step(const KDL::JntArray& q_in, const KDL::Twist& v_in, KDL::JntArray* qdot_out)
+      { return step(q_in, v_in, KDL::JntArray(0), KDL::JntArray(0), qdot_out); }
+
+      int step(const KDL::JntArray& q_in, const KDL::Twist& v_in,
+               const KDL::JntArray& q_bias, const KDL::JntArray& q_vel_bias,
+               KDL::JntArray* qdot_out);
+
+      // Context of the session, for example for getTaskScaleFactors()
+      const SolveContext& getContext() const { return *m_context; }
+
+    private:
+      friend class SNS_IK;
+      VelocityIkSession(const SNS_IK* ik, std::shared_ptr<SolveContext> context);
+
+      const SNS_IK* m_ik;
+      std::shared_ptr<SolveContext> m_context;
+      std::vector<Task> m_sot;  // tasks in the order of CartToJntVel()
+      std::vector<int> m_biasIndices;  // index of each bias joint in the chain
+      int m_biasTask;  // index of the nullspace bias task in m_sot, or -1
+      int m_velocityBiasTask;  // index of the joint velocity bias task in m_sot, or -1
+    };
+
     SNS_IK(const std::string& base_link, const std::string& tip_link,
            const std::string& URDF_param="/robot_description",
            double loopPeriod=0.01, double eps=1e-5,
@@ -64,16 +147,34 @@ namespace sns_ik {
 
     bool setVelocitySolveType(VelocitySolveType type);
 
+    // The settings of this position solver (step size, iteration limit, ...) are copied to
+    // every other solve context at the start of each solve.
     inline bool getPositionSolver(std::shared_ptr<sns_ik::SNSPositionIK>& positionSolver) {
-      positionSolver=m_ik_pos_solver;
+      positionSolver=m_context ? m_context->m_ik_pos_solver : nullptr;
       return m_initialized;
     }
 
     inline bool getVelocitySolver(std::shared_ptr<sns_ik::SNSVelocityIK>& velocitySolver) {
-      velocitySolver=m_ik_vel_solver;
+      velocitySolver=m_context ? m_context->m_ik_vel_solver : nullptr;
       return m_initialized;
     }
 
+    /*
+     * Create a solve context for the const solve functions. Each thread that calls the const
+     * solve functions on this object must use its own context.
+     */
+    std::shared_ptr<SolveContext> createSolveContext() const;
+
+    /*
+     * Create a session for a velocity control loop (see VelocityIkSession).
+     * @param biasNames: joints of the nullspace bias; empty for no nullspace bias
+     * @param useVelocityBias: true if the steps have a joint velocity bias
+     * @return: the session, or nullptr if a bias joint name is not in the chain
+     */
+    std::shared_ptr<VelocityIkSession> createVelocitySession(
+        const std::vector<std::string>& biasNames = std::vector<std::string>(),
+        bool useVelocityBias = false) const;
+
     inline bool getKDLChain(KDL::Chain& chain) {
       chain=m_chain;
       return m_initialized;
@@ -117,7 +218,168 @@ namespace sns_ik {
                   const KDL::JntArray& q_bias,
                   const std::vector<std::string>& biasNames,
                   KDL::JntArray &q_out,
-                  const KDL::Twist& bounds=KDL::Twist::Zero());
+                  const KDL::Twist& bounds=KDL::Twist::Zero())
+    { return CartToJnt(m_context.get(), q_init, p_in, q_bias, biasNames, q_out, bounds); }
+
+    // Thread-safe version: all mutable state is stored in the solve context
+    int CartToJnt(SolveContext* context,
+                  const KDL::JntArray &q_init, const KDL::Frame &p_in,
+                  const KDL::JntArray& q_bias,
+                  const std::vector<std::string>& biasNames,
+                  KDL::JntArray &q_out,
+                  const KDL::Twist& bounds=KDL::Twist::Zero()) const
+    { if (q_out.rows() != q_init.rows()) { q_out.resize(q_init.rows()); }
+      return CartToJnt(context, q_init.data, p_in, q_bias.data, biasNames, q_out.data, bounds); }
+
+    /*
+     * Same as the CartToJnt() above, with the joint angles in the memory of the caller: a vector,
+     * a block of a matrix or a Map. q_out must have one element per joint.
+     */
+    int CartToJnt(const Eigen::Ref<const Eigen::VectorXd>& q_init, const KDL::Frame &p_in,
+                  Eigen::Ref<Eigen::VectorXd> q_out,
+                  const KDL::Twist& bounds=KDL::Twist::Zero())
+    { return CartToJnt(m_context.get(), q_init, p_in, Eigen::VectorXd(), std::vector<std::string>(),
+                       q_out, bounds); }
+
+    int CartToJnt(const Eigen::Ref<const Eigen::VectorXd>& q_init, const KDL::Frame &p_in,
+                  const Eigen::Ref<const Eigen::VectorXd>& q_bias,
+                  const std::vector<std::string>& biasNames,
+                  Eigen::Ref<Eigen::VectorXd> q_out,
+                  const KDL::Twist& bounds=KDL::Twist::Zero())
+    { return CartToJnt(m_context.get(), q_init, p_in, q_bias, biasNames, q_out, bounds); }
+
+    int CartToJnt(SolveContext* context,
+                  const Eigen::Ref<const Eigen::VectorXd>& q_init, const KDL::Frame &p_in,
+                  const Eigen::Ref<const Eigen::VectorXd>& q_bias,
+                  const std::vector<std::string>& biasNames,
+                  Eigen::Ref<Eigen::VectorXd> q_out,
+                  const KDL::Twist& bounds=KDL::Twist::Zero()) const;
+
+    /*
+     * Solve the position IK for a batch of goal frames, spreading the solves over several threads.
+     * Each thread uses its own copy of the solver, so the result of each solve is the same as the
+     * result of CartToJnt() with the same inputs. Threads take the next unsolved goal as soon as
+     * they finish one, which balances the load when the number of iterations varies between goals.
+     * @param q_init: joint seeds: either one seed for each goal, or a single seed for all goals
+     * @param p_in: goal frames
+     * @param q_bias: nullspace bias: either empty (no bias), one bias for each goal, or a single
+     *                bias for all goals
+     * @param biasNames: names of the joints in the nullspace bias
+     * @param[out] q_out: joint solutions, one for each goal
+     * @param[out] results: return code of CartToJnt() for each goal
+     * @param bounds: tolerance on the goal frames
+     * @return: number of goals that were solved, or -1 if the input is invalid
+     */
+    int CartToJntBatch(const std::vector<KDL::JntArray>& q_init,
+                       const std::vector<KDL::Frame>& p_in,
+                       std::vector<KDL::JntArray>* q_out,
+                       std::vector<int>* results,
+                       const KDL::Twist& bounds=KDL::Twist::Zero())
+    { return CartToJntBatch(q_init, p_in, std::vector<KDL::JntArray>(), std::vector<std::string>(),
+                            q_out, results, bounds);
+    }
+
+    int CartToJntBatch(const std::vector<KDL::JntArray>& q_init,
+                       const std::vector<KDL::Frame>& p_in,
+                       const std::vector<KDL::JntArray>& q_bias,
+                       const std::vector<std::string>& biasNames,
+                       std::vector<KDL::JntArray>* q_out,
+                       std::vector<int>* results,
+                       const KDL::Twist& bounds=KDL::Twist::Zero());
+
+    // Number of threads used by CartToJntBatch() and CartToJntMultiSeed().
+    // Zero selects the number of hardware threads.
+    void setBatchThreadCount(int nThread) { m_batchThreadCount = std::max(nThread, 0); }
+    int getBatchThreadCount() { return m_batchThreadCount; }
+
+    /*
+     * Solve the position IK from several seeds in parallel. The first seed is q_init; the others
+     * are quasi-random (Halton) samples within the joint limits. This raises the success rate
+     * when q_init is in the basin of a poor local solution, and cuts the worst-case solve time.
+     * The number of seeds and the choice of solution are set by setMultiSeedCount() and
+     * setMultiSeedMode(). The inputs and the return value are the same as for CartToJnt().
+     */
+    int CartToJntMultiSeed(const KDL::JntArray &q_init, const KDL::Frame &p_in,
+                           KDL::JntArray &q_out,
+                           const KDL::Twist& bounds=KDL::Twist::Zero())
+    { return CartToJntMultiSeed(q_init, p_in, KDL::JntArray(0), std::vector<std::string>(),
+                                q_out, bounds);
+    }
+
+    int CartToJntMultiSeed(const KDL::JntArray &q_init, const KDL::Frame &p_in,
+                           const KDL::JntArray& q_bias,
+                           const std::vector<std::string>& biasNames,
+                           KDL::JntArray &q_out,
+                           const KDL::Twist& bounds=KDL::Twist::Zero());
+
+    // Number of seeds used by CartToJntMultiSeed(), including the user's seed
+    void setMultiSeedCount(int nSeed) { m_multiSeedCount = std::max(nSeed, 1); }
+    int getMultiSeedCount() { return m_multiSeedCount; }
+
+    void setMultiSeedMode(MultiSeedMode mode) { m_multiSeedMode = mode; }
+    MultiSeedMode getMultiSeedMode() { return m_multiSeedMode; }
+
+    /*
+     * Find several distinct solutions for one goal frame, for example to choose the one with the
+     * most clearance. The first solution is the solution of CartToJnt() from q_init. The others
+     * are found by sweeping the null space from the first solution: the solves start from a step
+     * along the null space toward a bias target, and are repeated with a nullspace bias toward
+     * that target if they return to a known solution. This is cheaper than solving from random
+     * seeds, since the solves start close to the goal.
+     * @param q_init: joint seed of the first solution
+     * @param p_in: goal frame
+     * @param maxSolutions: maximum number of solutions
+     * @param[out] q_out: solutions, the first solution first
+     * @param minDistance: minimum distance between the solutions (norm of the joint difference)
+     * @param bounds: tolerance on the goal frame
+     * @return: number of solutions, or the return code of CartToJnt() if the first solve failed
+     */
+    int CartToJntMultiSolution(const KDL::JntArray &q_init, const KDL::Frame &p_in,
+                               size_t maxSolutions, std::vector<KDL::JntArray>* q_out,
+                               double minDistance = 0.5,
+                               const KDL::Twist& bounds=KDL::Twist::Zero());
+
+    /*
+     * Solve the position IK along a dense Cartesian path, such as the waypoints of a trajectory.
+     * Each waypoint is seeded from the solution of the previous one, and the first one from
+     * q_init. The solves reuse the solver state and buffers, and ignore the solution cache, whose
+     * solutions may be on another branch. A waypoint is a continuity break if its solve failed, or
+     * if a joint moved by more than maxJointStep from the previous solution (or from q_init). The
+     * caller can then re-solve the segments around the breaks, for example with
+     * CartToJntMultiSeed(). The waypoint after a failed one is seeded from the last solution.
+     * @param q_init: seed of the first waypoint
+     * @param first, last: iterators over the goal frames (KDL::Frame)
+     * @param[out] q_out: buffer of nJoints values per waypoint, one waypoint after the other.
+     *                    A failed waypoint gets the last solution (or q_init).
+     * @param[out] results: buffer of one return code of CartToJnt() per waypoint, or nullptr
+     * @param[out] breaks: indices of the waypoints that are continuity breaks, or nullptr
+     * @param maxJointStep: largest joint change between waypoints that is not a break
+     * @param bounds: tolerance on the goal frames
+     * @return: number of waypoints that were solved, or -1 if the input is invalid
+     */
+    template <typename FrameIterator>
+    int CartToJntTrajectory(const KDL::JntArray& q_init, FrameIterator first, FrameIterator last,
+                            double* q_out, int* results, std::vector<size_t>* breaks,
+                            double maxJointStep, const KDL::Twist& bounds=KDL::Twist::Zero())
+    {
+      if (!beginTrajectory(q_init, q_out, breaks)) {
+        return -1;
+      }
+      int nSolved = 0;
+      for (size_t i = 0; first != last; ++first, ++i) {
+        int result;
+        if (solveTrajectoryWaypoint(*first, maxJointStep, bounds, q_out + i * q_init.rows(), &result) &&
+            breaks) {
+          breaks->push_back(i);
+        }
+        if (results) {
+          results[i] = result;
+        }
+        nSolved += result >= 0;
+      }
+      endTrajectory();
+      return nSolved;
+    }
 
     int CartToJntVel(const KDL::JntArray& q_in,
                      const KDL::Twist& v_in,
@@ -144,7 +406,46 @@ namespace sns_ik {
                      const KDL::JntArray& q_bias,
                      const std::vector<std::string>& biasNames,
                      const KDL::JntArray& q_vel_bias,
-                     KDL::JntArray& qdot_out);
+                     KDL::JntArray& qdot_out)
+    { return CartToJntVel(m_context.get(), q_in, v_in, q_bias, biasNames, q_vel_bias, qdot_out); }
+
+    // Thread-safe version: all mutable state is stored in the solve context
+    int CartToJntVel(SolveContext* context,
+                     const KDL::JntArray& q_in,
+                     const KDL::Twist& v_in,
+                     const KDL::JntArray& q_bias,
+                     const std::vector<std::string>& biasNames,
+                     const KDL::JntArray& q_vel_bias,
+                     KDL::JntArray& qdot_out) const
+    { if (qdot_out.rows() != q_in.rows()) { qdot_out.resize(q_in.rows()); }
+      return CartToJntVel(context, q_in.data, v_in, q_bias.data, biasNames, q_vel_bias.data,
+                          qdot_out.data); }
+
+    /*
+     * Same as the CartToJntVel() above, with the joint vectors in the memory of the caller: a
+     * vector, a block of a matrix or a Map. qdot_out must have one element per joint.
+     */
+    int CartToJntVel(const Eigen::Ref<const Eigen::VectorXd>& q_in,
+                     const KDL::Twist& v_in,
+                     Eigen::Ref<Eigen::VectorXd> qdot_out)
+    { return CartToJntVel(m_context.get(), q_in, v_in, Eigen::VectorXd(), std::vector<std::string>(),
+                          Eigen::VectorXd(), qdot_out); }
+
+    int CartToJntVel(const Eigen::Ref<const Eigen::VectorXd>& q_in,
+                     const KDL::Twist& v_in,
+                     const Eigen::Ref<const Eigen::VectorXd>& q_bias,
+                     const std::vector<std::string>& biasNames,
+                     const Eigen::Ref<const Eigen::VectorXd>& q_vel_bias,
+                     Eigen::Ref<Eigen::VectorXd> qdot_out)
+    { return CartToJntVel(m_context.get(), q_in, v_in, q_bias, biasNames, q_vel_bias, qdot_out); }
+
+    int CartToJntVel(SolveContext* context,
+                     const Eigen::Ref<const Eigen::VectorXd>& q_in,
+                     const KDL::Twist& v_in,
+                     const Eigen::Ref<const Eigen::VectorXd>& q_bias,
+                     const std::vector<std::string>& biasNames,
+                     const Eigen::Ref<const Eigen::VectorXd>& q_vel_bias,
+                     Eigen::Ref<Eigen::VectorXd> qdot_out) const;
 
     // Nullspace gain should be specified between 0 and 1.0
     double getNullspaceGain() { return m_nullspaceGain; }
@@ -155,9 +456,32 @@ namespace sns_ik {
     void setLoopPeriod(double loopPeriod);
     double getLoopPeriod() { return m_loopPeriod; }
 
-    bool getTaskScaleFactors(std::vector<double>& scaleFactors);
+    // Time limit for the position solver in seconds; zero or negative for no limit.
+    // When the time limit is reached, CartToJnt() returns SNSPositionIK::TIMED_OUT and the
+    // joint angles that were closest to the goal.
+    // Without a position solver (the URDF could not be loaded), there is no limit.
+    void setTimeout(double timeout)
+    { if (hasPositionSolver()) m_context->m_ik_pos_solver->setTimeout(timeout); }
+    double getTimeout()
+    { return hasPositionSolver() ? m_context->m_ik_pos_solver->getTimeout() : 0.0; }
+
+    // Cache of recent solutions, used to seed the position solver (see SolutionCache).
+    // The cache is shared by all solve contexts; nullptr disables it (default).
+    void setSolutionCache(const std::shared_ptr<SolutionCache>& cache)
+    { if (hasPositionSolver()) m_context->m_ik_pos_solver->setSolutionCache(cache); }
+    std::shared_ptr<SolutionCache> getSolutionCache()
+    { return hasPositionSolver() ? m_context->m_ik_pos_solver->getSolutionCache() : nullptr; }
+
+    bool getTaskScaleFactors(std::vector<double>& scaleFactors)
+    { return m_context ? getTaskScaleFactors(*m_context, scaleFactors) : false; }
+
+    // Task scale factors of the last velocity solve that used the context
+    bool getTaskScaleFactors(const SolveContext& context, std::vector<double>& scaleFactors) const;
 
   private:
+    // The solve context and its solvers are only created if the robot model could be loaded
+    bool hasPositionSolver() const { return m_context && m_context->m_ik_pos_solver; }
+
     bool m_initialized;
     double m_eps;
     double m_loopPeriod;
@@ -170,15 +494,50 @@ namespace sns_ik {
     std::vector<std::string> m_jointNames;
 
     std::vector<KDL::JntArray> m_solutions;
-    std::shared_ptr<SNSVelocityIK> m_ik_vel_solver;
-    std::shared_ptr<SNSPositionIK> m_ik_pos_solver;
-    std::shared_ptr<KDL::ChainJntToJacSolver> m_jacobianSolver;
+
+    // Forward kinematics and Jacobian, shared by all solve contexts. This is the backend that was
+    // registered for the chain, if any (see generateKinematicsCode()).
+    std::shared_ptr<const KinematicsBackend> m_kinematics;
+
+    // Incremented whenever a setting that is used by the velocity solver changes
+    int m_settingsVersion;
+
+    // Context used by the non-const solve functions
+    std::shared_ptr<SolveContext> m_context;
+
+    // Contexts for the worker threads of CartToJntBatch(). The calling thread uses m_context.
+    int m_batchThreadCount;
+    std::vector<std::shared_ptr<SolveContext>> m_batchContexts;
+
+    // Settings for CartToJntMultiSeed()
+    int m_multiSeedCount;
+    MultiSeedMode m_multiSeedMode;
+
+    // State of CartToJntTrajectory(): the seed of the next waypoint, which is the last solution
+    KDL::JntArray m_trajectorySeed, m_trajectorySolution;
+    bool m_trajectoryUseCachedSeed;
 
     void initialize();
 
-    bool nullspaceBiasTask(const KDL::JntArray& q_bias,
+    std::shared_ptr<SNSVelocityIK> createVelocitySolver(VelocitySolveType type) const;
+
+    void reserveBatchContexts(size_t nContext);
+
+    // Distance between joint angles, along the shortest angle for the continuous joints
+    double jointDistance(const KDL::JntArray& qA, const KDL::JntArray& qB) const;
+
+    // Steps of CartToJntTrajectory(). solveTrajectoryWaypoint() writes the joint angles of the
+    // waypoint to q_out and returns true if the waypoint is a continuity break.
+    bool beginTrajectory(const KDL::JntArray& q_init, const double* q_out, std::vector<size_t>* breaks);
+    bool solveTrajectoryWaypoint(const KDL::Frame& p_in, double maxJointStep, const KDL::Twist& bounds,
+                                 double* q_out, int* result);
+    void endTrajectory();
+
+    bool updateContext(SolveContext* context) const;
+
+    bool nullspaceBiasTask(const Eigen::Ref<const Eigen::VectorXd>& q_bias,
                            const std::vector<std::string>& biasNames,
-                           Eigen::MatrixXd* jacobian, std::vector<int>* indicies);
+                           Eigen::MatrixXd* jacobian, std::vector<int>* indicies) const;
 
   };
 }  //namespace
@@ -23,9 +23,11 @@
 #define SNS_IK_LIB__SNS_IK_BASE_H_
 
 #include <Eigen/Dense>
+#include <cstdint>
 #include <memory>
 #include <vector>
 
+#include "sns_joint_mask.hpp"
 #include "sns_linear_solver.hpp"
 #include "sns_ik_math_utils.hpp"
 
@@ -53,6 +55,21 @@ public:
     InternalError  // there was an internal error in the solver (should never happen...)
   };
 
+  /*
+   * Counters of the iterations of the main SNS loop, accumulated over calls to solve().
+   * Each iteration solves the projection equation once for the current set of saturated joints.
+   */
+  struct IterationStatistics {
+    uint64_t solves = 0;  // number of calls to the main loop
+    uint64_t iterations = 0;  // number of iterations of the main loop, over all solves
+    uint64_t warmStarts = 0;  // number of solves that started from the previous active set
+
+    /*
+     * @return: mean number of iterations per solve
+     */
+    double averageIterations() const { return solves > 0 ? double(iterations) / solves : 0.0; }
+  };
+
   // Make sure that class is cleaned-up correctly
   virtual ~SnsIkBase() {};
 
@@ -83,8 +100,37 @@ public:
    */
   size_t getNrOfJoints() const { return nJnt_; }
 
+  /**
+   * Warm start each solve from the active set of the previous solve. The joints that were saturated
+   * at the end of the previous solve start saturated at their current bounds, and the joints that
+   * the task would move back inside their bounds are released, using the sign of their Lagrange
+   * multiplier. The main loop then saturates more joints if needed. This saves most of the
+   * iterations in a control loop, where the set of saturated joints rarely changes between cycles.
+   * Only the active set of a solve that achieved the full task is kept. If a warm-started solve
+   * fails or has to scale the task, it is repeated with all joints free and the solution with the
+   * larger task scale is returned, so the task scale is never lower than without the warm start.
+   * The default is false.
+   * @param use: true to enable the warm start
+   */
+  void setUseWarmStart(bool use) { kernelState_.useWarmStart = use; }
+  bool getUseWarmStart() const { return kernelState_.useWarmStart; }
+
+  /*
+   * Forget the active set, so that the next solve starts with all joints free
+   */
+  void resetWarmStart() { kernelState_.activeSet.reset(nJnt_); }
+
+  /*
+   * @return: iteration counters of the main loop, since construction or the last reset
+   */
+  const IterationStatistics& getIterationStatistics() const { return kernelState_.stats; }
+  void resetIterationStatistics() { kernelState_.stats = IterationStatistics(); }
+
 protected:
 
+  // The main loop of the solver is implemented by SnsIkKernel, which shares the constants below
+  template <int NTask, int NJnt> friend class SnsIkKernel;
+
   /*
    * The code of the SNS-IK solver relies on a linear solver. If the linear system is infeasible,
    * then the solver will return the minimum-norm solution with a non-zero (positive) residual.
@@ -121,108 +167,25 @@ protected:
   static const Eigen::IOFormat EigArrFmt;
 
   /*
-   * protected constructor: require factory method to create an object.
+   * State that the kernels keep between calls to solve(): the active set of the last solve, for
+   * the warm start, and the iteration counters.
    */
-  SnsIkBase(int nJnt) : nJnt_(nJnt), qLow_(nJnt), qUpp_(nJnt) {};
-
-  /*
-   * Check that qLow_ <= q <= qUpp_
-   * @param qUpp: joint acceleration to test
-   * @return: true iff qLow <= q <= qUpp
-   *          if q.empty() return false
-   */
-  bool checkBounds(const Eigen::VectorXd& q);
-
-  /*
-   * This method sets and solves the decomposition of the matrix that is used by the linear solver.
-   * In general, this will be the J*W matrix, which describes the jacobian of the active joints.
-   * @param JW: matrix to set in the linear solver.
-   * @return: Success if the decomposition was successful
-   */
-  SnsIkBase::ExitCode setLinearSolver(const Eigen::MatrixXd& JW);
-
-  /*
-   * Solve a specific linear system and compute the residual error. Linear system:
-   * JW * q = rhs
-   * @param rhs: "right hand side" of the linear system.
-   * @param[out] q: solution to the linear system
-   * @param[out] resErr: residual error in the linear system
-   * @return: Success if the solve was successful
-   */
-  SnsIkBase::ExitCode solveLinearSystem(const Eigen::MatrixXd& rhs, Eigen::VectorXd* q, double* resErr);
-
-  /*
-   * @return: rank of the matrix that is currently set in the linear solver
-   */
-  unsigned int getLinSolverRank() const { return linSolver_.rank(); }
-
-  /*
-   * Solve the following equation for the variable qUpp:
-   *    J * W * (qUpp - dqNull) = dx - J*dqNull
-   * This equation appears throughout the SNS-IK papers. One example is in block "D" of Algorithm 1:
-   *  "Control of Redundant Robots Under Hard Joint Constraint: Saturation in the Null Space"
-   *   by: Fabrizio Flacco, Alessandro De Luca, Oussama Khatib
-   *
-   * PRECONDITION:
-   * --> Assumes that setLinearSolver(J*W) has been successfully called
-   * --> This allows multiple projections to be solved for a single matrix decomposition
-   *
-   * @param J: Jacobian matrix, mapping from joint to task space. Size = [nTask, nJoint]
-   * @param dqNull: null-space joint acceleration. Size = nJoint
-   * @param dx: task acceleration vector. Length = nTask
-   * @param[out] q: joint velocity/acceleration solution. Length = nJoint
-   * @param[out, opt] resErr: residual error (norm-squared)
-   * @return: ExitCode::Success: the algorithm worked correctly and satisfied the problem statement
-   *          otherwise: something went wrong, exit code specifics the type of problem
-   */
-  SnsIkBase::ExitCode solveProjectionEquation(const Eigen::MatrixXd& J,
-                               const Eigen::VectorXd& dqNull, const Eigen::VectorXd& dx,
-                               Eigen::VectorXd* q, double* resErr);
+  struct KernelState {
+    bool useWarmStart = false;
+    JointMask activeSet;  // joints that were saturated at the end of the last solve
+    Eigen::VectorXi activeSide;  // +1 for a joint saturated at its upper bound, -1 at its lower bound
+    IterationStatistics stats;
+  };
 
   /*
-   * Solve the following equation for the variable ddqUpp:
-   *    J * W * (ddq - dqNull) = ddx - dJdq - J*ddqNull
-   * This equation appears throughout the SNS-IK papers. One example is in block "D" of Algorithm 1:
-   *  "Control of Redundant Robots Under Hard Joint Constraint: Saturation in the Null Space"
-   *   by: Fabrizio Flacco, Alessandro De Luca, Oussama Khatib
-   *
-   * PRECONDITION:
-   * --> Assumes that linSolver_ has been initialized with J*W
-   *
-   * @param J: Jacobian matrix, mapping from joint to task space. Size = [nTask, nJoint]
-   * @param dJdq: the product of Jacobian derivative and joint velocity. Length = nTask
-   * @param ddqNull: null-space joint acceleration. Size = nJoint
-   * @param ddx: task acceleration vector. Length = nTask
-   * @param[out] ddq: joint acceleration solution. Length = nJoint
-   * @param[out, opt] resErr: residual error (norm-squared)
-   * @return: ExitCode::Success: the algorithm worked correctly and satisfied the problem statement
-   *          otherwise: something went wrong, exit code specifics the type of problem
+   * protected constructor: require factory method to create an object.
    */
-  SnsIkBase::ExitCode solveProjectionEquation(const Eigen::MatrixXd& J, const Eigen::VectorXd& dJdq,
-                               const Eigen::VectorXd& ddqNull, const Eigen::VectorXd& ddx,
-                               Eigen::VectorXd* ddq, double* resErr);
+  SnsIkBase(int nJnt) : nJnt_(nJnt), qLow_(nJnt), qUpp_(nJnt) {};
 
   /*
-   * This method implements Algorithm 2 (and a bit of Algorithm 1) from the paper:
-   *  "Control of Redundant Robots Under Hard Joint Constraint: Saturation in the Null Space"
-   *   by: Fabrizio Flacco, Alessandro De Luca, Oussama Khatib
-   *
-   * PRECONDITION:
-   * --> Assumes that linSolver_ has been initialized with J*W
-   *
-   * @param J: Jacobian matrix, mapping from joint to task space. Size = [nTask, nJoint]
-   * @param desiredTask: task velocity/acceleration vector. Length = nTask
-   * @param jointOut: joint velocity/acceleration. Length = nJoint
-   * @param jntIsFree: which joints are free to saturate? Length = nJoint
-   * @param[out] taskScale: task scale factor
-   * @param[out] jntIdx: index corresponding to the most critical joint that is free
-   * @param[out] resErr: residual error (norm-squared) in the linear solve
-   * @return: ExitCode::Success: the algorithm worked correctly and satisfied the problem statement
-   *          otherwise: something went wrong, exit code specifics the type of problem
+   * @return: the state that is passed to the kernels
    */
-  ExitCode computeTaskScalingFactor(const Eigen::MatrixXd& J, const Eigen::VectorXd& desiredTask, 
-                                const Eigen::VectorXd& jointOut, const std::vector<bool>& jntIsFree,
-                                 double* taskScale, int* jntIdx, double* resErr);
+  KernelState* getKernelState() { return &kernelState_; }
 
   /*
    * This algorithm computes the scale factor that is associated with a given joint, but considering
@@ -242,9 +205,7 @@ private:
   Eigen::ArrayXd qLow_;  //!< lower bound on joint velocity/acceleration
   Eigen::ArrayXd qUpp_;  //!< upper bound on joint velocity/acceleration
 
-  SnsLinearSolver linSolver_;  //!< linear solver for the core SNS-IK algorithm
-
-  Eigen::MatrixXd JW_;  //!< the matrix that is currently set in the linear solver
+  KernelState kernelState_;  //!< active set and iteration counters of the kernels
 
 };  // class SnsIkBase
 
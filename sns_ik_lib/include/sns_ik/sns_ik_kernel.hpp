@@ -0,0 +1,248 @@
+/** @file sns_ik_kernel.hpp
+ *
+ * @brief The core SNS-IK loop, shared by the velocity and acceleration base solvers
+ *
+ *    Copyright 2018 Rethink Robotics
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef SNS_IK_LIB__SNS_IK_KERNEL_H_
+#define SNS_IK_LIB__SNS_IK_KERNEL_H_
+
+#include <Eigen/Dense>
+
+#include "sns_joint_mask.hpp"
+#include "sns_linear_solver.hpp"
+#include "sns_ik_base.hpp"
+
+namespace sns_ik {
+
+/*
+ * This class implements the main loop of "Algorithm 1: SNS algorithm" for both the velocity and
+ * the acceleration solvers. It is templated on the number of rows in the task jacobian (NTask)
+ * and on the number of joints (NJnt). Use Eigen::Dynamic for the general solver. Fixed sizes keep
+ * all of the solver state in fixed-size Eigen objects, which removes the heap allocations and
+ * lets Eigen unroll the small matrix products. Explicit instantiations are provided for the
+ * dynamic kernel and for a six-dimensional task on six, seven, and eight joints.
+ *
+ * The kernel does not validate the user input: that is done by SnsVelIkBase and SnsAccIkBase.
+ *
+ * Each iteration of the main loop saturates one joint, which removes one column from the matrix in
+ * the linear solver. The decomposition is updated for that change rather than computed again.
+ *
+ * The main loop starts with all joints free, or, with the warm start, from the joints that were
+ * saturated at the end of the previous solve (see SnsIkBase::setUseWarmStart()). That active set
+ * is kept by the solver that owns the kernel and is passed to each solve.
+ *
+ * All intermediate results are stored in member variables. Once a dynamic kernel has been used
+ * with a given problem size, later calls with the same size do not allocate memory.
+ */
+template <int NTask, int NJnt>
+class SnsIkKernel {
+
+public:
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  typedef SnsIkBase::ExitCode ExitCode;
+
+  typedef Eigen::Matrix<double, NTask, NJnt> TaskMatrix;  //!< task jacobian, size = [nTask, nJnt]
+  typedef Eigen::Matrix<double, NTask, 1> TaskVector;  //!< task velocity or acceleration
+  typedef Eigen::Matrix<double, NJnt, 1> JointVector;  //!< joint velocity or acceleration
+  typedef Eigen::Array<double, NJnt, 1> JointArray;
+
+  /*
+   * Solve the velocity IK problem. See SnsVelIkBase::solve() for details.
+   * @param qLow: lower bound on the joint velocity
+   * @param qUpp: upper bound on the joint velocity
+   * @param J: Jacobian matrix, mapping from joint to task space. Size = [nTask, nJoint]
+   * @param dx: task velocity vector. Length = nTask
+   * @param[out] dq: joint velocity solution. Length = nJoint
+   * @param[out] taskScale: task scale.  fwdKin(dq) = taskScale*dx
+   * @param state: warm start setting and active set of the solver, updated with the active set
+   *               and the iteration counters of this solve
+   * @return: ExitCode::Success: the algorithm worked correctly and satisfied the problem statement
+   */
+  ExitCode solveVel(const Eigen::ArrayXd& qLow, const Eigen::ArrayXd& qUpp,
+                    const TaskMatrix& J, const TaskVector& dx, JointVector* dq, double* taskScale,
+                    SnsIkBase::KernelState* state);
+
+  /*
+   * Solve the acceleration IK problem. See SnsAccIkBase::solve() for details.
+   * @param qLow: lower bound on the joint acceleration
+   * @param qUpp: upper bound on the joint acceleration
+   * @param J: Jacobian matrix, mapping from joint to task space. Size = [nTask, nJoint]
+   * @param dJdq: the product of Jacobian derivative and joint velocity. Length = nTask
+   * @param ddx: task acceleration vector. Length = nTask
+   * @param[out] ddq: joint acceleration solution. Length = nJoint
+   * @param[out] taskScale: task scale.  fwdKin(q, dq, ddq) = taskScale*ddx
+   * @param state: warm start setting and active set of the solver, updated with the active set
+   *               and the iteration counters of this solve
+   * @return: ExitCode::Success: the algorithm worked correctly and satisfied the problem statement
+   */
+  ExitCode solveAcc(const Eigen::ArrayXd& qLow, const Eigen::ArrayXd& qUpp,
+                    const TaskMatrix& J, const TaskVector& dJdq, const TaskVector& ddx,
+                    JointVector* ddq, double* taskScale, SnsIkBase::KernelState* state);
+
+private:
+
+  /*
+   * Main loop of solveVel().
+   * PRECONDITION: startSolve() has been successfully called
+   */
+  ExitCode solveVelLoop(const Eigen::ArrayXd& qLow, const Eigen::ArrayXd& qUpp,
+                        const TaskMatrix& J, const TaskVector& dx, JointVector* dq, double* taskScale);
+
+  /*
+   * Main loop of solveAcc().
+   * PRECONDITION: startSolve() has been successfully called
+   */
+  ExitCode solveAccLoop(const Eigen::ArrayXd& qLow, const Eigen::ArrayXd& qUpp,
+                        const TaskMatrix& J, const TaskVector& dJdq, const TaskVector& ddx,
+                        JointVector* ddq, double* taskScale);
+
+  /*
+   * Set the initial active set of the main loop and the matching linear solver. The active set is
+   * empty (W = I, qNull = 0), unless the warm start is enabled and succeeds.
+   * @param qLow: lower bound on the joint velocity/acceleration
+   * @param qUpp: upper bound on the joint velocity/acceleration
+   * @param J: Jacobian matrix, mapping from joint to task space. Size = [nTask, nJoint]
+   * @param task: right hand side of J * q = task: dx, or ddx - dJdq
+   * @param state: active set of the previous solve, or nullptr to start with all joints free
+   * @param[out] warmStarted: true iff the loop starts from the active set of the previous solve
+   * @return: Success if the linear solver was set
+   */
+  ExitCode startSolve(const Eigen::ArrayXd& qLow, const Eigen::ArrayXd& qUpp,
+                      const TaskMatrix& J, const TaskVector& task,
+                      const SnsIkBase::KernelState* state, bool* warmStarted);
+
+  /*
+   * Saturate the joints of the previous active set at their current bounds, then release the
+   * joints whose Lagrange multiplier shows that the task would move them back inside their bounds.
+   * PRECONDITION: all joints are free in mask_ and qNull_ is zero
+   * @return: true iff at least one joint is saturated and the linear solver is set for mask_
+   */
+  bool warmStart(const Eigen::ArrayXd& qLow, const Eigen::ArrayXd& qUpp,
+                 const TaskMatrix& J, const TaskVector& task, const SnsIkBase::KernelState& state);
+
+  /*
+   * Store the final active set of a solve that achieved the full task in the state, otherwise
+   * clear it, and update the iteration counters.
+   */
+  void finishSolve(ExitCode exitCode, double taskScale, const Eigen::ArrayXd& qUpp,
+                   bool warmStarted, SnsIkBase::KernelState* state) const;
+
+  /*
+   * Check that qLow <= q <= qUpp
+   * @return: true iff qLow <= q <= qUpp
+   */
+  static bool checkBounds(const Eigen::ArrayXd& qLow, const Eigen::ArrayXd& qUpp,
+                          const JointVector& q);
+
+  /*
+   * This method sets and solves the decomposition of the matrix that is used by the linear solver:
+   * J*W, where W is the current selection matrix. J*W describes the jacobian of the active joints.
+   * @param J: Jacobian matrix, mapping from joint to task space. Size = [nTask, nJoint]
+   * @return: Success if the decomposition was successful
+   */
+  ExitCode setLinearSolver(const TaskMatrix& J);
+
+  /*
+   * Remove a joint from the matrix in the linear solver, after the joint was saturated. This sets
+   * column jntIdx of J*W to zero and updates the decomposition, rather than computing it again.
+   * The caller is responsible for the matching update of W.
+   * PRECONDITION: setLinearSolver(J) has been successfully called
+   * @param jntIdx: index of the joint to remove
+   * @return: Success if the update was successful
+   */
+  ExitCode removeJointFromLinearSolver(int jntIdx);
+
+  /*
+   * Solve a specific linear system and compute the residual error. Linear system:
+   * JW * q = rhs
+   * @param rhs: "right hand side" of the linear system.
+   * @param[out] q: solution to the linear system
+   * @param[out] resErr: residual error in the linear system
+   * @return: Success if the solve was successful
+   */
+  ExitCode solveLinearSystem(const TaskVector& rhs, JointVector* q, double* resErr);
+
+  /*
+   * @return: rank of the matrix that is currently set in the linear solver
+   */
+  unsigned int getLinSolverRank() const { return linSolver_.rank(); }
+
+  /*
+   * Solve the following equation for the variable dq:
+   *    J * W * (dq - dqNull) = dx - J*dqNull
+   * PRECONDITION: setLinearSolver(J) has been successfully called
+   */
+  ExitCode solveProjectionEquation(const TaskMatrix& J, const JointVector& dqNull,
+                                   const TaskVector& dx, JointVector* dq, double* resErr);
+
+  /*
+   * Solve the following equation for the variable ddq:
+   *    J * W * (ddq - ddqNull) = ddx - dJdq - J*ddqNull
+   * PRECONDITION: setLinearSolver(J) has been successfully called
+   */
+  ExitCode solveProjectionEquation(const TaskMatrix& J, const TaskVector& dJdq,
+                                   const JointVector& ddqNull, const TaskVector& ddx,
+                                   JointVector* ddq, double* resErr);
+
+  /*
+   * This method implements Algorithm 2 (and a bit of Algorithm 1) from the paper:
+   *  "Control of Redundant Robots Under Hard Joint Constraint: Saturation in the Null Space"
+   *   by: Fabrizio Flacco, Alessandro De Luca, Oussama Khatib
+   *
+   * PRECONDITION: setLinearSolver(J) has been successfully called
+   *
+   * @param qLow: lower bound on the joint velocity/acceleration
+   * @param qUpp: upper bound on the joint velocity/acceleration
+   * @param J: Jacobian matrix, mapping from joint to task space. Size = [nTask, nJoint]
+   * @param desiredTask: task velocity/acceleration vector. Length = nTask
+   * @param jointOut: joint velocity/acceleration. Length = nJoint
+   * @param mask: which joints are free to saturate? Length = nJoint
+   * @param[out] taskScale: task scale factor
+   * @param[out] jntIdx: index corresponding to the most critical joint that is free
+   * @param[out] resErr: residual error (norm-squared) in the linear solve
+   * @return: ExitCode::Success: the algorithm worked correctly and satisfied the problem statement
+   */
+  ExitCode computeTaskScalingFactor(const Eigen::ArrayXd& qLow, const Eigen::ArrayXd& qUpp,
+                                    const TaskMatrix& J, const TaskVector& desiredTask,
+                                    const JointVector& jointOut, const JointMask& mask,
+                                    double* taskScale, int* jntIdx, double* resErr);
+
+  SnsLinearSolverT<TaskMatrix> linSolver_;  //!< linear solver for the core SNS-IK algorithm
+
+  TaskMatrix JW_;  //!< workspace for J*W, used to set the linear solver
+
+  // Workspace for the main solver loop:
+  JointMask mask_;  //!< null-space selection matrix W, stored as the set of saturated joints
+  JointMask bestMask_;  //!< mask_ for the best solution so far
+  JointVector qNull_;  //!< velocity or acceleration in the null-space
+  JointVector bestQNull_;  //!< qNull_ for the best solution so far
+  JointVector qTmp_;  //!< candidate solution, used to check the best solution so far
+  JointVector a_;  //!< solution of J*W*a = dx, used to compute the task scale
+  TaskVector B_;  //!< right hand side of the projection equation
+  TaskVector scaledTask_;  //!< the desired task, multiplied by a task scale
+  TaskVector resVec_;  //!< residual of the linear solve
+  TaskVector task_;  //!< ddx - dJdq, the task of the acceleration solver for the warm start
+  JointVector warmQ_;  //!< solution of a warm-started solve that had to scale the task
+  TaskVector lambda_;  //!< Lagrange multipliers of the task, for the warm start
+  int iterations_ = 0;  //!< iterations of the main loop in the current solve
+
+};  // class SnsIkKernel
+
+}  // namespace sns_ik
+
+#endif  // SNS_IK_LIB__SNS_IK_KERNEL_H_
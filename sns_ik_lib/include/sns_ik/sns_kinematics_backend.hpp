@@ -0,0 +1,112 @@
+/** @file sns_kinematics_backend.hpp
+ *
+ * @brief Interface for the kinematics used by the SNS-IK solvers, and a registry of backends
+ *
+ *    Copyright 2018 Rethink Robotics
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef SNS_IK_LIB__SNS_KINEMATICS_BACKEND_H_
+#define SNS_IK_LIB__SNS_KINEMATICS_BACKEND_H_
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <functional>
+#include <kdl/chain.hpp>
+#include <kdl/frames.hpp>
+#include <memory>
+
+namespace sns_ik {
+
+/*
+ * Forward kinematics of a serial chain. ChainKinematics implements it for any KDL chain;
+ * generateKinematicsCode() writes an implementation that is specific to one chain.
+ *
+ * All functions are const and must be safe to call from several threads.
+ */
+class KinematicsBackend {
+
+public:
+
+  virtual ~KinematicsBackend() {}
+
+  /*
+   * @return: number of (non-fixed) joints in the chain
+   */
+  virtual int getNrOfJoints() const = 0;
+
+  /*
+   * Compute the pose of the tip of the chain
+   * @param q: joint angles, q.size() == getNrOfJoints()
+   * @param[out] pose: pose of the tip in the base frame
+   */
+  virtual void computePose(const Eigen::Ref<const Eigen::VectorXd>& q, KDL::Frame* pose) const = 0;
+
+  /*
+   * Compute the pose of the tip of the chain and the Jacobian in one pass.
+   * Once jacobian has size [6, getNrOfJoints()], this function does not allocate memory.
+   * @param q: joint angles, q.size() == getNrOfJoints()
+   * @param[out] pose: pose of the tip in the base frame
+   * @param[out] jacobian: Jacobian of the tip: [linear velocity; angular velocity] in the base
+   *                       frame, with the reference point at the tip
+   */
+  virtual void computePoseAndJacobian(const Eigen::Ref<const Eigen::VectorXd>& q,
+                                      KDL::Frame* pose, Eigen::MatrixXd* jacobian) const = 0;
+
+  /*
+   * Compute the product of the time derivative of the Jacobian with the joint velocities. This is
+   * the acceleration of the tip when the joint accelerations are zero.
+   * Once jdotQdot has size 6, this function does not allocate memory.
+   * @param q: joint angles, q.size() == getNrOfJoints()
+   * @param qd: joint velocities, qd.size() == getNrOfJoints()
+   * @param[out] jdotQdot: dJ/dt * qd: [linear acceleration; angular acceleration] in the base frame
+   */
+  virtual void computeJacobianDotQdot(const Eigen::Ref<const Eigen::VectorXd>& q,
+                                      const Eigen::Ref<const Eigen::VectorXd>& qd,
+                                      Eigen::VectorXd* jdotQdot) const = 0;
+
+};  // class KinematicsBackend
+
+/*
+ * Function that creates a kinematics backend for one chain
+ */
+typedef std::function<std::shared_ptr<const KinematicsBackend>()> KinematicsBackendFactory;
+
+/*
+ * Compute a hash of the geometry of a chain: the joint types, axes, scales and offsets, and the
+ * fixed transforms. Two chains with the same hash have the same kinematics.
+ * @param chain: kinematic chain
+ * @return: 64-bit hash of the chain
+ */
+uint64_t computeChainHash(const KDL::Chain& chain);
+
+/*
+ * Register a kinematics backend for the chain with the given hash. The code written by
+ * generateKinematicsCode() calls this function during static initialization.
+ * @param chainHash: hash of the chain, from computeChainHash()
+ * @param factory: creates the backend
+ * @return: true if the backend was registered, false if there is already one for this hash
+ */
+bool registerKinematicsBackend(uint64_t chainHash, const KinematicsBackendFactory& factory);
+
+/*
+ * Create the kinematics for a chain: the backend that was registered for the hash of the chain if
+ * there is one, and ChainKinematics otherwise.
+ * @param chain: kinematic chain
+ * @return: kinematics of the chain
+ */
+std::shared_ptr<const KinematicsBackend> createKinematicsBackend(const KDL::Chain& chain);
+
+}  // namespace sns_ik
+
+#endif  // SNS_IK_LIB__SNS_KINEMATICS_BACKEND_H_
@@ -0,0 +1,50 @@
+/** @file sns_kinematics_codegen.hpp
+ *
+ * @brief Generate C++ code for the kinematics of one specific chain
+ *
+ *    Copyright 2018 Rethink Robotics
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef SNS_IK_LIB__SNS_KINEMATICS_CODEGEN_H_
+#define SNS_IK_LIB__SNS_KINEMATICS_CODEGEN_H_
+
+#include <kdl/chain.hpp>
+#include <ostream>
+#include <string>
+
+namespace sns_ik {
+
+/*
+ * Write a C++ source file that implements KinematicsBackend for one chain. The forward kinematics,
+ * the Jacobian, and dJ/dt * qd are written as straight-line code: the fixed transforms are folded
+ * into the expressions, and products with the zeros and ones of axis-aligned frames are removed.
+ *
+ * The generated file defines the function
+ *     std::shared_ptr<const sns_ik::KinematicsBackend> sns_ik::create<className>();
+ * and registers it with registerKinematicsBackend() during static initialization, so that
+ * createKinematicsBackend() (and so SNS_IK) uses it for any chain with the same hash. The file
+ * must be compiled into an executable or a shared library: the linker can drop it from a static
+ * library, since nothing refers to it.
+ *
+ * Entries of the fixed transforms within 1e-14 of -1, 0, or 1 are rounded to these values.
+ *
+ * @param chain: kinematic chain
+ * @param className: name of the generated class, a valid C++ identifier
+ * @param[out] out: stream that receives the source code
+ */
+void generateKinematicsCode(const KDL::Chain& chain, const std::string& className, std::ostream* out);
+
+}  // namespace sns_ik
+
+#endif  // SNS_IK_LIB__SNS_KINEMATICS_CODEGEN_H_
@@ -20,11 +20,14 @@
 #ifndef SNS_IK_POSITION_IK
 #define SNS_IK_POSITION_IK
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <Eigen/Dense>
 #include <kdl/chain.hpp>
-#include <kdl/chainjnttojacsolver.hpp>
-#include <kdl/chainfksolverpos_recursive.hpp>
+#include <kdl/jntarray.hpp>
+#include <sns_ik/sns_kinematics_backend.hpp>
+#include <sns_ik/sns_solution_cache.hpp>
 #include <sns_ik/sns_vel_ik_base.hpp>
 
 namespace sns_ik {
@@ -33,9 +36,24 @@ namespace sns_ik {
 class SNSVelocityIK;
 class SNSPositionIK {
   public:
+    // Return code of CartToJnt() when the solve was stopped by the cancellation flag
+    static const int CANCELLED = -3;
+    // Return code of CartToJnt() when the time limit was reached. The joint angles that were
+    // closest to the goal are returned.
+    static const int TIMED_OUT = -4;
+    // Return code of step() while the solve has not finished
+    static const int IN_PROGRESS = -5;
+
     SNSPositionIK(KDL::Chain chain, std::shared_ptr<SNSVelocityIK> velocity_ik, double eps=1e-5);
     ~SNSPositionIK();
 
+    /*
+     * The bounds are the tolerances on the axes of the goal frame: translations, then rotations.
+     * The axes with a tolerance are only part of the task while they are outside their tolerance,
+     * which leaves more freedom to the other axes and to the joint limits. A tolerance of pi on
+     * the three rotations gives a position-only goal, and an infinite tolerance on the three
+     * translations gives an orientation-only goal.
+     */
     int CartToJnt(const KDL::JntArray& joint_seed,
                   const KDL::Frame& goal_pose,
                   KDL::JntArray* return_joints,
@@ -52,6 +70,67 @@ class SNSPositionIK {
                   KDL::JntArray* return_joints,
                   const KDL::Twist& bounds=KDL::Twist::Zero());
 
+    /*
+     * Same as CartToJnt() above, with the joint angles in the memory of the caller
+     * @param[out] return_joints: the solution, of the size of joint_seed
+     */
+    int CartToJnt(const Eigen::Ref<const Eigen::VectorXd>& joint_seed,
+                  const KDL::Frame& goal_pose,
+                  const Eigen::Ref<const Eigen::VectorXd>& joint_ns_bias,
+                  const Eigen::MatrixXd& ns_jacobian,
+                  const std::vector<int>& ns_indicies,
+                  const double ns_gain,
+                  Eigen::Ref<Eigen::VectorXd> return_joints,
+                  const KDL::Twist& bounds=KDL::Twist::Zero());
+
+    /*
+     * Start a solve, which is then run by step(). This allows the solve to be split over several
+     * calls, for example to interleave the solves of several arms in one thread, and to stop it
+     * early with the best joint angles so far. CartToJnt() is begin() followed by step() for the
+     * iteration limit. The inputs are the same as for CartToJnt().
+     * @return: true if the solve was started; false if the seed does not match the chain
+     */
+    bool begin(const KDL::JntArray& joint_seed,
+               const KDL::Frame& goal_pose,
+               const KDL::Twist& bounds=KDL::Twist::Zero())
+    { return begin(joint_seed, goal_pose, KDL::JntArray(0), Eigen::MatrixXd(0,0),
+                   std::vector<int>(0), 0.0, bounds); }
+
+    bool begin(const KDL::JntArray& joint_seed,
+               const KDL::Frame& goal_pose,
+               const KDL::JntArray& joint_ns_bias,
+               const Eigen::MatrixXd& ns_jacobian,
+               const std::vector<int>& ns_indicies,
+               const double ns_gain,
+               const KDL::Twist& bounds=KDL::Twist::Zero())
+    { return begin(joint_seed.data, goal_pose, joint_ns_bias.data, ns_jacobian, ns_indicies, ns_gain,
+                   bounds); }
+
+    bool begin(const Eigen::Ref<const Eigen::VectorXd>& joint_seed,
+               const KDL::Frame& goal_pose,
+               const Eigen::Ref<const Eigen::VectorXd>& joint_ns_bias,
+               const Eigen::MatrixXd& ns_jacobian,
+               const std::vector<int>& ns_indicies,
+               const double ns_gain,
+               const KDL::Twist& bounds=KDL::Twist::Zero());
+
+    /*
+     * Run iterations of the solve that was started by begin(). The iteration limit, the time limit
+     * (measured from begin()) and the cancellation flag apply to the whole solve.
+     * @param nIterations: maximum number of iterations to run in this call
+     * @return: IN_PROGRESS if the solve has not finished, otherwise the return code of CartToJnt().
+     *          Once the solve has finished, step() returns the same code without iterating.
+     */
+    int step(int nIterations);
+
+    /*
+     * @param[out] q: the solution once the solve converged, otherwise the iterate of the solve
+     *                that was closest to the goal so far
+     * @return: position error plus rotation error of q, or infinity before the first iteration
+     */
+    double best(KDL::JntArray* q) const;
+    double best(Eigen::Ref<Eigen::VectorXd> q) const;
+
     // TODO: looks like this would require the KDL solvers to be wrapped in smart pointers
     //void setChain(const KDL::Chain chain);
     KDL::Chain getChain() { return m_chain; }
@@ -89,11 +168,133 @@ class SNSPositionIK {
       }
     }
 
+    /*
+     * Set the time limit for CartToJnt(), measured with a monotonic clock. The clock is read
+     * every few iterations, so the limit may be exceeded by the time of those iterations.
+     * @param timeout: time limit in seconds; zero or negative for no limit (default)
+     */
+    void setTimeout(double timeout) {
+      m_timeout = timeout;
+    }
+    double getTimeout() const { return m_timeout; }
+
+    /*
+     * Set a flag that cancels the solve: CartToJnt() checks the flag at each iteration and returns
+     * CANCELLED once it is set. The flag is typically set by another thread.
+     * @param cancel: cancellation flag, or nullptr to disable cancellation
+     */
+    void setCancelFlag(const std::atomic<bool>* cancel) {
+      m_cancel = cancel;
+    }
+
+    /*
+     * Set a cache of recent solutions. CartToJnt() starts from the cached solution of the nearest
+     * pose within the distances of the cache, instead of the seed, and adds its solutions to the
+     * cache. The cache can be shared by several solvers.
+     * @param cache: solution cache, or nullptr to disable the cache (default)
+     */
+    void setSolutionCache(const std::shared_ptr<SolutionCache>& cache) {
+      m_solutionCache = cache;
+    }
+    const std::shared_ptr<SolutionCache>& getSolutionCache() const { return m_solutionCache; }
+
+    /*
+     * When false, CartToJnt() starts from the seed even if the cache has a nearby solution; its
+     * solutions are still added to the cache. This is not copied by copySettings().
+     */
+    void setUseCachedSeed(bool use) {
+      m_useCachedSeed = use;
+    }
+    bool getUseCachedSeed() const { return m_useCachedSeed; }
+
+    /*
+     * Adapt the step size to the error reduction of each step (default). The maximum step sizes
+     * and the time step are scaled by a factor, up to four, that grows while the steps reduce the
+     * error as predicted by the Jacobian and shrinks when they do not; a larger step that increases
+     * the error is rejected and retried with a smaller scale. When false, the steps are not scaled.
+     */
+    void setUseAdaptiveStep(bool use) {
+      m_useAdaptiveStep = use;
+    }
+
+    /*
+     * Set how often CartToJnt() computes the exact Jacobian near the goal, once the steps are no
+     * longer limited by the maximum step sizes. Between the exact Jacobians, it is approximated by
+     * Broyden (rank-one) updates from the joint step and the change of the pose, which saves the
+     * cost of the Jacobian in the kinematics. The exact Jacobian is also computed when a step
+     * reduces the error much less than the approximate Jacobian predicted.
+     * @param period: number of iterations between exact Jacobians; 1 for every iteration (default)
+     */
+    void setJacobianUpdatePeriod(int period) {
+      m_jacobianUpdatePeriod = std::max(period, 1);
+    }
+    int getJacobianUpdatePeriod() const { return m_jacobianUpdatePeriod; }
+
+    /*
+     * Restart from another seed when the error stagnates, in a local minimum or against the joint
+     * limits, or when the joint velocity vanishes (default). The restarts share the iteration and
+     * time limits of the solve, and their seeds are deterministic. When false, the solve continues
+     * from the stagnating iterate, and returns -2 when the joint velocity vanishes.
+     */
+    void setUseRestarts(bool use) {
+      m_useRestarts = use;
+    }
+
+    /*
+     * Warm start the velocity solver from the saturated joints of the previous iteration (see
+     * SNSVelocityIK::setUseWarmStart()). The saturation set is cleared at the start of each solve
+     * and restart, and the setting of the velocity solver is restored when the solve finishes.
+     * The iterations that were saved are counted by SNSVelocityIK::getWarmStartStatistics().
+     */
+    void setUseVelocityWarmStart(bool use) {
+      m_useVelocityWarmStart = use;
+    }
+
+    /*
+     * Set the continuous joints. Their angles are wrapped: the joint angles of the iterates and of
+     * the solution are within half a revolution of the seed, and the nullspace bias pulls them
+     * along the shortest angle. This is a property of the chain, not copied by copySettings().
+     * @param continuous: one entry per joint, or empty if no joint is continuous (default)
+     */
+    void setContinuousJoints(const std::vector<bool>& continuous) {
+      m_continuous = continuous;
+    }
+
+    /*
+     * @return: number of iterations of the last solve, including its restarts
+     */
+    int getLastIterationCount() const;
+
+    /*
+     * @return: number of restarts of the last solve
+     */
+    int getLastRestartCount() const;
+
+    /*
+     * Copy the solver settings (step size and adaptive step, Jacobian update period, restarts,
+     * velocity warm start, iteration and time limits, time step, barrier function and solution
+     * cache) from another position solver. The chain and the velocity solver are not changed.
+     */
+    void copySettings(const SNSPositionIK& other) {
+      m_linearMaxStepSize = other.m_linearMaxStepSize;
+      m_angularMaxStepSize = other.m_angularMaxStepSize;
+      m_useAdaptiveStep = other.m_useAdaptiveStep;
+      m_jacobianUpdatePeriod = other.m_jacobianUpdatePeriod;
+      m_useRestarts = other.m_useRestarts;
+      m_useVelocityWarmStart = other.m_useVelocityWarmStart;
+      m_maxIterations = other.m_maxIterations;
+      m_dt = other.m_dt;
+      m_useBarrierFunction = other.m_useBarrierFunction;
+      m_barrierInitAlpha = other.m_barrierInitAlpha;
+      m_barrierDecay = other.m_barrierDecay;
+      m_timeout = other.m_timeout;
+      m_solutionCache = other.m_solutionCache;
+    }
+
   private:
     KDL::Chain m_chain;
     std::shared_ptr<SNSVelocityIK> m_ikVelSolver;
-    KDL::ChainFkSolverPos_recursive m_positionFK;
-    KDL::ChainJntToJacSolver m_jacobianSolver;
+    std::shared_ptr<const KinematicsBackend> m_kinematics;
     double m_linearMaxStepSize;
     double m_angularMaxStepSize;
     double m_maxIterations;
@@ -102,20 +303,43 @@ class SNSPositionIK {
     bool m_useBarrierFunction;
     double m_barrierInitAlpha;
     double m_barrierDecay;
+    double m_timeout;  // time limit in seconds, disabled if <= 0
+    const std::atomic<bool>* m_cancel;  // optional cancellation flag
+    std::shared_ptr<SolutionCache> m_solutionCache;  // optional cache of recent solutions
+    bool m_useCachedSeed;
+    bool m_useAdaptiveStep;
+    int m_jacobianUpdatePeriod;  // iterations between exact Jacobians, with Broyden updates between
+    bool m_useRestarts;
+    bool m_useVelocityWarmStart;
+    std::vector<bool> m_continuous;  // continuous joints, empty if there are none
+
+    struct SolveState;
+    std::unique_ptr<SolveState> m_solve;  // state of the solve that was started by begin()
+
+    // Restart the solve from the next seed
+    void restart();
+
+    // Run one iteration of the solve
+    void iterate();
+
+    // Wrap the continuous joints of q to within half a revolution of the reference
+    void wrapContinuousJoints(const KDL::JntArray& reference, KDL::JntArray* q) const;
+
+    // Set the primary task to the rows of the goal frame axes that are outside their tolerance,
+    // with the step limited by the maximum step sizes
+    void setReducedTask(double linearMaxStepSize, double angularMaxStepSize, double dt);
 
     /**
      * @brief Calculate the position and rotation errors in base frame
-     * @param q - joints input
+     * @param pose - current pose
      * @param goal - desired goal frame
-     * @param pose - pose based of FK of q
      * @param errL - translation error magnitude (== trans.Norm())
      * @param errR - rotational error magnitude (angle-axis representation)
      * @param trans - translation vector
      * @param rotAxis - unit rotation vector
      */
-    bool calcPoseError(const KDL::JntArray& q,
+    void calcPoseError(const KDL::Frame& pose,
                        const KDL::Frame& goal,
-                       KDL::Frame* pose,
                        double* errL,
                        double* errR,
                        KDL::Vector* trans,
@@ -0,0 +1,159 @@
+/** @file sns_solution_cache.hpp
+ *
+ * @brief Cache of recent position IK solutions, used to warm-start SNSPositionIK
+ *
+ *    Copyright 2018 Rethink Robotics
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef SNS_IK_LIB__SNS_SOLUTION_CACHE_H_
+#define SNS_IK_LIB__SNS_SOLUTION_CACHE_H_
+
+#include <Eigen/Dense>
+#include <atomic>
+#include <cstdint>
+#include <kdl/frames.hpp>
+#include <kdl/jntarray.hpp>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace sns_ik {
+
+/*
+ * Cache of (goal pose -> joint solution) pairs. SNSPositionIK looks up the goal before it solves:
+ * if a cached solution was found for a pose within the position and angle distances of the goal,
+ * it is used as the seed. Solutions are added to the cache when the solver converges.
+ *
+ * The poses are indexed by a grid over the position, with a cell size equal to the maximum
+ * position distance, so a lookup only visits the cell of the goal and its neighbors. The grid is
+ * split into shards with one lock each, so that concurrent readers and writers rarely wait on each
+ * other. Each shard has a fixed number of entries; once it is full, the oldest entry is replaced.
+ * A solution for a pose that is within the distances of an entry of the same cell replaces
+ * that entry, so that repeated requests do not fill the cache.
+ *
+ * All functions can be called concurrently from several threads.
+ */
+class SolutionCache {
+
+public:
+
+  struct Statistics {
+    uint64_t lookups;  // number of calls to lookup()
+    uint64_t hits;  // number of lookups that found a solution
+    uint64_t insertions;  // number of solutions added to the cache (not counting replacements)
+    uint64_t evictions;  // number of entries that were removed to make space
+    double hitRate;  // hits / lookups
+    // Estimate of the solver iterations saved by the cache: the mean number of iterations of the
+    // solves without a cache hit, times the number of solves with a hit, minus their iterations.
+    double iterationsSaved;
+  };
+
+  /*
+   * Create an empty cache
+   * @param capacity: maximum number of solutions in the cache
+   * @param maxPositionDistance: maximum distance between the positions of the goal and of a cached pose (m)
+   * @param maxAngleDistance: maximum rotation angle between the goal and a cached pose (rad)
+   * A distance that is not positive is replaced by its default value.
+   */
+  explicit SolutionCache(size_t capacity = 10000, double maxPositionDistance = 0.01,
+                         double maxAngleDistance = 0.05);
+
+  /*
+   * Find the cached solution of the pose nearest to the goal: the pose that minimizes
+   * positionDistance / maxPositionDistance + angleDistance / maxAngleDistance, among the poses
+   * within both distances of the goal.
+   * @param goal: goal pose
+   * @param[out] q: cached solution, unchanged if there is none
+   * @return: true if a cached solution was found
+   */
+  bool lookup(const KDL::Frame& goal, KDL::JntArray* q);
+
+  /*
+   * Add a solution to the cache
+   * @param pose: goal pose
+   * @param q: joint angles that reach the goal
+   */
+  void insert(const KDL::Frame& pose, const KDL::JntArray& q);
+
+  /*
+   * Record the number of iterations of a converged solve, for the statistics
+   * @param cacheHit: true if the solve was seeded from the cache
+   * @param iterations: number of iterations of the solver
+   */
+  void recordSolve(bool cacheHit, int iterations);
+
+  /*
+   * @return: statistics since the construction of the cache or the last call to clear()
+   */
+  Statistics getStatistics() const;
+
+  /*
+   * Remove all solutions and reset the statistics
+   */
+  void clear();
+
+  /*
+   * @return: number of solutions in the cache
+   */
+  size_t size() const;
+
+  size_t getCapacity() const { return nShard_ * shardCapacity_; }
+  double getMaxPositionDistance() const { return maxPositionDistance_; }
+  double getMaxAngleDistance() const { return maxAngleDistance_; }
+
+private:
+
+  struct Entry {
+    uint64_t cell;
+    KDL::Frame pose;
+    Eigen::VectorXd q;
+  };
+
+  // Entries are stored in a ring buffer, and indexed by the key of their grid cell
+  struct Shard {
+    std::mutex mutex;
+    std::vector<Entry> entries;
+    std::unordered_multimap<uint64_t, size_t> index;  // cell -> entry
+    size_t next = 0;  // next entry to write
+  };
+
+  // Index of the grid cell of a position coordinate, clamped to a finite range
+  int64_t cellIndex(double p) const;
+  uint64_t cellKey(int64_t ix, int64_t iy, int64_t iz) const;
+  Shard& getShard(uint64_t cell);
+
+  // Distance from the goal to a pose, relative to the maximum distances; negative if too far
+  double relativeDistance(const KDL::Frame& goal, const KDL::Frame& pose) const;
+
+  double maxPositionDistance_;
+  double maxAngleDistance_;
+  size_t nShard_;
+  size_t shardCapacity_;
+  std::unique_ptr<Shard[]> shards_;
+
+  std::atomic<uint64_t> lookups_;
+  std::atomic<uint64_t> hits_;
+  std::atomic<uint64_t> insertions_;
+  std::atomic<uint64_t> evictions_;
+  std::atomic<uint64_t> hitSolves_;
+  std::atomic<uint64_t> hitIterations_;
+  std::atomic<uint64_t> missSolves_;
+  std::atomic<uint64_t> missIterations_;
+
+};  // class SolutionCache
+
+}  // namespace sns_ik
+
+#endif  // SNS_IK_LIB__SNS_SOLUTION_CACHE_H_
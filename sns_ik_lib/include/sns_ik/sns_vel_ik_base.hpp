@@ -27,6 +27,8 @@
 #include <vector>
 
 #include "sns_ik_base.hpp"
+#include "sns_ik_kernel.hpp"
+#include "sns_joint_mask.hpp"
 // #include "sns_linear_solver.hpp"
 
 namespace sns_ik {
@@ -50,10 +52,14 @@ public:
    * Create a default solver with constant bounds on the joint velocity
    * @param dqLow: lower bound on the velocity of each joint
    * @param dqUpp: upper bound on the velocity of each joint
+   * @param useFixedSizeKernel: if true and the robot has 6, 7, or 8 joints, then a six-dimensional
+   *                            task is solved by a kernel with compile-time matrix sizes.
+   *                            Other problem sizes always use the dynamic kernel.
    * @return: velocity solver iff successful, nullptr otherwise
    */
   static std::unique_ptr<SnsVelIkBase> create(const Eigen::ArrayXd& dqLow,
-                                              const Eigen::ArrayXd& dqUpp);
+                                              const Eigen::ArrayXd& dqUpp,
+                                              bool useFixedSizeKernel = true);
 
   // Make sure that class is cleaned-up correctly
   virtual ~SnsVelIkBase() {};
@@ -117,16 +123,124 @@ public:
   ExitCode solve(const Eigen::MatrixXd& J, const Eigen::VectorXd& dx, const Eigen::VectorXd& dqCS,
                       Eigen::VectorXd* dq, double* taskScale, double* taskScaleCS);
 
+  /**
+   * Solve a velocity IK problem with any number of tasks in a strict order of priority.
+   *
+   *  This method implements the multi-task SNS algorithm of snsIk_vel_rr_mt.m, a modification of
+   *  "Algorithm 4: SNS algorithm for multiple tasks" from the paper above. The primary task is
+   *  solved by solve(J, dx, dq, taskScale). Each lower priority task is solved in the null space
+   *  of all higher priority tasks, and its saturated joints are removed from that null space.
+   *
+   * Solve for joint velocity dq and task scales s[i], one task after the other:
+   *
+   *  maximize: s[i]
+   *  subject to:
+   *    s[k] * dx[k] = J[k] * dq   for all k < i, with the scales of the higher priority tasks
+   *    s[i] * dx[i] = J[i] * dq
+   *    0 <= s[i] <= 1
+   *    dqLow <= dq <= dqUpp      ( bounds set in constructor or setBounds() )
+   *
+   * @param J: task jacobians, in decreasing order of priority. Size of J[i] = [nTask_i, nJoint]
+   * @param dx: task velocities, in decreasing order of priority. Length of dx[i] = nTask_i
+   * @param[out] dq: joint velocity solution. Length = nJoint
+   * @param[out] taskScale: scale of each task. Length = J.size()
+   *                            taskScale[i] == 1.0  --> task was feasible
+   *                            taskScale[i] < 1.0  --> task was infeasible and had to be scaled
+   *                            taskScale[i] == 0.0  --> lower priority task was not executed
+   * @return: ExitCode::Success: the algorithm worked correctly and satisfied the problem statement
+   *          otherwise: something went wrong, exit code specifics the type of problem
+   */
+  ExitCode solve(const std::vector<Eigen::MatrixXd>& J, const std::vector<Eigen::VectorXd>& dx,
+                 Eigen::VectorXd* dq, std::vector<double>* taskScale);
+
 protected:
 
   /*
    * protected constructor: require factory method to create an object.
    */
+  SnsVelIkBase(int nJnt) : SnsIkBase(nJnt) {};
 
+  /*
+   * Run the main loop of the solver. The inputs have already been validated by solve().
+   * The default implementation uses the dynamic kernel. The solvers for common problem sizes
+   * override this method to run a fixed-size kernel instead.
+   */
+  virtual ExitCode solveKernel(const Eigen::MatrixXd& J, const Eigen::VectorXd& dx,
+                               Eigen::VectorXd* dq, double* taskScale);
 
 private:
 
-  SnsVelIkBase(int nJnt) : SnsIkBase(nJnt) {};
+  /*
+   * Compute the QR decomposition of (J * Z)', which is shared by all of the solves of a lower
+   * priority task with the same saturated joints, and by the null space of that task.
+   * @param J: task jacobian. Size = [nTask, nJoint]
+   * @param Z: orthonormal basis of the joint velocities available to the task. Size = [nJoint, r]
+   * @return: rank of J * Z
+   */
+  int decomposeTask(const Eigen::MatrixXd& J, const Eigen::MatrixXd& Z);
+
+  /*
+   * Compute the minimum-norm solution x = Z * pinv(J * Z) * r with the last decomposition.
+   */
+  void solveTask(const Eigen::MatrixXd& Z, const Eigen::VectorXd& r, Eigen::VectorXd* x);
+
+  /*
+   * Compute an orthonormal basis N = Z * null(J * Z) with the last decomposition.
+   */
+  void taskNullSpace(const Eigen::MatrixXd& Z, Eigen::MatrixXd* N);
+
+  /*
+   * Compute the joint velocity dqTask_ of a lower priority task for the current saturation set:
+   *   dqTask_ = dqPrev_ + pNull_ + barZ_ * pinv(J * barZ_) * (scale * dx - J * pNull_ - J * dqPrev_)
+   * @param dropCorrection: if true, then the term - J * dqPrev_ is not included
+   */
+  void solveTaskVelocity(const Eigen::MatrixXd& J, const Eigen::VectorXd& dx, double scale,
+                         bool dropCorrection);
+
+  /*
+   * Saturate a joint for the current lower priority task: pNull_ moves the joint to its target
+   * velocity, and the joint is removed from the basis barZ_ with a Householder reflection.
+   */
+  void saturateJoint(int jntIdx, double target);
+
+  /*
+   * Solve one lower priority task in the null space Z_ of the higher priority tasks, whose
+   * solution is dqPrev_. The solution is stored in dqTask_.
+   * @param computeNullSpace: if true, then nextZ_ is set to the null space of this task in Z_
+   * @return: task scale, zero if the task is not executed
+   */
+  double solveLowerPriorityTask(const Eigen::MatrixXd& J, const Eigen::VectorXd& dx,
+                                bool computeNullSpace);
+
+  /*
+   * @return: true iff dq is within the bounds of the solver
+   */
+  bool isWithinBounds(const Eigen::VectorXd& dq) const;
+
+  SnsIkKernel<Eigen::Dynamic, Eigen::Dynamic> kernel_;  //!< general-purpose SNS-IK kernel
+
+  // Workspace for the solver with a configuration space task:
+  Eigen::VectorXd dq1_;  //!< solution of the primary goal
+  JointMask mask_;  //!< null-space selection matrix W, stored as the set of saturated joints
+  Eigen::MatrixXd Jinv_;  //!< pseudo-inverse of J
+  Eigen::MatrixXd P1_;  //!< null-space projector of the primary task
+  Eigen::VectorXd a_;  //!< W * P1 * dqCS
+  PinvWorkspace pinvJ_;  //!< workspace for the pseudo-inverse of J
+
+  // Workspace for the solver with multiple tasks:
+  Eigen::VectorXd dqPrev_;  //!< solution of the higher priority tasks
+  Eigen::VectorXd dqTask_;  //!< solution of the current task
+  Eigen::VectorXd aTask_;  //!< barZ_ * pinv(J * barZ_) * dx
+  Eigen::VectorXd pNull_, bestPNull_;  //!< velocity that moves the saturated joints to their bounds
+  Eigen::MatrixXd Z_;  //!< orthonormal basis of the null space of the higher priority tasks
+  Eigen::MatrixXd nextZ_;  //!< orthonormal basis of the null space of the current task in Z_
+  Eigen::MatrixXd barZ_, bestBarZ_;  //!< orthonormal basis of Z_ that keeps saturated joints fixed
+  Eigen::MatrixXd tmpZ_;  //!< used to remove the first column of barZ_
+  Eigen::MatrixXd JZt_;  //!< (J * barZ_)'
+  Eigen::ColPivHouseholderQR<Eigen::MatrixXd> qrJZ_;  //!< rank-revealing QR of (J * barZ_)'
+  Eigen::HouseholderQR<Eigen::MatrixXd> qrRank_;  //!< least-squares solve if J * barZ_ is singular
+  Eigen::MatrixXd Rt_, Q_;  //!< factors of the decomposition of (J * barZ_)'
+  Eigen::VectorXd res_, y_, u_, zRow_, hWork_;  //!< intermediate results
 
 };  // class SnsVelIkBase
 
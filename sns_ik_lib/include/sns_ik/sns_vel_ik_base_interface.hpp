@@ -25,6 +25,7 @@
 #define SNS_IK_VELOCITY_BASE_IK
 
 #include <Eigen/Dense>
+#include <vector>
 #include "sns_ik/sns_velocity_ik.hpp"
 #include "sns_vel_ik_base.hpp"
 
@@ -36,8 +37,9 @@ class SNSVelIKBaseInterface : public SNSVelocityIK {
     virtual ~SNSVelIKBaseInterface() {};
 
     // Optimal SNS Velocity IK
-    virtual double getJointVelocity(Eigen::VectorXd *jointVelocity, const std::vector<Task> &sot,
-                  const Eigen::VectorXd &jointConfiguration);
+    using SNSVelocityIK::getJointVelocity;
+    virtual double getJointVelocity(Eigen::VectorXd *jointVelocity, const std::vector<TaskView> &sot,
+                  const Eigen::Ref<const Eigen::VectorXd> &jointConfiguration);
 
   protected:
    Eigen::ArrayXd dqLow;
@@ -47,7 +49,11 @@ class SNSVelIKBaseInterface : public SNSVelocityIK {
    Eigen::VectorXd dqCS;
    Eigen::VectorXd dqSol;
 
+   std::vector<Eigen::MatrixXd> taskJacobians;  // stack of tasks with more than a nullspace bias
+   std::vector<Eigen::VectorXd> taskVelocities;
+
    double taskScale, taskScaleCS;
+   std::vector<double> taskScales;
 
    SnsVelIkBase::uPtr baseIkSolver;
 
@@ -24,18 +24,69 @@
 #define SNS_IK_VELOCITY_IK
 
 #include <Eigen/Dense>
+#include <cstdint>
 #include <vector>
 #include <sns_ik/sns_vel_ik_base.hpp>
 
+#include "sns_ik_math_utils.hpp"
+#include "sns_joint_mask.hpp"
+
 namespace sns_ik {
 
 /*! \struct Task
  *  A desired robot task
+ *
+ *  The structure tells the solvers that the Jacobian is the identity (a joint velocity task) or
+ *  a selection of joints (a nullspace bias), so that they can skip the dense products with it.
+ *  The Jacobian is always set, and must match the structure: setIdentity() and setSelection()
+ *  set both.
  */
 
 struct Task {
+    enum Structure { Dense, Identity, Selection };
+
     Eigen::MatrixXd jacobian;  //!< the task Jacobian
     Eigen::VectorXd desired;   //!< desired velocity in task space
+    Structure structure;       //!< structure of the Jacobian
+    std::vector<int> indices;  //!< Selection: the joint of each row of the Jacobian
+
+    Task() : structure(Dense) {}
+
+    // Set the Jacobian to the identity of size nJoint
+    void setIdentity(int nJoint);
+
+    // Set the Jacobian to the rows of the identity of size nJoint that select the joints
+    void setSelection(const std::vector<int>& joints, int nJoint);
+
+    // JX = J * X, using the structure of the Jacobian
+    void multiply(const Eigen::MatrixXd &X, Eigen::MatrixXd *JX) const;
+
+    // y -= J * x, using the structure of the Jacobian
+    void subtractProduct(const Eigen::VectorXd &x, Eigen::VectorXd *y) const;
+};
+
+/*! \struct TaskView
+ *  A desired robot task that refers to the memory of the caller instead of owning it, so that a
+ *  stack of tasks can be built without copying the Jacobians. The data must outlive the view, and
+ *  be stored column by column (a MatrixXd or VectorXd, a block of one, or a Map). A Task converts
+ *  to a view of itself.
+ */
+struct TaskView {
+    Eigen::Ref<const Eigen::MatrixXd> jacobian;  //!< the task Jacobian
+    Eigen::Ref<const Eigen::VectorXd> desired;   //!< desired velocity in task space
+    Task::Structure structure;  //!< structure of the Jacobian
+    const int *indices;  //!< Selection: the joint of each row of the Jacobian
+
+    TaskView(const Task &task);
+    TaskView(const Eigen::Ref<const Eigen::MatrixXd> &jacobian,
+             const Eigen::Ref<const Eigen::VectorXd> &desired,
+             Task::Structure structure = Task::Dense, const int *indices = nullptr);
+
+    // JX = J * X, using the structure of the Jacobian
+    void multiply(const Eigen::MatrixXd &X, Eigen::MatrixXd *JX) const;
+
+    // y -= J * x, using the structure of the Jacobian
+    void subtractProduct(const Eigen::VectorXd &x, Eigen::VectorXd *y) const;
 };
 
 static const double SHAPE_MARGIN = 0.98;
@@ -56,8 +107,12 @@ class SNSVelocityIK {
     void setLoopPeriod(double period) { loop_period = period; }
 
     // SNS Velocity IK
-    virtual double getJointVelocity(Eigen::VectorXd *jointVelocity, const std::vector<Task> &sot,
-                                    const Eigen::VectorXd &jointConfiguration);
+    double getJointVelocity(Eigen::VectorXd *jointVelocity, const std::vector<Task> &sot,
+                            const Eigen::Ref<const Eigen::VectorXd> &jointConfiguration);
+
+    // SNS Velocity IK, for tasks that refer to the memory of the caller
+    virtual double getJointVelocity(Eigen::VectorXd *jointVelocity, const std::vector<TaskView> &sot,
+                                    const Eigen::Ref<const Eigen::VectorXd> &jointConfiguration);
 
     // Standard straight inverse jacobian
     double getJointVelocity_STD(Eigen::VectorXd *jointVelocity, const std::vector<Task> &sot);
@@ -76,19 +131,89 @@ class SNSVelocityIK {
 
     void usePositionLimits(bool use) { m_usePositionLimits = use; }
 
+    /*! \struct WarmStartStatistics
+     *  Counters of the SNS iterations of the primary task, for the warm start
+     */
+    struct WarmStartStatistics {
+      uint64_t solves;  // number of solves of the primary task
+      uint64_t iterations;  // number of SNS iterations of the primary task
+      uint64_t warmStarts;  // number of solves that started from a saturation set
+      // Estimate of the SNS iterations saved by the warm start: each joint of the saturation set
+      // that is kept saves the iteration that would have saturated it, and the update of the set
+      // after joints were released costs one iteration.
+      int64_t iterationsSaved;
+    };
+
+    /*
+     * Warm start the primary task from the joints that were saturated by the previous call. These
+     * joints start saturated at their new bounds, and the joints that the task no longer pushes
+     * against their bound are released, using the Lagrange multipliers of the minimum-norm
+     * solution. The SNS iterations then saturate more joints if needed. This is meant for
+     * sequences of slowly changing problems, such as the iterations of the position IK. Only the
+     * SNS solver uses the warm start; the other solvers ignore it. The default is false.
+     */
+    void setUseWarmStart(bool use) { m_useWarmStart = use; }
+    bool getUseWarmStart() const { return m_useWarmStart; }
+
+    /*
+     * Forget the saturation set, so that the next call starts with all joints free
+     */
+    void resetWarmStart() { W.assign(W.size(), noSaturation); }
+
+    WarmStartStatistics getWarmStartStatistics() const { return m_warmStartStats; }
+    void resetWarmStartStatistics() { m_warmStartStats = WarmStartStatistics(); }
+
   protected:
 
+    /*! \struct TaskWorkspace
+     *  Storage for the intermediate results of SNSsingle(), one for each task. The matrices are
+     *  only resized when the shape of the task changes, so the solve does not allocate memory once
+     *  it has been called with a given set of tasks.
+     */
+    struct TaskWorkspace {
+      PinvWorkspace pinvJP;  // pseudo-inverse of J*P
+      PinvWorkspace pinvBarP;  // inverse used by the projector of the saturated joints
+      Eigen::MatrixXd JP;  // J*P, with P the current null-space projector
+      Eigen::MatrixXd JPs;  // J*projectorSaturated
+      Eigen::MatrixXd JPinverse;  // (J P)^#
+      Eigen::MatrixXd bestInvJP;
+      Eigen::MatrixXd projectorSaturated;  // (((I-W_k)*P_{k-1})^#
+      Eigen::MatrixXd barP;
+      Eigen::MatrixXd tildeP;
+      JointMask bestW;
+      Eigen::MatrixXd bestTildeP;
+      Eigen::VectorXd tildeDotQ;
+      Eigen::VectorXd bestTildeDotQ;
+      Eigen::VectorXd dotQn;  // saturate velocity in the null space
+      Eigen::VectorXd bestDotQn;
+      Eigen::VectorXd dotQs;
+      Eigen::VectorXd barMu;
+      Eigen::VectorXd taskErr;  // task - J*dq
+      Eigen::VectorXd Jtask;  // (J P)^# * task
+      Eigen::VectorXd lambda;  // Lagrange multipliers of the task, for the warm start
+      Eigen::VectorXd scaledTask;  // task * task scale margin
+      Eigen::ArrayXd a, b;  // used to compute the task scaling factor
+    };
+
     // Shape the joint velocity bound dotQmin and dotQmax
-    void shapeJointVelocityBound(const Eigen::VectorXd &actualJointConfiguration, double margin = SHAPE_MARGIN);
+    void shapeJointVelocityBound(const Eigen::Ref<const Eigen::VectorXd> &actualJointConfiguration,
+                                 double margin = SHAPE_MARGIN);
+
+    // Start the primary task from the saturation set of the previous call. Returns false if the
+    // solve should start with all joints free, otherwise the estimate of the iterations saved.
+    bool warmStartPrimaryTask(const Eigen::Ref<const Eigen::MatrixXd> &jacobian,
+                              const Eigen::Ref<const Eigen::VectorXd> &task, int *iterationsSaved);
 
     // Perform the SNS for a single task
+    // The Jacobian is the one of sotTask, and task is its desired velocity, which may be scaled
     virtual double SNSsingle(int priority, const Eigen::VectorXd &higherPriorityJointVelocity,
-                     const Eigen::MatrixXd &higherPriorityNull, const Eigen::MatrixXd &jacobian,
-                     const Eigen::VectorXd &task, Eigen::VectorXd *jointVelocity, Eigen::MatrixXd *nullSpaceProjector);
+                     const Eigen::MatrixXd &higherPriorityNull, const TaskView &sotTask,
+                     const Eigen::Ref<const Eigen::VectorXd> &task, Eigen::VectorXd *jointVelocity,
+                     Eigen::MatrixXd *nullSpaceProjector);
 
     void getTaskScalingFactor(const Eigen::ArrayXd &a,
                               const Eigen::ArrayXd &b,
-                              const Eigen::MatrixXd &W, double *scalingFactor,
+                              const JointMask &W, double *scalingFactor,
                               int *mostCriticalJoint);
 
     int n_dof;  //manipulator degree of freedom
@@ -106,12 +231,25 @@ class SNSVelocityIK {
 
     // TODO: are these needed here???
     Eigen::VectorXd dotQ;  // next solution (bar{\dotqv} in the paper)
-    std::vector<Eigen::MatrixXd> W;  //selection matrices  [here to permit a warm start]
+    std::vector<JointMask> W;  //selection matrices, as joint masks  [here to permit a warm start]
     std::vector<Eigen::VectorXd> dotQopt;  // next solution (bar{\dotqv} in the paper)
     Eigen::MatrixXd I;  // identity matrix
+    JointMask noSaturation;  // joint mask with all joints free (W = I)
     std::vector<double> scaleFactors;
 
     std::vector<int> nSat;  //number of saturated joint
+
+    bool m_useWarmStart;
+    Eigen::VectorXi m_saturationSide;  // +1 for a joint saturated at its upper bound, -1 at its lower bound
+    WarmStartStatistics m_warmStartStats;
+
+    // Workspace for getJointVelocity() and SNSsingle()
+    std::vector<TaskView> m_taskViews;  // views of the tasks of getJointVelocity() with Task
+    std::vector<TaskWorkspace> m_taskWs;
+    Eigen::MatrixXd m_P;  // null-space projector of the tasks solved so far
+    Eigen::MatrixXd m_PS;  // null-space projector before the task scale margin is applied
+    Eigen::MatrixXd m_higherPriorityNull;
+    Eigen::VectorXd m_higherPriorityJointVelocity;
 };
 
 }  // namespace sns_ik
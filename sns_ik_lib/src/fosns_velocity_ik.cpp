@@ -39,56 +39,57 @@ void FOSNSVelocityIK::setNumberOfTasks(int ntasks, int dof)
   SNSVelocityIK::setNumberOfTasks(ntasks, dof);
 
   //for the Fast version
-  Eigen::MatrixXd Z = Eigen::MatrixXd::Zero(n_dof, n_dof);
-  Eigen::VectorXd zv = Eigen::VectorXd::Zero(n_dof);
-  Eigen::VectorXi zvi = Eigen::VectorXi::Zero(n_dof);
-  B = Z;
+  B.setZero(n_dof, n_dof);
 
-  S.resize(n_tasks, zvi);
+  if ((int)S.size() != n_tasks) {
+    S.resize(n_tasks, Eigen::VectorXi::Zero(n_dof));
+  }
   nSat.resize(n_tasks, 0);
+  m_fastTaskWs.resize(n_tasks);
 
   satList.resize(n_tasks);
-  lagrangeMu = zv;
-  lagrangeMu1 = zv;
-  lagrangeMup2w = zv;
+  for (auto &list : satList) {
+    list.reserve(n_dof);
+  }
+  lagrangeMu.setZero(n_dof);
+  lagrangeMu1.setZero(n_dof);
+  lagrangeMup2w.setZero(n_dof);
 }
 
 double FOSNSVelocityIK::getJointVelocity(Eigen::VectorXd *jointVelocity,
-    const std::vector<Task> &sot,
-    const Eigen::VectorXd &jointConfiguration)
+    const std::vector<TaskView> &sot,
+    const Eigen::Ref<const Eigen::VectorXd> &jointConfiguration)
 {
   // This will only reset member variables if different from previous values
   setNumberOfTasks(sot.size(), sot[0].jacobian.cols());
-  S.resize(n_tasks, Eigen::VectorXi::Zero(n_dof));
 
   // TODO: check that setJointsCapabilities has been already called
 
-  Eigen::MatrixXd P = Eigen::MatrixXd::Identity(n_dof, n_dof);
-  Eigen::MatrixXd PS = Eigen::MatrixXd::Identity(n_dof, n_dof);
-  *jointVelocity = Eigen::VectorXd::Zero(n_dof, 1);
-  Eigen::VectorXd higherPriorityJointVelocity;
-  Eigen::MatrixXd higherPriorityNull;
+  m_P.setIdentity(n_dof, n_dof);
+  m_PS.setIdentity(n_dof, n_dof);
+  jointVelocity->setZero(n_dof);
 
   shapeJointVelocityBound(jointConfiguration);
 
   // this is not the best solution... the scale margin should be computed inside FOSNSsingle
 
   for (int i_task = 0; i_task < n_tasks; i_task++) {  //consider all tasks
-    higherPriorityJointVelocity = *jointVelocity;
-    higherPriorityNull = P;
-    scaleFactors[i_task] = SNSsingle(i_task, higherPriorityJointVelocity, higherPriorityNull,
-        sot[i_task].jacobian, sot[i_task].desired, jointVelocity, &PS);
+    m_higherPriorityJointVelocity = *jointVelocity;
+    m_higherPriorityNull = m_P;
+    scaleFactors[i_task] = SNSsingle(i_task, m_higherPriorityJointVelocity, m_higherPriorityNull,
+        sot[i_task], sot[i_task].desired, jointVelocity, &m_PS);
 
     if (scaleFactors[i_task] > 0.0) {
       if (scaleFactors[i_task] * scaleMargin < 1.0) {
         double taskScale = scaleFactors[i_task] * scaleMargin;
-        Eigen::VectorXd scaledTask = sot[i_task].desired * taskScale;
-        scaleFactors[i_task] = SNSsingle(i_task, higherPriorityJointVelocity, higherPriorityNull,
-            sot[i_task].jacobian, scaledTask, jointVelocity, &P);
+        Eigen::VectorXd &scaledTask = m_taskWs[i_task].scaledTask;
+        scaledTask = sot[i_task].desired * taskScale;
+        scaleFactors[i_task] = SNSsingle(i_task, m_higherPriorityJointVelocity, m_higherPriorityNull,
+            sot[i_task], scaledTask, jointVelocity, &m_P);
         scaleFactors[i_task] = taskScale;
       } else {
         scaleFactors[i_task] = 1.0;
-        P = PS;
+        m_P = m_PS;
       }
     }
   }
@@ -103,14 +104,16 @@ double FOSNSVelocityIK::getJointVelocity(Eigen::VectorXd *jointVelocity,
 double FOSNSVelocityIK::SNSsingle(int priority,
                                   const Eigen::VectorXd &higherPriorityJointVelocity,
                                   const Eigen::MatrixXd &higherPriorityNull,
-                                  const Eigen::MatrixXd &jacobian,
-                                  const Eigen::VectorXd &task,
+                                  const TaskView &sotTask,
+                                  const Eigen::Ref<const Eigen::VectorXd> &task,
                                   Eigen::VectorXd *jointVelocity,
                                   Eigen::MatrixXd *nullSpaceProjector)
 {
   //INITIALIZATION
-  Eigen::MatrixXd JPinverse;  //(J_k P_{k-1})^#
-  Eigen::ArrayXd a, b;  // used to compute the task scaling factor
+  const Eigen::Ref<const Eigen::MatrixXd> &jacobian = sotTask.jacobian;
+  FastTaskWorkspace &ws = m_fastTaskWs[priority];
+  Eigen::MatrixXd &JPinverse = ws.JPinverse;  //(J_k P_{k-1})^#
+  Eigen::ArrayXd &a = ws.a, &b = ws.b;  // used to compute the task scaling factor
   bool limit_excedeed;
   double scalingFactor = 1.0;
   int mostCriticalJoint;
@@ -118,20 +121,21 @@ double FOSNSVelocityIK::SNSsingle(int priority,
 
   double base_Scale;
   double best_Scale = -1.0;
-  Eigen::VectorXd best_dq1;
-  Eigen::VectorXd best_dq2;
-  Eigen::VectorXd best_dqw;
+  Eigen::VectorXd &best_dq1 = ws.best_dq1;
+  Eigen::VectorXd &best_dq2 = ws.best_dq2;
+  Eigen::VectorXd &best_dqw = ws.best_dqw;
   //int best_nSat;
 
-  Eigen::MatrixXd tildeZ;
-  Eigen::VectorXd dq1, dq2;
-  Eigen::VectorXd dqw;
-  Eigen::VectorXd dq1_base, dq2_base;
-  Eigen::VectorXd dqn = Eigen::VectorXd::Zero(n_dof);
+  Eigen::MatrixXd &tildeZ = ws.tildeZ;
+  Eigen::VectorXd &dq1 = ws.dq1, &dq2 = ws.dq2;
+  Eigen::VectorXd &dqw = ws.dqw;
+  Eigen::VectorXd &dq1_base = ws.dq1_base, &dq2_base = ws.dq2_base;
+  Eigen::VectorXd &dqn = ws.dqn;
+  dqn.setZero(n_dof);
   //Eigen::VectorXd dotQs;
 
-  Eigen::MatrixXd zin;
-  Eigen::VectorXd bin, bout;
+  Eigen::RowVectorXd &zin = ws.zin;
+  Eigen::VectorXd &bin = ws.bin, &bout = ws.bout;
   double dqw_in;
 
   //double mu_in;
@@ -142,22 +146,26 @@ double FOSNSVelocityIK::SNSsingle(int priority,
   double mu_outp2w;
   double min_mu;
   int id_min_mu = n_dof + 1;  //just to be not possible
-  Eigen::VectorXd scaledMU;
+  Eigen::VectorXd &scaledMU = ws.scaledMU;
 
   bool computedScalingFactor = false;
 
   //compute the base solution
-  singularTask = !pinv_QR_Z(jacobian, higherPriorityNull, &JPinverse, &tildeZ);
-  *nullSpaceProjector = tildeZ * tildeZ.transpose();
-  dq1 = JPinverse * task;
-  dq2 = -JPinverse * jacobian * higherPriorityJointVelocity;
-  dqw = Eigen::VectorXd::Zero(n_dof);
+  sotTask.multiply(higherPriorityNull, &ws.JZ);
+  singularTask = !pinv_QR_Z_product(ws.JZ, higherPriorityNull, &JPinverse, &tildeZ, &ws.pinv);
+  nullSpaceProjector->noalias() = tildeZ * tildeZ.transpose();
+  dq1.noalias() = JPinverse * task;
+  ws.taskTmp.setZero(task.rows());
+  sotTask.subtractProduct(higherPriorityJointVelocity, &ws.taskTmp);
+  dq2.noalias() = JPinverse * ws.taskTmp;
+  dqw.setZero(n_dof);
   dq1_base = dq1;
   dq2_base = dq2;
   dotQ = higherPriorityJointVelocity + dq1 + dq2;
   a = dq1.array();
   b = dotQ.array() - a;
-  getTaskScalingFactor(a, b, Eigen::VectorXi::Zero(n_dof), &scalingFactor, &mostCriticalJoint);
+  ws.noSat.setZero(n_dof);
+  getTaskScalingFactor(a, b, ws.noSat, &scalingFactor, &mostCriticalJoint);
 
   ROS_DEBUG("task %d", priority);
   ROS_DEBUG("base Z norm %f", higherPriorityNull.norm());
@@ -171,7 +179,7 @@ double FOSNSVelocityIK::SNSsingle(int priority,
     //dotQopt[priority]=dotQ;
     nSat[priority] = 0;
     satList[priority].clear();
-    S[priority] = Eigen::VectorXi::Zero(n_dof);
+    S[priority].setZero(n_dof);
     ROS_DEBUG("task accomplished without saturations");
     ROS_DEBUG("scale %f", scalingFactor);
     if (singularTask){
@@ -196,7 +204,7 @@ double FOSNSVelocityIK::SNSsingle(int priority,
     if (scalingFactor > 0.0) {
       *jointVelocity = higherPriorityJointVelocity + scalingFactor * dq1 + dq2;
       //dotQopt[priority]=(*jointVelocity);
-      *nullSpaceProjector = tildeZ * tildeZ.transpose();
+      nullSpaceProjector->noalias() = tildeZ * tildeZ.transpose();
     } else {
       // the task is not executed
       *jointVelocity = higherPriorityJointVelocity;
@@ -208,7 +216,7 @@ double FOSNSVelocityIK::SNSsingle(int priority,
     ROS_DEBUG("scale %f", scalingFactor);
     nSat[priority] = 0;
     satList[priority].clear();
-    S[priority] = Eigen::VectorXi::Zero(n_dof);
+    S[priority].setZero(n_dof);
     return scalingFactor;
   }
 
@@ -216,13 +224,19 @@ double FOSNSVelocityIK::SNSsingle(int priority,
 
 //B=Eigen::MatrixXd::Zero(n_dof,n_dof);
   if (nSat[priority]) {
-    Eigen::MatrixXd Zws = Eigen::MatrixXd::Zero(nSat[priority], tildeZ.cols());
-    Eigen::MatrixXd invZws = Eigen::MatrixXd::Zero(tildeZ.cols(), nSat[priority]);
-    Eigen::MatrixXd forMu = Eigen::MatrixXd::Zero(nSat[priority], nSat[priority]);
-    Eigen::MatrixXd Bws = Eigen::MatrixXd::Zero(n_dof, nSat[priority]);
-    Eigen::VectorXd dq1_ws = Eigen::VectorXd::Zero(nSat[priority]);
-    Eigen::VectorXd dq2_ws = Eigen::VectorXd::Zero(nSat[priority]);
-    Eigen::VectorXd dqw_ws = Eigen::VectorXd::Zero(nSat[priority]);
+    // The matrices below have one row (or column) for each saturated joint. They are allocated
+    // for n_dof saturated joints and padded with zeros, so that their size does not change.
+    Eigen::MatrixXd &Zws = ws.Zws;
+    Eigen::MatrixXd &invZws = ws.invZws;
+    Eigen::MatrixXd &forMu = ws.forMu;
+    Eigen::MatrixXd &Bws = ws.Bws;
+    Eigen::VectorXd &dq1_ws = ws.dq1_ws;
+    Eigen::VectorXd &dq2_ws = ws.dq2_ws;
+    Eigen::VectorXd &dqw_ws = ws.dqw_ws;
+    Zws.setZero(n_dof, tildeZ.cols());
+    dq1_ws.setZero(n_dof);
+    dq2_ws.setZero(n_dof);
+    dqw_ws.setZero(n_dof);
     int idws = 0;
     bool invertibelZws;
 
@@ -231,11 +245,7 @@ double FOSNSVelocityIK::SNSsingle(int priority,
 
       if (tildeZ.row(id).norm() < 1e-10) {
         //it means that the joint has been already saturated by the previous task
-        if (it == satList[priority].begin()) {
-          it = satList[priority].erase_after(satList[priority].before_begin());
-        } else {
-          it = satList[priority].erase_after(prev_it);
-        }
+        it = satList[priority].erase(it);
         S[priority](id) = 0;
         nSat[priority]--;
       } else {
@@ -251,46 +261,46 @@ double FOSNSVelocityIK::SNSsingle(int priority,
         dqn(id) = dqw_ws(idws);
 
         idws++;
-        prev_it = it;
         it++;
       }
 
     }
 
     if (nSat[priority]) {
-      Zws.conservativeResize(nSat[priority], tildeZ.cols());
-      invertibelZws = pinv_QR(Zws, &invZws);
+      invertibelZws = pinv_QR(Zws, nSat[priority], &invZws, &ws.pinvZws);
 
       if (!invertibelZws) {
         //  ROS_WARN("Zws is not invertible... what should I do?");
         satList[priority].clear();
         nSat[priority] = 0;
-        S[priority] = Eigen::VectorXi::Zero(n_dof);
+        S[priority].setZero(n_dof);
 
       } else {
 
-        Bws = tildeZ * invZws;
-        forMu = invZws.transpose() * invZws;
+        Bws.noalias() = tildeZ * invZws;
+        forMu.noalias() = invZws.transpose() * invZws;
         //      forMu=Bws.transpose()*Bws;
         idws = 0;
         for (it = satList[priority].begin(); it != satList[priority].end(); ++it) {
           int id = *it;
           B.col(id) = Bws.col(idws);
 
-          lagrangeMu1(id) = -forMu.row(idws) * dq1_ws;
-          lagrangeMup2w(id) = forMu.row(idws) * (dqw_ws - dq2_ws);
+          lagrangeMu1(id) = -forMu.row(idws).dot(dq1_ws);
+          lagrangeMup2w(id) = forMu.row(idws).dot(dqw_ws - dq2_ws);
           lagrangeMu(id) = lagrangeMu1(id) + lagrangeMup2w(id);
 
           idws++;
         }
-        dq1 = dq1_base - Bws * dq1_ws;
-        dq2 = dq2_base - Bws * dq2_ws;
-        dqw = Bws * dqw_ws;
+        dq1 = dq1_base;
+        dq1.noalias() -= Bws * dq1_ws;
+        dq2 = dq2_base;
+        dq2.noalias() -= Bws * dq2_ws;
+        dqw.noalias() = Bws * dqw_ws;
         dotQ = higherPriorityJointVelocity + dq1 + dq2 + dqw;
 
-        tildeZ = tildeZ - Bws * Zws;
+        tildeZ.noalias() -= Bws * Zws;
         // Special function to call only when in debug mode
-        std::function<double()>  getScaleFactorForLogging = [&]() {
+        auto getScaleFactorForLogging = [&]() {
           a=dq1.array();
           b=dotQ.array() - a;
           double sf;
@@ -328,7 +338,7 @@ double FOSNSVelocityIK::SNSsingle(int priority,
       //nSat[priority]=0;
       satList[priority].clear();
       nSat[priority] = 0;
-      S[priority] = Eigen::VectorXi::Zero(n_dof);
+      S[priority].setZero(n_dof);
       *jointVelocity = higherPriorityJointVelocity;
       //dotQopt[priority]=(*jointVelocity);
       *nullSpaceProjector = higherPriorityNull;
@@ -361,16 +371,11 @@ double FOSNSVelocityIK::SNSsingle(int priority,
           int id = *it;
           if (id == id_min_mu) {
             //remove id-min_mu from list of saturated joints
-            if (it == satList[priority].begin()) {
-              it = satList[priority].erase_after(satList[priority].before_begin());
-            } else {
-              it = satList[priority].erase_after(prev_it);
-            }
+            it = satList[priority].erase(it);
           } else {
             //update B
             double baux = (double) bout.dot(B.col(id)) / bout.squaredNorm();
             B.col(id) -= bout * baux;
-            prev_it = it;
             it++;
           }
         }
@@ -378,7 +383,8 @@ double FOSNSVelocityIK::SNSsingle(int priority,
         double dq1X = dq1_base(id_min_mu);
         double dq2X = dq2_base(id_min_mu);
         double dqwX = dqn(id_min_mu);
-        Eigen::MatrixXd ZX = tildeZ.row(id_min_mu);
+        Eigen::RowVectorXd &ZX = ws.ZX;
+        ZX = tildeZ.row(id_min_mu);
         for (it = satList[priority].begin(); it != satList[priority].end(); ++it) {
           int id = *it;
           lagrangeMu1(id) += bout(id) * mu_out1;
@@ -393,7 +399,7 @@ double FOSNSVelocityIK::SNSsingle(int priority,
         dq1 += bout * dq1X;
         dq2 += bout * dq2X;
         dqw -= bout * dqwX;
-        tildeZ += bout * ZX;
+        tildeZ.noalias() += bout * ZX;
         nSat[priority]--;
         S[priority](id_min_mu) = 0;
         dotQ = higherPriorityJointVelocity + dq1 + dq2 + dqw;
@@ -417,7 +423,7 @@ double FOSNSVelocityIK::SNSsingle(int priority,
       // task accomplished
       *jointVelocity = dotQ;
       //dotQopt[priority]=(*jointVelocity);
-      *nullSpaceProjector = tildeZ * tildeZ.transpose();  //if start net task from previous saturations
+      nullSpaceProjector->noalias() = tildeZ * tildeZ.transpose();  //if start net task from previous saturations
 
       return scalingFactor;
 
@@ -456,16 +462,11 @@ double FOSNSVelocityIK::SNSsingle(int priority,
           int id = *it;
           if (id == id_min_mu) {
             //remove id-min_mu from list of saturated joints
-            if (it == satList[priority].begin()) {
-              it = satList[priority].erase_after(satList[priority].before_begin());
-            } else {
-              it = satList[priority].erase_after(prev_it);
-            }
+            it = satList[priority].erase(it);
           } else {
             //update B
             double baux = (double) bout.dot(B.col(id)) / bout.squaredNorm();
             B.col(id) -= bout * baux;
-            prev_it = it;
             it++;
           }
         }
@@ -473,7 +474,8 @@ double FOSNSVelocityIK::SNSsingle(int priority,
         double dq1X = dq1_base(id_min_mu);
         double dq2X = dq2_base(id_min_mu);
         double dqwX = dqn(id_min_mu);
-        Eigen::MatrixXd ZX = tildeZ.row(id_min_mu);
+        Eigen::RowVectorXd &ZX = ws.ZX;
+        ZX = tildeZ.row(id_min_mu);
         for (it = satList[priority].begin(); it != satList[priority].end(); ++it) {
           int id = *it;
           lagrangeMu1(id) += bout(id) * mu_out1;
@@ -488,7 +490,7 @@ double FOSNSVelocityIK::SNSsingle(int priority,
         dq1 += bout * dq1X;
         dq2 += bout * dq2X;
         dqw -= bout * dqwX;
-        tildeZ += bout * ZX;
+        tildeZ.noalias() += bout * ZX;
         nSat[priority]--;
         S[priority](id_min_mu) = 0;
         dotQ = higherPriorityJointVelocity + dq1 + dq2 + dqw;
@@ -515,7 +517,8 @@ double FOSNSVelocityIK::SNSsingle(int priority,
     //saturate the most critical joint
     zin = tildeZ.row(idxW);
     //if we do not use norm(zin) then this part can go first
-    bin = tildeZ * (zin.transpose() / zin.squaredNorm());
+    ws.zinScaled = zin / zin.squaredNorm();
+    bin.noalias() = tildeZ * ws.zinScaled.transpose();
 
     dq1 -= bin * dq1(idxW);
     dq2 -= bin * dq2(idxW);
@@ -547,12 +550,12 @@ double FOSNSVelocityIK::SNSsingle(int priority,
       if (best_Scale >= 0) {
         //take the best solution
         *jointVelocity = higherPriorityJointVelocity + best_Scale * best_dq1 + best_dq2 + best_dqw;
-        *nullSpaceProjector = tildeZ * tildeZ.transpose();  //if start net task from previous saturations
+        nullSpaceProjector->noalias() = tildeZ * tildeZ.transpose();  //if start net task from previous saturations
         if (best_Scale == base_Scale) {
           //no saturation was needed to obtain the best scale
           satList[priority].clear();
           nSat[priority] = 0;
-          S[priority] = Eigen::VectorXi::Zero(n_dof);
+          S[priority].setZero(n_dof);
 
         }
         return best_Scale;
@@ -569,7 +572,7 @@ double FOSNSVelocityIK::SNSsingle(int priority,
     }
 
     nSat[priority]++;
-    tildeZ -= bin * zin;
+    tildeZ.noalias() -= bin * zin;
 
     //update mu and B
     min_mu = 0;
@@ -589,14 +592,14 @@ double FOSNSVelocityIK::SNSsingle(int priority,
         id_min_mu = id;
       }
     }
-    satList[priority].push_front(idxW);
+    satList[priority].insert(satList[priority].begin(), idxW);
     lagrangeMu1(idxW) = mu_in1;
     lagrangeMup2w(idxW) = mu_inp2w;
     //lagrangeMu(idxW)=lagrangeMu1(idxW)+lagrangeMup2w(idxW);
 
   } while (limit_excedeed);  //actually in this implementation if we use while(1) it would be the same
 
-  *nullSpaceProjector = tildeZ * tildeZ.transpose();
+  nullSpaceProjector->noalias() = tildeZ * tildeZ.transpose();
   (*jointVelocity) = dotQ;
   //dotQopt[priority]=(*jointVelocity);
   return scalingFactor;
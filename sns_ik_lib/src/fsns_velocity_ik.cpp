@@ -33,29 +33,30 @@ FSNSVelocityIK::FSNSVelocityIK(int dof, double loop_period) :
 
 
 double FSNSVelocityIK::getJointVelocity(Eigen::VectorXd *jointVelocity,
-    const std::vector<Task> &sot,
-    const Eigen::VectorXd &jointConfiguration)
+    const std::vector<TaskView> &sot,
+    const Eigen::Ref<const Eigen::VectorXd> &jointConfiguration)
 {
   // This will only reset member variables if different from previous values
   setNumberOfTasks(sot.size(), sot[0].jacobian.cols());
-  S.resize(n_tasks, Eigen::VectorXi::Zero(n_dof));
+  if ((int)S.size() != n_tasks) {
+    S.resize(n_tasks, Eigen::VectorXi::Zero(n_dof));
+  }
+  m_fastTaskWs.resize(n_tasks);
 
   // TODO: check that setJointsCapabilities has been already called
 
   //P_0=I
   //dq_0=0
-  Eigen::MatrixXd P = Eigen::MatrixXd::Identity(n_dof, n_dof);
-  *jointVelocity = Eigen::VectorXd::Zero(n_dof, 1);
-  Eigen::VectorXd higherPriorityJointVelocity;
-  Eigen::MatrixXd higherPriorityNull;
+  m_P.setIdentity(n_dof, n_dof);
+  jointVelocity->setZero(n_dof);
 
   shapeJointVelocityBound(jointConfiguration);
 
   for (int i_task = 0; i_task < n_tasks; i_task++) {  //consider all tasks
-    higherPriorityJointVelocity = *jointVelocity;
-    higherPriorityNull = P;
-    scaleFactors[i_task] = SNSsingle(i_task, higherPriorityJointVelocity, higherPriorityNull,
-        sot[i_task].jacobian, sot[i_task].desired, jointVelocity, &P);
+    m_higherPriorityJointVelocity = *jointVelocity;
+    m_higherPriorityNull = m_P;
+    scaleFactors[i_task] = SNSsingle(i_task, m_higherPriorityJointVelocity, m_higherPriorityNull,
+        sot[i_task], sot[i_task].desired, jointVelocity, &m_P);
 
     if (scaleFactors[i_task] > 1)
           scaleFactors[i_task] = 1;
@@ -69,43 +70,48 @@ double FSNSVelocityIK::getJointVelocity(Eigen::VectorXd *jointVelocity,
 double FSNSVelocityIK::SNSsingle(int priority,
                                  const Eigen::VectorXd &higherPriorityJointVelocity,
                                  const Eigen::MatrixXd &higherPriorityNull,
-                                 const Eigen::MatrixXd &jacobian,
-                                 const Eigen::VectorXd &task,
+                                 const TaskView &sotTask,
+                                 const Eigen::Ref<const Eigen::VectorXd> &task,
                                  Eigen::VectorXd *jointVelocity,
                                  Eigen::MatrixXd *nullSpaceProjector)
 {
   //FIXME: THERE IS A PROBLEM if we use 3 tasks... to be checked
 
   //INITIALIZATION
-  Eigen::MatrixXd JPinverse;  //(J_k P_{k-1})^#
-  Eigen::ArrayXd a, b;  // used to compute the task scaling factor
+  FastTaskWorkspace &ws = m_fastTaskWs[priority];
+  Eigen::MatrixXd &JPinverse = ws.JPinverse;  //(J_k P_{k-1})^#
+  Eigen::ArrayXd &a = ws.a, &b = ws.b;  // used to compute the task scaling factor
   bool limit_excedeed;
   double scalingFactor = 1.0;
   int mostCriticalJoint;
   bool singularTask = false;
 
   double best_Scale = -1.0;
-  Eigen::VectorXd best_dq1;
-  Eigen::VectorXd best_dq2;
-  Eigen::VectorXd best_dqw;
+  Eigen::VectorXd &best_dq1 = ws.best_dq1;
+  Eigen::VectorXd &best_dq2 = ws.best_dq2;
+  Eigen::VectorXd &best_dqw = ws.best_dqw;
   //int best_nSat;
 
-  Eigen::MatrixXd tildeZ;
-  Eigen::VectorXd dq1, dq2, dqw;
+  Eigen::MatrixXd &tildeZ = ws.tildeZ;
+  Eigen::VectorXd &dq1 = ws.dq1, &dq2 = ws.dq2, &dqw = ws.dqw;
 
-  Eigen::MatrixXd bin, zin;
+  Eigen::VectorXd &bin = ws.bin;
+  Eigen::RowVectorXd &zin = ws.zin;
   double dqw_in;
 
   //initialization
   nSat[priority] = 0;
-  S[priority] = Eigen::VectorXi::Zero(n_dof);
+  S[priority].setZero(n_dof);
 
   //compute the base solution
-  singularTask = !pinv_QR_Z(jacobian, higherPriorityNull, &JPinverse, &tildeZ);
-  *nullSpaceProjector = tildeZ * tildeZ.transpose();
-  dq1 = JPinverse * task;
-  dq2 = -JPinverse * jacobian * higherPriorityJointVelocity;
-  dqw = Eigen::VectorXd::Zero(n_dof);
+  sotTask.multiply(higherPriorityNull, &ws.JZ);
+  singularTask = !pinv_QR_Z_product(ws.JZ, higherPriorityNull, &JPinverse, &tildeZ, &ws.pinv);
+  nullSpaceProjector->noalias() = tildeZ * tildeZ.transpose();
+  dq1.noalias() = JPinverse * task;
+  ws.taskTmp.setZero(task.rows());
+  sotTask.subtractProduct(higherPriorityJointVelocity, &ws.taskTmp);
+  dq2.noalias() = JPinverse * ws.taskTmp;
+  dqw.setZero(n_dof);
 
   dotQ = higherPriorityJointVelocity + dq1 + dq2;
   a = dq1.array();
@@ -175,7 +181,7 @@ double FSNSVelocityIK::SNSsingle(int priority,
         *jointVelocity = higherPriorityJointVelocity + best_Scale * best_dq1 + best_dq2 + best_dqw;
         dotQopt[priority] = (*jointVelocity);
         //nSat[priority]=best_nSat;
-        *nullSpaceProjector = tildeZ * tildeZ.transpose();  //if start net task from previous saturations
+        nullSpaceProjector->noalias() = tildeZ * tildeZ.transpose();  //if start net task from previous saturations
         return best_Scale;
       } else {
         //no solution
@@ -190,7 +196,8 @@ double FSNSVelocityIK::SNSsingle(int priority,
     }
 
     //if we do not use norm(zin) then this part can go first
-    bin = tildeZ * (zin.transpose() / zin.squaredNorm());
+    ws.zinScaled = zin / zin.squaredNorm();
+    bin.noalias() = tildeZ * ws.zinScaled.transpose();
 
     dq1 -= bin * dq1(mostCriticalJoint);
     dq2 -= bin * dq2(mostCriticalJoint);
@@ -206,7 +213,7 @@ double FSNSVelocityIK::SNSsingle(int priority,
 
     nSat[priority]++;
     S[priority](mostCriticalJoint) = nSat[priority];
-    tildeZ -= bin * zin;
+    tildeZ.noalias() -= bin * zin;
 
     a = dq1.array();
     b = dotQ.array() - a;
@@ -215,7 +222,7 @@ double FSNSVelocityIK::SNSsingle(int priority,
       // task accomplished
       *jointVelocity = dotQ;
       dotQopt[priority] = (*jointVelocity);
-      *nullSpaceProjector = tildeZ * tildeZ.transpose();  //if start net task from previous saturations
+      nullSpaceProjector->noalias() = tildeZ * tildeZ.transpose();  //if start net task from previous saturations
       return 1.0;
     } else {
       if ((scalingFactor > best_Scale)) {
@@ -230,7 +237,7 @@ double FSNSVelocityIK::SNSsingle(int priority,
 
   } while (limit_excedeed);  //actually in this implementation if we use while(1) it would be the same
 
-  *nullSpaceProjector = tildeZ * tildeZ.transpose();
+  nullSpaceProjector->noalias() = tildeZ * tildeZ.transpose();
   *jointVelocity = dotQ;
   return 1.0;
 }
@@ -240,32 +247,37 @@ void FSNSVelocityIK::getTaskScalingFactor(const Eigen::ArrayXd &a,
                   const Eigen::VectorXi &S, double *scalingFactor,
                   int *mostCriticalJoint)
 {
-  Eigen::ArrayXd Smin, Smax;
-  double temp, smax, smin;
+  double temp, smax, smin, sMin, sMax;
   double inf = INF;
-  int col;
-
-  Smin = (dotQmin - b) / a;
-  Smax = (dotQmax - b) / a;
 
+  // equivalent to Smin = (dotQmin - b) / a, Smax = (dotQmax - b) / a, without temporary arrays
+  smax = inf;
+  smin = -inf;
+  *mostCriticalJoint = 0;
   for (int i = 0; i < a.rows(); i++) {
+    sMin = (dotQmin(i) - b(i)) / a(i);
+    sMax = (dotQmax(i) - b(i)) / a(i);
     //switch
-    if (Smin(i) > Smax(i)) {
-      temp = Smin(i);
-      Smin(i) = Smax(i);
-      Smax(i) = temp;
+    if (sMin > sMax) {
+      temp = sMin;
+      sMin = sMax;
+      sMax = temp;
     }
     //remove saturated
     if (S(i) || a(i) == 0) {  // if it is not 0 (safer)
-      Smin(i) = -inf;
-      Smax(i) = inf;
+      sMin = -inf;
+      sMax = inf;
+    }
 
+    if (i == 0 || sMax < smax) {
+      smax = sMax;
+      *mostCriticalJoint = i;
+    }
+    if (i == 0 || sMin > smin) {
+      smin = sMin;
     }
   }
 
-  smax = Smax.minCoeff(mostCriticalJoint, &col);
-  smin = Smin.maxCoeff();
-
   if ((smin > smax) || (smax < 0.0) || (smin > 1.0) || (smax == inf)) {
     (*scalingFactor) = -1.0;  // the task is not feasible
   } else {
@@ -34,8 +34,8 @@ OSNS_sm_VelocityIK::OSNS_sm_VelocityIK(int dof, double loop_period) :
 
 
 double OSNS_sm_VelocityIK::getJointVelocity(Eigen::VectorXd *jointVelocity,
-    const std::vector<Task> &sot,
-    const Eigen::VectorXd &jointConfiguration)
+    const std::vector<TaskView> &sot,
+    const Eigen::Ref<const Eigen::VectorXd> &jointConfiguration)
 {
   // This will only reset member variables if different from previous values
   setNumberOfTasks(sot.size(), sot[0].jacobian.cols());
@@ -44,42 +44,41 @@ double OSNS_sm_VelocityIK::getJointVelocity(Eigen::VectorXd *jointVelocity,
 
   //P_0=I
   //dq_0=0
-  Eigen::MatrixXd P = Eigen::MatrixXd::Identity(n_dof, n_dof);
-  *jointVelocity = Eigen::VectorXd::Zero(n_dof, 1);
-  Eigen::VectorXd higherPriorityJointVelocity;
-  Eigen::MatrixXd higherPriorityNull;
+  m_P.setIdentity(n_dof, n_dof);
+  jointVelocity->setZero(n_dof);
 
   shapeJointVelocityBound(jointConfiguration, m_scaleMargin);
 
-  Eigen::MatrixXd PS = Eigen::MatrixXd::Identity(n_dof, n_dof);
+  m_PS.setIdentity(n_dof, n_dof);
 
   for (int i_task = 0; i_task < n_tasks; i_task++) {  //consider all tasks
-    higherPriorityJointVelocity = *jointVelocity;
-    higherPriorityNull = P;
+    m_higherPriorityJointVelocity = *jointVelocity;
+    m_higherPriorityNull = m_P;
 
-    scaleFactors[i_task] = SNSsingle(i_task, higherPriorityJointVelocity, higherPriorityNull,
-        sot[i_task].jacobian, sot[i_task].desired, jointVelocity, &PS);
+    scaleFactors[i_task] = SNSsingle(i_task, m_higherPriorityJointVelocity, m_higherPriorityNull,
+        sot[i_task], sot[i_task].desired, jointVelocity, &m_PS);
 
     if (scaleFactors[i_task] < 0) {
       //second chance
-      W[i_task] = I;
-      PS = higherPriorityNull;
-      scaleFactors[i_task] = SNSsingle(i_task, higherPriorityJointVelocity, higherPriorityNull,
-          sot[i_task].jacobian, sot[i_task].desired, jointVelocity, &PS);
+      W[i_task].reset(n_dof);
+      m_PS = m_higherPriorityNull;
+      scaleFactors[i_task] = SNSsingle(i_task, m_higherPriorityJointVelocity, m_higherPriorityNull,
+          sot[i_task], sot[i_task].desired, jointVelocity, &m_PS);
 
     }
 
     if (scaleFactors[i_task] > 0.0) {
       if (scaleFactors[i_task] * m_scaleMargin < (1.0)) {
         double taskScale = scaleFactors[i_task] * m_scaleMargin;
-        Eigen::VectorXd scaledTask = sot[i_task].desired * taskScale;
-        scaleFactors[i_task] = SNSsingle(i_task, higherPriorityJointVelocity, higherPriorityNull,
-            sot[i_task].jacobian, scaledTask, jointVelocity, &P);
+        Eigen::VectorXd &scaledTask = m_taskWs[i_task].scaledTask;
+        scaledTask = sot[i_task].desired * taskScale;
+        scaleFactors[i_task] = SNSsingle(i_task, m_higherPriorityJointVelocity, m_higherPriorityNull,
+            sot[i_task], scaledTask, jointVelocity, &m_P);
         scaleFactors[i_task] = taskScale;
 
       } else {
         scaleFactors[i_task] = 1.0;
-        P = PS;
+        m_P = m_PS;
       }
     }
   }
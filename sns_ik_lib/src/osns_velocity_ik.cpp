@@ -33,8 +33,8 @@ OSNSVelocityIK::OSNSVelocityIK(int dof, double loop_period) :
 
 
 double OSNSVelocityIK::getJointVelocity(Eigen::VectorXd *jointVelocity,
-    const std::vector<Task> &sot,
-    const Eigen::VectorXd &jointConfiguration)
+    const std::vector<TaskView> &sot,
+    const Eigen::Ref<const Eigen::VectorXd> &jointConfiguration)
 {
   // This will only reset member variables if different from previous values
   setNumberOfTasks(sot.size(), sot[0].jacobian.cols());
@@ -43,18 +43,16 @@ double OSNSVelocityIK::getJointVelocity(Eigen::VectorXd *jointVelocity,
 
   //P_0=I
   //dq_0=0
-  Eigen::MatrixXd P = Eigen::MatrixXd::Identity(n_dof, n_dof);
-  *jointVelocity = Eigen::VectorXd::Zero(n_dof, 1);
-  Eigen::VectorXd higherPriorityJointVelocity;
-  Eigen::MatrixXd higherPriorityNull;
+  m_P.setIdentity(n_dof, n_dof);
+  jointVelocity->setZero(n_dof);
 
   shapeJointVelocityBound(jointConfiguration);
 
   for (int i_task = 0; i_task < n_tasks; i_task++) {  //consider all tasks
-    higherPriorityJointVelocity = *jointVelocity;
-    higherPriorityNull = P;
-    scaleFactors[i_task] = SNSsingle(i_task, higherPriorityJointVelocity, higherPriorityNull,
-        sot[i_task].jacobian, sot[i_task].desired, jointVelocity, &P);
+    m_higherPriorityJointVelocity = *jointVelocity;
+    m_higherPriorityNull = m_P;
+    scaleFactors[i_task] = SNSsingle(i_task, m_higherPriorityJointVelocity, m_higherPriorityNull,
+        sot[i_task], sot[i_task].desired, jointVelocity, &m_P);
   }
 
   // TODO: verify what is being set here
@@ -66,19 +64,21 @@ double OSNSVelocityIK::getJointVelocity(Eigen::VectorXd *jointVelocity,
 double OSNSVelocityIK::SNSsingle(int priority,
                                 const Eigen::VectorXd &higherPriorityJointVelocity,
                                 const Eigen::MatrixXd &higherPriorityNull,
-                                const Eigen::MatrixXd &jacobian,
-                                const Eigen::VectorXd &task,
+                                const TaskView &sotTask,
+                                const Eigen::Ref<const Eigen::VectorXd> &task,
                                 Eigen::VectorXd *jointVelocity,
                                 Eigen::MatrixXd *nullSpaceProjector)
 {
+  const Eigen::Ref<const Eigen::MatrixXd> &jacobian = sotTask.jacobian;
+
   //INITIALIZATION
+  TaskWorkspace &ws = m_taskWs[priority];
   //Eigen::VectorXd tildeDotQ;
-  Eigen::MatrixXd projectorSaturated;  //(((I-W_k)*P_{k-1})^#
-  Eigen::MatrixXd JPinverse;  //(J_k P_{k-1})^#
-  Eigen::MatrixXd temp;
+  Eigen::MatrixXd &projectorSaturated = ws.projectorSaturated;  //(((I-W_k)*P_{k-1})^#
+  Eigen::MatrixXd &JPinverse = ws.JPinverse;  //(J_k P_{k-1})^#
   bool isW_identity;
-  Eigen::MatrixXd barP = higherPriorityNull;  // remove the pointer arguments advantage... but I need to modify it
-  Eigen::ArrayXd a, b;  // used to compute the task scaling factor
+  Eigen::MatrixXd &barP = ws.barP;
+  Eigen::ArrayXd &a = ws.a, &b = ws.b;  // used to compute the task scaling factor
   bool limit_excedeed;
   bool singularTask = false;
   bool reachedSingularity = false;
@@ -87,14 +87,14 @@ double OSNSVelocityIK::SNSsingle(int priority,
 
   //best solution
   double bestScale = -0.1;
-  Eigen::MatrixXd bestW;  //(only in OSNS)
-  Eigen::MatrixXd bestInvJP;
-  Eigen::VectorXd bestDotQn;
-  Eigen::MatrixXd bestTildeP;
+  JointMask &bestW = ws.bestW;  //(only in OSNS)
+  Eigen::MatrixXd &bestInvJP = ws.bestInvJP;
+  Eigen::VectorXd &bestDotQn = ws.bestDotQn;
+  Eigen::MatrixXd &bestTildeP = ws.bestTildeP;
 
-  Eigen::VectorXd dotQn;  //saturate velocity in the null space
-  Eigen::VectorXd dotQs;
-  Eigen::MatrixXd tildeP;  // used in the  OSNS
+  Eigen::VectorXd &dotQn = ws.dotQn;  //saturate velocity in the null space
+  Eigen::VectorXd &dotQs = ws.dotQs;
+  Eigen::MatrixXd &tildeP = ws.tildeP;  // used in the  OSNS
 
   //these two are needed to consider also W=I in case of a non feasible task
   bool invJPcomputed = false;
@@ -103,20 +103,26 @@ double OSNSVelocityIK::SNSsingle(int priority,
 
   //Compute the solution with W=I it is needed anyway to obtain nullSpaceProjector
   //compute (J P)^#
-  temp = jacobian * higherPriorityNull;
-  singularTask = !pinv_damped_P(temp, &JPinverse, nullSpaceProjector);
-
-  tildeP = Eigen::MatrixXd::Zero(n_dof, n_dof);
-  dotQs = higherPriorityJointVelocity + JPinverse * (task - jacobian * higherPriorityJointVelocity);
-  a = (JPinverse * task).array();
+  barP = higherPriorityNull;
+  ws.JP.noalias() = jacobian * higherPriorityNull;
+  singularTask = !pinv_damped_P(ws.JP, &JPinverse, nullSpaceProjector, &ws.pinvJP);
+
+  tildeP.setZero(n_dof, n_dof);
+  // dotQs = higherPriorityJointVelocity + JPinverse * (task - jacobian * higherPriorityJointVelocity)
+  ws.taskErr = task;
+  ws.taskErr.noalias() -= jacobian * higherPriorityJointVelocity;
+  dotQs = higherPriorityJointVelocity;
+  dotQs.noalias() += JPinverse * ws.taskErr;
+  ws.Jtask.noalias() = JPinverse * task;
+  a = ws.Jtask.array();
   b = dotQs.array() - a;
-  getTaskScalingFactor(a, b, I, &scalingFactor, &mostCriticalJoint);
+  getTaskScalingFactor(a, b, noSaturation, &scalingFactor, &mostCriticalJoint);
 
   //double scalingI=scalingFactor;
   if (scalingFactor >= 1.0) {
     // this is clearly the optimum since all joints velocity are computed with the pseudoinverse
     (*jointVelocity) = dotQs;
-    W[priority] = I;
+    W[priority].reset(n_dof);
     dotQopt[priority] = dotQs;
     return scalingFactor;
   }
@@ -124,13 +130,14 @@ double OSNSVelocityIK::SNSsingle(int priority,
   if (singularTask) {
     // the task is singular so return a scaled damped solution (no SNS possible)
     if (scalingFactor >= 0.0) {
-      W[priority] = I;
-      (*jointVelocity) = higherPriorityJointVelocity + scalingFactor * JPinverse * task
-          + tildeP * higherPriorityJointVelocity;
+      W[priority].reset(n_dof);
+      (*jointVelocity) = higherPriorityJointVelocity;
+      jointVelocity->noalias() += scalingFactor * JPinverse * task;
+      jointVelocity->noalias() += tildeP * higherPriorityJointVelocity;
       dotQopt[priority] = *jointVelocity;
     } else {
       // the task is not executed
-      W[priority] = I;
+      W[priority].reset(n_dof);
       *jointVelocity = higherPriorityJointVelocity;
       dotQopt[priority] = *jointVelocity;
       *nullSpaceProjector = higherPriorityNull;
@@ -143,24 +150,24 @@ double OSNSVelocityIK::SNSsingle(int priority,
     bestScale = scalingFactor;
     //bestTildeDotQ=tildeDotQ;
     bestInvJP = JPinverse;
-    bestW = I;
+    bestW.reset(n_dof);
     bestTildeP = tildeP;
     //bestPS=projectorSaturated;
-    bestDotQn = Eigen::VectorXd::Zero(n_dof);
+    bestDotQn.setZero(n_dof);
   }
 
   //W[priority] = I;  //test: do not use the warm start
 //----------------------------------------------------------------------- END W=I
 
   //INIT
-  dotQn = Eigen::VectorXd::Zero(n_dof);
-  if (isIdentity (W[priority])) {
+  dotQn.setZero(n_dof);
+  if (W[priority].allFree()) {
     isW_identity = true;
     dotQopt[priority] = dotQs;  // use the one computed above
   } else {
     isW_identity = false;
     for (int i = 0; i < n_dof; i++) {
-      if ((W[priority])(i, i) < 0.1) {  // equal to 0.0 (safer)
+      if (!W[priority].isFree(i)) {
         //nSat[priority]++;
         //I'm not considering a different dotQ for each task... this could be a little improvement
         if (dotQopt[priority](i) >= 0.0) {
@@ -182,11 +189,10 @@ double OSNSVelocityIK::SNSsingle(int priority,
       // the task is not executed
       if (bestScale >= 0.0) {
         W[priority]=bestW;
-        dotQopt[priority] = higherPriorityJointVelocity
-            + bestInvJP *( bestScale * task - jacobian * higherPriorityJointVelocity)
-            + bestTildeP * bestDotQn;
+        computeSolution(priority, higherPriorityJointVelocity, jacobian, task, bestScale,
+                        bestInvJP, bestTildeP, bestDotQn, &dotQopt[priority]);
       } else {
-        W[priority] = I;
+        W[priority].reset(n_dof);
         dotQopt[priority] = higherPriorityJointVelocity;
       }
 
@@ -198,29 +204,34 @@ double OSNSVelocityIK::SNSsingle(int priority,
 
     if (!isW_identity && !invJPcomputed) {
       if (priority == 0) {  //for the primary task higherPriorityNull==I
-        barP = W[0];
-        projectorSaturated = (I - W[0]);
+        // barP = W  -->  J * barP = J * W
+        W[0].getSaturatedSelectionMatrix(&projectorSaturated);  // I - W
+        W[0].selectFreeColumns(jacobian, &ws.JP);
       } else {
-        temp = (I - W[priority]);
-        reachedSingularity |= !pinv_forBarP(temp, higherPriorityNull, &projectorSaturated);
-        barP = (I - projectorSaturated) * higherPriorityNull;
+        reachedSingularity |= !pinv_forBarP(W[priority].saturated(), higherPriorityNull,
+                                            &projectorSaturated, &ws.pinvBarP);
+        barP = higherPriorityNull;
+        barP.noalias() -= projectorSaturated * higherPriorityNull;
+        ws.JP.noalias() = jacobian * barP;
       }
-      temp = jacobian * barP;
-      reachedSingularity |= !pinv(temp, &JPinverse);
+      reachedSingularity |= !pinv(ws.JP, &JPinverse, &ws.pinvJP);
 
       invJPcomputed = false;  //it needs to be computed for the next step
     }
     if (!isW_identity) {
 
-      tildeP = (I - JPinverse * jacobian) * projectorSaturated;
+      // tildeP = (I - JPinverse * jacobian) * projectorSaturated
+      ws.JPs.noalias() = jacobian * projectorSaturated;
+      tildeP = projectorSaturated;
+      tildeP.noalias() -= JPinverse * ws.JPs;
 
       //compute the joint velocity
-      dotQopt[priority] = higherPriorityJointVelocity
-          + JPinverse * (task - jacobian * higherPriorityJointVelocity)
-          + tildeP * dotQn;
+      computeSolution(priority, higherPriorityJointVelocity, jacobian, task, 1.0,
+                      JPinverse, tildeP, dotQn, &dotQopt[priority]);
 
       //compute the scaling factor
-      a = (JPinverse * task).array();
+      ws.Jtask.noalias() = JPinverse * task;
+      a = ws.Jtask.array();
       b = dotQopt[priority].array() - a;
       getTaskScalingFactor(a, b, W[priority], &scalingFactor, &mostCriticalJoint);
 
@@ -245,8 +256,8 @@ double OSNSVelocityIK::SNSsingle(int priority,
 
       // is scaled an optimum
       if (scalingFactor >= 0) {
-        dotQs = higherPriorityJointVelocity
-            + JPinverse * (scalingFactor * task - jacobian * higherPriorityJointVelocity) + tildeP * dotQn;
+        computeSolution(priority, higherPriorityJointVelocity, jacobian, task, scalingFactor,
+                        JPinverse, tildeP, dotQn, &dotQs);
         if (!isOptimal(priority, dotQs, tildeP, &W[priority], &dotQn)) {
           //ROS_INFO("non OPT s");
           //modified W and dotQn
@@ -269,7 +280,7 @@ double OSNSVelocityIK::SNSsingle(int priority,
       limit_excedeed = true;  //if it was W=I, to be here the limit is exceeded
 
     //nSat[priority]++;
-    W[priority](mostCriticalJoint, mostCriticalJoint) = 0.0;
+    W[priority].saturate(mostCriticalJoint);
     isW_identity = false;
     if (dotQopt[priority](mostCriticalJoint) > dotQmax(mostCriticalJoint)) {
       dotQn(mostCriticalJoint) = dotQmax(mostCriticalJoint) - higherPriorityJointVelocity(mostCriticalJoint);
@@ -279,15 +290,17 @@ double OSNSVelocityIK::SNSsingle(int priority,
 
     //compute JPinverse
     if (priority == 0) {  //for the primary task higherPriorityNull==I
-      barP = W[0];
-      projectorSaturated = (I - W[0]);
+      // barP = W  -->  J * barP = J * W
+      W[0].getSaturatedSelectionMatrix(&projectorSaturated);  // I - W
+      W[0].selectFreeColumns(jacobian, &ws.JP);
     } else {
-      temp = (I - W[priority]);
-      reachedSingularity |= !pinv_forBarP(temp, higherPriorityNull, &projectorSaturated);
-      barP = (I - projectorSaturated) * higherPriorityNull;
+      reachedSingularity |= !pinv_forBarP(W[priority].saturated(), higherPriorityNull,
+                                          &projectorSaturated, &ws.pinvBarP);
+      barP = higherPriorityNull;
+      barP.noalias() -= projectorSaturated * higherPriorityNull;
+      ws.JP.noalias() = jacobian * barP;
     }
-    temp = jacobian * barP;
-    reachedSingularity |= !pinv(temp, &JPinverse);
+    reachedSingularity |= !pinv(ws.JP, &JPinverse, &ws.pinvJP);
 
     invJPcomputed = true;
     //if reachedSingularity then take the best solution
@@ -295,9 +308,8 @@ double OSNSVelocityIK::SNSsingle(int priority,
     if ((reachedSingularity) || (scalingFactor < 1e-12)) {
       if (bestScale >= 0.0) {
         W[priority] = bestW;
-        dotQopt[priority] = higherPriorityJointVelocity
-            + bestInvJP * (bestScale * task - jacobian * higherPriorityJointVelocity)
-            + bestTildeP * bestDotQn;
+        computeSolution(priority, higherPriorityJointVelocity, jacobian, task, bestScale,
+                        bestInvJP, bestTildeP, bestDotQn, &dotQopt[priority]);
       } else {
         dotQopt[priority] = higherPriorityJointVelocity;
       }
@@ -312,22 +324,22 @@ double OSNSVelocityIK::SNSsingle(int priority,
 }
 
 bool OSNSVelocityIK::isOptimal(int priority, const Eigen::VectorXd& dotQ,
-                               const Eigen::MatrixXd& tildeP, Eigen::MatrixXd* W,
+                               const Eigen::MatrixXd& tildeP, JointMask* W,
                                Eigen::VectorXd* dotQn, double eps) {
 
-  Eigen::VectorXd barMu;
+  Eigen::VectorXd &barMu = m_taskWs[priority].barMu;
   bool isOptimal = true;
 
-  barMu = tildeP.transpose() * dotQ;
+  barMu.noalias() = tildeP.transpose() * dotQ;
 
   for (int i = 0; i < n_dof; i++) {
-    if ((*W)(i, i) < 0.1) {  //equal to 0.0 (safer)
+    if (!W->isFree(i)) {
 
       if (abs(dotQ(i) - dotQmax(i)) < eps)
         barMu(i) = -barMu(i);
 
       if (barMu(i) < 0.0) {
-        (*W)(i, i) = 1.0;
+        W->release(i);
         (*dotQn)(i) = 0.0;
         isOptimal = false;
       }
@@ -337,4 +349,20 @@ bool OSNSVelocityIK::isOptimal(int priority, const Eigen::VectorXd& dotQ,
   return isOptimal;
 }
 
+void OSNSVelocityIK::computeSolution(int priority, const Eigen::VectorXd &higherPriorityJointVelocity,
+                                     const Eigen::Ref<const Eigen::MatrixXd> &jacobian,
+                                     const Eigen::Ref<const Eigen::VectorXd> &task,
+                                     double scale, const Eigen::MatrixXd &invJP,
+                                     const Eigen::MatrixXd &tildeP, const Eigen::VectorXd &dotQn,
+                                     Eigen::VectorXd *dotQ)
+{
+  Eigen::VectorXd &taskErr = m_taskWs[priority].taskErr;
+
+  taskErr = scale * task;
+  taskErr.noalias() -= jacobian * higherPriorityJointVelocity;
+  *dotQ = higherPriorityJointVelocity;
+  dotQ->noalias() += invJP * taskErr;
+  dotQ->noalias() += tildeP * dotQn;
+}
+
 }  // namespace sns_ik
@@ -25,6 +25,47 @@
 
 namespace sns_ik {
 
+namespace {
+
+/*
+ * Acceleration solver that runs a fixed-size kernel whenever the jacobian is [NTask, NJnt], and
+ * falls back to the dynamic kernel otherwise.
+ */
+template <int NTask, int NJnt>
+class SnsAccIkFixed : public SnsAccIkBase {
+
+public:
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  SnsAccIkFixed() : SnsAccIkBase(NJnt) {};
+
+protected:
+
+  virtual ExitCode solveKernel(const Eigen::MatrixXd& J, const Eigen::VectorXd& dJdq,
+                               const Eigen::VectorXd& ddx, Eigen::VectorXd* ddq, double* taskScale)
+  {
+    if (J.rows() != NTask || J.cols() != NJnt) {
+      return SnsAccIkBase::solveKernel(J, dJdq, ddx, ddq, taskScale);
+    }
+    typename SnsIkKernel<NTask, NJnt>::TaskMatrix Jfix = J;
+    typename SnsIkKernel<NTask, NJnt>::TaskVector dJdqFix = dJdq;
+    typename SnsIkKernel<NTask, NJnt>::TaskVector ddxFix = ddx;
+    typename SnsIkKernel<NTask, NJnt>::JointVector ddqFix;
+    ExitCode exitCode = fixedKernel_.solveAcc(getLowerBounds(), getUpperBounds(), Jfix, dJdqFix,
+                                              ddxFix, &ddqFix, taskScale, getKernelState());
+    *ddq = ddqFix;
+    return exitCode;
+  }
+
+private:
+
+  SnsIkKernel<NTask, NJnt> fixedKernel_;
+
+};  // class SnsAccIkFixed
+
+}  // namespace
+
 /*************************************************************************************************
  *                                 Public Methods                                                *
  *************************************************************************************************/
@@ -42,7 +83,8 @@ SnsAccIkBase::uPtr SnsAccIkBase::create(int nJnt)
 
 /*************************************************************************************************/
 
-SnsAccIkBase::uPtr SnsAccIkBase::create(const Eigen::ArrayXd& ddqLow, const Eigen::ArrayXd& ddqUpp)
+SnsAccIkBase::uPtr SnsAccIkBase::create(const Eigen::ArrayXd& ddqLow, const Eigen::ArrayXd& ddqUpp,
+                                        bool useFixedSizeKernel)
 {
   // Input validation
   int nJnt = ddqLow.size();
@@ -51,8 +93,14 @@ SnsAccIkBase::uPtr SnsAccIkBase::create(const Eigen::ArrayXd& ddqLow, const Eige
     return nullptr;
   }
 
-  // Create an empty solver
-  SnsAccIkBase::uPtr accIk(new SnsAccIkBase(nJnt));
+  // Create an empty solver, using a fixed-size kernel for a full pose task on common arms
+  SnsAccIkBase::uPtr accIk;
+  switch (useFixedSizeKernel ? nJnt : 0) {
+    case 6: accIk.reset(new SnsAccIkFixed<6, 6>()); break;
+    case 7: accIk.reset(new SnsAccIkFixed<6, 7>()); break;
+    case 8: accIk.reset(new SnsAccIkFixed<6, 8>()); break;
+    default: accIk.reset(new SnsAccIkBase(nJnt));
+  }
 
   // Set the joint limits:
   if (!accIk->setBounds(ddqLow, ddqUpp)) { ROS_ERROR("Bad Input!"); return nullptr; };
@@ -87,133 +135,7 @@ SnsIkBase::ExitCode SnsAccIkBase::solve(const Eigen::MatrixXd& J, const Eigen::V
     return ExitCode::BadUserInput;
   }
 
-  // Local variable initialization:
-  Eigen::MatrixXd W = Eigen::MatrixXd::Identity(getNrOfJoints(), getNrOfJoints());  // null-space selection matrix
-  Eigen::VectorXd ddqNull = Eigen::VectorXd::Zero(getNrOfJoints());  // acceleration in the null-space
-  *taskScale = 1.0;  // task scale (assume feasible solution until proven otherwise)
-
-  // Temp. variables to store the best solution
-  double bestTaskScale = 0.0;  // temp variable to track the lower bound on the task scale between iterations
-  Eigen::MatrixXd bestW;  // temp variable to track W before it has been accepted
-  Eigen::VectorXd bestDdqNull;  // temp variable to track dqNull between iterations
-
-  // Set the linear solver for this iteration:
-  if(setLinearSolver(J*W) != ExitCode::Success) {
-    ROS_ERROR("Solver failed to set linear solver!");
-    return ExitCode::InternalError;
-  }
-
-  // Keep track of which joints are saturated:
-  std::vector<bool> jointIsFree(getNrOfJoints(), true);
-
-  // Main solver loop:
-  double resErr;  // residual error in the linear solver
-  for (size_t iter = 0; iter < getNrOfJoints() * MAXIMUM_SOLVER_ITERATION_FACTOR; iter++) {
-
-    // Compute the joint acceleration given current saturation set:
-    if (solveProjectionEquation(J, dJdq, ddqNull, ddx, ddq, &resErr) != ExitCode::Success) {
-      ROS_ERROR("Failed to solve projection equation!");
-      return ExitCode::InternalError;
-    }
-    if (resErr > LIN_SOLVE_RESIDUAL_TOL) { // check that the solver found a feasible solution
-      ROS_ERROR("Task is infeasible!  resErr: %e > tol: %e", resErr, LIN_SOLVE_RESIDUAL_TOL);
-      return ExitCode::InfeasibleTask;
-    }
-
-    // Check to see if the solution satisfies the joint limits
-    if (checkBounds(*ddq)) { // Done! solution is feasible and task scale is at maximum value
-      return ExitCode::Success;
-    }  //  else joint acceleration is infeasible: saturate joint and then try again
-
-    // Compute the task scaling factor
-    double tmpScale;
-    int jntIdx;
-    ExitCode taskScaleExit = computeTaskScalingFactor(J, ddx, *ddq, jointIsFree, &tmpScale, &jntIdx, &resErr);
-    if (resErr > LIN_SOLVE_RESIDUAL_TOL) { // check that the solver found a feasible solution
-      ROS_ERROR("Failed to compute task scale!  resErr: %e > tol: %e", resErr, LIN_SOLVE_RESIDUAL_TOL);
-      return ExitCode::InfeasibleTask;
-    }
-    if (taskScaleExit != ExitCode::Success) {
-      ROS_ERROR("Failed to compute task scale!");
-      return taskScaleExit;
-    }
-    if (tmpScale < MINIMUM_FINITE_SCALE_FACTOR) { // check that the solver found a feasible solution
-      ROS_ERROR("Task is infeasible! scaling --> zero");
-      return ExitCode::InfeasibleTask;
-    }
-
-    if (tmpScale > 1.0) {
-      ROS_ERROR("Task scale is %f, which is more than 1.0", tmpScale);
-      return ExitCode::InternalError;
-    }
-
-    // If the task scale exceeds previous, then cache the results as "best so far"
-    // Also if the current best so far solution violates the limits, update bestTakeScale
-    Eigen::VectorXd ddxScaledTmp = (ddx.array() * bestTaskScale).matrix();
-    Eigen::VectorXd ddqTmp;
-    if (solveProjectionEquation(J, dJdq, ddqNull, ddxScaledTmp, &ddqTmp, &resErr) != ExitCode::Success) {
-      ROS_ERROR("Failed to solve projection equation!");
-      return ExitCode::InternalError;
-    }
-    if (resErr > LIN_SOLVE_RESIDUAL_TOL) { // check that the solver found a feasible solution
-      ROS_ERROR("Task is infeasible!  resErr: %e > tol: %e", resErr, LIN_SOLVE_RESIDUAL_TOL);
-      return ExitCode::InfeasibleTask;
-    }
-    if (tmpScale > bestTaskScale || !checkBounds(ddqTmp)) {
-      bestTaskScale = tmpScale;
-      bestW = W;
-      bestDdqNull = ddqNull;
-    }
-
-    // Saturate the most critical joint
-    W(jntIdx, jntIdx) = 0.0;
-    jointIsFree[jntIdx] = false;
-    if ((*ddq)(jntIdx) > (getUpperBounds())(jntIdx)) {
-      ddqNull(jntIdx) = (getUpperBounds())(jntIdx);
-    } else if ((*ddq)(jntIdx) < (getLowerBounds())(jntIdx)) {
-      ddqNull(jntIdx) = (getLowerBounds())(jntIdx);
-    } else {
-      ROS_ERROR("Internal error in computing task scale!  ddq(%d) = %f", jntIdx, (*ddq)(jntIdx));
-      return ExitCode::InternalError;
-    }
-
-    // Update the linear solver
-    if (setLinearSolver(J*W) != ExitCode::Success) {
-      ROS_ERROR("Solver failed to set linear solver!");
-      return ExitCode::InternalError;
-    }
-
-    // Test the rank:
-    if (getLinSolverRank() < nTask) { // no more degrees of freedom: scale the task
-      (*taskScale) = bestTaskScale;
-      W = bestW;
-      ddqNull = bestDdqNull;
-
-      // Update the linear solver
-      if (setLinearSolver(J * W) != ExitCode::Success) {
-        ROS_ERROR("Solver failed to set linear solver!");
-        return ExitCode::InternalError;
-      }
-
-      // Compute the joint acceleration given current saturation set:
-      Eigen::VectorXd ddxScaled = (ddx.array() * (*taskScale)).matrix();
-      if (solveProjectionEquation(J, dJdq, ddqNull, ddxScaled, ddq, &resErr) != ExitCode::Success) {
-        ROS_ERROR("Failed to solve projection equation!");
-        return ExitCode::InternalError;
-      }
-      if (resErr > LIN_SOLVE_RESIDUAL_TOL) { // check that the solver found a feasible solution
-        ROS_ERROR("Task is infeasible!  resErr: %e > tol: %e", resErr, LIN_SOLVE_RESIDUAL_TOL);
-        return ExitCode::InfeasibleTask;
-      }
-
-      return ExitCode::Success;  // DONE
-
-    } // end rank test
-
-  }  // end main solver loop
-
-  ROS_ERROR("Internal Error: reached maximum iteration in solver main loop!");
-  return ExitCode::InternalError;
+  return solveKernel(J, dJdq, ddx, ddq, taskScale);
 }
 
 /*************************************************************************************************/
@@ -241,20 +163,16 @@ SnsIkBase::ExitCode SnsAccIkBase::solve(const Eigen::MatrixXd& J, const Eigen::V
   *taskScaleCS = 1.0;  // task scale (assume feasible solution until proven otherwise)
   Eigen::MatrixXd I = Eigen::MatrixXd::Identity(getNrOfJoints(), getNrOfJoints());
 
-  // Keep track of which joints are saturated:
-  std::vector<bool> jointIsFree(getNrOfJoints(), true);
-
   /*
-   * W is a diagonal selection matrix which indicates free joints.
+   * The joint mask is equivalent to a diagonal selection matrix W which indicates free joints.
    * The entry of 1 indicates the corresponding joint is free for the task,
    * and 0 indicates the corresponding joint is saturated.
    */
-  Eigen::MatrixXd W = I;  // null-space selection matrix
+  JointMask mask(getNrOfJoints());  // null-space selection matrix
   for (size_t jntIdx = 0; jntIdx < getNrOfJoints(); jntIdx++) {
     if (ddq1(jntIdx) > (getUpperBounds())(jntIdx) + BOUND_TOLERANCE ||
         ddq1(jntIdx) < (getLowerBounds())(jntIdx) - BOUND_TOLERANCE) {
-          W(jntIdx, jntIdx) = 0.0;
-          jointIsFree[jntIdx] = false;
+          mask.saturate(jntIdx);
     }
   }
 
@@ -266,9 +184,11 @@ SnsIkBase::ExitCode SnsAccIkBase::solve(const Eigen::MatrixXd& J, const Eigen::V
   }
 
   Eigen::MatrixXd P1 = I - Jinv*J; // for primary task
-  if(!pinv((I - W)*P1, &Pinv, PINV_TOL)){
+  Eigen::MatrixXd IWP;  // (I - W)*P1
+  mask.selectSaturatedRows(P1, &IWP);
+  if(!pinv(IWP, &Pinv, PINV_TOL)){
     // if (I-W) is a zero matrix, inverse is the same
-    Pinv = (I - W)*P1;
+    Pinv = IWP;
   }
   Eigen::MatrixXd Pcs = (I - Pinv)*P1; // for both primary and joint saturation tasks
 
@@ -284,7 +204,7 @@ SnsIkBase::ExitCode SnsAccIkBase::solve(const Eigen::MatrixXd& J, const Eigen::V
   Eigen::ArrayXd lowMargin = (getLowerBounds() - b);
   Eigen::ArrayXd uppMargin = (getUpperBounds() - b);
   for (size_t i = 0; i < getNrOfJoints(); i++) {
-    if (jointIsFree[i]) {
+    if (mask.isFree(i)) {
       jntScaleFactorArr(i) = findScaleFactor(lowMargin(i), uppMargin(i), a(i));
     } else {  // joint is constrained
       jntScaleFactorArr(i) = POS_INF;
@@ -325,4 +245,14 @@ SnsIkBase::ExitCode SnsAccIkBase::solve(const Eigen::MatrixXd& J, const Eigen::V
  *                               Protected Methods                                               *
  *************************************************************************************************/
 
+SnsIkBase::ExitCode SnsAccIkBase::solveKernel(const Eigen::MatrixXd& J, const Eigen::VectorXd& dJdq,
+                                              const Eigen::VectorXd& ddx, Eigen::VectorXd* ddq,
+                                              double* taskScale)
+{
+  return kernel_.solveAcc(getLowerBounds(), getUpperBounds(), J, dJdq, ddx, ddq, taskScale,
+                          getKernelState());
+}
+
+/*************************************************************************************************/
+
 }  // namespace sns_ik
@@ -0,0 +1,183 @@
+/** @file sns_chain_kinematics.cpp
+ *
+ * @brief Forward kinematics and Jacobian of a serial chain, computed in a single pass
+ *
+ *    Copyright 2018 Rethink Robotics
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+#include <sns_ik/sns_chain_kinematics.hpp>
+
+#include <kdl/joint.hpp>
+#include <kdl/segment.hpp>
+
+namespace sns_ik {
+
+namespace {
+
+void toEigen(const KDL::Frame& frame, Eigen::Matrix3d* R, Eigen::Vector3d* p)
+{
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      (*R)(i, j) = frame.M(i, j);
+    }
+    (*p)(i) = frame.p(i);
+  }
+}
+
+void toKdl(const Eigen::Matrix3d& R, const Eigen::Vector3d& p, KDL::Frame* frame)
+{
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      frame->M.data[3 * i + j] = R(i, j);
+    }
+    frame->p.data[i] = p(i);
+  }
+}
+
+}  // namespace
+
+/*************************************************************************************************/
+
+ChainKinematics::ChainKinematics(const KDL::Chain& chain)
+{
+  // Transform from the frame of the last joint to the base of the current segment
+  KDL::Frame fixed = KDL::Frame::Identity();
+  for (const KDL::Segment& segment : chain.segments) {
+    const KDL::Joint& joint = segment.getJoint();
+    if (joint.getType() == KDL::Joint::None) {
+      fixed = fixed * segment.pose(0.0);
+      continue;
+    }
+
+    // KDL: segment.pose(q) = joint.pose(0) * motion(q) * joint.pose(0).Inverse() * segment.pose(0)
+    KDL::Frame jointFrame = joint.pose(0.0);
+    KDL::Vector axis = joint.JointAxis();
+    axis.Normalize();
+    KDL::Twist unitTwist = joint.twist(1.0);
+    Joint data;
+    toEigen(fixed * jointFrame, &data.R, &data.p);
+    data.axis << axis.x(), axis.y(), axis.z();
+    switch (joint.getType()) {
+      case KDL::Joint::RotAxis:
+      case KDL::Joint::RotX:
+      case KDL::Joint::RotY:
+      case KDL::Joint::RotZ:
+        data.motion = Motion::Rotation;
+        data.scale = KDL::dot(unitTwist.rot, axis);
+        break;
+      default:
+        data.motion = Motion::Translation;
+        data.scale = KDL::dot(unitTwist.vel, axis);
+    }
+    joints_.push_back(data);
+    fixed = jointFrame.Inverse() * segment.pose(0.0);
+  }
+  toEigen(fixed, &tipR_, &tipP_);
+}
+
+/*************************************************************************************************/
+
+void ChainKinematics::computePose(const Eigen::Ref<const Eigen::VectorXd>& q, KDL::Frame* pose) const
+{
+  Eigen::Matrix3d R = Eigen::Matrix3d::Identity();
+  Eigen::Vector3d p = Eigen::Vector3d::Zero();
+  for (size_t i = 0; i < joints_.size(); i++) {
+    const Joint& joint = joints_[i];
+    p.noalias() += R * joint.p;
+    R = R * joint.R;
+    if (joint.motion == Motion::Rotation) {
+      R = R * Eigen::AngleAxisd(joint.scale * q(i), joint.axis).toRotationMatrix();
+    } else {
+      p.noalias() += (joint.scale * q(i)) * (R * joint.axis);
+    }
+  }
+  p.noalias() += R * tipP_;
+  R = R * tipR_;
+  toKdl(R, p, pose);
+}
+
+/*************************************************************************************************/
+
+void ChainKinematics::computePoseAndJacobian(const Eigen::Ref<const Eigen::VectorXd>& q,
+                                             KDL::Frame* pose, Eigen::MatrixXd* jacobian) const
+{
+  int nJnt = joints_.size();
+  jacobian->resize(6, nJnt);
+  Eigen::Matrix3d R = Eigen::Matrix3d::Identity();
+  Eigen::Vector3d p = Eigen::Vector3d::Zero();
+  for (int i = 0; i < nJnt; i++) {
+    const Joint& joint = joints_[i];
+    p.noalias() += R * joint.p;
+    R = R * joint.R;
+    Eigen::Vector3d axis = joint.scale * (R * joint.axis);
+    if (joint.motion == Motion::Rotation) {
+      // The linear part needs the tip position: store the joint position until the end of the sweep
+      jacobian->col(i).head<3>() = p;
+      jacobian->col(i).tail<3>() = axis;
+      R = R * Eigen::AngleAxisd(joint.scale * q(i), joint.axis).toRotationMatrix();
+    } else {
+      jacobian->col(i).head<3>() = axis;
+      jacobian->col(i).tail<3>().setZero();
+      p.noalias() += q(i) * axis;
+    }
+  }
+  p.noalias() += R * tipP_;
+  R = R * tipR_;
+  toKdl(R, p, pose);
+
+  // Linear velocity of the tip due to the rotation of each joint
+  for (int i = 0; i < nJnt; i++) {
+    if (joints_[i].motion == Motion::Rotation) {
+      Eigen::Vector3d lever = p - jacobian->col(i).head<3>();
+      jacobian->col(i).head<3>() = jacobian->col(i).tail<3>().cross(lever);
+    }
+  }
+}
+
+/*************************************************************************************************/
+
+void ChainKinematics::computeJacobianDotQdot(const Eigen::Ref<const Eigen::VectorXd>& q,
+                                             const Eigen::Ref<const Eigen::VectorXd>& qd,
+                                             Eigen::VectorXd* jdotQdot) const
+{
+  // Velocity propagation along the chain with zero joint accelerations. w and dw are the angular
+  // velocity and acceleration of the current frame, and a is the acceleration of its origin.
+  Eigen::Matrix3d R = Eigen::Matrix3d::Identity();
+  Eigen::Vector3d w = Eigen::Vector3d::Zero();
+  Eigen::Vector3d dw = Eigen::Vector3d::Zero();
+  Eigen::Vector3d a = Eigen::Vector3d::Zero();
+  for (size_t i = 0; i < joints_.size(); i++) {
+    const Joint& joint = joints_[i];
+    Eigen::Vector3d r = R * joint.p;
+    a += dw.cross(r) + w.cross(w.cross(r));
+    R = R * joint.R;
+    Eigen::Vector3d axis = joint.scale * (R * joint.axis);
+    Eigen::Vector3d u = qd(i) * axis;
+    if (joint.motion == Motion::Rotation) {
+      dw += w.cross(u);
+      w += u;
+      R = R * Eigen::AngleAxisd(joint.scale * q(i), joint.axis).toRotationMatrix();
+    } else {
+      // The joint slides along an axis that rotates with the previous frame: Coriolis term
+      Eigen::Vector3d d = q(i) * axis;
+      a += dw.cross(d) + w.cross(w.cross(d)) + 2.0 * w.cross(u);
+    }
+  }
+  Eigen::Vector3d r = R * tipP_;
+  a += dw.cross(r) + w.cross(w.cross(r));
+  jdotQdot->resize(6);
+  jdotQdot->head<3>() = a;
+  jdotQdot->tail<3>() = dw;
+}
+
+}  // namespace sns_ik
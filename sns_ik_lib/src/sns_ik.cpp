@@ -15,6 +15,9 @@
 // Author: Ian McMahon
 
 #include <sns_ik/sns_ik.hpp>
+#include <atomic>
+#include <cmath>
+#include <thread>
 #include <ros/ros.h>
 #include <kdl_parser/kdl_parser.hpp>
 #include <urdf/model.h>
@@ -25,8 +28,18 @@
 #include <sns_ik/fsns_velocity_ik.hpp>
 #include <sns_ik/fosns_velocity_ik.hpp>
 
+#include "sns_ik_math_utils.hpp"
+
 namespace sns_ik {
 
+  // CartToJntMultiSeed() uses the points of the Halton sequence that follow this index
+  static const int HALTON_SEQUENCE_OFFSET = 100;
+
+  // CartToJntMultiSolution() tries this number of nullspace bias targets for each solution, from
+  // the points of the Halton sequence that follow MULTI_SOLUTION_HALTON_OFFSET
+  static const int MULTI_SOLUTION_TARGET_COUNT = 4;
+  static const int MULTI_SOLUTION_HALTON_OFFSET = 2000;
+
   std::string toStr(const sns_ik::VelocitySolveType& type) {
    switch (type) {
      case sns_ik::VelocitySolveType::SNS:
@@ -53,7 +66,12 @@ namespace sns_ik {
     m_eps(eps),
     m_loopPeriod(loopPeriod),
     m_nullspaceGain(1.0),
-    m_solvetype(type)
+    m_solvetype(type),
+    m_settingsVersion(0),
+    m_batchThreadCount(0),
+    m_multiSeedCount(4),
+    m_multiSeedMode(FirstSolution),
+    m_trajectoryUseCachedSeed(true)
   {
     ros::NodeHandle node_handle("~");
     urdf::Model robot_model;
@@ -163,7 +181,12 @@ namespace sns_ik {
     m_upper_bounds(q_max),
     m_velocity(v_max),
     m_acceleration(a_max),
-    m_jointNames(jointNames)
+    m_jointNames(jointNames),
+    m_settingsVersion(0),
+    m_batchThreadCount(0),
+    m_multiSeedCount(4),
+    m_multiSeedMode(FirstSolution),
+    m_trajectoryUseCachedSeed(true)
   {
     initialize();
   }
@@ -198,65 +221,119 @@ namespace sns_ik {
     ROS_ASSERT_MSG(m_types.size()==(unsigned int)m_lower_bounds.data.size(),
                    "SNS_IK: Could not determine joint limits for all non-continuous joints");
 
-    m_jacobianSolver = std::shared_ptr<KDL::ChainJntToJacSolver>(new KDL::ChainJntToJacSolver(m_chain));
+    m_kinematics = createKinematicsBackend(m_chain);
+    m_context.reset(new SolveContext());
     ROS_ASSERT_MSG(setVelocitySolveType(m_solvetype),
                    "SNS_IK: Failed to create a new SNS velocity and position solver."); //TODO make loop rate configurable
   }
 
+  SNS_IK::SolveContext::SolveContext() :
+    m_settingsVersion(-1),
+    m_solvetype(SNS)
+  {
+  }
+
+std::shared_ptr<SNS_IK::SolveContext> SNS_IK::createSolveContext() const {
+  std::shared_ptr<SolveContext> context(new SolveContext());
+  updateContext(context.get());
+  return context;
+}
+
+std::shared_ptr<SNSVelocityIK> SNS_IK::createVelocitySolver(VelocitySolveType type) const {
+  switch (type) {
+    case sns_ik::SNS_OptimalScaleMargin:
+      return std::shared_ptr<OSNS_sm_VelocityIK>(new OSNS_sm_VelocityIK(m_chain.getNrOfJoints(), m_loopPeriod));
+    case sns_ik::SNS_Optimal:
+      return std::shared_ptr<OSNSVelocityIK>(new OSNSVelocityIK(m_chain.getNrOfJoints(), m_loopPeriod));
+    case sns_ik::SNS_Fast:
+      return std::shared_ptr<FSNSVelocityIK>(new FSNSVelocityIK(m_chain.getNrOfJoints(), m_loopPeriod));
+    case sns_ik::SNS_FastOptimal:
+      return std::shared_ptr<FOSNSVelocityIK>(new FOSNSVelocityIK(m_chain.getNrOfJoints(), m_loopPeriod));
+    case sns_ik::SNS:
+      return std::shared_ptr<SNSVelocityIK>(new SNSVelocityIK(m_chain.getNrOfJoints(), m_loopPeriod));
+    case sns_ik::SNS_Base:
+      return std::shared_ptr<SNSVelIKBaseInterface>(new SNSVelIKBaseInterface(m_chain.getNrOfJoints(), m_loopPeriod));
+    default:
+      return std::shared_ptr<SNSVelocityIK>();
+  }
+}
+
+bool SNS_IK::updateContext(SolveContext* context) const {
+  if (context->m_settingsVersion == m_settingsVersion) {
+    return true;
+  }
+  bool success = true;
+  if (context->m_solvetype != m_solvetype || !context->m_ik_vel_solver) {
+    std::shared_ptr<SNSVelocityIK> velSolver = createVelocitySolver(m_solvetype);
+    if (!velSolver) {
+      return false;
+    }
+    success = velSolver->setJointsCapabilities(m_lower_bounds.data, m_upper_bounds.data,
+                                               m_velocity.data, m_acceleration.data);
+    std::shared_ptr<SNSPositionIK> posSolver(new SNSPositionIK(m_chain, velSolver, m_eps));
+    std::vector<bool> continuous(m_types.size());
+    for (size_t j = 0; j < m_types.size(); j++) {
+      continuous[j] = m_types[j] == SNS_IK::JointType::Continuous;
+    }
+    posSolver->setContinuousJoints(continuous);
+    if (context->m_ik_pos_solver) {
+      posSolver->copySettings(*context->m_ik_pos_solver);  // keep the settings of the old solver
+    }
+    context->m_ik_vel_solver = velSolver;
+    context->m_ik_pos_solver = posSolver;
+    context->m_solvetype = m_solvetype;
+  } else {
+    context->m_ik_vel_solver->setLoopPeriod(m_loopPeriod);
+    success = context->m_ik_vel_solver->setMaxJointVelocity(m_velocity.data) && success;
+    success = context->m_ik_vel_solver->setMaxJointAcceleration(m_acceleration.data) && success;
+  }
+  context->m_settingsVersion = m_settingsVersion;
+  return success;
+}
+
 bool SNS_IK::setVelocitySolveType(VelocitySolveType type) {
+  if (!m_context) {
+    ROS_ERROR("SNS_IK was not properly initialized with a valid chain or limits.");
+    return false;
+  }
   // If the requested solve type is different or there is no velocity solver
-  if(m_solvetype != type || !m_ik_vel_solver){
-    switch (type) {
-      case sns_ik::SNS_OptimalScaleMargin:
-        m_ik_vel_solver = std::shared_ptr<OSNS_sm_VelocityIK>(new OSNS_sm_VelocityIK(m_chain.getNrOfJoints(), m_loopPeriod));
-        ROS_INFO("SNS_IK: Set Velocity solver to SNS Optimal Scale Margin solver.");
-        break;
-      case sns_ik::SNS_Optimal:
-        m_ik_vel_solver = std::shared_ptr<OSNSVelocityIK>(new OSNSVelocityIK(m_chain.getNrOfJoints(), m_loopPeriod));
-        ROS_INFO("SNS_IK: Set Velocity solver to SNS Optimal solver.");
-        break;
-      case sns_ik::SNS_Fast:
-        m_ik_vel_solver = std::shared_ptr<FSNSVelocityIK>(new FSNSVelocityIK(m_chain.getNrOfJoints(), m_loopPeriod));
-        ROS_INFO("SNS_IK: Set Velocity solver to Fast SNS solver.");
-        break;
-      case sns_ik::SNS_FastOptimal:
-        m_ik_vel_solver = std::shared_ptr<FOSNSVelocityIK>(new FOSNSVelocityIK(m_chain.getNrOfJoints(), m_loopPeriod));
-        ROS_INFO("SNS_IK: Set Velocity solver to Fast Optimal SNS solver.");
-        break;
-      case sns_ik::SNS:
-        m_ik_vel_solver = std::shared_ptr<SNSVelocityIK>(new SNSVelocityIK(m_chain.getNrOfJoints(), m_loopPeriod));
-        ROS_INFO("SNS_IK: Set Velocity solver to Standard SNS solver.");
-        break;
-      case sns_ik::SNS_Base:
-        m_ik_vel_solver = std::shared_ptr<SNSVelIKBaseInterface>(new SNSVelIKBaseInterface(m_chain.getNrOfJoints(), m_loopPeriod));
-        ROS_INFO("SNS_IK: Set Velocity solver to Base SNS solver.");
-        break;
-      default:
-        ROS_ERROR("SNS_IK: Unknown Velocity solver type requested.");
-        return false;
+  if(m_solvetype != type || !m_context->m_ik_vel_solver){
+    if (!createVelocitySolver(type)) {
+      ROS_ERROR("SNS_IK: Unknown Velocity solver type requested.");
+      return false;
     }
-    m_ik_vel_solver->setJointsCapabilities(m_lower_bounds.data, m_upper_bounds.data,
-                                           m_velocity.data, m_acceleration.data);
-    m_ik_pos_solver = std::shared_ptr<SNSPositionIK>(new SNSPositionIK(m_chain, m_ik_vel_solver, m_eps));
     m_solvetype = type;
+    m_settingsVersion++;
+    updateContext(m_context.get());
+    ROS_INFO("SNS_IK: Set Velocity solver to %s solver.", toStr(type).c_str());
     m_initialized = true;
     return true;
  }
  return false;
 }
 
-int SNS_IK::CartToJnt(const KDL::JntArray &q_init, const KDL::Frame &p_in,
-                      const KDL::JntArray& q_bias,
+int SNS_IK::CartToJnt(SolveContext* context,
+                      const Eigen::Ref<const Eigen::VectorXd>& q_init, const KDL::Frame &p_in,
+                      const Eigen::Ref<const Eigen::VectorXd>& q_bias,
                       const std::vector<std::string>& biasNames,
-                      KDL::JntArray &q_out, const KDL::Twist& bounds) {
+                      Eigen::Ref<Eigen::VectorXd> q_out, const KDL::Twist& bounds) const {
 
   if (!m_initialized) {
     ROS_ERROR("SNS_IK was not properly initialized with a valid chain or limits.");
     return -1;
   }
+  if (!context || !updateContext(context)) {
+    ROS_ERROR("SNS_IK: Invalid solve context.");
+    return -1;
+  }
+  if (context != m_context.get()) {
+    context->m_ik_pos_solver->copySettings(*m_context->m_ik_pos_solver);
+  }
+  SNSVelocityIK& velSolver = *context->m_ik_vel_solver;
+  SNSPositionIK& posSolver = *context->m_ik_pos_solver;
 
   // The position solver uses a barrier function instead of the hard position limits
-  m_ik_vel_solver->usePositionLimits(false);
+  velSolver.usePositionLimits(false);
   int result;
   if (q_bias.rows()) {
     Eigen::MatrixXd ns_jacobian;
@@ -265,90 +342,458 @@ int SNS_IK::CartToJnt(const KDL::JntArray &q_init, const KDL::Frame &p_in,
       ROS_ERROR("Could not create nullspace bias task");
       result = -1;
     } else {
-      result = m_ik_pos_solver->CartToJnt(q_init, p_in, q_bias, ns_jacobian, indicies,
-                                          m_nullspaceGain, &q_out, bounds);
+      result = posSolver.CartToJnt(q_init, p_in, q_bias, ns_jacobian, indicies,
+                                   m_nullspaceGain, q_out, bounds);
     }
   } else {
-    result = m_ik_pos_solver->CartToJnt(q_init, p_in, &q_out, bounds);
+    result = posSolver.CartToJnt(q_init, p_in, Eigen::VectorXd(), Eigen::MatrixXd(),
+                                 std::vector<int>(), 0.0, q_out, bounds);
   }
-  m_ik_vel_solver->usePositionLimits(true);
+  velSolver.usePositionLimits(true);
   return result;
 }
 
-int SNS_IK::CartToJntVel(const KDL::JntArray& q_in, const KDL::Twist& v_in,
-                         const KDL::JntArray& q_bias,
+int SNS_IK::CartToJntBatch(const std::vector<KDL::JntArray>& q_init,
+                           const std::vector<KDL::Frame>& p_in,
+                           const std::vector<KDL::JntArray>& q_bias,
+                           const std::vector<std::string>& biasNames,
+                           std::vector<KDL::JntArray>* q_out,
+                           std::vector<int>* results,
+                           const KDL::Twist& bounds)
+{
+  if (!m_initialized) {
+    ROS_ERROR("SNS_IK was not properly initialized with a valid chain or limits.");
+    return -1;
+  }
+  if (!q_out || !results) {
+    ROS_ERROR("SNS_IK: q_out and results must not be null.");
+    return -1;
+  }
+  size_t nGoal = p_in.size();
+  if (q_init.size() != nGoal && q_init.size() != 1) {
+    ROS_ERROR("SNS_IK: Number of joint seeds (%d) must be one or equal to the number of goals (%d)",
+              int(q_init.size()), int(nGoal));
+    return -1;
+  }
+  if (q_bias.size() != nGoal && q_bias.size() > 1) {
+    ROS_ERROR("SNS_IK: Number of joint biases (%d) must be zero, one, or equal to the number of goals (%d)",
+              int(q_bias.size()), int(nGoal));
+    return -1;
+  }
+  q_out->resize(nGoal);
+  results->assign(nGoal, -1);
+  if (nGoal == 0) { return 0; }
+
+  size_t nThread = m_batchThreadCount > 0 ? m_batchThreadCount : std::thread::hardware_concurrency();
+  nThread = std::max(std::min(nThread, nGoal), size_t(1));
+
+  // Each worker thread gets its own solve context
+  reserveBatchContexts(nThread - 1);
+
+  // Each thread claims the next goal from a shared counter until all goals are taken
+  std::atomic<size_t> nextGoal(0);
+  std::atomic<int> nSolved(0);
+  auto worker = [&](SolveContext* context) {
+    KDL::JntArray noBias(0);
+    for (size_t i = nextGoal++; i < nGoal; i = nextGoal++) {
+      const KDL::JntArray& seed = q_init.size() == 1 ? q_init[0] : q_init[i];
+      const KDL::JntArray& bias = q_bias.empty() ? noBias : q_bias.size() == 1 ? q_bias[0] : q_bias[i];
+      (*results)[i] = CartToJnt(context, seed, p_in[i], bias, biasNames, (*q_out)[i], bounds);
+      if ((*results)[i] >= 0) { nSolved++; }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < nThread; i++) {
+    threads.push_back(std::thread(worker, m_batchContexts[i - 1].get()));
+  }
+  worker(m_context.get());
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  return nSolved;
+}
+
+int SNS_IK::CartToJntMultiSeed(const KDL::JntArray &q_init, const KDL::Frame &p_in,
+                               const KDL::JntArray& q_bias,
+                               const std::vector<std::string>& biasNames,
+                               KDL::JntArray &q_out, const KDL::Twist& bounds)
+{
+  if (!m_initialized) {
+    ROS_ERROR("SNS_IK was not properly initialized with a valid chain or limits.");
+    return -1;
+  }
+  if (q_init.rows() != m_chain.getNrOfJoints()) {
+    ROS_ERROR("SNS_IK: Joint seed has %d joints, but the chain has %d joints",
+              int(q_init.rows()), int(m_chain.getNrOfJoints()));
+    return -1;
+  }
+
+  // The first seed is the user's seed. The others are spread over the joint limits; continuous
+  // joints are sampled over one revolution.
+  size_t nSeed = m_multiSeedCount;
+  std::vector<KDL::JntArray> seeds(nSeed, q_init);
+  Eigen::VectorXd sample(q_init.rows());
+  for (size_t iSeed = 1; iSeed < nSeed; iSeed++) {
+    // Skip the start of the sequence: its first points are correlated across dimensions
+    haltonPoint(HALTON_SEQUENCE_OFFSET + iSeed, &sample);
+    for (int j = 0; j < int(q_init.rows()); j++) {
+      if (m_types[j] == SNS_IK::JointType::Continuous) {
+        seeds[iSeed](j) = q_init(j) + M_PI * (2.0 * sample(j) - 1.0);
+      } else {
+        seeds[iSeed](j) = m_lower_bounds(j) + sample(j) * (m_upper_bounds(j) - m_lower_bounds(j));
+      }
+    }
+  }
+
+  size_t nThread = m_batchThreadCount > 0 ? m_batchThreadCount : std::thread::hardware_concurrency();
+  nThread = std::max(std::min(nThread, nSeed), size_t(1));
+  reserveBatchContexts(nThread - 1);
+
+  // Each thread claims the next seed until all seeds are taken or, in FirstSolution mode, one of
+  // the seeds converges. The other solves then stop at their next iteration.
+  bool stopOnFirst = m_multiSeedMode == FirstSolution;
+  std::atomic<size_t> nextSeed(0);
+  std::atomic<bool> cancel(false);
+  std::atomic<size_t> firstSolution(nSeed);  // nSeed until a seed converges
+  std::vector<int> results(nSeed, -1);
+  std::vector<KDL::JntArray> solutions(nSeed);
+  bool useCachedSeed = m_context->m_ik_pos_solver->getUseCachedSeed();
+  auto worker = [&](SolveContext* context) {
+    bool contextUseCachedSeed = context->m_ik_pos_solver->getUseCachedSeed();
+    context->m_ik_pos_solver->setCancelFlag(stopOnFirst ? &cancel : nullptr);
+    for (size_t i = nextSeed++; i < nSeed && !cancel; i = nextSeed++) {
+      // Only the user's seed may be replaced by a cached solution (if the caller did not turn the
+      // cached seeds off): the others explore the joint space
+      context->m_ik_pos_solver->setUseCachedSeed(i == 0 && useCachedSeed);
+      results[i] = CartToJnt(context, seeds[i], p_in, q_bias, biasNames, solutions[i], bounds);
+      size_t none = nSeed;
+      if (results[i] >= 0 && firstSolution.compare_exchange_strong(none, i) && stopOnFirst) {
+        cancel = true;
+      }
+    }
+    context->m_ik_pos_solver->setCancelFlag(nullptr);
+    context->m_ik_pos_solver->setUseCachedSeed(contextUseCachedSeed);
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < nThread; i++) {
+    threads.push_back(std::thread(worker, m_batchContexts[i - 1].get()));
+  }
+  worker(m_context.get());
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  size_t best = firstSolution;
+  if (best == nSeed) {
+    return results[0];
+  }
+  if (m_multiSeedMode == NearestSolution) {
+    for (size_t i = 0; i < nSeed; i++) {
+      if (results[i] >= 0 && jointDistance(solutions[i], q_init) < jointDistance(solutions[best], q_init)) {
+        best = i;
+      }
+    }
+  }
+  q_out = solutions[best];
+  return results[best];
+}
+
+int SNS_IK::CartToJntMultiSolution(const KDL::JntArray &q_init, const KDL::Frame &p_in,
+                                   size_t maxSolutions, std::vector<KDL::JntArray>* q_out,
+                                   double minDistance, const KDL::Twist& bounds)
+{
+  if (!q_out) {
+    ROS_ERROR("SNS_IK: q_out must not be null.");
+    return -1;
+  }
+  q_out->clear();
+  KDL::JntArray q_first;
+  int result = CartToJnt(q_init, p_in, q_first, bounds);
+  if (result < 0) {
+    return result;
+  }
+  q_out->push_back(q_first);
+
+  // Projector onto the null space of the Jacobian at the first solution. If the first solution is
+  // at a singularity, the damped inverse still removes the non-singular directions of the
+  // Jacobian, so the sweep stays (a superset of) the null space rather than the whole joint space.
+  int nJoint = q_first.rows();
+  KDL::Frame pose;
+  Eigen::MatrixXd jacobian, jacobianInv;
+  Eigen::MatrixXd projector = Eigen::MatrixXd::Identity(nJoint, nJoint);
+  m_kinematics->computePoseAndJacobian(q_first.data, &pose, &jacobian);
+  pinv_damped_P(jacobian, &jacobianInv, &projector);
+
+  // Sweep the null space from the first solution: each bias target is a sample within the joint
+  // limits, and the solves start from a step toward the target along the null space, so that they
+  // start close to the goal. If the solve from that seed falls back onto a known solution, solve
+  // again with a nullspace bias toward the target. The solves ignore the cached solutions.
+  std::shared_ptr<SNSPositionIK> posSolver = m_context->m_ik_pos_solver;
+  bool useCachedSeed = posSolver->getUseCachedSeed();
+  posSolver->setUseCachedSeed(false);
+  KDL::JntArray target(nJoint), seed(nJoint), q(nJoint);
+  auto isDistinct = [&](const KDL::JntArray& candidate) {
+    for (const KDL::JntArray& solution : *q_out) {
+      if (jointDistance(candidate, solution) < minDistance) {
+        return false;
+      }
+    }
+    return true;
+  };
+  Eigen::VectorXd sample(nJoint);
+  size_t nTarget = MULTI_SOLUTION_TARGET_COUNT * maxSolutions;
+  for (size_t iTarget = 1; iTarget <= nTarget && q_out->size() < maxSolutions; iTarget++) {
+    haltonPoint(MULTI_SOLUTION_HALTON_OFFSET + iTarget, &sample);
+    for (int j = 0; j < nJoint; j++) {
+      if (m_types[j] == SNS_IK::JointType::Continuous) {
+        target(j) = q_first(j) + M_PI * (2.0 * sample(j) - 1.0);
+      } else {
+        target(j) = m_lower_bounds(j) + sample(j) * (m_upper_bounds(j) - m_lower_bounds(j));
+      }
+    }
+    seed.data = q_first.data + projector * (target.data - q_first.data);
+    for (int j = 0; j < nJoint; j++) {
+      if (m_types[j] != SNS_IK::JointType::Continuous) {
+        seed(j) = std::max(std::min(seed(j), m_upper_bounds(j)), m_lower_bounds(j));
+      }
+    }
+    bool distinct = CartToJnt(seed, p_in, q, bounds) >= 0 && isDistinct(q);
+    if (!distinct) {
+      distinct = CartToJnt(seed, p_in, target, q, bounds) >= 0 && isDistinct(q);
+    }
+    if (distinct) {
+      q_out->push_back(q);
+    }
+  }
+  posSolver->setUseCachedSeed(useCachedSeed);
+  return q_out->size();
+}
+
+double SNS_IK::jointDistance(const KDL::JntArray& qA, const KDL::JntArray& qB) const
+{
+  double squared = 0.0;
+  for (int j = 0; j < int(qA.rows()); j++) {
+    double delta = qA(j) - qB(j);
+    if (m_types[j] == SNS_IK::JointType::Continuous) {
+      delta = wrapAngle(delta);
+    }
+    squared += delta * delta;
+  }
+  return std::sqrt(squared);
+}
+
+bool SNS_IK::beginTrajectory(const KDL::JntArray& q_init, const double* q_out,
+                             std::vector<size_t>* breaks)
+{
+  if (!m_initialized) {
+    ROS_ERROR("SNS_IK was not properly initialized with a valid chain or limits.");
+    return false;
+  }
+  if (!q_out) {
+    ROS_ERROR("SNS_IK: q_out must not be null.");
+    return false;
+  }
+  if (q_init.rows() != m_chain.getNrOfJoints()) {
+    ROS_ERROR("SNS_IK: Joint seed has %d joints, but the chain has %d joints",
+              int(q_init.rows()), int(m_chain.getNrOfJoints()));
+    return false;
+  }
+  if (breaks) {
+    breaks->clear();
+  }
+  m_trajectorySeed = q_init;
+  m_trajectorySolution.resize(q_init.rows());
+  m_trajectoryUseCachedSeed = m_context->m_ik_pos_solver->getUseCachedSeed();
+  m_context->m_ik_pos_solver->setUseCachedSeed(false);
+  return true;
+}
+
+bool SNS_IK::solveTrajectoryWaypoint(const KDL::Frame& p_in, double maxJointStep,
+                                     const KDL::Twist& bounds, double* q_out, int* result)
+{
+  *result = CartToJnt(m_trajectorySeed, p_in, m_trajectorySolution, bounds);
+  bool isBreak = true;
+  if (*result >= 0) {
+    isBreak = (m_trajectorySolution.data - m_trajectorySeed.data).lpNorm<Eigen::Infinity>() > maxJointStep;
+    m_trajectorySeed.data.swap(m_trajectorySolution.data);
+  }
+  Eigen::Map<Eigen::VectorXd>(q_out, m_trajectorySeed.rows()) = m_trajectorySeed.data;
+  return isBreak;
+}
+
+void SNS_IK::endTrajectory()
+{
+  m_context->m_ik_pos_solver->setUseCachedSeed(m_trajectoryUseCachedSeed);
+}
+
+void SNS_IK::reserveBatchContexts(size_t nContext)
+{
+  while (m_batchContexts.size() < nContext) {
+    m_batchContexts.push_back(createSolveContext());
+  }
+}
+
+int SNS_IK::CartToJntVel(SolveContext* context,
+                         const Eigen::Ref<const Eigen::VectorXd>& q_in, const KDL::Twist& v_in,
+                         const Eigen::Ref<const Eigen::VectorXd>& q_bias,
                          const std::vector<std::string>& biasNames,
-                         const KDL::JntArray& q_vel_bias,
-                         KDL::JntArray& qdot_out)
+                         const Eigen::Ref<const Eigen::VectorXd>& q_vel_bias,
+                         Eigen::Ref<Eigen::VectorXd> qdot_out) const
 {
   if (!m_initialized) {
     ROS_ERROR("SNS_IK was not properly initialized with a valid chain or limits.");
     return -1;
   }
+  if (!context || !updateContext(context)) {
+    ROS_ERROR("SNS_IK: Invalid solve context.");
+    return -1;
+  }
+  std::vector<Task>& sot = context->m_sot;
 
-  KDL::Jacobian jacobian;
-  jacobian.resize(q_in.rows());
-  if (m_jacobianSolver->JntToJac(q_in, jacobian) < 0)
+  if (int(q_in.rows()) != m_kinematics->getNrOfJoints() || qdot_out.rows() != q_in.rows())
   {
-    std::cout << "JntToJac failed" << std::endl;
+    ROS_ERROR("SNS_IK: Number of joint angles does not equal number of joints");
     return -1;
   }
 
-  std::vector<Task> sot;
-  Task task;
-  task.jacobian = jacobian.data;
-  task.desired = Eigen::VectorXd::Zero(6);
+  // The tasks are stored in the context, so that their memory is reused by the next call
+  size_t nTask = 1;
+  if (q_bias.rows()) { nTask++; }
+  if (q_vel_bias.rows() == q_in.rows()) { nTask++; }
+  sot.resize(nTask);
+  size_t iTask = 0;
+
+  Task& task = sot[iTask++];
+  KDL::Frame pose;
+  m_kinematics->computePoseAndJacobian(q_in, &pose, &task.jacobian);
+  task.desired.resize(6);
   // twistEigenToKDL
   for(size_t i = 0; i < 6; i++)
       task.desired(i) = v_in[i];
-  sot.push_back(task);
 
   // Calculate the nullspace goal as a configuration-space task.
   // Creates a task Jacobian which maps the provided nullspace joints to
   // the full joint state.
   if (q_bias.rows()) {
-    Task task2;
-    std::vector<int> indicies;
-    if (!nullspaceBiasTask(q_bias, biasNames, &(task2.jacobian), &indicies)) {
+    Task& task2 = sot[iTask++];
+    if (!nullspaceBiasTask(q_bias, biasNames, &(task2.jacobian), &(context->m_biasIndices))) {
       ROS_ERROR("Could not create nullspace bias task");
       return -1;
     }
-    task2.desired = Eigen::VectorXd::Zero(q_bias.rows());
-    for (size_t ii = 0; ii < q_bias.rows(); ++ii) {
+    task2.setSelection(context->m_biasIndices, q_in.rows());
+    task2.desired.resize(q_bias.rows());
+    for (int ii = 0; ii < q_bias.rows(); ++ii) {
       // This calculates a "nullspace velocity".
       // There is an arbitrary scale factor which will be set by the max scale factor.
-      task2.desired(ii) = m_nullspaceGain * (q_bias(ii) - q_in(indicies[ii])) / m_loopPeriod;
+      task2.desired(ii) = m_nullspaceGain * (q_bias(ii) - q_in(context->m_biasIndices[ii])) / m_loopPeriod;
       // TODO: may want to limit the NS velocity to 70-90% of max joint velocity
     }
-    sot.push_back(task2);
   }
 
   // Bias the joint velocities
   // If the bias is the previous joint velocities, this is velocity damping
   if(q_vel_bias.rows() == q_in.rows()) {
-    Task task2;
-    task2.jacobian = Eigen::MatrixXd::Identity(q_vel_bias.rows(), q_vel_bias.rows());
-    task2.desired = Eigen::VectorXd::Zero(q_vel_bias.rows());
-    for (size_t ii = 0; ii < q_vel_bias.rows(); ++ii) {
+    Task& task2 = sot[iTask++];
+    task2.setIdentity(q_vel_bias.rows());
+    task2.desired.resize(q_vel_bias.rows());
+    for (int ii = 0; ii < q_vel_bias.rows(); ++ii) {
       task2.desired(ii) = q_vel_bias(ii);
     }
-    sot.push_back(task2);
   }
 
-  return m_ik_vel_solver->getJointVelocity(&qdot_out.data, sot, q_in.data);
+  double result = context->m_ik_vel_solver->getJointVelocity(&context->m_qdot, sot, q_in);
+  qdot_out = context->m_qdot;
+  return result;
+}
+
+std::shared_ptr<SNS_IK::VelocityIkSession> SNS_IK::createVelocitySession(
+    const std::vector<std::string>& biasNames, bool useVelocityBias) const
+{
+  if (!m_initialized) {
+    ROS_ERROR("SNS_IK was not properly initialized with a valid chain or limits.");
+    return std::shared_ptr<VelocityIkSession>();
+  }
+  std::shared_ptr<VelocityIkSession> session(new VelocityIkSession(this, createSolveContext()));
+  int nJoint = m_kinematics->getNrOfJoints();
+  session->m_sot.resize(1);
+  session->m_sot[0].jacobian.resize(6, nJoint);
+  session->m_sot[0].desired.resize(6);
+  if (!biasNames.empty()) {
+    session->m_biasTask = session->m_sot.size();
+    session->m_sot.push_back(Task());
+    Task& task = session->m_sot.back();
+    if (!nullspaceBiasTask(Eigen::VectorXd::Zero(biasNames.size()), biasNames, &task.jacobian,
+                           &session->m_biasIndices)) {
+      ROS_ERROR("Could not create nullspace bias task");
+      return std::shared_ptr<VelocityIkSession>();
+    }
+    task.setSelection(session->m_biasIndices, nJoint);
+    task.desired.resize(biasNames.size());
+  }
+  if (useVelocityBias) {
+    session->m_velocityBiasTask = session->m_sot.size();
+    session->m_sot.push_back(Task());
+    Task& task = session->m_sot.back();
+    task.setIdentity(nJoint);
+    task.desired.resize(nJoint);
+  }
+  return session;
 }
 
-bool SNS_IK::nullspaceBiasTask(const KDL::JntArray& q_bias,
+SNS_IK::VelocityIkSession::VelocityIkSession(const SNS_IK* ik, std::shared_ptr<SolveContext> context) :
+  m_ik(ik),
+  m_context(context),
+  m_biasTask(-1),
+  m_velocityBiasTask(-1)
+{
+}
+
+int SNS_IK::VelocityIkSession::step(const KDL::JntArray& q_in, const KDL::Twist& v_in,
+                                    const KDL::JntArray& q_bias, const KDL::JntArray& q_vel_bias,
+                                    KDL::JntArray* qdot_out)
+{
+  const SNS_IK& ik = *m_ik;
+  if (!ik.updateContext(m_context.get())) {
+    ROS_ERROR("SNS_IK: Invalid solve context.");
+    return -1;
+  }
+  if (int(q_in.rows()) != ik.m_kinematics->getNrOfJoints() ||
+      q_bias.rows() != m_biasIndices.size() ||
+      q_vel_bias.rows() != (m_velocityBiasTask >= 0 ? q_in.rows() : 0)) {
+    ROS_ERROR("SNS_IK: Joint arrays do not match the velocity session");
+    return -1;
+  }
+
+  // Only the data of the tasks changes: their sizes were set when the session was created
+  Task& task = m_sot[0];
+  KDL::Frame pose;
+  ik.m_kinematics->computePoseAndJacobian(q_in.data, &pose, &task.jacobian);
+  for (size_t i = 0; i < 6; i++) {
+    task.desired(i) = v_in[i];
+  }
+  if (m_biasTask >= 0) {
+    Eigen::VectorXd& desired = m_sot[m_biasTask].desired;
+    for (size_t ii = 0; ii < m_biasIndices.size(); ++ii) {
+      desired(ii) = ik.m_nullspaceGain * (q_bias(ii) - q_in(m_biasIndices[ii])) / ik.m_loopPeriod;
+    }
+  }
+  if (m_velocityBiasTask >= 0) {
+    m_sot[m_velocityBiasTask].desired = q_vel_bias.data;
+  }
+
+  return m_context->m_ik_vel_solver->getJointVelocity(&qdot_out->data, m_sot, q_in.data);
+}
+
+bool SNS_IK::nullspaceBiasTask(const Eigen::Ref<const Eigen::VectorXd>& q_bias,
                                const std::vector<std::string>& biasNames,
                                Eigen::MatrixXd* jacobian,
-                               std::vector<int>* indicies)
+                               std::vector<int>* indicies) const
 {
-  ROS_ASSERT_MSG(q_bias.rows() == biasNames.size(), "SNS_IK: Number of joint bias and names differ");
-  Task task2;
-  *jacobian = Eigen::MatrixXd::Zero(q_bias.rows(), m_jointNames.size());
+  ROS_ASSERT_MSG(q_bias.rows() == (int)biasNames.size(), "SNS_IK: Number of joint bias and names differ");
+  jacobian->setZero(q_bias.rows(), m_jointNames.size());
   indicies->resize(q_bias.rows(), 0);
-  std::vector<std::string>::iterator it;
-  for (size_t ii = 0; ii < q_bias.rows(); ++ii) {
+  std::vector<std::string>::const_iterator it;
+  for (int ii = 0; ii < q_bias.rows(); ++ii) {
     it = std::find(m_jointNames.begin(), m_jointNames.end(), biasNames[ii]);
     if (it == m_jointNames.end())
     {
@@ -366,21 +811,29 @@ SNS_IK::~SNS_IK(){}
 
 bool SNS_IK::setMaxJointVelocity(const KDL::JntArray& vel) {
   m_velocity = vel;
-  return m_ik_vel_solver->setMaxJointVelocity(vel.data);
+  m_settingsVersion++;
+  return updateContext(m_context.get());
 }
 
 void SNS_IK::setLoopPeriod(double loopPeriod) {
   m_loopPeriod = loopPeriod;
-  m_ik_vel_solver->setLoopPeriod(loopPeriod);
+  m_settingsVersion++;
+  updateContext(m_context.get());
 }
 
 bool SNS_IK::setMaxJointAcceleration(const KDL::JntArray& accel) {
   m_acceleration = accel;
-  return m_ik_vel_solver->setMaxJointAcceleration(accel.data);
+  m_settingsVersion++;
+  return updateContext(m_context.get());
 }
 
-bool SNS_IK::getTaskScaleFactors(std::vector<double>& scaleFactors) {
-  scaleFactors = m_ik_vel_solver->getTasksScaleFactor();
+bool SNS_IK::getTaskScaleFactors(const SolveContext& context,
+                                 std::vector<double>& scaleFactors) const {
+  if (!context.m_ik_vel_solver) {
+    scaleFactors.clear();
+    return false;
+  }
+  scaleFactors = context.m_ik_vel_solver->getTasksScaleFactor();
   return m_initialized && !scaleFactors.empty();
 }
 
@@ -0,0 +1,611 @@
+/** @file sns_ik_kernel.cpp
+ *
+ * @brief The core SNS-IK loop, shared by the velocity and acceleration base solvers
+ *
+ *    Copyright 2018 Rethink Robotics
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+#include <sns_ik/sns_ik_kernel.hpp>
+
+#include <ros/console.h>
+#include <cmath>
+
+namespace sns_ik {
+
+/*************************************************************************************************
+ *                                 Public Methods                                                *
+ *************************************************************************************************/
+
+template <int NTask, int NJnt>
+SnsIkBase::ExitCode SnsIkKernel<NTask, NJnt>::solveVel(const Eigen::ArrayXd& qLow, const Eigen::ArrayXd& qUpp,
+                                                        const TaskMatrix& J, const TaskVector& dx,
+                                                        JointVector* dq, double* taskScale,
+                                                        SnsIkBase::KernelState* state)
+{
+  iterations_ = 0;
+  bool warmStarted;
+  ExitCode exitCode = startSolve(qLow, qUpp, J, dx, state, &warmStarted);
+  if (exitCode == ExitCode::Success) {
+    exitCode = solveVelLoop(qLow, qUpp, J, dx, dq, taskScale);
+  }
+  if (warmStarted && (exitCode != ExitCode::Success || *taskScale < 1.0)) {
+    // Solve again with all joints free, and keep the warm-started solution if its scale is larger
+    bool isWarmValid = exitCode == ExitCode::Success && checkBounds(qLow, qUpp, *dq);
+    double warmTaskScale = *taskScale;
+    if (isWarmValid) {
+      warmQ_ = *dq;
+    }
+    exitCode = startSolve(qLow, qUpp, J, dx, nullptr, &warmStarted);
+    if (exitCode == ExitCode::Success) {
+      exitCode = solveVelLoop(qLow, qUpp, J, dx, dq, taskScale);
+    }
+    if (isWarmValid && (exitCode != ExitCode::Success || warmTaskScale > *taskScale)) {
+      *dq = warmQ_;
+      *taskScale = warmTaskScale;
+      exitCode = ExitCode::Success;
+    }
+    warmStarted = true;
+  }
+  finishSolve(exitCode, *taskScale, qUpp, warmStarted, state);
+  return exitCode;
+}
+
+/*************************************************************************************************/
+
+template <int NTask, int NJnt>
+SnsIkBase::ExitCode SnsIkKernel<NTask, NJnt>::solveAcc(const Eigen::ArrayXd& qLow, const Eigen::ArrayXd& qUpp,
+                                                        const TaskMatrix& J, const TaskVector& dJdq,
+                                                        const TaskVector& ddx, JointVector* ddq,
+                                                        double* taskScale, SnsIkBase::KernelState* state)
+{
+  iterations_ = 0;
+  task_ = ddx - dJdq;
+  bool warmStarted;
+  ExitCode exitCode = startSolve(qLow, qUpp, J, task_, state, &warmStarted);
+  if (exitCode == ExitCode::Success) {
+    exitCode = solveAccLoop(qLow, qUpp, J, dJdq, ddx, ddq, taskScale);
+  }
+  if (warmStarted && (exitCode != ExitCode::Success || *taskScale < 1.0)) {
+    // Solve again with all joints free, and keep the warm-started solution if its scale is larger
+    bool isWarmValid = exitCode == ExitCode::Success && checkBounds(qLow, qUpp, *ddq);
+    double warmTaskScale = *taskScale;
+    if (isWarmValid) {
+      warmQ_ = *ddq;
+    }
+    exitCode = startSolve(qLow, qUpp, J, task_, nullptr, &warmStarted);
+    if (exitCode == ExitCode::Success) {
+      exitCode = solveAccLoop(qLow, qUpp, J, dJdq, ddx, ddq, taskScale);
+    }
+    if (isWarmValid && (exitCode != ExitCode::Success || warmTaskScale > *taskScale)) {
+      *ddq = warmQ_;
+      *taskScale = warmTaskScale;
+      exitCode = ExitCode::Success;
+    }
+    warmStarted = true;
+  }
+  finishSolve(exitCode, *taskScale, qUpp, warmStarted, state);
+  return exitCode;
+}
+
+/*************************************************************************************************
+ *                                Private Methods                                                *
+ *************************************************************************************************/
+
+template <int NTask, int NJnt>
+SnsIkBase::ExitCode SnsIkKernel<NTask, NJnt>::solveVelLoop(const Eigen::ArrayXd& qLow, const Eigen::ArrayXd& qUpp,
+                                                            const TaskMatrix& J, const TaskVector& dx,
+                                                            JointVector* dq, double* taskScale)
+{
+  const int nJnt = J.cols();
+  const unsigned int nTask = J.rows();
+
+  *taskScale = 1.0;  // task scale (assume feasible solution until proven otherwise)
+
+  // Temp. variables to store the best solution
+  double bestTaskScale = 0.0;  // temp variable to track the lower bound on the task scale between iterations
+
+  // Main solver loop:
+  double resErr;  // residual error in the linear solver
+  for (int iter = 0; iter < nJnt * SnsIkBase::MAXIMUM_SOLVER_ITERATION_FACTOR; iter++) {
+    iterations_++;
+
+    // Compute the joint velocity given current saturation set:
+    if (solveProjectionEquation(J, qNull_, dx, dq, &resErr) != ExitCode::Success) {
+      ROS_ERROR("Failed to solve projection equation!");
+      return ExitCode::InternalError;
+    }
+    if (resErr > SnsIkBase::LIN_SOLVE_RESIDUAL_TOL) { // check that the solver found a feasible solution
+      ROS_ERROR("Task is infeasible!  resErr: %e > tol: %e", resErr, SnsIkBase::LIN_SOLVE_RESIDUAL_TOL);
+      return ExitCode::InfeasibleTask;
+    }
+
+    // Check to see if the solution satisfies the joint limits
+    if (checkBounds(qLow, qUpp, *dq)) { // Done! solution is feasible and task scale is at maximum value
+      return ExitCode::Success;
+    }  //  else joint velocity is infeasible: saturate joint and then try again
+
+    // Compute the task scaling factor
+    double tmpScale;
+    int jntIdx;
+    ExitCode taskScaleExit = computeTaskScalingFactor(qLow, qUpp, J, dx, *dq, mask_,
+                                                      &tmpScale, &jntIdx, &resErr);
+    if (resErr > SnsIkBase::LIN_SOLVE_RESIDUAL_TOL) { // check that the solver found a feasible solution
+      ROS_ERROR("Failed to compute task scale!  resErr: %e > tol: %e", resErr, SnsIkBase::LIN_SOLVE_RESIDUAL_TOL);
+      return ExitCode::InfeasibleTask;
+    }
+    if (taskScaleExit != ExitCode::Success) {
+      ROS_ERROR("Failed to compute task scale!");
+      return taskScaleExit;
+    }
+    if (tmpScale < SnsIkBase::MINIMUM_FINITE_SCALE_FACTOR) { // check that the solver found a feasible solution
+      ROS_ERROR("Task is infeasible! scaling --> zero");
+      return ExitCode::InfeasibleTask;
+    }
+
+    if (tmpScale > 1.0) {
+      ROS_ERROR("Task scale is %f, which is more than 1.0", tmpScale);
+      return ExitCode::InternalError;
+    }
+
+    // If the task scale exceeds previous, then cache the results as "best so far"
+    if (tmpScale > bestTaskScale) {
+      bestTaskScale = tmpScale;
+      bestMask_ = mask_;
+      bestQNull_ = qNull_;
+    }
+
+    // Saturate the most critical joint
+    mask_.saturate(jntIdx);
+    if ((*dq)(jntIdx) > qUpp(jntIdx)) {
+      qNull_(jntIdx) = qUpp(jntIdx);
+    } else if ((*dq)(jntIdx) < qLow(jntIdx)) {
+      qNull_(jntIdx) = qLow(jntIdx);
+    } else {
+      ROS_ERROR("Internal error in computing task scale!  dq(%d) = %f", jntIdx, (*dq)(jntIdx));
+      return ExitCode::InternalError;
+    }
+
+    // Update the linear solver
+    if (removeJointFromLinearSolver(jntIdx) != ExitCode::Success) {
+      ROS_ERROR("Solver failed to update linear solver!");
+      return ExitCode::InternalError;
+    }
+
+    // Test the rank:
+    if (getLinSolverRank() < nTask) { // no more degrees of freedom: scale the task
+      (*taskScale) = bestTaskScale;
+      mask_ = bestMask_;
+      qNull_ = bestQNull_;
+
+      // Update the linear solver
+      if (setLinearSolver(J) != ExitCode::Success) {
+        ROS_ERROR("Solver failed to set linear solver!");
+        return ExitCode::InternalError;
+      }
+
+      // Compute the joint velocity given current saturation set:
+      scaledTask_ = dx * (*taskScale);
+      if (solveProjectionEquation(J, qNull_, scaledTask_, dq, &resErr) != ExitCode::Success) {
+        ROS_ERROR("Failed to solve projection equation!");
+        return ExitCode::InternalError;
+      }
+      if (resErr > SnsIkBase::LIN_SOLVE_RESIDUAL_TOL) { // check that the solver found a feasible solution
+        ROS_ERROR("Task is infeasible!  resErr: %e > tol: %e", resErr, SnsIkBase::LIN_SOLVE_RESIDUAL_TOL);
+        return ExitCode::InfeasibleTask;
+      }
+
+      return ExitCode::Success;  // DONE
+
+    } // end rank test
+  }  // end main solver loop
+
+  ROS_ERROR("Internal Error: reached maximum iteration in solver main loop!");
+  return ExitCode::InternalError;
+}
+
+/*************************************************************************************************/
+
+template <int NTask, int NJnt>
+SnsIkBase::ExitCode SnsIkKernel<NTask, NJnt>::solveAccLoop(const Eigen::ArrayXd& qLow, const Eigen::ArrayXd& qUpp,
+                                                            const TaskMatrix& J, const TaskVector& dJdq,
+                                                            const TaskVector& ddx, JointVector* ddq,
+                                                            double* taskScale)
+{
+  const int nJnt = J.cols();
+  const unsigned int nTask = J.rows();
+
+  *taskScale = 1.0;  // task scale (assume feasible solution until proven otherwise)
+
+  // Temp. variables to store the best solution
+  double bestTaskScale = 0.0;  // temp variable to track the lower bound on the task scale between iterations
+
+  // Main solver loop:
+  double resErr;  // residual error in the linear solver
+  for (int iter = 0; iter < nJnt * SnsIkBase::MAXIMUM_SOLVER_ITERATION_FACTOR; iter++) {
+    iterations_++;
+
+    // Compute the joint acceleration given current saturation set:
+    if (solveProjectionEquation(J, dJdq, qNull_, ddx, ddq, &resErr) != ExitCode::Success) {
+      ROS_ERROR("Failed to solve projection equation!");
+      return ExitCode::InternalError;
+    }
+    if (resErr > SnsIkBase::LIN_SOLVE_RESIDUAL_TOL) { // check that the solver found a feasible solution
+      ROS_ERROR("Task is infeasible!  resErr: %e > tol: %e", resErr, SnsIkBase::LIN_SOLVE_RESIDUAL_TOL);
+      return ExitCode::InfeasibleTask;
+    }
+
+    // Check to see if the solution satisfies the joint limits
+    if (checkBounds(qLow, qUpp, *ddq)) { // Done! solution is feasible and task scale is at maximum value
+      return ExitCode::Success;
+    }  //  else joint acceleration is infeasible: saturate joint and then try again
+
+    // Compute the task scaling factor
+    double tmpScale;
+    int jntIdx;
+    ExitCode taskScaleExit = computeTaskScalingFactor(qLow, qUpp, J, ddx, *ddq, mask_,
+                                                      &tmpScale, &jntIdx, &resErr);
+    if (resErr > SnsIkBase::LIN_SOLVE_RESIDUAL_TOL) { // check that the solver found a feasible solution
+      ROS_ERROR("Failed to compute task scale!  resErr: %e > tol: %e", resErr, SnsIkBase::LIN_SOLVE_RESIDUAL_TOL);
+      return ExitCode::InfeasibleTask;
+    }
+    if (taskScaleExit != ExitCode::Success) {
+      ROS_ERROR("Failed to compute task scale!");
+      return taskScaleExit;
+    }
+    if (tmpScale < SnsIkBase::MINIMUM_FINITE_SCALE_FACTOR) { // check that the solver found a feasible solution
+      ROS_ERROR("Task is infeasible! scaling --> zero");
+      return ExitCode::InfeasibleTask;
+    }
+
+    if (tmpScale > 1.0) {
+      ROS_ERROR("Task scale is %f, which is more than 1.0", tmpScale);
+      return ExitCode::InternalError;
+    }
+
+    // If the task scale exceeds previous, then cache the results as "best so far"
+    // Also if the current best so far solution violates the limits, update bestTakeScale
+    scaledTask_ = ddx * bestTaskScale;
+    if (solveProjectionEquation(J, dJdq, qNull_, scaledTask_, &qTmp_, &resErr) != ExitCode::Success) {
+      ROS_ERROR("Failed to solve projection equation!");
+      return ExitCode::InternalError;
+    }
+    if (resErr > SnsIkBase::LIN_SOLVE_RESIDUAL_TOL) { // check that the solver found a feasible solution
+      ROS_ERROR("Task is infeasible!  resErr: %e > tol: %e", resErr, SnsIkBase::LIN_SOLVE_RESIDUAL_TOL);
+      return ExitCode::InfeasibleTask;
+    }
+    if (tmpScale > bestTaskScale || !checkBounds(qLow, qUpp, qTmp_)) {
+      bestTaskScale = tmpScale;
+      bestMask_ = mask_;
+      bestQNull_ = qNull_;
+    }
+
+    // Saturate the most critical joint
+    mask_.saturate(jntIdx);
+    if ((*ddq)(jntIdx) > qUpp(jntIdx)) {
+      qNull_(jntIdx) = qUpp(jntIdx);
+    } else if ((*ddq)(jntIdx) < qLow(jntIdx)) {
+      qNull_(jntIdx) = qLow(jntIdx);
+    } else {
+      ROS_ERROR("Internal error in computing task scale!  ddq(%d) = %f", jntIdx, (*ddq)(jntIdx));
+      return ExitCode::InternalError;
+    }
+
+    // Update the linear solver
+    if (removeJointFromLinearSolver(jntIdx) != ExitCode::Success) {
+      ROS_ERROR("Solver failed to update linear solver!");
+      return ExitCode::InternalError;
+    }
+
+    // Test the rank:
+    if (getLinSolverRank() < nTask) { // no more degrees of freedom: scale the task
+      (*taskScale) = bestTaskScale;
+      mask_ = bestMask_;
+      qNull_ = bestQNull_;
+
+      // Update the linear solver
+      if (setLinearSolver(J) != ExitCode::Success) {
+        ROS_ERROR("Solver failed to set linear solver!");
+        return ExitCode::InternalError;
+      }
+
+      // Compute the joint acceleration given current saturation set:
+      scaledTask_ = ddx * (*taskScale);
+      if (solveProjectionEquation(J, dJdq, qNull_, scaledTask_, ddq, &resErr) != ExitCode::Success) {
+        ROS_ERROR("Failed to solve projection equation!");
+        return ExitCode::InternalError;
+      }
+      if (resErr > SnsIkBase::LIN_SOLVE_RESIDUAL_TOL) { // check that the solver found a feasible solution
+        ROS_ERROR("Task is infeasible!  resErr: %e > tol: %e", resErr, SnsIkBase::LIN_SOLVE_RESIDUAL_TOL);
+        return ExitCode::InfeasibleTask;
+      }
+
+      return ExitCode::Success;  // DONE
+
+    } // end rank test
+
+  }  // end main solver loop
+
+  ROS_ERROR("Internal Error: reached maximum iteration in solver main loop!");
+  return ExitCode::InternalError;
+}
+
+/*************************************************************************************************/
+
+template <int NTask, int NJnt>
+SnsIkBase::ExitCode SnsIkKernel<NTask, NJnt>::startSolve(const Eigen::ArrayXd& qLow, const Eigen::ArrayXd& qUpp,
+                                                          const TaskMatrix& J, const TaskVector& task,
+                                                          const SnsIkBase::KernelState* state,
+                                                          bool* warmStarted)
+{
+  const int nJnt = J.cols();
+
+  /*
+   * The joint mask is equivalent to a diagonal selection matrix W which indicates free joints.
+   * The entry of 1 indicates the corresponding joint is free for the task,
+   * and 0 indicates the corresponding joint is saturated.
+   */
+  mask_.reset(nJnt);  // null-space selection matrix
+  qNull_.setZero(nJnt);  // velocity or acceleration in the null-space
+  *warmStarted = state && state->useWarmStart && warmStart(qLow, qUpp, J, task, *state);
+  if (*warmStarted) {
+    return ExitCode::Success;
+  }
+  mask_.reset(nJnt);
+  qNull_.setZero(nJnt);
+
+  // Set the linear solver for the first iteration:
+  if(setLinearSolver(J) != ExitCode::Success) {
+    ROS_ERROR("Solver failed to set linear solver!");
+    return ExitCode::InternalError;
+  }
+  return ExitCode::Success;
+}
+
+/*************************************************************************************************/
+
+template <int NTask, int NJnt>
+bool SnsIkKernel<NTask, NJnt>::warmStart(const Eigen::ArrayXd& qLow, const Eigen::ArrayXd& qUpp,
+                                         const TaskMatrix& J, const TaskVector& task,
+                                         const SnsIkBase::KernelState& state)
+{
+  const int nJnt = J.cols();
+  const unsigned int nTask = J.rows();
+  if (state.activeSet.size() != nJnt || state.activeSet.allFree()) {
+    return false;
+  }
+
+  // Saturate the joints of the previous active set at their current bounds
+  for (int j : state.activeSet.saturated()) {
+    double bound = state.activeSide(j) > 0 ? qUpp(j) : qLow(j);
+    if (std::isfinite(bound)) {
+      mask_.saturate(j);
+      qNull_(j) = bound;
+    }
+  }
+  if (mask_.allFree() || setLinearSolver(J) != ExitCode::Success || getLinSolverRank() < nTask) {
+    return false;
+  }
+
+  // The minimum norm solution is q = qNull + (J*W)' * lambda, where lambda are the multipliers of
+  // the task: J*W*(J*W)' * lambda = task - J*qNull. A saturated joint j would move at J(:,j)' * lambda
+  // if it was free. The multiplier of its bound is positive if that exceeds the bound, otherwise the
+  // joint is released.
+  B_ = task;
+  B_.noalias() -= J * qNull_;
+  if (!linSolver_.solveMultipliers(B_, &lambda_)) {
+    return false;
+  }
+  bool released = false;
+  for (int i = int(mask_.saturated().size()) - 1; i >= 0; i--) {
+    int j = mask_.saturated()[i];
+    double freeValue = J.col(j).dot(lambda_);
+    if (state.activeSide(j) > 0 ? freeValue < qUpp(j) : freeValue > qLow(j)) {
+      mask_.release(j);
+      qNull_(j) = 0.0;
+      released = true;
+    }
+  }
+  if (mask_.allFree()) {
+    return false;
+  }
+  if (released && (setLinearSolver(J) != ExitCode::Success || getLinSolverRank() < nTask)) {
+    return false;
+  }
+  return true;
+}
+
+/*************************************************************************************************/
+
+template <int NTask, int NJnt>
+void SnsIkKernel<NTask, NJnt>::finishSolve(ExitCode exitCode, double taskScale,
+                                           const Eigen::ArrayXd& qUpp, bool warmStarted,
+                                           SnsIkBase::KernelState* state) const
+{
+  if (!state) {
+    return;
+  }
+  state->stats.solves++;
+  state->stats.iterations += iterations_;
+  if (warmStarted) {
+    state->stats.warmStarts++;
+  }
+  if (exitCode != ExitCode::Success || taskScale < 1.0) {
+    state->activeSet.reset(mask_.size());
+    return;
+  }
+  state->activeSet = mask_;
+  state->activeSide.resize(mask_.size());
+  for (int j : mask_.saturated()) {
+    state->activeSide(j) = qNull_(j) == qUpp(j) ? 1 : -1;
+  }
+}
+
+/*************************************************************************************************/
+
+template <int NTask, int NJnt>
+bool SnsIkKernel<NTask, NJnt>::checkBounds(const Eigen::ArrayXd& qLow, const Eigen::ArrayXd& qUpp,
+                                           const JointVector& q)
+{
+  for (int i = 0; i < q.size(); i++) {
+    if (q(i) < qLow(i) - SnsIkBase::BOUND_TOLERANCE) { return false; }
+    if (q(i) > qUpp(i) + SnsIkBase::BOUND_TOLERANCE) { return false; }
+  }
+  return true;
+}
+
+/*************************************************************************************************/
+
+template <int NTask, int NJnt>
+SnsIkBase::ExitCode SnsIkKernel<NTask, NJnt>::setLinearSolver(const TaskMatrix& J)
+{
+  mask_.selectFreeColumns(J, &JW_);  // J * W
+  linSolver_.compute(JW_);
+  if(linSolver_.info() != Eigen::ComputationInfo::Success) {
+    ROS_ERROR("Solver failed to decompose the matrix!");
+    return ExitCode::InternalError;
+  }
+  return ExitCode::Success;
+}
+
+/*************************************************************************************************/
+
+template <int NTask, int NJnt>
+SnsIkBase::ExitCode SnsIkKernel<NTask, NJnt>::removeJointFromLinearSolver(int jntIdx)
+{
+  linSolver_.removeColumn(jntIdx);
+  if(linSolver_.info() != Eigen::ComputationInfo::Success) {
+    ROS_ERROR("Solver failed to update the decomposition!");
+    return ExitCode::InternalError;
+  }
+  return ExitCode::Success;
+}
+
+/*************************************************************************************************/
+
+template <int NTask, int NJnt>
+SnsIkBase::ExitCode SnsIkKernel<NTask, NJnt>::solveLinearSystem(const TaskVector& rhs, JointVector* q,
+                                                                 double* resErr)
+{
+  if (!q) {
+    ROS_ERROR("q is nullptr!");
+    return ExitCode::BadUserInput;
+  }
+  const TaskMatrix& JW = linSolver_.matrix();  // the matrix that is currently set in the solver
+  if (JW.size() == 0) {
+    ROS_ERROR("Cannot solve an empty system! Have you called setLinearSolver()?");
+    return ExitCode::BadUserInput;
+  }
+  if (rhs.rows() != JW.rows()) {
+    ROS_ERROR("Invalid matrix dimensions! rhs.rows() == JW.rows(). Linear system is inconsistent.");
+    return ExitCode::BadUserInput;
+  }
+  linSolver_.solve(rhs, q);
+  if(linSolver_.info() != Eigen::ComputationInfo::Success) {
+    ROS_ERROR("Failed to solve linear system!");
+    return ExitCode::InfeasibleTask;
+  }
+  if (resErr) {
+    resVec_.noalias() = JW * (*q);
+    resVec_ -= rhs;
+    *resErr = resVec_.squaredNorm();
+  }
+  return ExitCode::Success;
+}
+
+/*************************************************************************************************/
+
+template <int NTask, int NJnt>
+SnsIkBase::ExitCode SnsIkKernel<NTask, NJnt>::solveProjectionEquation(const TaskMatrix& J,
+                                     const JointVector& dqNull, const TaskVector& dx,
+                                     JointVector* dq, double* resErr)
+{
+  // Solve the linear system
+  B_ = dx;
+  B_.noalias() -= J * dqNull;
+  ExitCode result = solveLinearSystem(B_, dq, resErr);
+  if (result != ExitCode::Success) {
+    ROS_ERROR("Failed to solve linear system!");
+  }
+
+  // Solve for dq
+  *dq += dqNull;
+  return result;
+}
+
+/*************************************************************************************************/
+
+template <int NTask, int NJnt>
+SnsIkBase::ExitCode SnsIkKernel<NTask, NJnt>::solveProjectionEquation(const TaskMatrix& J,
+                                     const TaskVector& dJdq, const JointVector& ddqNull,
+                                     const TaskVector& ddx, JointVector* ddq, double* resErr)
+{
+  // Solve the linear system
+  B_ = ddx - dJdq;
+  B_.noalias() -= J * ddqNull;
+  ExitCode result = solveLinearSystem(B_, ddq, resErr);
+  if (result != ExitCode::Success) {
+    ROS_ERROR("Failed to solve linear system!");
+  }
+
+  // Solve for ddq
+  *ddq += ddqNull;
+  return result;
+}
+
+/*************************************************************************************************/
+
+template <int NTask, int NJnt>
+SnsIkBase::ExitCode SnsIkKernel<NTask, NJnt>::computeTaskScalingFactor(
+                                     const Eigen::ArrayXd& qLow, const Eigen::ArrayXd& qUpp,
+                                     const TaskMatrix& J, const TaskVector& desiredTask,
+                                     const JointVector& jointOut, const JointMask& mask,
+                                     double* taskScale, int* jntIdx, double* resErr)
+{
+  const int nJnt = J.cols();
+
+  // Compute "a" and "b" from the paper.   (J*W*a = dx,  b = jointOut - a)
+  ExitCode result = solveLinearSystem(desiredTask, &a_, resErr);
+  if (result != ExitCode::Success) {
+    ROS_ERROR("Failed to solve linear system!");
+    return result;
+  }
+
+  // Compute the task scale associated with each joint, and keep track of the most critical one
+  *jntIdx = 0;  // index of the most critical joint
+  *taskScale = SnsIkBase::POS_INF;  // minimum scale factor over all joints
+  for (int i = 0; i < nJnt; i++) {
+    double jntScaleFactor = SnsIkBase::POS_INF;  // joint is constrained
+    if (mask.isFree(i)) {
+      double b = jointOut(i) - a_(i);
+      jntScaleFactor = SnsIkBase::findScaleFactor(qLow(i) - b, qUpp(i) - b, a_(i));
+    }
+    if (i == 0 || jntScaleFactor < *taskScale) {
+      *jntIdx = i;
+      *taskScale = jntScaleFactor;
+    }
+  }
+
+  return ExitCode::Success;
+}
+
+/*************************************************************************************************/
+
+// General-purpose kernel:
+template class SnsIkKernel<Eigen::Dynamic, Eigen::Dynamic>;
+
+// Fixed-size kernels for a full six-dimensional (pose) task on common arms:
+template class SnsIkKernel<6, 6>;
+template class SnsIkKernel<6, 7>;
+template class SnsIkKernel<6, 8>;
+
+}  // namespace sns_ik
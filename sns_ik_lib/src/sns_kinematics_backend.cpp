@@ -0,0 +1,138 @@
+/** @file sns_kinematics_backend.cpp
+ *
+ * @brief Registry of kinematics backends, selected by the hash of the chain
+ *
+ *    Copyright 2018 Rethink Robotics
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+#include <sns_ik/sns_kinematics_backend.hpp>
+
+#include <cstring>
+#include <kdl/joint.hpp>
+#include <kdl/segment.hpp>
+#include <map>
+#include <mutex>
+#include <ros/console.h>
+
+#include <sns_ik/sns_chain_kinematics.hpp>
+
+namespace sns_ik {
+
+namespace {
+
+// 64-bit FNV-1a hash
+const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+const uint64_t FNV_PRIME = 1099511628211ULL;
+
+void hashBytes(const void* data, size_t size, uint64_t* hash)
+{
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; i++) {
+    *hash = (*hash ^ bytes[i]) * FNV_PRIME;
+  }
+}
+
+void hashDouble(double value, uint64_t* hash)
+{
+  if (value == 0.0) {
+    value = 0.0;  // -0.0 and 0.0 describe the same chain
+  }
+  uint64_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  hashBytes(&bits, sizeof(bits), hash);
+}
+
+void hashFrame(const KDL::Frame& frame, uint64_t* hash)
+{
+  for (int i = 0; i < 9; i++) {
+    hashDouble(frame.M.data[i], hash);
+  }
+  for (int i = 0; i < 3; i++) {
+    hashDouble(frame.p(i), hash);
+  }
+}
+
+// The registry is created on first use, so that it can be used during static initialization
+std::map<uint64_t, KinematicsBackendFactory>& getRegistry(std::mutex** mutex)
+{
+  static std::mutex registryMutex;
+  static std::map<uint64_t, KinematicsBackendFactory> registry;
+  *mutex = &registryMutex;
+  return registry;
+}
+
+}  // namespace
+
+/*************************************************************************************************/
+
+uint64_t computeChainHash(const KDL::Chain& chain)
+{
+  uint64_t hash = FNV_OFFSET_BASIS;
+  int32_t nSeg = chain.getNrOfSegments();
+  hashBytes(&nSeg, sizeof(nSeg), &hash);
+  for (const KDL::Segment& segment : chain.segments) {
+    const KDL::Joint& joint = segment.getJoint();
+    int32_t type = joint.getType();
+    hashBytes(&type, sizeof(type), &hash);
+    if (joint.getType() != KDL::Joint::None) {
+      hashFrame(joint.pose(0.0), &hash);
+      KDL::Twist unitTwist = joint.twist(1.0);
+      for (int i = 0; i < 3; i++) {
+        hashDouble(unitTwist.vel(i), &hash);
+        hashDouble(unitTwist.rot(i), &hash);
+      }
+    }
+    hashFrame(segment.pose(0.0), &hash);
+  }
+  return hash;
+}
+
+/*************************************************************************************************/
+
+bool registerKinematicsBackend(uint64_t chainHash, const KinematicsBackendFactory& factory)
+{
+  std::mutex* mutex;
+  std::map<uint64_t, KinematicsBackendFactory>& registry = getRegistry(&mutex);
+  std::lock_guard<std::mutex> lock(*mutex);
+  return registry.emplace(chainHash, factory).second;
+}
+
+/*************************************************************************************************/
+
+std::shared_ptr<const KinematicsBackend> createKinematicsBackend(const KDL::Chain& chain)
+{
+  uint64_t chainHash = computeChainHash(chain);
+  KinematicsBackendFactory factory;
+  {
+    std::mutex* mutex;
+    std::map<uint64_t, KinematicsBackendFactory>& registry = getRegistry(&mutex);
+    std::lock_guard<std::mutex> lock(*mutex);
+    auto it = registry.find(chainHash);
+    if (it != registry.end()) {
+      factory = it->second;
+    }
+  }
+  if (factory) {
+    std::shared_ptr<const KinematicsBackend> backend = factory();
+    if (backend && backend->getNrOfJoints() == int(chain.getNrOfJoints())) {
+      ROS_DEBUG("SNS_IK: Using the registered kinematics backend for chain hash 0x%016llx.",
+                static_cast<unsigned long long>(chainHash));
+      return backend;
+    }
+    ROS_ERROR("SNS_IK: Invalid kinematics backend for chain hash 0x%016llx!",
+              static_cast<unsigned long long>(chainHash));
+  }
+  return std::make_shared<ChainKinematics>(chain);
+}
+
+}  // namespace sns_ik
@@ -0,0 +1,497 @@
+/** @file sns_kinematics_codegen.cpp
+ *
+ * @brief Generate C++ code for the kinematics of one specific chain
+ *
+ *    Copyright 2018 Rethink Robotics
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+#include <sns_ik/sns_kinematics_codegen.hpp>
+
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+#include <sns_ik/sns_chain_kinematics.hpp>
+#include <sns_ik/sns_kinematics_backend.hpp>
+
+namespace sns_ik {
+
+namespace {
+
+// Entries of the model that are this close to -1, 0, or 1 are rounded to these values
+const double ROUNDING_TOL = 1e-14;
+
+double roundConstant(double x)
+{
+  for (double v : {-1.0, 0.0, 1.0}) {
+    if (std::abs(x - v) < ROUNDING_TOL) {
+      return v;
+    }
+  }
+  return x;
+}
+
+std::string toLiteral(double x)
+{
+  std::ostringstream ss;
+  ss << std::setprecision(17) << x;
+  std::string literal = ss.str();
+  if (literal.find_first_of(".e") == std::string::npos) {
+    literal += ".0";
+  }
+  return literal;
+}
+
+/*
+ * Scalar in the generated code: either a constant that is known when the code is generated, or a
+ * variable of the generated code.
+ */
+struct Scalar {
+  Scalar(double value = 0.0) : value(value), id(-1) {}
+  Scalar(const std::string& name, int id) : value(0.0), name(name), id(id) {}
+  bool isConstant() const { return name.empty(); }
+  std::string str() const { return isConstant() ? toLiteral(value) : name; }
+  double value;  // value of a constant
+  std::string name;  // name of a variable
+  int id;  // index of the definition of a local variable, -1 for the function arguments
+};
+
+typedef std::array<Scalar, 3> Vec3;
+typedef std::array<Vec3, 3> Mat3;  // R[i][j]: row i, column j
+
+// Term of a sum: coef * a * b
+struct Term {
+  Term(double coef, const Scalar& a, const Scalar& b = Scalar(1.0)) : coef(coef), a(a), b(b) {}
+  double coef;
+  Scalar a;
+  Scalar b;
+};
+
+/*
+ * Writes the body of one function as a list of constant local variables followed by the
+ * assignments to the outputs. Products with constants are folded while the code is written, and
+ * the variables that do not contribute to an output are removed when the body is flushed.
+ */
+class CodeWriter {
+
+public:
+
+  Scalar argument(const std::string& name) const { return Scalar(name, -1); }
+
+  Scalar define(const std::string& expr, const std::vector<Scalar>& deps)
+  {
+    Definition def;
+    def.name = "t" + std::to_string(defs_.size());
+    def.expr = expr;
+    for (const Scalar& x : deps) {
+      if (x.id >= 0) {
+        def.deps.push_back(x.id);
+      }
+    }
+    defs_.push_back(def);
+    return Scalar(def.name, defs_.size() - 1);
+  }
+
+  Scalar sum(const std::vector<Term>& terms)
+  {
+    double constant = 0.0;
+    std::vector<std::pair<double, std::string>> products;
+    std::vector<Scalar> deps;
+    for (const Term& term : terms) {
+      double coef = term.coef;
+      std::string product;
+      for (const Scalar* x : {&term.a, &term.b}) {
+        if (x->isConstant()) {
+          coef *= x->value;
+        } else {
+          product += (product.empty() ? "" : " * ") + x->name;
+        }
+      }
+      if (coef == 0.0) {
+        continue;
+      }
+      if (product.empty()) {
+        constant += coef;
+      } else {
+        products.emplace_back(coef, product);
+        deps.push_back(term.a);
+        deps.push_back(term.b);
+      }
+    }
+    if (products.empty()) {
+      return Scalar(constant);
+    }
+    if (products.size() == 1 && constant == 0.0 && products[0].first == 1.0) {
+      for (const Scalar& x : deps) {
+        if (x.name == products[0].second) {
+          return x;  // a single variable: no need for a new one
+        }
+      }
+    }
+    std::string expr;
+    for (size_t i = 0; i < products.size(); i++) {
+      double coef = products[i].first;
+      if (i == 0) {
+        expr += coef < 0.0 ? "-" : "";
+      } else {
+        expr += coef < 0.0 ? " - " : " + ";
+      }
+      if (std::abs(coef) != 1.0) {
+        expr += toLiteral(std::abs(coef)) + " * ";
+      }
+      expr += products[i].second;
+    }
+    if (constant != 0.0) {
+      expr += (constant < 0.0 ? " - " : " + ") + toLiteral(std::abs(constant));
+    }
+    return define(expr, deps);
+  }
+
+  void assign(const std::string& lhs, const Scalar& x)
+  {
+    outputs_.push_back(lhs + " = " + x.str() + ";");
+    if (x.id >= 0) {
+      liveOutputs_.push_back(x.id);
+    }
+  }
+
+  void flush(std::ostream* out) const
+  {
+    std::vector<bool> live(defs_.size(), false);
+    for (int id : liveOutputs_) {
+      live[id] = true;
+    }
+    for (int i = int(defs_.size()) - 1; i >= 0; i--) {
+      if (live[i]) {
+        for (int id : defs_[i].deps) {
+          live[id] = true;
+        }
+      }
+    }
+    for (size_t i = 0; i < defs_.size(); i++) {
+      if (live[i]) {
+        *out << "    const double " << defs_[i].name << " = " << defs_[i].expr << ";\n";
+      }
+    }
+    for (const std::string& line : outputs_) {
+      *out << "    " << line << "\n";
+    }
+  }
+
+  /***** Vector operations *****/
+
+  Vec3 add(const Vec3& a, const Vec3& b)
+  {
+    Vec3 c;
+    for (int i = 0; i < 3; i++) {
+      c[i] = sum({Term(1.0, a[i]), Term(1.0, b[i])});
+    }
+    return c;
+  }
+
+  Vec3 scale(const Scalar& s, const Vec3& a)
+  {
+    Vec3 c;
+    for (int i = 0; i < 3; i++) {
+      c[i] = sum({Term(1.0, s, a[i])});
+    }
+    return c;
+  }
+
+  Vec3 cross(const Vec3& a, const Vec3& b)
+  {
+    Vec3 c;
+    for (int i = 0; i < 3; i++) {
+      int j = (i + 1) % 3;
+      int k = (i + 2) % 3;
+      c[i] = sum({Term(1.0, a[j], b[k]), Term(-1.0, a[k], b[j])});
+    }
+    return c;
+  }
+
+  Vec3 mul(const Mat3& R, const Eigen::Vector3d& v)
+  {
+    Vec3 c;
+    for (int i = 0; i < 3; i++) {
+      c[i] = sum({Term(roundConstant(v(0)), R[i][0]), Term(roundConstant(v(1)), R[i][1]),
+                  Term(roundConstant(v(2)), R[i][2])});
+    }
+    return c;
+  }
+
+  Mat3 mul(const Mat3& R, const Eigen::Matrix3d& M)
+  {
+    Mat3 C;
+    for (int i = 0; i < 3; i++) {
+      for (int j = 0; j < 3; j++) {
+        C[i][j] = sum({Term(roundConstant(M(0, j)), R[i][0]), Term(roundConstant(M(1, j)), R[i][1]),
+                       Term(roundConstant(M(2, j)), R[i][2])});
+      }
+    }
+    return C;
+  }
+
+  /*
+   * Compute R * Rot(axis, angle), with c = cos(angle) and s = sin(angle), using
+   * Rot = c * (I - axis * axis') + s * [axis]x + axis * axis'
+   */
+  Mat3 rotate(const Mat3& R, const Eigen::Vector3d& axis, const Scalar& c, const Scalar& s)
+  {
+    Eigen::Matrix3d skew;
+    skew << 0.0, -axis(2), axis(1),
+            axis(2), 0.0, -axis(0),
+            -axis(1), axis(0), 0.0;
+    Eigen::Matrix3d outer = axis * axis.transpose();
+    Mat3 C;
+    for (int i = 0; i < 3; i++) {
+      for (int j = 0; j < 3; j++) {
+        std::vector<Term> terms;
+        for (int k = 0; k < 3; k++) {
+          terms.emplace_back(roundConstant((k == j ? 1.0 : 0.0) - outer(k, j)), R[i][k], c);
+          terms.emplace_back(roundConstant(skew(k, j)), R[i][k], s);
+          terms.emplace_back(roundConstant(outer(k, j)), R[i][k]);
+        }
+        C[i][j] = sum(terms);
+      }
+    }
+    return C;
+  }
+
+private:
+
+  struct Definition {
+    std::string name;
+    std::string expr;
+    std::vector<int> deps;  // definitions used by the expression
+  };
+
+  std::vector<Definition> defs_;
+  std::vector<std::string> outputs_;
+  std::vector<int> liveOutputs_;
+
+};  // class CodeWriter
+
+/*************************************************************************************************/
+
+Mat3 identity()
+{
+  Mat3 I;
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      I[i][j] = Scalar(i == j ? 1.0 : 0.0);
+    }
+  }
+  return I;
+}
+
+std::string jointArgument(const std::string& vector, int i)
+{
+  return vector + "(" + std::to_string(i) + ")";
+}
+
+/*
+ * Write the forward kinematics sweep over the joints, as in ChainKinematics::computePose().
+ * @param model: kinematic model
+ * @param writer: code writer
+ * @param[out] R: rotation of the tip
+ * @param[out] p: position of the tip
+ * @param[out] jointPos: (optional) position of each joint frame
+ * @param[out] jointAxis: (optional) scaled axis of each joint, in the base frame
+ */
+void writeSweep(const ChainKinematics& model, CodeWriter* writer, Mat3* R, Vec3* p,
+                std::vector<Vec3>* jointPos, std::vector<Vec3>* jointAxis)
+{
+  *R = identity();
+  *p = Vec3();
+  const std::vector<ChainKinematics::Joint>& joints = model.getJoints();
+  for (size_t i = 0; i < joints.size(); i++) {
+    const ChainKinematics::Joint& joint = joints[i];
+    *p = writer->add(*p, writer->mul(*R, joint.p));
+    *R = writer->mul(*R, joint.R);
+    Vec3 axis = writer->mul(*R, Eigen::Vector3d(joint.scale * joint.axis));
+    Scalar q = writer->argument(jointArgument("q", i));
+    if (jointPos) {
+      jointPos->push_back(*p);
+      jointAxis->push_back(axis);
+    }
+    if (joint.motion == ChainKinematics::Motion::Rotation) {
+      std::string angle = (joint.scale == 1.0 ? "" : toLiteral(joint.scale) + " * ") + q.name;
+      Scalar c = writer->define("std::cos(" + angle + ")", {});
+      Scalar s = writer->define("std::sin(" + angle + ")", {});
+      *R = writer->rotate(*R, joint.axis, c, s);
+    } else {
+      *p = writer->add(*p, writer->scale(q, axis));
+    }
+  }
+  *p = writer->add(*p, writer->mul(*R, model.getTipPosition()));
+  *R = writer->mul(*R, model.getTipRotation());
+}
+
+void writePose(const Mat3& R, const Vec3& p, CodeWriter* writer)
+{
+  for (int i = 0; i < 9; i++) {
+    writer->assign("rotation[" + std::to_string(i) + "]", R[i / 3][i % 3]);
+  }
+  for (int i = 0; i < 3; i++) {
+    writer->assign("pose->p.data[" + std::to_string(i) + "]", p[i]);
+  }
+}
+
+void writeComputePose(const ChainKinematics& model, std::ostream* out)
+{
+  CodeWriter writer;
+  Mat3 R;
+  Vec3 p;
+  writeSweep(model, &writer, &R, &p, nullptr, nullptr);
+  writePose(R, p, &writer);
+  *out << "  void computePose(const Eigen::Ref<const Eigen::VectorXd>& q,\n"
+       << "                   KDL::Frame* pose) const override\n"
+       << "  {\n"
+       << "    double* rotation = pose->M.data;\n";
+  writer.flush(out);
+  *out << "  }\n\n";
+}
+
+void writeComputePoseAndJacobian(const ChainKinematics& model, std::ostream* out)
+{
+  CodeWriter writer;
+  Mat3 R;
+  Vec3 p;
+  std::vector<Vec3> jointPos, jointAxis;
+  writeSweep(model, &writer, &R, &p, &jointPos, &jointAxis);
+  writePose(R, p, &writer);
+  const std::vector<ChainKinematics::Joint>& joints = model.getJoints();
+  for (size_t j = 0; j < joints.size(); j++) {
+    Vec3 linear, angular;
+    if (joints[j].motion == ChainKinematics::Motion::Rotation) {
+      Vec3 lever = writer.add(p, writer.scale(Scalar(-1.0), jointPos[j]));
+      linear = writer.cross(jointAxis[j], lever);
+      angular = jointAxis[j];
+    } else {
+      linear = jointAxis[j];
+    }
+    for (int i = 0; i < 3; i++) {
+      std::string col = ", " + std::to_string(j) + ")";
+      writer.assign("(*jacobian)(" + std::to_string(i) + col, linear[i]);
+      writer.assign("(*jacobian)(" + std::to_string(i + 3) + col, angular[i]);
+    }
+  }
+  *out << "  void computePoseAndJacobian(const Eigen::Ref<const Eigen::VectorXd>& q,\n"
+       << "                              KDL::Frame* pose, Eigen::MatrixXd* jacobian) const override\n"
+       << "  {\n"
+       << "    jacobian->resize(6, " << joints.size() << ");\n"
+       << "    double* rotation = pose->M.data;\n";
+  writer.flush(out);
+  *out << "  }\n\n";
+}
+
+void writeComputeJacobianDotQdot(const ChainKinematics& model, std::ostream* out)
+{
+  // Same recursion as ChainKinematics::computeJacobianDotQdot()
+  CodeWriter writer;
+  Mat3 R = identity();
+  Vec3 w, dw, a;
+  const std::vector<ChainKinematics::Joint>& joints = model.getJoints();
+  for (size_t i = 0; i < joints.size(); i++) {
+    const ChainKinematics::Joint& joint = joints[i];
+    Vec3 r = writer.mul(R, joint.p);
+    a = writer.add(a, writer.add(writer.cross(dw, r), writer.cross(w, writer.cross(w, r))));
+    R = writer.mul(R, joint.R);
+    Vec3 axis = writer.mul(R, Eigen::Vector3d(joint.scale * joint.axis));
+    Scalar q = writer.argument(jointArgument("q", i));
+    Vec3 u = writer.scale(writer.argument(jointArgument("qd", i)), axis);
+    if (joint.motion == ChainKinematics::Motion::Rotation) {
+      dw = writer.add(dw, writer.cross(w, u));
+      w = writer.add(w, u);
+      std::string angle = (joint.scale == 1.0 ? "" : toLiteral(joint.scale) + " * ") + q.name;
+      Scalar c = writer.define("std::cos(" + angle + ")", {});
+      Scalar s = writer.define("std::sin(" + angle + ")", {});
+      R = writer.rotate(R, joint.axis, c, s);
+    } else {
+      Vec3 d = writer.scale(q, axis);
+      a = writer.add(a, writer.add(writer.cross(dw, d), writer.cross(w, writer.cross(w, d))));
+      a = writer.add(a, writer.scale(Scalar(2.0), writer.cross(w, u)));
+    }
+  }
+  Vec3 r = writer.mul(R, model.getTipPosition());
+  a = writer.add(a, writer.add(writer.cross(dw, r), writer.cross(w, writer.cross(w, r))));
+  for (int i = 0; i < 3; i++) {
+    writer.assign("(*jdotQdot)(" + std::to_string(i) + ")", a[i]);
+    writer.assign("(*jdotQdot)(" + std::to_string(i + 3) + ")", dw[i]);
+  }
+  *out << "  void computeJacobianDotQdot(const Eigen::Ref<const Eigen::VectorXd>& q,\n"
+       << "                              const Eigen::Ref<const Eigen::VectorXd>& qd,\n"
+       << "                              Eigen::VectorXd* jdotQdot) const override\n"
+       << "  {\n"
+       << "    jdotQdot->resize(6);\n";
+  writer.flush(out);
+  *out << "  }\n\n";
+}
+
+}  // namespace
+
+/*************************************************************************************************/
+
+void generateKinematicsCode(const KDL::Chain& chain, const std::string& className, std::ostream* out)
+{
+  ChainKinematics model(chain);
+  char hash[32];
+  std::snprintf(hash, sizeof(hash), "0x%016llxULL",
+                static_cast<unsigned long long>(computeChainHash(chain)));
+
+  *out << "// Kinematics of one specific chain, generated by sns_ik::generateKinematicsCode().\n"
+       << "// Do not edit: regenerate the file when the chain changes.\n"
+       << "\n"
+       << "#include <cmath>\n"
+       << "#include <memory>\n"
+       << "\n"
+       << "#include <sns_ik/sns_kinematics_backend.hpp>\n"
+       << "\n"
+       << "namespace sns_ik {\n"
+       << "\n"
+       << "namespace {\n"
+       << "\n"
+       << "class " << className << " : public KinematicsBackend {\n"
+       << "\n"
+       << "public:\n"
+       << "\n"
+       << "  int getNrOfJoints() const override { return " << model.getNrOfJoints() << "; }\n"
+       << "\n";
+  writeComputePose(model, out);
+  writeComputePoseAndJacobian(model, out);
+  writeComputeJacobianDotQdot(model, out);
+  *out << "};  // class " << className << "\n"
+       << "\n"
+       << "}  // namespace\n"
+       << "\n"
+       << "std::shared_ptr<const KinematicsBackend> create" << className << "()\n"
+       << "{\n"
+       << "  return std::make_shared<" << className << ">();\n"
+       << "}\n"
+       << "\n"
+       << "namespace {\n"
+       << "\n"
+       << "// Register the backend during static initialization\n"
+       << "struct Registration {\n"
+       << "  Registration() { registerKinematicsBackend(" << hash << ", create" << className << "); }\n"
+       << "} registration;\n"
+       << "\n"
+       << "}  // namespace\n"
+       << "\n"
+       << "}  // namespace sns_ik\n";
+}
+
+}  // namespace sns_ik
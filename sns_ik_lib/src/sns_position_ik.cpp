@@ -20,16 +20,92 @@
 #include <sns_ik/sns_position_ik.hpp>
 #include <sns_ik/sns_velocity_ik.hpp>
 #include <ros/console.h>
+#include <chrono>
+#include <cmath>
+#include <limits>
 
 #include "sns_ik_math_utils.hpp"
 
 namespace sns_ik {
 
+const int SNSPositionIK::CANCELLED;
+const int SNSPositionIK::TIMED_OUT;
+const int SNSPositionIK::IN_PROGRESS;
+
+// Number of iterations between checks of the time limit
+static const int TIMEOUT_CHECK_PERIOD = 4;
+
+// Adaptive step: the step scale is increased when the error reduction of a step is at least
+// STEP_RATIO_HIGH times the reduction predicted by the Jacobian, and decreased when it is less
+// than STEP_RATIO_LOW times the prediction. Steps smaller than the nominal step size were found to
+// need more iterations, so the scale is not decreased below one.
+static const double STEP_RATIO_LOW = 0.25;
+static const double STEP_RATIO_HIGH = 0.75;
+static const double STEP_SCALE_MIN = 1.0;
+static const double STEP_SCALE_MAX = 4.0;
+
+// Restarts: the solve stagnates when the error was not reduced by STAGNATION_REDUCTION (relative)
+// in the last STAGNATION_ITERATIONS iterations. The seeds of the restarts are points of the Halton
+// sequence, after the points that are used by SNS_IK::CartToJntMultiSeed().
+static const int STAGNATION_ITERATIONS = 8;
+static const double STAGNATION_REDUCTION = 0.05;
+static const int RESTART_HALTON_OFFSET = 1000;
+
+// Tolerances: the task has the rows of the axes that are outside this fraction of their tolerance,
+// and drives them to it. The margin keeps the axes from leaving and entering the task on
+// successive iterations, near the edge of their tolerance.
+static const double TOLERANCE_TARGET_FRACTION = 0.5;
+
+/*
+ * Broyden rank-one update of the Jacobian, from the joint step and the change of the pose of the
+ * last iteration: J += (dx - J*dq) * dq^T / (dq^T*dq)
+ * @param dq: joint step
+ * @param poseA: pose before the step
+ * @param poseB: pose after the step
+ * @param[in/out] jacobian: Jacobian to update
+ * @param residual: workspace, with 6 rows
+ */
+static void broydenUpdate(const Eigen::VectorXd& dq, const KDL::Frame& poseA, const KDL::Frame& poseB,
+                          Eigen::MatrixXd* jacobian, Eigen::VectorXd* residual)
+{
+  double dqSquaredNorm = dq.squaredNorm();
+  if (dqSquaredNorm < 1e-20) {
+    return;
+  }
+  KDL::Vector dp = poseB.p - poseA.p;
+  KDL::Vector dr = (poseB.M * poseA.M.Inverse()).GetRot();
+  *residual << dp.x(), dp.y(), dp.z(), dr.x(), dr.y(), dr.z();
+  residual->noalias() -= (*jacobian) * dq;
+  *residual /= dqSquaredNorm;
+  jacobian->noalias() += (*residual) * dq.transpose();
+}
+
+/*
+ * Error beyond the tolerance of each axis of the goal frame
+ * @param bounds: tolerance on each axis of the goal frame
+ * @param error: offset of the pose from the goal in the goal frame, in the same order as the
+ *               Jacobian rows: translation, then rotation vector
+ * @param[out] errL: norm of the translation error beyond the tolerances
+ * @param[out] errR: norm of the rotation error beyond the tolerances
+ */
+static void calcExcessError(const KDL::Twist& bounds, const Eigen::VectorXd& error,
+                            double* errL, double* errR)
+{
+  double squaredL = 0.0, squaredR = 0.0;
+  for (int k = 0; k < 3; k++) {
+    double excessL = std::max(std::abs(error(k)) - std::abs(bounds[k]), 0.0);
+    double excessR = std::max(std::abs(error(k + 3)) - std::abs(bounds[k + 3]), 0.0);
+    squaredL += excessL * excessL;
+    squaredR += excessR * excessR;
+  }
+  *errL = std::sqrt(squaredL);
+  *errR = std::sqrt(squaredR);
+}
+
 SNSPositionIK::SNSPositionIK(KDL::Chain chain, std::shared_ptr<SNSVelocityIK> velocity_ik, double eps) :
     m_chain(chain),
     m_ikVelSolver(velocity_ik),
-    m_positionFK(chain),
-    m_jacobianSolver(chain),
+    m_kinematics(createKinematicsBackend(chain)),
     m_linearMaxStepSize(0.2),
     m_angularMaxStepSize(0.2),
     m_maxIterations(150),
@@ -37,7 +113,14 @@ SNSPositionIK::SNSPositionIK(KDL::Chain chain, std::shared_ptr<SNSVelocityIK> ve
     m_dt(0.2),
     m_useBarrierFunction(true),
     m_barrierInitAlpha(0.1),
-    m_barrierDecay(0.8)
+    m_barrierDecay(0.8),
+    m_timeout(0.0),
+    m_cancel(nullptr),
+    m_useCachedSeed(true),
+    m_useAdaptiveStep(true),
+    m_jacobianUpdatePeriod(1),
+    m_useRestarts(true),
+    m_useVelocityWarmStart(true)
 {
 }
 
@@ -45,28 +128,93 @@ SNSPositionIK::~SNSPositionIK()
 {
 }
 
-bool SNSPositionIK::calcPoseError(const KDL::JntArray& q,
+void SNSPositionIK::calcPoseError(const KDL::Frame& pose,
                                   const KDL::Frame& goal,
-                                  KDL::Frame* pose,
                                   double* errL,
                                   double* errR,
                                   KDL::Vector* trans,
                                   KDL::Vector* rotAxis)
 {
-  if (m_positionFK.JntToCart(q, *pose) < 0)
-  {
-    ROS_ERROR("JntToCart failed");
-    return false;
-  }
-
   // Calculate the offset transform
-  *trans = goal.p - pose->p;
+  *trans = goal.p - pose.p;
   *errL = trans->Norm();
-  KDL::Rotation rot = goal.M * pose->M.Inverse();
+  KDL::Rotation rot = goal.M * pose.M.Inverse();
   *errR = rot.GetRotAngle(*rotAxis);  // returns [0 ... pi]
-  return true;
 }
 
+/*
+ * State of the solve that was started by begin(): the iterate, the barrier function, the step
+ * control and the history of the error.
+ */
+struct SNSPositionIK::SolveState {
+  // Problem
+  KDL::JntArray seed;
+  KDL::Frame goal;
+  KDL::Twist bounds;
+  KDL::JntArray nsBias;
+  std::vector<int> nsIndices;
+  double nsGain;
+  Eigen::VectorXd jointLimitLow;
+  Eigen::VectorXd jointLimitHigh;
+  std::vector<Task> sot;
+  bool cacheHit;
+
+  // Tolerances: the task only has the rows of the goal frame axes that are outside (a fraction of)
+  // their tolerance. The full Jacobian is kept in `jacobian`, or in sot[0] without tolerances.
+  bool reducedTask;
+  Eigen::Matrix3d goalRotation;
+  Eigen::MatrixXd jacobian;
+  Eigen::MatrixXd goalJacobian;  // the Jacobian in the goal frame
+  Eigen::VectorXd goalError, prevGoalError, predictedGoalError;  // errors in the goal frame
+
+  // Status
+  int status;  // IN_PROGRESS or the return code of the solve
+  int iteration;
+  int restartCount;
+  std::chrono::steady_clock::time_point startTime;
+  KDL::JntArray qBest;  // the iterate that is closest to the goal, or the solution
+  double bestErr;
+
+  // Iterate
+  KDL::JntArray q;
+  KDL::Frame pose;
+  Eigen::VectorXd qDot;
+  double lineErr;
+  double rotErr;
+  KDL::Vector trans;
+  KDL::Vector rotAxis;
+  double barrierAlpha;
+
+  // Adaptive step: the previous iterate, which is restored if the step from it increased the error.
+  // Broyden updates of the Jacobian also start from the previous iterate.
+  bool keepPrevious;
+  double stepScale;
+  double prevErr, prevLineErr, prevRotErr;
+  double predictedReduction;
+  KDL::JntArray qPrev;
+  KDL::Frame posePrev;
+  KDL::Vector prevTrans, prevRotAxis;
+  Eigen::MatrixXd prevJacobian;
+  Eigen::VectorXd predictedTwist;
+  Eigen::VectorXd qStep;
+
+  // Broyden updates: number of updates since the last exact Jacobian
+  int broydenCount, prevBroydenCount;
+  bool nearGoal;  // the last step was not limited by the maximum step sizes
+  Eigen::VectorXd jacobianResidual;
+
+  // Warm start of the velocity solver: its setting before the solve
+  bool velocityWarmStart;
+
+  // Restarts: the iteration of the last significant reduction of the error since the restart
+  bool restarted;  // the first iteration of the solve or of a restart
+  double stagnationErr;
+  int stagnationIteration;
+  Eigen::VectorXd haltonSample;
+};
+
+/*************************************************************************************************/
+
 int SNSPositionIK::CartToJnt(const KDL::JntArray& joint_seed,
                              const KDL::Frame& goal_pose,
                              const KDL::JntArray& joint_ns_bias,
@@ -76,140 +224,556 @@ int SNSPositionIK::CartToJnt(const KDL::JntArray& joint_seed,
                              KDL::JntArray* return_joints,
                              const KDL::Twist& bounds)
 {
-  Eigen::VectorXd jl_low = m_ikVelSolver->getJointLimitLow();
-  Eigen::VectorXd jl_high = m_ikVelSolver->getJointLimitHigh();
-  Eigen::VectorXd maxJointVel = m_ikVelSolver->getJointVelocityMax();
+  if (return_joints->rows() != joint_seed.rows()) {
+    return_joints->resize(joint_seed.rows());
+  }
+  return CartToJnt(joint_seed.data, goal_pose, joint_ns_bias.data, ns_jacobian, ns_indicies, ns_gain,
+                   return_joints->data, bounds);
+}
+
+/*************************************************************************************************/
 
-  // initialize variables
-  bool solutionFound = false;
-  KDL::JntArray q_i = joint_seed;
-  KDL::Frame pose_i;
+int SNSPositionIK::CartToJnt(const Eigen::Ref<const Eigen::VectorXd>& joint_seed,
+                             const KDL::Frame& goal_pose,
+                             const Eigen::Ref<const Eigen::VectorXd>& joint_ns_bias,
+                             const Eigen::MatrixXd& ns_jacobian,
+                             const std::vector<int>& ns_indicies,
+                             const double ns_gain,
+                             Eigen::Ref<Eigen::VectorXd> return_joints,
+                             const KDL::Twist& bounds)
+{
+  if (return_joints.rows() != joint_seed.rows()) {
+    ROS_ERROR("The output has %d joints, but the seed has %d joints", int(return_joints.rows()),
+              int(joint_seed.rows()));
+    return -1;
+  }
+  if (!begin(joint_seed, goal_pose, joint_ns_bias, ns_jacobian, ns_indicies, ns_gain, bounds)) {
+    return -1;
+  }
+  int result = step(m_maxIterations);
+  if (result == 1 || result == TIMED_OUT) {
+    best(return_joints);
+  }
+  return result;
+}
+
+/*************************************************************************************************/
+
+bool SNSPositionIK::begin(const Eigen::Ref<const Eigen::VectorXd>& joint_seed,
+                          const KDL::Frame& goal_pose,
+                          const Eigen::Ref<const Eigen::VectorXd>& joint_ns_bias,
+                          const Eigen::MatrixXd& ns_jacobian,
+                          const std::vector<int>& ns_indicies,
+                          const double ns_gain,
+                          const KDL::Twist& bounds)
+{
+  // A rejected seed leaves a solve in progress untouched
   int n_dof = joint_seed.rows();
-  std::vector<Task> sot(1);
-  sot[0].desired = Eigen::VectorXd::Zero(6);
+  if (n_dof != m_kinematics->getNrOfJoints()) {
+    ROS_ERROR("Joint seed has %d joints, but the chain has %d joints", n_dof, m_kinematics->getNrOfJoints());
+    return false;
+  }
+
+  if (!m_solve) {
+    m_solve.reset(new SolveState());
+  }
+  SolveState& st = *m_solve;
+  if (st.status == IN_PROGRESS) {
+    m_ikVelSolver->setUseWarmStart(st.velocityWarmStart);
+  }
+  st.status = -1;
+  st.iteration = 0;
+  st.restartCount = 0;
+  st.bestErr = std::numeric_limits<double>::infinity();
+
+  // The vectors and matrices keep their memory from one solve to the next
+  st.seed.data = joint_seed;
+  st.goal = goal_pose;
+  st.bounds = bounds;
+  st.nsBias.data = joint_ns_bias;
+  st.nsIndices = ns_indicies;
+  st.nsGain = ns_gain;
+  st.jointLimitLow = m_ikVelSolver->getJointLimitLow();
+  st.jointLimitHigh = m_ikVelSolver->getJointLimitHigh();
+  st.sot.resize(1);
+  st.sot[0].desired = Eigen::VectorXd::Zero(6);
+  st.reducedTask = false;
+  for (int k = 0; k < 6; k++) {
+    st.reducedTask = st.reducedTask || bounds[k] != 0.0;
+  }
+  if (st.reducedTask) {
+    for (int i = 0; i < 3; i++) {
+      for (int j = 0; j < 3; j++) {
+        st.goalRotation(i, j) = goal_pose.M(i, j);
+      }
+    }
+    st.goalError.resize(6);
+    st.prevGoalError.resize(6);
+    st.predictedGoalError.resize(6);
+  }
 
   // If there's a nullspace bias, create a secondary task
   if (joint_ns_bias.rows()) {
-    Task nsTask;
-    nsTask.jacobian = ns_jacobian;
-    nsTask.desired = Eigen::VectorXd::Zero(joint_ns_bias.rows());
+    st.sot.resize(2);
+    st.sot[1].jacobian = ns_jacobian;
+    // The bias task from SNS_IK selects the biased joints: let the solver skip the products
+    bool isSelection = (int)ns_indicies.size() == ns_jacobian.rows();
+    for (int i = 0; isSelection && i < ns_jacobian.rows(); i++) {
+      int j = ns_indicies[i];
+      isSelection = j >= 0 && j < ns_jacobian.cols() && ns_jacobian(i, j) == 1.0 &&
+                    ns_jacobian.row(i).cwiseAbs().sum() == 1.0;
+    }
+    if (isSelection) {
+      st.sot[1].structure = Task::Selection;
+      st.sot[1].indices = ns_indicies;
+    }
     // the desired task to apply the NS bias will change with each iteration
-    sot.push_back(nsTask);
-  }
-
-  double theta;
-  double lineErr, rotErr;
-  Eigen::VectorXd qDot(n_dof);
-  KDL::Jacobian jacobian;
-  jacobian.resize(q_i.rows());
-  KDL::Vector rotAxis, trans;
-  KDL::Rotation rot;
-  KDL::Twist delta_twist;
-
-  double barrierAlpha = m_barrierInitAlpha;
-
-  int ii;
-  for (ii = 0; ii < m_maxIterations; ++ii) {
-
-    if (!calcPoseError(q_i, goal_pose, &pose_i, &lineErr, &rotErr, &trans, &rotAxis)) {
-      ROS_ERROR("Failed to calculate pose error!");
-      return -1;
-    }
-
-    // Check stopping tolerances
-    delta_twist = diffRelative(goal_pose, pose_i);
-
-    if (std::abs(delta_twist.vel.x()) <= std::abs(bounds.vel.x()))
-      delta_twist.vel.x(0);
-    if (std::abs(delta_twist.vel.y()) <= std::abs(bounds.vel.y()))
-      delta_twist.vel.y(0);
-    if (std::abs(delta_twist.vel.z()) <= std::abs(bounds.vel.z()))
-      delta_twist.vel.z(0);
-    if (std::abs(delta_twist.rot.x()) <= std::abs(bounds.rot.x()))
-      delta_twist.rot.x(0);
-    if (std::abs(delta_twist.rot.y()) <= std::abs(bounds.rot.y()))
-      delta_twist.rot.y(0);
-    if (std::abs(delta_twist.rot.z()) <= std::abs(bounds.rot.z()))
-      delta_twist.rot.z(0);
-
-    if(KDL::Equal(delta_twist, KDL::Twist::Zero(), m_eps)) {
-      solutionFound = true;
+    st.sot[1].desired = Eigen::VectorXd::Zero(joint_ns_bias.rows());
+  }
+
+  // Start from the cached solution of a nearby pose, if there is one
+  st.q.data = joint_seed;
+  st.cacheHit = false;
+  if (m_solutionCache && m_useCachedSeed) {
+    st.cacheHit = m_solutionCache->lookup(goal_pose, &st.q);
+    wrapContinuousJoints(st.seed, &st.q);
+  }
+  st.qBest = st.q;
+  st.qDot.resize(n_dof);
+  st.barrierAlpha = m_barrierInitAlpha;
+
+  st.keepPrevious = m_useAdaptiveStep || m_jacobianUpdatePeriod > 1;
+  st.stepScale = 1.0;
+  st.prevErr = 0.0;
+  st.prevLineErr = 0.0;
+  st.prevRotErr = 0.0;
+  st.predictedReduction = 0.0;
+  st.qPrev = st.q;
+  st.predictedTwist.resize(6);
+  st.qStep.resize(n_dof);
+
+  st.broydenCount = 0;
+  st.prevBroydenCount = 0;
+  st.nearGoal = false;
+  st.jacobianResidual.resize(6);
+
+  st.velocityWarmStart = m_ikVelSolver->getUseWarmStart();
+  m_ikVelSolver->setUseWarmStart(m_useVelocityWarmStart);
+  m_ikVelSolver->resetWarmStart();
+
+  st.restarted = true;
+  st.stagnationErr = std::numeric_limits<double>::infinity();
+  st.stagnationIteration = 0;
+  st.haltonSample.resize(n_dof);
+
+  st.startTime = std::chrono::steady_clock::now();
+  st.status = IN_PROGRESS;
+  return true;
+}
+
+/*************************************************************************************************/
+
+int SNSPositionIK::step(int nIterations)
+{
+  if (!m_solve) {
+    return -1;
+  }
+  SolveState& st = *m_solve;
+  for (int i = 0; i < nIterations && st.status == IN_PROGRESS; i++) {
+    if (st.iteration >= m_maxIterations) {
+      st.status = -1;
       break;
     }
+    iterate();
+    if (st.status == IN_PROGRESS) {
+      st.iteration++;
+    }
+  }
+  if (st.status == IN_PROGRESS && st.iteration >= m_maxIterations) {
+    st.status = -1;
+  }
+  if (st.status != IN_PROGRESS) {
+    m_ikVelSolver->setUseWarmStart(st.velocityWarmStart);
+  }
+  return st.status;
+}
+
+/*************************************************************************************************/
 
-    // Enforce max linear and rotational step sizes
-    if (lineErr > m_linearMaxStepSize) {
-      trans = (m_linearMaxStepSize / lineErr) * trans;
+double SNSPositionIK::best(KDL::JntArray* q) const
+{
+  if (!m_solve) {
+    return std::numeric_limits<double>::infinity();
+  }
+  *q = m_solve->qBest;
+  return m_solve->bestErr;
+}
+
+double SNSPositionIK::best(Eigen::Ref<Eigen::VectorXd> q) const
+{
+  if (!m_solve) {
+    return std::numeric_limits<double>::infinity();
+  }
+  q = m_solve->qBest.data;
+  return m_solve->bestErr;
+}
+
+/*************************************************************************************************/
+
+int SNSPositionIK::getLastIterationCount() const
+{
+  return m_solve ? m_solve->iteration : 0;
+}
+
+/*************************************************************************************************/
+
+int SNSPositionIK::getLastRestartCount() const
+{
+  return m_solve ? m_solve->restartCount : 0;
+}
+
+/*************************************************************************************************/
+
+void SNSPositionIK::restart()
+{
+  SolveState& st = *m_solve;
+  const Eigen::VectorXd& jl_low = st.jointLimitLow;
+  const Eigen::VectorXd& jl_high = st.jointLimitHigh;
+
+  // Restart from the next seed, keeping the iteration count. Joints with a range of more than a
+  // revolution are sampled over one revolution around the seed of the solve.
+  st.restartCount++;
+  haltonPoint(RESTART_HALTON_OFFSET + st.restartCount, &st.haltonSample);
+  for (int j = 0; j < int(st.q.rows()); j++) {
+    if (jl_high(j) - jl_low(j) > 2.0 * M_PI) {
+      st.q(j) = std::max(std::min(st.seed(j) + M_PI * (2.0 * st.haltonSample(j) - 1.0), jl_high(j)), jl_low(j));
+    } else {
+      st.q(j) = jl_low(j) + st.haltonSample(j) * (jl_high(j) - jl_low(j));
+    }
+  }
+  st.barrierAlpha = m_barrierInitAlpha;
+  st.stepScale = 1.0;
+  st.restarted = true;
+  m_ikVelSolver->resetWarmStart();
+  st.stagnationErr = std::numeric_limits<double>::infinity();
+  ROS_DEBUG("Restart %d after %d iterations", st.restartCount, st.iteration);
+}
+
+/*************************************************************************************************/
+
+void SNSPositionIK::setReducedTask(double linearMaxStepSize, double angularMaxStepSize, double dt)
+{
+  SolveState& st = *m_solve;
+  const Eigen::VectorXd& error = st.goalError;
+  Task& task = st.sot[0];
+  int nJoint = st.jacobian.cols();
+
+  // Jacobian of the error in the goal frame. The rows of the rotation vector are coupled, unlike
+  // the rows of the angular velocity: the angular velocity is mapped to the rate of the rotation
+  // vector phi by the inverse of the right Jacobian of SO(3),
+  // Jr^-1 = I + [phi]/2 + (1/theta^2 - (1 + cos(theta)) / (2 theta sin(theta))) [phi]^2
+  Eigen::Vector3d phi = error.tail<3>();
+  double theta = phi.norm();
+  double coeff = 1.0 / 12.0;
+  if (theta > 1e-4) {
+    coeff = 1.0 / (theta * theta) - (1.0 + std::cos(theta)) / (2.0 * theta * std::max(std::sin(theta), 1e-6));
+  }
+  Eigen::Matrix3d phiCross;
+  phiCross << 0.0, -phi(2), phi(1),
+              phi(2), 0.0, -phi(0),
+              -phi(1), phi(0), 0.0;
+  Eigen::Matrix3d rateMap = Eigen::Matrix3d::Identity() + 0.5 * phiCross + coeff * phiCross * phiCross;
+  st.goalJacobian.resize(6, nJoint);
+  st.goalJacobian.topRows<3>().noalias() = st.goalRotation.transpose() * st.jacobian.topRows<3>();
+  st.goalJacobian.bottomRows<3>().noalias() = (rateMap * st.goalRotation.transpose()) * st.jacobian.bottomRows<3>();
+
+  // Offset to remove on each axis, zero for the axes that are not in the task
+  double target[6];
+  double squaredL = 0.0, squaredR = 0.0;
+  int nRow = 0;
+  for (int k = 0; k < 6; k++) {
+    double tolerance = TOLERANCE_TARGET_FRACTION * std::abs(st.bounds[k]);
+    target[k] = 0.0;
+    if (std::abs(error(k)) > tolerance) {
+      target[k] = error(k) - std::copysign(tolerance, error(k));
+      nRow++;
     }
+    (k < 3 ? squaredL : squaredR) += target[k] * target[k];
+  }
+  double scaleL = std::min(linearMaxStepSize / std::max(std::sqrt(squaredL), 1e-12), 1.0);
+  double scaleR = std::min(angularMaxStepSize / std::max(std::sqrt(squaredR), 1e-12), 1.0);
 
-    theta = rotErr;
-    if (theta > m_angularMaxStepSize) {
-      theta = m_angularMaxStepSize;
+  task.jacobian.resize(nRow, nJoint);
+  task.desired.resize(nRow);
+  int row = 0;
+  for (int k = 0; k < 6; k++) {
+    if (target[k] != 0.0) {
+      task.jacobian.row(row) = st.goalJacobian.row(k);
+      task.desired(row) = (k < 3 ? scaleL : scaleR) * target[k] / dt;
+      row++;
     }
+  }
+}
 
-    // Calculate the desired Cartesian twist
-    sot[0].desired(0) = trans.data[0] / m_dt;
-    sot[0].desired(1) = trans.data[1] / m_dt;
-    sot[0].desired(2) = trans.data[2] / m_dt;
-    sot[0].desired(3) = theta * rotAxis.data[0] / m_dt;
-    sot[0].desired(4) = theta * rotAxis.data[1] / m_dt;
-    sot[0].desired(5) = theta * rotAxis.data[2] / m_dt;
-
-    if (m_jacobianSolver.JntToJac(q_i, jacobian) < 0)
-    {
-      ROS_ERROR("JntToJac failed");
-      return -1;
-    }
-    sot[0].jacobian = jacobian.data;
-
-    if (joint_ns_bias.rows()) {
-      for (size_t jj = 0; jj < joint_ns_bias.rows(); ++jj) {
-        // This calculates a "nullspace velocity".
-        // There is an arbitrary scale factor which will be set by the max scale factor.
-        int indx = ns_indicies[jj];
-        double vel = ns_gain * (joint_ns_bias(jj) - q_i(indx)); // TODO: step size needs to be optimized
-        // TODO: may want to limit the NS velocity to 50% of max joint velocity
-        //vel = std::max(-0.5*maxJointVel(indx), std::min(0.5*maxJointVel(indx), vel));
-        sot[1].desired(jj) = vel;
+/*************************************************************************************************/
+
+void SNSPositionIK::iterate()
+{
+  SolveState& st = *m_solve;
+  const Eigen::VectorXd& jl_low = st.jointLimitLow;
+  const Eigen::VectorXd& jl_high = st.jointLimitHigh;
+  const KDL::Frame& goal_pose = st.goal;
+  const KDL::Twist& bounds = st.bounds;
+  std::vector<Task>& sot = st.sot;
+  KDL::JntArray& q_i = st.q;
+  KDL::Frame& pose_i = st.pose;
+  Eigen::VectorXd& qDot = st.qDot;
+  double& lineErr = st.lineErr;
+  double& rotErr = st.rotErr;
+  KDL::Vector& trans = st.trans;
+  KDL::Vector& rotAxis = st.rotAxis;
+  Eigen::MatrixXd& jacobian = st.reducedTask ? st.jacobian : sot[0].jacobian;
+  int ii = st.iteration;
+
+  if (m_cancel && m_cancel->load(std::memory_order_relaxed)) {
+    st.status = CANCELLED;
+    return;
+  }
+
+  // The forward kinematics and the Jacobian are computed in one pass. Between the periodic
+  // refreshes, the Jacobian is approximated by Broyden updates, which only need the pose.
+  if (st.restarted || st.broydenCount + 1 >= m_jacobianUpdatePeriod || !st.nearGoal) {
+    m_kinematics->computePoseAndJacobian(q_i.data, &pose_i, &jacobian);
+    st.broydenCount = 0;
+  } else {
+    m_kinematics->computePose(q_i.data, &pose_i);
+    st.qStep = q_i.data - st.qPrev.data;
+    for (size_t j = 0; j < m_continuous.size(); j++) {
+      if (m_continuous[j]) {
+        st.qStep(j) = wrapAngle(st.qStep(j));
+      }
+    }
+    broydenUpdate(st.qStep, st.posePrev, pose_i, &jacobian, &st.jacobianResidual);
+    st.broydenCount++;
+  }
+  calcPoseError(pose_i, goal_pose, &lineErr, &rotErr, &trans, &rotAxis);
+  if (st.reducedTask) {
+    KDL::Vector rot = rotErr * rotAxis;
+    st.goalError.head<3>().noalias() = st.goalRotation.transpose() * Eigen::Map<const Eigen::Vector3d>(trans.data);
+    st.goalError.tail<3>().noalias() = st.goalRotation.transpose() * Eigen::Map<const Eigen::Vector3d>(rot.data);
+    calcExcessError(bounds, st.goalError, &lineErr, &rotErr);
+  }
+
+  // Compare the error reduction of the last step with the reduction that was predicted by the
+  // Jacobian, like the trust region of Levenberg-Marquardt: a step that increased the error is
+  // rejected, and the step scale follows the agreement of the linear model.
+  if (st.keepPrevious && !st.restarted) {
+    double err = lineErr + rotErr;
+    double ratio = st.predictedReduction > 0.0 ? (st.prevErr - err) / st.predictedReduction : 0.0;
+    if (m_useAdaptiveStep && err > st.prevErr && st.stepScale > STEP_SCALE_MIN) {
+      q_i = st.qPrev;
+      pose_i = st.posePrev;
+      jacobian = st.prevJacobian;
+      st.broydenCount = st.prevBroydenCount;
+      lineErr = st.prevLineErr;
+      rotErr = st.prevRotErr;
+      trans = st.prevTrans;
+      rotAxis = st.prevRotAxis;
+      if (st.reducedTask) {
+        st.goalError = st.prevGoalError;
       }
+      st.stepScale = std::max(0.5 * st.stepScale, STEP_SCALE_MIN);
+    } else if (m_useAdaptiveStep) {
+      // Larger steps only help if the last step was not predicted to reach the goal
+      if (ratio > STEP_RATIO_HIGH && st.predictedReduction < (1.0 - STEP_RATIO_LOW) * st.prevErr) {
+        st.stepScale = std::min(2.0 * st.stepScale, STEP_SCALE_MAX);
+      } else if (ratio < STEP_RATIO_LOW) {
+        st.stepScale = std::max(0.5 * st.stepScale, STEP_SCALE_MIN);
+      }
+    }
+    // Progress stalls: the approximate Jacobian is replaced by the exact one
+    if (ratio < STEP_RATIO_LOW && st.broydenCount > 0) {
+      m_kinematics->computePoseAndJacobian(q_i.data, &pose_i, &jacobian);
+      st.broydenCount = 0;
+    }
+  }
+
+  // Check stopping tolerances
+  KDL::Twist delta_twist = diffRelative(goal_pose, pose_i);
+
+  if (std::abs(delta_twist.vel.x()) <= std::abs(bounds.vel.x()))
+    delta_twist.vel.x(0);
+  if (std::abs(delta_twist.vel.y()) <= std::abs(bounds.vel.y()))
+    delta_twist.vel.y(0);
+  if (std::abs(delta_twist.vel.z()) <= std::abs(bounds.vel.z()))
+    delta_twist.vel.z(0);
+  if (std::abs(delta_twist.rot.x()) <= std::abs(bounds.rot.x()))
+    delta_twist.rot.x(0);
+  if (std::abs(delta_twist.rot.y()) <= std::abs(bounds.rot.y()))
+    delta_twist.rot.y(0);
+  if (std::abs(delta_twist.rot.z()) <= std::abs(bounds.rot.z()))
+    delta_twist.rot.z(0);
 
+  if(KDL::Equal(delta_twist, KDL::Twist::Zero(), m_eps)) {
+    st.qBest = q_i;
+    st.bestErr = lineErr + rotErr;
+    st.status = 1;
+    if (m_solutionCache) {
+      m_solutionCache->insert(goal_pose, q_i);
+      m_solutionCache->recordSolve(st.cacheHit, ii);
     }
+    ROS_DEBUG("Solution Found in %d iterations!", ii);
+    return;
+  }
+
+  st.restarted = false;
 
-    m_ikVelSolver->getJointVelocity(&qDot, sot, q_i.data);
+  // Keep track of the iterate that is closest to the goal
+  if (lineErr + rotErr < st.bestErr) {
+    st.bestErr = lineErr + rotErr;
+    st.qBest = q_i;
+  }
+  if (m_timeout > 0.0 && ii % TIMEOUT_CHECK_PERIOD == 0 &&
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - st.startTime).count() > m_timeout) {
+    ROS_DEBUG("Time limit reached after %d iterations", ii);
+    st.status = TIMED_OUT;
+    return;
+  }
 
-    if (qDot.norm() < 1e-6) {  // TODO: config param
-      ROS_ERROR("qDot.norm() too small!");
-      return -2;
+  // Restart when the error stagnates, in a local minimum or against the joint limits
+  if (m_useRestarts) {
+    if (lineErr + rotErr < (1.0 - STAGNATION_REDUCTION) * st.stagnationErr) {
+      st.stagnationErr = lineErr + rotErr;
+      st.stagnationIteration = ii;
+    } else if (ii - st.stagnationIteration >= STAGNATION_ITERATIONS) {
+      restart();
+      return;
+    }
+  }
+
+  if (st.keepPrevious) {
+    st.qPrev = q_i;
+    st.posePrev = pose_i;
+    st.prevJacobian = jacobian;
+    st.prevBroydenCount = st.broydenCount;
+    st.prevLineErr = lineErr;
+    st.prevRotErr = rotErr;
+    st.prevTrans = trans;
+    st.prevRotAxis = rotAxis;
+    st.prevErr = lineErr + rotErr;
+    if (st.reducedTask) {
+      st.prevGoalError = st.goalError;
+    }
+  }
+
+  // Enforce max linear and rotational step sizes. The step scale also scales the time step, so
+  // that the joint velocity limits allow joint steps of the same scale.
+  double linearMaxStepSize = st.stepScale * m_linearMaxStepSize;
+  double angularMaxStepSize = st.stepScale * m_angularMaxStepSize;
+  double dt = st.stepScale * m_dt;
+  st.nearGoal = lineErr <= linearMaxStepSize && rotErr <= angularMaxStepSize;
+  if (st.reducedTask) {
+    setReducedTask(linearMaxStepSize, angularMaxStepSize, dt);
+  } else {
+    if (lineErr > linearMaxStepSize) {
+      trans = (linearMaxStepSize / lineErr) * trans;
     }
 
-    // Update the joint positions
-    q_i.data += m_dt * qDot;
+    double theta = rotErr;
+    if (theta > angularMaxStepSize) {
+      theta = angularMaxStepSize;
+    }
+
+    // Calculate the desired Cartesian twist
+    sot[0].desired(0) = trans.data[0] / dt;
+    sot[0].desired(1) = trans.data[1] / dt;
+    sot[0].desired(2) = trans.data[2] / dt;
+    sot[0].desired(3) = theta * rotAxis.data[0] / dt;
+    sot[0].desired(4) = theta * rotAxis.data[1] / dt;
+    sot[0].desired(5) = theta * rotAxis.data[2] / dt;
+  }
 
-    // Apply a decaying barrier function
-    // u = upper limit;  l = lower limit
-    // B(x) = -log(u - x) - log(-l + x)
-    // -alpha * dB(x)/dx === alpha * (1/(x-l) + 1/(x-u))
-    if (m_useBarrierFunction && (lineErr > 0.5 || rotErr > 0.5) ) {
-      for (int j = 0; j < jl_low.rows(); ++j) {
-        // First force the joint within limits.
-        // It can not be exactly at the limit since it will cause a division by zero NaN in the barrier function.
-        q_i.data[j] = std::max(std::min(q_i.data[j], jl_high[j] - 1e-7), jl_low[j] + 1e-7);
-        q_i.data[j] += barrierAlpha * (1/(q_i.data[j] - jl_low[j]) + 1/(q_i.data[j] - jl_high[j]));
+  if (st.nsBias.rows()) {
+    for (size_t jj = 0; jj < st.nsBias.rows(); ++jj) {
+      // This calculates a "nullspace velocity".
+      // There is an arbitrary scale factor which will be set by the max scale factor.
+      int indx = st.nsIndices[jj];
+      double error = st.nsBias(jj) - q_i(indx);
+      if (indx < int(m_continuous.size()) && m_continuous[indx]) {
+        error = wrapAngle(error);  // shortest angle to the bias
       }
-      barrierAlpha *= m_barrierDecay;
+      double vel = st.nsGain * error; // TODO: step size needs to be optimized
+      // TODO: may want to limit the NS velocity to 50% of max joint velocity
+      //vel = std::max(-0.5*maxJointVel(indx), std::min(0.5*maxJointVel(indx), vel));
+      sot[1].desired(jj) = vel;
+    }
+
+  }
+
+  m_ikVelSolver->getJointVelocity(&qDot, sot, q_i.data);
+
+  if (qDot.norm() < 1e-6) {  // TODO: config param
+    if (m_useRestarts) {
+      restart();
+      return;
+    }
+    ROS_ERROR("qDot.norm() too small!");
+    st.status = -2;
+    return;
+  }
+
+  // Error predicted by the Jacobian for the step within the joint limits. The barrier function
+  // is not part of the prediction.
+  if (st.keepPrevious) {
+    st.qStep = (q_i.data + dt * qDot).cwiseMin(jl_high).cwiseMax(jl_low) - q_i.data;
+    if (st.reducedTask) {
+      st.predictedGoalError = st.prevGoalError;
+      st.predictedGoalError.noalias() -= st.goalJacobian * st.qStep;
+      double predictedErrL, predictedErrR;
+      calcExcessError(bounds, st.predictedGoalError, &predictedErrL, &predictedErrR);
+      st.predictedReduction = st.prevErr - predictedErrL - predictedErrR;
     } else {
-      for (int j = 0; j < jl_low.rows(); ++j) {
-        q_i.data[j] = std::max(std::min(q_i.data[j], jl_high[j]), jl_low[j]);
-      }
+      st.predictedTwist.noalias() = jacobian * st.qStep;
+      const Eigen::VectorXd& predictedTwist = st.predictedTwist;
+      KDL::Vector predictedTrans = st.prevTrans - KDL::Vector(predictedTwist(0), predictedTwist(1), predictedTwist(2));
+      KDL::Vector predictedRot = st.prevRotErr * st.prevRotAxis - KDL::Vector(predictedTwist(3), predictedTwist(4), predictedTwist(5));
+      st.predictedReduction = st.prevErr - predictedTrans.Norm() - predictedRot.Norm();
     }
   }
 
-  if (solutionFound) {
-    *return_joints = q_i;
-    ROS_DEBUG("Solution Found in %d iterations!", ii);
-    return 1;  // TODO: return success/fail code
+  // Update the joint positions
+  q_i.data += dt * qDot;
+
+  // Apply a decaying barrier function
+  // u = upper limit;  l = lower limit
+  // B(x) = -log(u - x) - log(-l + x)
+  // -alpha * dB(x)/dx === alpha * (1/(x-l) + 1/(x-u))
+  if (m_useBarrierFunction && (lineErr > 0.5 || rotErr > 0.5) ) {
+    for (int j = 0; j < jl_low.rows(); ++j) {
+      // First force the joint within limits.
+      // It can not be exactly at the limit since it will cause a division by zero NaN in the barrier function.
+      q_i.data[j] = std::max(std::min(q_i.data[j], jl_high[j] - 1e-7), jl_low[j] + 1e-7);
+      q_i.data[j] += st.barrierAlpha * (1/(q_i.data[j] - jl_low[j]) + 1/(q_i.data[j] - jl_high[j]));
+      // The barrier step is very large next to a limit: keep the joint within the limits
+      q_i.data[j] = std::max(std::min(q_i.data[j], jl_high[j]), jl_low[j]);
+    }
+    st.barrierAlpha *= m_barrierDecay;
   } else {
-    return -1;
+    for (int j = 0; j < jl_low.rows(); ++j) {
+      q_i.data[j] = std::max(std::min(q_i.data[j], jl_high[j]), jl_low[j]);
+    }
+  }
+  wrapContinuousJoints(st.seed, &q_i);
+}
+
+/*************************************************************************************************/
+
+void SNSPositionIK::wrapContinuousJoints(const KDL::JntArray& reference, KDL::JntArray* q) const
+{
+  for (size_t j = 0; j < m_continuous.size(); j++) {
+    if (m_continuous[j]) {
+      (*q)(j) = reference(j) + wrapAngle((*q)(j) - reference(j));
+    }
   }
 }
 
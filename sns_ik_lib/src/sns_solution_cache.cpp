@@ -0,0 +1,255 @@
+/** @file sns_solution_cache.cpp
+ *
+ * @brief Cache of recent position IK solutions, used to warm-start SNSPositionIK
+ *
+ *    Copyright 2018 Rethink Robotics
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+#include <sns_ik/sns_solution_cache.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <ros/console.h>
+
+namespace sns_ik {
+
+namespace {
+
+// Number of shards: enough for the lock of a shard to be rarely contended
+const size_t SHARD_COUNT = 16;
+
+// Grid cell indices are stored in 21 bits each
+const int CELL_INDEX_BITS = 21;
+const uint64_t CELL_INDEX_MASK = (uint64_t(1) << CELL_INDEX_BITS) - 1;
+
+// Grid cell indices are clamped to this range before the conversion to an integer: poses that are
+// far away share the cells at the border of the grid, which only makes their lookups slower
+const double MAX_CELL_INDEX = 1e15;
+
+// Default distances, used when the distances given to the constructor are not positive
+const double DEFAULT_MAX_POSITION_DISTANCE = 0.01;
+const double DEFAULT_MAX_ANGLE_DISTANCE = 0.05;
+
+}  // namespace
+
+/*************************************************************************************************/
+
+SolutionCache::SolutionCache(size_t capacity, double maxPositionDistance, double maxAngleDistance)
+  : maxPositionDistance_(maxPositionDistance), maxAngleDistance_(maxAngleDistance),
+    nShard_(SHARD_COUNT), shardCapacity_(std::max<size_t>((capacity + SHARD_COUNT - 1) / SHARD_COUNT, 1)),
+    shards_(new Shard[SHARD_COUNT]),
+    lookups_(0), hits_(0), insertions_(0), evictions_(0),
+    hitSolves_(0), hitIterations_(0), missSolves_(0), missIterations_(0)
+{
+  if (!(maxPositionDistance_ > 0.0)) {
+    ROS_ERROR("Bad Input: maxPositionDistance (%f) > 0 is required! Using %f",
+              maxPositionDistance_, DEFAULT_MAX_POSITION_DISTANCE);
+    maxPositionDistance_ = DEFAULT_MAX_POSITION_DISTANCE;
+  }
+  if (!(maxAngleDistance_ > 0.0)) {
+    ROS_ERROR("Bad Input: maxAngleDistance (%f) > 0 is required! Using %f",
+              maxAngleDistance_, DEFAULT_MAX_ANGLE_DISTANCE);
+    maxAngleDistance_ = DEFAULT_MAX_ANGLE_DISTANCE;
+  }
+  for (size_t i = 0; i < nShard_; i++) {
+    shards_[i].entries.reserve(shardCapacity_);
+    shards_[i].index.reserve(shardCapacity_);
+  }
+}
+
+/*************************************************************************************************/
+
+int64_t SolutionCache::cellIndex(double p) const
+{
+  double index = std::floor(p / maxPositionDistance_);
+  if (std::isnan(index)) {
+    return 0;
+  }
+  return int64_t(std::min(std::max(index, -MAX_CELL_INDEX), MAX_CELL_INDEX));
+}
+
+/*************************************************************************************************/
+
+uint64_t SolutionCache::cellKey(int64_t ix, int64_t iy, int64_t iz) const
+{
+  return ((uint64_t(ix) & CELL_INDEX_MASK) << (2 * CELL_INDEX_BITS)) |
+         ((uint64_t(iy) & CELL_INDEX_MASK) << CELL_INDEX_BITS) |
+         (uint64_t(iz) & CELL_INDEX_MASK);
+}
+
+/*************************************************************************************************/
+
+SolutionCache::Shard& SolutionCache::getShard(uint64_t cell)
+{
+  // Mix the bits, so that neighboring cells are spread over the shards
+  return shards_[((cell * 0x9E3779B97F4A7C15ULL) >> 32) % nShard_];
+}
+
+/*************************************************************************************************/
+
+double SolutionCache::relativeDistance(const KDL::Frame& goal, const KDL::Frame& pose) const
+{
+  double positionDistance = (goal.p - pose.p).Norm();
+  if (positionDistance > maxPositionDistance_) {
+    return -1.0;
+  }
+  KDL::Vector axis;
+  double angleDistance = (goal.M.Inverse() * pose.M).GetRotAngle(axis);
+  if (angleDistance > maxAngleDistance_) {
+    return -1.0;
+  }
+  return positionDistance / maxPositionDistance_ + angleDistance / maxAngleDistance_;
+}
+
+/*************************************************************************************************/
+
+bool SolutionCache::lookup(const KDL::Frame& goal, KDL::JntArray* q)
+{
+  lookups_++;
+  int64_t ix = cellIndex(goal.p.x());
+  int64_t iy = cellIndex(goal.p.y());
+  int64_t iz = cellIndex(goal.p.z());
+  double bestDistance = -1.0;
+  for (int dx = -1; dx <= 1; dx++) {
+    for (int dy = -1; dy <= 1; dy++) {
+      for (int dz = -1; dz <= 1; dz++) {
+        uint64_t cell = cellKey(ix + dx, iy + dy, iz + dz);
+        Shard& shard = getShard(cell);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto range = shard.index.equal_range(cell);
+        for (auto it = range.first; it != range.second; ++it) {
+          const Entry& entry = shard.entries[it->second];
+          double distance = relativeDistance(goal, entry.pose);
+          if (distance >= 0.0 && (bestDistance < 0.0 || distance < bestDistance)) {
+            bestDistance = distance;
+            q->data = entry.q;
+          }
+        }
+      }
+    }
+  }
+  if (bestDistance < 0.0) {
+    return false;
+  }
+  hits_++;
+  return true;
+}
+
+/*************************************************************************************************/
+
+void SolutionCache::insert(const KDL::Frame& pose, const KDL::JntArray& q)
+{
+  uint64_t cell = cellKey(cellIndex(pose.p.x()), cellIndex(pose.p.y()), cellIndex(pose.p.z()));
+  Shard& shard = getShard(cell);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+
+  // Replace an entry for a nearby pose
+  auto range = shard.index.equal_range(cell);
+  for (auto it = range.first; it != range.second; ++it) {
+    Entry& entry = shard.entries[it->second];
+    if (relativeDistance(pose, entry.pose) >= 0.0) {
+      entry.pose = pose;
+      entry.q = q.data;
+      return;
+    }
+  }
+
+  // Add an entry, replacing the oldest one if the shard is full
+  size_t slot = shard.next;
+  if (slot < shard.entries.size()) {
+    Entry& oldest = shard.entries[slot];
+    range = shard.index.equal_range(oldest.cell);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second == slot) {
+        shard.index.erase(it);
+        break;
+      }
+    }
+    evictions_++;
+  } else {
+    shard.entries.emplace_back();
+  }
+  Entry& entry = shard.entries[slot];
+  entry.cell = cell;
+  entry.pose = pose;
+  entry.q = q.data;
+  shard.index.emplace(cell, slot);
+  shard.next = (slot + 1) % shardCapacity_;
+  insertions_++;
+}
+
+/*************************************************************************************************/
+
+void SolutionCache::recordSolve(bool cacheHit, int iterations)
+{
+  if (cacheHit) {
+    hitSolves_++;
+    hitIterations_ += iterations;
+  } else {
+    missSolves_++;
+    missIterations_ += iterations;
+  }
+}
+
+/*************************************************************************************************/
+
+SolutionCache::Statistics SolutionCache::getStatistics() const
+{
+  Statistics stats;
+  stats.lookups = lookups_;
+  stats.hits = hits_;
+  stats.insertions = insertions_;
+  stats.evictions = evictions_;
+  stats.hitRate = stats.lookups > 0 ? double(stats.hits) / double(stats.lookups) : 0.0;
+  uint64_t missSolves = missSolves_;
+  stats.iterationsSaved = 0.0;
+  if (missSolves > 0) {
+    double meanMissIterations = double(missIterations_) / double(missSolves);
+    stats.iterationsSaved = meanMissIterations * double(hitSolves_) - double(hitIterations_);
+  }
+  return stats;
+}
+
+/*************************************************************************************************/
+
+void SolutionCache::clear()
+{
+  for (size_t i = 0; i < nShard_; i++) {
+    std::lock_guard<std::mutex> lock(shards_[i].mutex);
+    shards_[i].entries.clear();
+    shards_[i].index.clear();
+    shards_[i].next = 0;
+  }
+  lookups_ = 0;
+  hits_ = 0;
+  insertions_ = 0;
+  evictions_ = 0;
+  hitSolves_ = 0;
+  hitIterations_ = 0;
+  missSolves_ = 0;
+  missIterations_ = 0;
+}
+
+/*************************************************************************************************/
+
+size_t SolutionCache::size() const
+{
+  size_t count = 0;
+  for (size_t i = 0; i < nShard_; i++) {
+    std::lock_guard<std::mutex> lock(shards_[i].mutex);
+    count += shards_[i].index.size();
+  }
+  return count;
+}
+
+}  // namespace sns_ik
@@ -21,10 +21,58 @@
 #include <sns_ik/sns_vel_ik_base.hpp>
 
 #include <ros/console.h>
+#include <algorithm>
 #include <limits>
 
 namespace sns_ik {
 
+namespace {
+
+// Relative tolerance on the pivots of the QR decomposition of the lower priority tasks: this
+// matches the pseudo-inverse tolerance of the multi-task reference solver
+const double TASK_RANK_TOL = 1e-6;
+
+// A saturated joint that moves less than this in the basis of a task is already fixed by it
+const double MIN_SQUARED_JOINT_BASIS_NORM = 1e-16;
+
+/*
+ * Velocity solver that runs a fixed-size kernel whenever the jacobian is [NTask, NJnt], and
+ * falls back to the dynamic kernel otherwise.
+ */
+template <int NTask, int NJnt>
+class SnsVelIkFixed : public SnsVelIkBase {
+
+public:
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  SnsVelIkFixed() : SnsVelIkBase(NJnt) {};
+
+protected:
+
+  virtual ExitCode solveKernel(const Eigen::MatrixXd& J, const Eigen::VectorXd& dx,
+                               Eigen::VectorXd* dq, double* taskScale)
+  {
+    if (J.rows() != NTask || J.cols() != NJnt) {
+      return SnsVelIkBase::solveKernel(J, dx, dq, taskScale);
+    }
+    typename SnsIkKernel<NTask, NJnt>::TaskMatrix Jfix = J;
+    typename SnsIkKernel<NTask, NJnt>::TaskVector dxFix = dx;
+    typename SnsIkKernel<NTask, NJnt>::JointVector dqFix;
+    ExitCode exitCode = fixedKernel_.solveVel(getLowerBounds(), getUpperBounds(), Jfix, dxFix,
+                                              &dqFix, taskScale, getKernelState());
+    *dq = dqFix;
+    return exitCode;
+  }
+
+private:
+
+  SnsIkKernel<NTask, NJnt> fixedKernel_;
+
+};  // class SnsVelIkFixed
+
+}  // namespace
+
 /*************************************************************************************************
  *                                 Public Methods                                                *
  *************************************************************************************************/
@@ -42,7 +90,8 @@ SnsVelIkBase::uPtr SnsVelIkBase::create(int nJnt)
 
 /*************************************************************************************************/
 
-SnsVelIkBase::uPtr SnsVelIkBase::create(const Eigen::ArrayXd& dqLow, const Eigen::ArrayXd& dqUpp)
+SnsVelIkBase::uPtr SnsVelIkBase::create(const Eigen::ArrayXd& dqLow, const Eigen::ArrayXd& dqUpp,
+                                        bool useFixedSizeKernel)
 {
   // Input validation
   int nJnt = dqLow.size();
@@ -51,8 +100,14 @@ SnsVelIkBase::uPtr SnsVelIkBase::create(const Eigen::ArrayXd& dqLow, const Eigen
     return nullptr;
   }
 
-  // Create an empty solver
-  SnsVelIkBase::uPtr velIk(new SnsVelIkBase(nJnt));
+  // Create an empty solver, using a fixed-size kernel for a full pose task on common arms
+  SnsVelIkBase::uPtr velIk;
+  switch (useFixedSizeKernel ? nJnt : 0) {
+    case 6: velIk.reset(new SnsVelIkFixed<6, 6>()); break;
+    case 7: velIk.reset(new SnsVelIkFixed<6, 7>()); break;
+    case 8: velIk.reset(new SnsVelIkFixed<6, 8>()); break;
+    default: velIk.reset(new SnsVelIkBase(nJnt));
+  }
 
   // Set the joint limits:
   if (!velIk->setBounds(dqLow, dqUpp)) { ROS_ERROR("Bad Input!"); return nullptr; };
@@ -82,125 +137,7 @@ SnsIkBase::ExitCode SnsVelIkBase::solve(const Eigen::MatrixXd& J, const Eigen::V
     return ExitCode::BadUserInput;
   }
 
-  /*
-   * W is a diagonal selection matrix which indicates free joints.
-   * The entry of 1 indicates the corresponding joint is free for the task,
-   * and 0 indicates the corresponding joint is saturated.
-   */
-  Eigen::MatrixXd W = Eigen::MatrixXd::Identity(getNrOfJoints(), getNrOfJoints());  // null-space selection matrix
-  Eigen::VectorXd dqNull = Eigen::VectorXd::Zero(getNrOfJoints());  // velocity in the null-space
-  *taskScale = 1.0;  // task scale (assume feasible solution until proven otherwise)
-
-  // Temp. variables to store the best solution
-  double bestTaskScale = 0.0;  // temp variable to track the lower bound on the task scale between iterations
-  Eigen::MatrixXd bestW;  // temp variable to track W before it has been accepted
-  Eigen::VectorXd bestDqNull;  // temp variable to track dqNull between iterations
-
-  // Set the linear solver for this iteration:
-  if(setLinearSolver(J*W) != ExitCode::Success) {
-    ROS_ERROR("Solver failed to set linear solver!");
-    return ExitCode::InternalError;
-  }
-
-  // Keep track of which joints are saturated:
-  std::vector<bool> jointIsFree(getNrOfJoints(), true);
-
-  // Main solver loop:
-  double resErr;  // residual error in the linear solver
-  for (size_t iter = 0; iter < getNrOfJoints() * MAXIMUM_SOLVER_ITERATION_FACTOR; iter++) {
-
-    // Compute the joint velocity given current saturation set:
-    if (solveProjectionEquation(J, dqNull, dx, dq, &resErr) != ExitCode::Success) {
-      ROS_ERROR("Failed to solve projection equation!");
-      return ExitCode::InternalError;
-    }
-    if (resErr > LIN_SOLVE_RESIDUAL_TOL) { // check that the solver found a feasible solution
-      ROS_ERROR("Task is infeasible!  resErr: %e > tol: %e", resErr, LIN_SOLVE_RESIDUAL_TOL);
-      return ExitCode::InfeasibleTask;
-    }
-
-    // Check to see if the solution satisfies the joint limits
-    if (checkBounds(*dq)) { // Done! solution is feasible and task scale is at maximum value
-      return ExitCode::Success;
-    }  //  else joint velocity is infeasible: saturate joint and then try again
-
-    // Compute the task scaling factor
-    double tmpScale;
-    int jntIdx;
-    ExitCode taskScaleExit = computeTaskScalingFactor(J, dx, *dq, jointIsFree, &tmpScale, &jntIdx, &resErr);
-    if (resErr > LIN_SOLVE_RESIDUAL_TOL) { // check that the solver found a feasible solution
-      ROS_ERROR("Failed to compute task scale!  resErr: %e > tol: %e", resErr, LIN_SOLVE_RESIDUAL_TOL);
-      return ExitCode::InfeasibleTask;
-    }
-    if (taskScaleExit != ExitCode::Success) {
-      ROS_ERROR("Failed to compute task scale!");
-      return taskScaleExit;
-    }
-    if (tmpScale < MINIMUM_FINITE_SCALE_FACTOR) { // check that the solver found a feasible solution
-      ROS_ERROR("Task is infeasible! scaling --> zero");
-      return ExitCode::InfeasibleTask;
-    }
-
-    if (tmpScale > 1.0) {
-      ROS_ERROR("Task scale is %f, which is more than 1.0", tmpScale);
-      return ExitCode::InternalError;
-    }
-
-    // If the task scale exceeds previous, then cache the results as "best so far"
-    if (tmpScale > bestTaskScale) {
-      bestTaskScale = tmpScale;
-      bestW = W;
-      bestDqNull = dqNull;
-    }
-
-    // Saturate the most critical joint
-    W(jntIdx, jntIdx) = 0.0;
-    jointIsFree[jntIdx] = false;
-    if ((*dq)(jntIdx) > (getUpperBounds())(jntIdx)) {
-      dqNull(jntIdx) = (getUpperBounds())(jntIdx);
-    } else if ((*dq)(jntIdx) < (getLowerBounds())(jntIdx)) {
-      dqNull(jntIdx) = (getLowerBounds())(jntIdx);
-    } else {
-      ROS_ERROR("Internal error in computing task scale!  dq(%d) = %f", jntIdx, (*dq)(jntIdx));
-      return ExitCode::InternalError;
-    }
-
-    // Update the linear solver
-    if(setLinearSolver(J*W) != ExitCode::Success) {
-      ROS_ERROR("Solver failed to set linear solver!");
-      return ExitCode::InternalError;
-    }
-
-    // Test the rank:
-    if (getLinSolverRank() < nTask) { // no more degrees of freedom: scale the task
-      (*taskScale) = bestTaskScale;
-      W = bestW;
-      dqNull = bestDqNull;
-
-      // Update the linear solver
-      if (setLinearSolver(J * W) != ExitCode::Success) {
-        ROS_ERROR("Solver failed to set linear solver!");
-        return ExitCode::InternalError;
-      }
-
-      // Compute the joint velocity given current saturation set:
-      Eigen::VectorXd dxScaled = (dx.array() * (*taskScale)).matrix();
-      if (solveProjectionEquation(J, dqNull, dxScaled, dq, &resErr) != ExitCode::Success) {
-        ROS_ERROR("Failed to solve projection equation!");
-        return ExitCode::InternalError;
-      }
-      if (resErr > LIN_SOLVE_RESIDUAL_TOL) { // check that the solver found a feasible solution
-        ROS_ERROR("Task is infeasible!  resErr: %e > tol: %e", resErr, LIN_SOLVE_RESIDUAL_TOL);
-        return ExitCode::InfeasibleTask;
-      }
-
-      return ExitCode::Success;  // DONE
-
-    } // end rank test
-  }  // end main solver loop
-
-  ROS_ERROR("Internal Error: reached maximum iteration in solver main loop!");
-  return ExitCode::InternalError;
+  return solveKernel(J, dx, dq, taskScale);
 }
 
 /*************************************************************************************************/
@@ -214,8 +151,7 @@ SnsIkBase::ExitCode SnsVelIkBase::solve(const Eigen::MatrixXd& J, const Eigen::V
   }
 
   //--- get the solution for the primary goal
-  Eigen::VectorXd dq1;
-  SnsIkBase::ExitCode exitCode = solve(J, dx, &dq1, taskScale);
+  SnsIkBase::ExitCode exitCode = solve(J, dx, &dq1_, taskScale);
   if (exitCode != ExitCode::Success) {
     ROS_ERROR("Primary goal did not find a solution! Terminating..");
     return exitCode;
@@ -224,63 +160,52 @@ SnsIkBase::ExitCode SnsVelIkBase::solve(const Eigen::MatrixXd& J, const Eigen::V
   //--- find the solution for the secondary goal
 
   *taskScaleCS = 1.0;  // task scale (assume feasible solution until proven otherwise)
-  Eigen::MatrixXd I = Eigen::MatrixXd::Identity(getNrOfJoints(), getNrOfJoints());
-
-  // Keep track of which joints are saturated:
-  std::vector<bool> jointIsFree(getNrOfJoints(), true);
+  int nJnt = getNrOfJoints();
 
   /*
-   * W is a diagonal selection matrix which indicates free joints.
+   * The joint mask is equivalent to a diagonal selection matrix W which indicates free joints.
    * The entry of 1 indicates the corresponding joint is free for the task,
    * and 0 indicates the corresponding joint is saturated.
    */
-  Eigen::MatrixXd W = I;  // null-space selection matrix
+  mask_.reset(nJnt);  // null-space selection matrix
   for (size_t jntIdx = 0; jntIdx < getNrOfJoints(); jntIdx++) {
-    if (dq1(jntIdx) > (getUpperBounds())(jntIdx) + BOUND_TOLERANCE ||
-        dq1(jntIdx) < (getLowerBounds())(jntIdx) - BOUND_TOLERANCE) {
-          W(jntIdx, jntIdx) = 0.0;
-          jointIsFree[jntIdx] = false;
+    if (dq1_(jntIdx) > (getUpperBounds())(jntIdx) + BOUND_TOLERANCE ||
+        dq1_(jntIdx) < (getLowerBounds())(jntIdx) - BOUND_TOLERANCE) {
+          mask_.saturate(jntIdx);
     }
   }
 
   // Compute nullspace projection matrix
-  Eigen::MatrixXd Jinv, Pinv;
-  if(!pinv(J, &Jinv, PINV_TOL)) {
+  if(!pinv(J, &Jinv_, &pinvJ_, PINV_TOL)) {
     ROS_ERROR("Pseudo-inverse of J cannot be computed!");
     return ExitCode::InternalError;
   }
 
-  Eigen::MatrixXd P1 = I - Jinv*J; // for primary task
-  if(!pinv((I - W)*P1, &Pinv, PINV_TOL)){
-    // if (I-W) is a zero matrix, inverse is the same
-    Pinv = (I - W)*P1;
+  // The configuration space task is the identity, so W * P1 * dqCS only needs P1 * dqCS with the
+  // saturated joints set to zero: the pseudo-inverse of (I - W) * P1 is not needed.
+  P1_.setIdentity(nJnt, nJnt);
+  P1_.noalias() -= Jinv_*J; // for primary task
+  a_.noalias() = P1_ * dqCS;  // for both primary and joint saturation tasks
+  for (size_t jntIdx = 0; jntIdx < getNrOfJoints(); jntIdx++) {
+    if (!mask_.isFree(jntIdx)) {
+      a_(jntIdx) = 0.0;
+    }
   }
-  Eigen::MatrixXd Pcs = (I - Pinv)*P1; // for both primary and joint saturation tasks
 
-  // Compute "a" and "b" from the paper.   (J*W*a = dx)
-  Eigen::VectorXd a = Pcs * dqCS;
-  Eigen::ArrayXd b = dq1.array();
+  // b = dq1
 
-  // Compute the task scale associated with each joint
-  Eigen::ArrayXd jntScaleFactorArr(getNrOfJoints());
+  // Compute the task scale associated with each joint, and the most critical scale factor.
   // here lower and upper margins are defined as the budget for the desired task (xd) only
   // qd needs to accomplish both task-independent term (b) as well as desired task (xd)
   // within the upper and lower bounds.
-  Eigen::ArrayXd lowMargin = (getLowerBounds() - b);
-  Eigen::ArrayXd uppMargin = (getUpperBounds() - b);
   for (size_t i = 0; i < getNrOfJoints(); i++) {
-    if (jointIsFree[i]) {
-      jntScaleFactorArr(i) = findScaleFactor(lowMargin(i), uppMargin(i), a(i));
-    } else {  // joint is constrained
-      jntScaleFactorArr(i) = POS_INF;
+    double jntScaleFactor = POS_INF;  // joint is constrained
+    if (mask_.isFree(i)) {
+      jntScaleFactor = findScaleFactor(getLowerBounds()(i) - dq1_(i),
+                                       getUpperBounds()(i) - dq1_(i), a_(i));
     }
-  }
-
-  // Compute the most critical scale factor and corresponding joint index
-  *taskScaleCS = jntScaleFactorArr(0);  // minimum value of jntScaleFactorArr()
-  for (size_t i = 1; i < getNrOfJoints(); i++) {
-    if (jntScaleFactorArr(i) < *taskScaleCS) {
-      *taskScaleCS = jntScaleFactorArr(i);
+    if (i == 0 || jntScaleFactor < *taskScaleCS) {
+      *taskScaleCS = jntScaleFactor;
     }
   }
 
@@ -297,12 +222,70 @@ SnsIkBase::ExitCode SnsVelIkBase::solve(const Eigen::MatrixXd& J, const Eigen::V
     ROS_DEBUG("Secondary goal is infeasible! scaling --> zero");
   }
 
-  // compute the additional joint velocity due to the secondary goal
-  Eigen::VectorXd dqDelta = ((Pcs*dqCS).array() * (*taskScaleCS)).matrix();
+  // compute the final solution, including the joint velocity due to the secondary goal
+  *dq = dq1_ + (*taskScaleCS) * a_;
 
-  // compute the final solution
-  *dq = dq1 + dqDelta;
+  return ExitCode::Success;
+}
+
+/*************************************************************************************************/
+
+SnsIkBase::ExitCode SnsVelIkBase::solve(const std::vector<Eigen::MatrixXd>& J,
+                                        const std::vector<Eigen::VectorXd>& dx,
+                                        Eigen::VectorXd* dq, std::vector<double>* taskScale)
+{
+  // Input validation
+  if (!dq) { ROS_ERROR("dq is nullptr!"); return ExitCode::BadUserInput; }
+  if (!taskScale) { ROS_ERROR("taskScale is nullptr!"); return ExitCode::BadUserInput; }
+  if (J.empty() || J.size() != dx.size()) {
+    ROS_ERROR("Bad Input: J.size() == dx.size() > 0 is required!");
+    return ExitCode::BadUserInput;
+  }
+  for (size_t i = 0; i < J.size(); i++) {
+    if (dx[i].size() <= 0 || J[i].rows() != dx[i].size()) {
+      ROS_ERROR("Bad Input: J[%d].rows() == dx[%d].size() > 0 is required!", int(i), int(i));
+      return ExitCode::BadUserInput;
+    }
+    if (size_t(J[i].cols()) != getNrOfJoints()) {
+      ROS_ERROR("Bad Input: J[%d].cols() == nJnt is required!", int(i));
+      return ExitCode::BadUserInput;
+    }
+  }
+  size_t nLevel = J.size();
+  taskScale->assign(nLevel, 0.0);
 
+  //--- get the solution for the primary task
+  ExitCode exitCode = solve(J[0], dx[0], &dqPrev_, &(*taskScale)[0]);
+  if (exitCode != ExitCode::Success) {
+    ROS_ERROR("Primary task did not find a solution! Terminating..");
+    return exitCode;
+  }
+
+  /*
+   * The null space of the higher priority tasks is stored as an orthonormal basis Z_, rather
+   * than as a projector: the null space of the next task is Z_ * null(J * Z_), which is computed
+   * from the same decomposition as the solution of the task.
+   */
+  Z_.setIdentity(getNrOfJoints(), getNrOfJoints());
+  if (nLevel > 1) {
+    decomposeTask(J[0], Z_);
+    taskNullSpace(Z_, &nextZ_);
+    Z_.swap(nextZ_);
+  }
+
+  //--- solve the lower priority tasks, one after the other
+  for (size_t i = 1; i < nLevel; i++) {
+    double scale = solveLowerPriorityTask(J[i], dx[i], i + 1 < nLevel);
+    (*taskScale)[i] = scale;
+    if (scale > 0.0) {
+      dqPrev_.swap(dqTask_);
+      if (i + 1 < nLevel) {
+        Z_.swap(nextZ_);
+      }
+    }
+  }
+
+  *dq = dqPrev_;
   return ExitCode::Success;
 }
 
@@ -310,7 +293,212 @@ SnsIkBase::ExitCode SnsVelIkBase::solve(const Eigen::MatrixXd& J, const Eigen::V
  *                               Protected Methods                                               *
  *************************************************************************************************/
 
+SnsIkBase::ExitCode SnsVelIkBase::solveKernel(const Eigen::MatrixXd& J, const Eigen::VectorXd& dx,
+                                              Eigen::VectorXd* dq, double* taskScale)
+{
+  return kernel_.solveVel(getLowerBounds(), getUpperBounds(), J, dx, dq, taskScale,
+                          getKernelState());
+}
+
+/*************************************************************************************************
+ *                                 Private Methods                                               *
+ *************************************************************************************************/
+
+int SnsVelIkBase::decomposeTask(const Eigen::MatrixXd& J, const Eigen::MatrixXd& Z)
+{
+  if (Z.cols() == 0) {
+    return 0;  // all joint velocities are fixed by the higher priority tasks
+  }
+  JZt_.noalias() = Z.transpose() * J.transpose();
+  qrJZ_.setThreshold(TASK_RANK_TOL);
+  qrJZ_.compute(JZt_);
+  return qrJZ_.rank();
+}
+
+/*************************************************************************************************/
+
+void SnsVelIkBase::solveTask(const Eigen::MatrixXd& Z, const Eigen::VectorXd& r, Eigen::VectorXd* x)
+{
+  int rank = Z.cols() == 0 ? 0 : qrJZ_.rank();
+  if (rank == 0) {
+    x->setZero(Z.rows());
+    return;
+  }
+
+  /*
+   * (J * Z)' * P = Q * R, so J * Z = P * R1' * Q1', with R1 the first rank rows of R and Q1 the
+   * first rank columns of Q. R1' has full column rank, and pinv(J * Z) = Q1 * pinv(R1') * P'.
+   */
+  int nTask = JZt_.cols();
+  y_ = qrJZ_.colsPermutation().transpose() * r;
+  Rt_ = qrJZ_.matrixQR().topRows(rank).triangularView<Eigen::Upper>();
+  Rt_.transposeInPlace();
+  u_.setZero(Z.cols());
+  if (rank == nTask) {
+    Rt_.triangularView<Eigen::Lower>().solveInPlace(y_);
+    u_.head(rank) = y_;
+  } else {
+    // J * Z is rank deficient: least-squares solution of R1' * u1 = P' * r
+    qrRank_.compute(Rt_);
+    u_.head(rank) = qrRank_.solve(y_);
+  }
+  u_.applyOnTheLeft(qrJZ_.householderQ());
+  x->noalias() = Z * u_;
+}
+
+/*************************************************************************************************/
+
+void SnsVelIkBase::taskNullSpace(const Eigen::MatrixXd& Z, Eigen::MatrixXd* N)
+{
+  int rank = Z.cols() == 0 ? 0 : qrJZ_.rank();
+  if (rank == 0) {
+    *N = Z;
+    return;
+  }
+  Q_.setIdentity(Z.cols(), Z.cols());
+  Q_.applyOnTheLeft(qrJZ_.householderQ());
+  N->noalias() = Z * Q_.rightCols(Z.cols() - rank);
+}
+
+/*************************************************************************************************/
+
+void SnsVelIkBase::solveTaskVelocity(const Eigen::MatrixXd& J, const Eigen::VectorXd& dx,
+                                     double scale, bool dropCorrection)
+{
+  res_ = scale * dx;
+  res_.noalias() -= J * pNull_;
+  if (!dropCorrection) {
+    res_.noalias() -= J * dqPrev_;
+  }
+  solveTask(barZ_, res_, &dqTask_);
+  dqTask_ += dqPrev_ + pNull_;
+}
+
+/*************************************************************************************************/
+
+void SnsVelIkBase::saturateJoint(int jntIdx, double target)
+{
+  zRow_ = barZ_.row(jntIdx).transpose();
+  double zNorm2 = zRow_.squaredNorm();
+  if (zNorm2 < MIN_SQUARED_JOINT_BASIS_NORM) {
+    return;  // the joint cannot move in the null space: nothing to remove
+  }
+
+  // Move the joint to its target: the other saturated joints have zero rows in barZ_
+  double step = (target - dqPrev_(jntIdx) - pNull_(jntIdx)) / zNorm2;
+  pNull_.noalias() += barZ_ * (step * zRow_);
+
+  // Rotate barZ_ such that only its first column moves the joint, then remove that column
+  int nCol = barZ_.cols();
+  double tau, beta;
+  zRow_.makeHouseholderInPlace(tau, beta);
+  hWork_.resize(barZ_.rows());
+  barZ_.applyHouseholderOnTheRight(zRow_.tail(nCol - 1), tau, hWork_.data());
+  tmpZ_ = barZ_.rightCols(nCol - 1);
+  barZ_.swap(tmpZ_);
+}
+
+/*************************************************************************************************/
+
+double SnsVelIkBase::solveLowerPriorityTask(const Eigen::MatrixXd& J, const Eigen::VectorXd& dx,
+                                            bool computeNullSpace)
+{
+  int nJnt = getNrOfJoints();
+  int nTask = J.rows();
+  const Eigen::ArrayXd& qLow = getLowerBounds();
+  const Eigen::ArrayXd& qUpp = getUpperBounds();
+
+  /*
+   * If the task is infeasible, or if the best solution with a scaled task violates the bounds,
+   * then the task is solved again without the term that corrects the task error of the higher
+   * priority solution.
+   */
+  for (int pass = 0; pass < 2; pass++) {
+    bool dropCorrection = pass > 0;
+    mask_.reset(nJnt);
+    pNull_.setZero(nJnt);
+    barZ_ = Z_;
+    double bestTaskScale = 0.0;
+    bestPNull_ = pNull_;
+    bestBarZ_ = barZ_;
+    decomposeTask(J, barZ_);
+    if (computeNullSpace && !dropCorrection) {
+      taskNullSpace(Z_, &nextZ_);
+    }
+
+    for (int iter = 0; iter < nJnt * MAXIMUM_SOLVER_ITERATION_FACTOR; iter++) {
+      solveTaskVelocity(J, dx, 1.0, dropCorrection);
+      if (isWithinBounds(dqTask_)) {
+        return 1.0;  // DONE
+      }
+
+      // Compute the task scale associated with each free joint, and the most critical joint
+      solveTask(barZ_, dx, &aTask_);
+      double taskScale = POS_INF;
+      int jntIdx = -1;
+      for (int i = 0; i < nJnt; i++) {
+        if (!mask_.isFree(i)) {
+          continue;
+        }
+        double b = dqTask_(i) - aTask_(i);
+        double jntScaleFactor;
+        if (aTask_(i) == 0.0) {  // the task does not move this joint
+          bool inBounds = b >= qLow(i) - BOUND_TOLERANCE && b <= qUpp(i) + BOUND_TOLERANCE;
+          jntScaleFactor = inBounds ? POS_INF : 0.0;
+        } else {
+          jntScaleFactor = findScaleFactor(qLow(i) - b, qUpp(i) - b, aTask_(i));
+        }
+        if (jntIdx < 0 || jntScaleFactor < taskScale) {
+          jntIdx = i;
+          taskScale = jntScaleFactor;
+        }
+      }
+
+      if (jntIdx < 0 || taskScale == POS_INF || taskScale <= 0.0) {
+        if (!dropCorrection) {
+          break;  // try again without the correction term, which may violate the bounds alone
+        }
+        // the task is infeasible: all of its joints are saturated or it cannot be scaled
+        dqTask_ = dqPrev_;
+        return 0.0;
+      }
+
+      if (taskScale > bestTaskScale) {  // save best solution so far
+        bestTaskScale = taskScale;
+        bestPNull_ = pNull_;
+        bestBarZ_ = barZ_;
+      }
+
+      // Saturate the most critical joint
+      mask_.saturate(jntIdx);
+      saturateJoint(jntIdx, std::min(std::max(qLow(jntIdx), dqTask_(jntIdx)), qUpp(jntIdx)));
+
+      // Test the rank:
+      if (decomposeTask(J, barZ_) < nTask) {  // no more degrees of freedom: scale the task
+        pNull_.swap(bestPNull_);
+        barZ_.swap(bestBarZ_);
+        decomposeTask(J, barZ_);
+        solveTaskVelocity(J, dx, bestTaskScale, dropCorrection);
+        if (dropCorrection || isWithinBounds(dqTask_)) {
+          return bestTaskScale;  // DONE
+        }
+        break;  // try again without the correction term
+      }
+    }  // end main solver loop
+  }
+
+  ROS_WARN("Lower priority task was not executed: no solution within the bounds!");
+  dqTask_ = dqPrev_;
+  return 0.0;
+}
 
+/*************************************************************************************************/
+
+bool SnsVelIkBase::isWithinBounds(const Eigen::VectorXd& dq) const
+{
+  return (dq.array() >= getLowerBounds() - BOUND_TOLERANCE).all() &&
+         (dq.array() <= getUpperBounds() + BOUND_TOLERANCE).all();
+}
 
 /*************************************************************************************************/
 
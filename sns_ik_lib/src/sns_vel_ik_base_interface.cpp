@@ -27,6 +27,34 @@
 
 namespace sns_ik {
 
+namespace {
+
+/*
+ * @return: true iff the task jacobian is the identity, whatever the structure of the task: a
+ *          nullspace bias of all joints in order is also tagged as a selection, or as a dense task
+ */
+bool isConfigurationSpaceTask(const TaskView &task, int nJoint)
+{
+  if (task.jacobian.rows() != nJoint || task.jacobian.cols() != nJoint) {
+    return false;
+  }
+  switch (task.structure) {
+    case Task::Identity:
+      return true;
+    case Task::Selection:
+      for (int i = 0; i < nJoint; i++) {
+        if (task.indices[i] != i) {
+          return false;
+        }
+      }
+      return true;
+    default:
+      return task.jacobian.isIdentity();
+  }
+}
+
+}  // namespace
+
 SNSVelIKBaseInterface::SNSVelIKBaseInterface(int dof, double loop_period) :
   SNSVelocityIK(dof, loop_period)
 {
@@ -34,8 +62,8 @@ SNSVelIKBaseInterface::SNSVelIKBaseInterface(int dof, double loop_period) :
 }
 
 double SNSVelIKBaseInterface::getJointVelocity(Eigen::VectorXd *jointVelocity,
-    const std::vector<Task> &sot,
-    const Eigen::VectorXd &jointConfiguration)
+    const std::vector<TaskView> &sot,
+    const Eigen::Ref<const Eigen::VectorXd> &jointConfiguration)
 {
   // This will only reset member variables if different from previous values
   setNumberOfTasks(sot.size(), sot[0].jacobian.cols());
@@ -46,29 +74,41 @@ double SNSVelIKBaseInterface::getJointVelocity(Eigen::VectorXd *jointVelocity,
   // solve using SNS base IK solver (andy)
   dqLow = dotQmin;
   dqUpp = dotQmax;
-  J = sot[0].jacobian;
-  dx = sot[0].desired;
   dqSol.resize(n_dof);
   taskScale = 1.0;
 
-  if (n_tasks > 1) {
-    // if the tasks include a nullspace bias task
-    taskScaleCS = 1.0;
-    dqCS = sot[1].desired;
-  }
-
   // set box constraints
   baseIkSolver->setBounds(dqLow, dqUpp);
 
   if (n_tasks == 1) {
+    J = sot[0].jacobian;
+    dx = sot[0].desired;
     exitCode = baseIkSolver->solve(J, dx, &dqSol, &taskScale);
     scaleFactors[0] = taskScale;
   }
-  else {
+  else if (n_tasks == 2 && isConfigurationSpaceTask(sot[1], n_dof)) {
+    // the secondary task is a nullspace bias of all joints: configuration space task
+    J = sot[0].jacobian;
+    dx = sot[0].desired;
+    taskScaleCS = 1.0;
+    dqCS = sot[1].desired;
     exitCode = baseIkSolver->solve(J, dx, dqCS, &dqSol, &taskScale, &taskScaleCS);
     scaleFactors[0] = taskScale;
     scaleFactors[1] = taskScaleCS;
   }
+  else {
+    // general stack of tasks: the copies keep their memory from one call to the next
+    taskJacobians.resize(n_tasks);
+    taskVelocities.resize(n_tasks);
+    for (int i = 0; i < n_tasks; i++) {
+      taskJacobians[i] = sot[i].jacobian;
+      taskVelocities[i] = sot[i].desired;
+    }
+    exitCode = baseIkSolver->solve(taskJacobians, taskVelocities, &dqSol, &taskScales);
+    for (int i = 0; i < n_tasks && i < int(taskScales.size()); i++) {
+      scaleFactors[i] = taskScales[i];
+    }
+  }
 
   // store solution and scale factor
   *jointVelocity = dqSol;
@@ -28,10 +28,90 @@
 
 namespace sns_ik {
 
+void Task::setIdentity(int nJoint)
+{
+  jacobian.setIdentity(nJoint, nJoint);
+  structure = Identity;
+  indices.clear();
+}
+
+void Task::setSelection(const std::vector<int>& joints, int nJoint)
+{
+  jacobian.setZero(joints.size(), nJoint);
+  for (size_t i = 0; i < joints.size(); i++) {
+    jacobian(i, joints[i]) = 1.0;
+  }
+  structure = Selection;
+  indices = joints;
+}
+
+void Task::multiply(const Eigen::MatrixXd &X, Eigen::MatrixXd *JX) const
+{
+  TaskView(*this).multiply(X, JX);
+}
+
+void Task::subtractProduct(const Eigen::VectorXd &x, Eigen::VectorXd *y) const
+{
+  TaskView(*this).subtractProduct(x, y);
+}
+
+TaskView::TaskView(const Task &task) :
+  jacobian(task.jacobian),
+  desired(task.desired),
+  structure(task.structure),
+  indices(task.indices.data())
+{
+}
+
+TaskView::TaskView(const Eigen::Ref<const Eigen::MatrixXd> &jacobian,
+                   const Eigen::Ref<const Eigen::VectorXd> &desired,
+                   Task::Structure structure, const int *indices) :
+  jacobian(jacobian),
+  desired(desired),
+  structure(structure),
+  indices(indices)
+{
+}
+
+void TaskView::multiply(const Eigen::MatrixXd &X, Eigen::MatrixXd *JX) const
+{
+  switch (structure) {
+    case Task::Identity:
+      *JX = X;
+      break;
+    case Task::Selection:
+      JX->resize(jacobian.rows(), X.cols());
+      for (int i = 0; i < jacobian.rows(); i++) {
+        JX->row(i) = X.row(indices[i]);
+      }
+      break;
+    default:
+      JX->noalias() = jacobian * X;
+  }
+}
+
+void TaskView::subtractProduct(const Eigen::VectorXd &x, Eigen::VectorXd *y) const
+{
+  switch (structure) {
+    case Task::Identity:
+      *y -= x;
+      break;
+    case Task::Selection:
+      for (int i = 0; i < jacobian.rows(); i++) {
+        (*y)(i) -= x(indices[i]);
+      }
+      break;
+    default:
+      y->noalias() -= jacobian * x;
+  }
+}
+
 SNSVelocityIK::SNSVelocityIK(int dof, double loop_period) :
   n_dof(0),
   n_tasks(0),
-  m_usePositionLimits(true)
+  m_usePositionLimits(true),
+  m_useWarmStart(false),
+  m_warmStartStats()
 {
   setNumberOfDOF(dof);
   setLoopPeriod(loop_period);
@@ -83,7 +163,10 @@ void SNSVelocityIK::setNumberOfDOF(int dof)
   if (dof > 0 && dof != n_dof) {
     n_dof = dof;
     I = Eigen::MatrixXd::Identity(n_dof, n_dof);
+    noSaturation.reset(n_dof);
     dotQ = Eigen::VectorXd::Zero(n_dof);
+    m_saturationSide = Eigen::VectorXi::Zero(n_dof);
+    resetWarmStart();
   }
 }
 
@@ -96,10 +179,11 @@ void SNSVelocityIK::setNumberOfTasks(int ntasks, int dof)
     double scale = 1.0;
     Eigen::VectorXd dq = Eigen::VectorXd::Zero(n_dof);
 
-    W.resize(n_tasks, I);
+    W.resize(n_tasks, noSaturation);
     scaleFactors.resize(n_tasks, scale);
     dotQopt.resize(n_tasks, dq);
     nSat.resize(n_tasks, 0);
+    m_taskWs.resize(n_tasks);
   }
 }
 
@@ -129,7 +213,18 @@ double SNSVelocityIK::getJointVelocity_STD(Eigen::VectorXd *jointVelocity,
 }
 
 double SNSVelocityIK::getJointVelocity(Eigen::VectorXd *jointVelocity, const std::vector<Task> &sot,
-                                       const Eigen::VectorXd &jointConfiguration)
+                                       const Eigen::Ref<const Eigen::VectorXd> &jointConfiguration)
+{
+  // The views keep their memory from one call to the next
+  m_taskViews.clear();
+  for (const Task &task : sot) {
+    m_taskViews.emplace_back(task);
+  }
+  return getJointVelocity(jointVelocity, m_taskViews, jointConfiguration);
+}
+
+double SNSVelocityIK::getJointVelocity(Eigen::VectorXd *jointVelocity, const std::vector<TaskView> &sot,
+                                       const Eigen::Ref<const Eigen::VectorXd> &jointConfiguration)
 {
   // This will only reset member variables if different from previous values
   setNumberOfTasks(sot.size(), sot[0].jacobian.cols());
@@ -138,25 +233,24 @@ double SNSVelocityIK::getJointVelocity(Eigen::VectorXd *jointVelocity, const std
 
   //P_0=I
   //dq_0=0
-  Eigen::MatrixXd P = Eigen::MatrixXd::Identity(n_dof, n_dof);
-  *jointVelocity = Eigen::VectorXd::Zero(n_dof, 1);
-  Eigen::VectorXd higherPriorityJointVelocity;
-  Eigen::MatrixXd higherPriorityNull;
+  m_P.setIdentity(n_dof, n_dof);
+  jointVelocity->setZero(n_dof);
 
   shapeJointVelocityBound(jointConfiguration);
 
   for (int i_task = 0; i_task < n_tasks; i_task++) {  //consider all tasks
-    higherPriorityJointVelocity = *jointVelocity;
-    higherPriorityNull = P;
-    scaleFactors[i_task] = SNSsingle(i_task, higherPriorityJointVelocity, higherPriorityNull,
-        sot[i_task].jacobian, sot[i_task].desired, jointVelocity, &P);
+    m_higherPriorityJointVelocity = *jointVelocity;
+    m_higherPriorityNull = m_P;
+    scaleFactors[i_task] = SNSsingle(i_task, m_higherPriorityJointVelocity, m_higherPriorityNull,
+        sot[i_task], sot[i_task].desired, jointVelocity, &m_P);
   }
 
   //return 1.0;
   return scaleFactors[0];
 }
 
-void SNSVelocityIK::shapeJointVelocityBound(const Eigen::VectorXd &actualJointConfiguration, double margin) {
+void SNSVelocityIK::shapeJointVelocityBound(const Eigen::Ref<const Eigen::VectorXd> &actualJointConfiguration,
+                                            double margin) {
 
   // it could be written using the Eigen::Array potentiality
   double step, max, stop;
@@ -189,22 +283,77 @@ void SNSVelocityIK::shapeJointVelocityBound(const Eigen::VectorXd &actualJointCo
   dotQmax *= margin;
 }
 
+bool SNSVelocityIK::warmStartPrimaryTask(const Eigen::Ref<const Eigen::MatrixXd> &jacobian,
+                                         const Eigen::Ref<const Eigen::VectorXd> &task,
+                                         int *iterationsSaved)
+{
+  // For the primary task, the higher priority velocity is zero and the projector is the identity
+  TaskWorkspace &ws = m_taskWs[0];
+  JointMask &W0 = W[0];
+  if (W0.allFree() || W0.size() != n_dof) {
+    return false;
+  }
+
+  // Saturate the joints of the previous solve at their new bounds
+  ws.dotQn.setZero(n_dof);
+  for (int j : W0.saturated()) {
+    ws.dotQn(j) = m_saturationSide(j) > 0 ? dotQmax(j) : dotQmin(j);
+  }
+  W0.selectFreeColumns(jacobian, &ws.JP);
+  if (!pinv(ws.JP, &ws.JPinverse, &ws.pinvJP)) {
+    return false;
+  }
+
+  // The minimum-norm velocity of the free joints is dq_F = (J W)^# r, with r = task - J dq_S, and
+  // the multipliers of the task are lambda = (J_F J_F^T)^-1 r = ((J W)^#)^T dq_F. A saturated
+  // joint j would move at J_j^T lambda if it was free: it is released if that is within its bound.
+  ws.taskErr = task;
+  ws.taskErr.noalias() -= jacobian * ws.dotQn;
+  ws.Jtask.noalias() = ws.JPinverse * ws.taskErr;
+  ws.lambda.noalias() = ws.JPinverse.transpose() * ws.Jtask;
+  int nWarm = W0.saturated().size();
+  for (int i = nWarm - 1; i >= 0; i--) {
+    int j = W0.saturated()[i];
+    double freeVelocity = jacobian.col(j).dot(ws.lambda);
+    if (m_saturationSide(j) > 0 ? freeVelocity < dotQmax(j) : freeVelocity > dotQmin(j)) {
+      W0.release(j);
+      ws.dotQn(j) = 0.0;
+    }
+  }
+  int nKept = W0.saturated().size();
+  if (nKept == 0) {
+    return false;
+  }
+  if (nKept < nWarm) {
+    W0.selectFreeColumns(jacobian, &ws.JP);
+    if (!pinv(ws.JP, &ws.JPinverse, &ws.pinvJP)) {
+      W0.reset(n_dof);
+      return false;
+    }
+  }
+  W0.getSaturatedSelectionMatrix(&ws.projectorSaturated);
+  *iterationsSaved = nKept - (nKept < nWarm ? 1 : 0);
+  return true;
+}
+
 double SNSVelocityIK::SNSsingle(int priority,
                                 const Eigen::VectorXd &higherPriorityJointVelocity,
                                 const Eigen::MatrixXd &higherPriorityNull,
-                                const Eigen::MatrixXd &jacobian,
-                                const Eigen::VectorXd &task,
+                                const TaskView &sotTask,
+                                const Eigen::Ref<const Eigen::VectorXd> &task,
                                 Eigen::VectorXd *jointVelocity,
                                 Eigen::MatrixXd *nullSpaceProjector)
 {
+  const Eigen::Ref<const Eigen::MatrixXd> &jacobian = sotTask.jacobian;
+
   //INITIALIZATION
-  Eigen::VectorXd tildeDotQ;
-  Eigen::MatrixXd projectorSaturated;  //(((I-W_k)*P_{k-1})^#
-  Eigen::MatrixXd JPinverse;  //(J_k P_{k-1})^#
-  Eigen::MatrixXd temp;
+  TaskWorkspace &ws = m_taskWs[priority];
+  Eigen::VectorXd &tildeDotQ = ws.tildeDotQ;
+  Eigen::MatrixXd &projectorSaturated = ws.projectorSaturated;  //(((I-W_k)*P_{k-1})^#
+  Eigen::MatrixXd &JPinverse = ws.JPinverse;  //(J_k P_{k-1})^#
   bool isW_identity;
-  Eigen::MatrixXd barP = higherPriorityNull;
-  Eigen::ArrayXd a, b;  // used to compute the task scaling factor
+  Eigen::MatrixXd &barP = ws.barP;
+  Eigen::ArrayXd &a = ws.a, &b = ws.b;  // used to compute the task scaling factor
   bool limit_excedeed;
   bool singularTask = false;
   bool reachedSingularity = false;
@@ -212,20 +361,47 @@ double SNSVelocityIK::SNSsingle(int priority,
   int mostCriticalJoint;
   //best solution
   double bestScale = -1.0;
-  Eigen::VectorXd bestTildeDotQ;
-  Eigen::MatrixXd bestInvJP;
-  Eigen::VectorXd bestDotQn;
-  Eigen::VectorXd dotQn;  //saturate velocity in the null space
+  int bestNSat = 0;
+  Eigen::VectorXd &bestTildeDotQ = ws.bestTildeDotQ;
+  Eigen::MatrixXd &bestInvJP = ws.bestInvJP;
+  Eigen::VectorXd &bestDotQn = ws.bestDotQn;
+  Eigen::VectorXd &dotQn = ws.dotQn;  //saturate velocity in the null space
 
   //INIT
-  W[priority] = I;
+  barP = higherPriorityNull;
   isW_identity = true;
-  dotQn = Eigen::VectorXd::Zero(n_dof);
+  if (priority == 0) {
+    m_warmStartStats.solves++;
+  }
+  bool warmStarted = false;
+  int warmStartSaving = 0;
+  if (priority == 0 && m_useWarmStart) {
+    // The null-space projector of the lower priority tasks is the one of the full task
+    if (n_tasks > 1) {
+      ws.JP = jacobian;
+      singularTask = !pinv_damped_P(ws.JP, &JPinverse, nullSpaceProjector, &ws.pinvJP);
+    }
+    warmStarted = !singularTask && warmStartPrimaryTask(jacobian, task, &warmStartSaving);
+    isW_identity = !warmStarted;
+    if (warmStarted) {
+      m_warmStartStats.warmStarts++;
+      m_warmStartStats.iterationsSaved += warmStartSaving;
+    } else {
+      *nullSpaceProjector = higherPriorityNull;
+    }
+  }
+  if (isW_identity) {
+    W[priority].reset(n_dof);
+    dotQn.setZero(n_dof);
+  }
 
   //SNS
   int count = 0;
   do {
     count++;
+    if (priority == 0) {
+      m_warmStartStats.iterations++;
+    }
     ROS_DEBUG("%d",count);
     if (count > 2 * n_dof) {
       ROS_WARN("Infinite loop on SNS for task (%d)", priority);
@@ -241,16 +417,30 @@ double SNSVelocityIK::SNSsingle(int priority,
     // remember that in the SNS W==I always and only on the first loop
     if (isW_identity) {
       tildeDotQ = higherPriorityJointVelocity;
-      //compute (J P)^#
-      temp = jacobian * higherPriorityNull;
-      singularTask = !pinv_damped_P(temp, &JPinverse, nullSpaceProjector);
+      if (sotTask.structure == Task::Identity) {
+        // J P = P is an orthogonal projector: it is its own pseudo-inverse, and it is only full
+        // rank if the higher priority tasks do not constrain the joints
+        JPinverse = higherPriorityNull;
+        singularTask = higherPriorityNull.trace() < n_dof - 0.5;
+        nullSpaceProjector->setZero(n_dof, n_dof);
+      } else {
+        //compute (J P)^#
+        sotTask.multiply(higherPriorityNull, &ws.JP);
+        singularTask = !pinv_damped_P(ws.JP, &JPinverse, nullSpaceProjector, &ws.pinvJP);
+      }
     } else {
       //JPinverse is already computed
-      tildeDotQ = higherPriorityJointVelocity + projectorSaturated * dotQn;
+      tildeDotQ = higherPriorityJointVelocity;
+      tildeDotQ.noalias() += projectorSaturated * dotQn;
     }
-    dotQ = tildeDotQ + JPinverse * (task - jacobian * tildeDotQ);
-
-    a = (JPinverse * task).array();
+    // dotQ = tildeDotQ + JPinverse * (task - jacobian * tildeDotQ)
+    ws.taskErr = task;
+    sotTask.subtractProduct(tildeDotQ, &ws.taskErr);
+    dotQ = tildeDotQ;
+    dotQ.noalias() += JPinverse * ws.taskErr;
+
+    ws.Jtask.noalias() = JPinverse * task;
+    a = ws.Jtask.array();
     b = dotQ.array() - a;
 
     getTaskScalingFactor(a, b, W[priority], &scalingFactor, &mostCriticalJoint);
@@ -263,7 +453,10 @@ double SNSVelocityIK::SNSsingle(int priority,
         // the task is singular so return a scaled damped solution (no SNS possible)
         ROS_DEBUG("task %d is singular, scaling factor: %f", priority, scalingFactor);
         if (scalingFactor >= 0.0) {
-          (*jointVelocity) = tildeDotQ + JPinverse * (scalingFactor * task - jacobian * tildeDotQ);
+          ws.taskErr = scalingFactor * task;
+          sotTask.subtractProduct(tildeDotQ, &ws.taskErr);
+          (*jointVelocity) = tildeDotQ;
+          jointVelocity->noalias() += JPinverse * ws.taskErr;
         } else {
           // the task is not executed
           //ROS_INFO("task not executed: J sing");
@@ -279,41 +472,70 @@ double SNSVelocityIK::SNSsingle(int priority,
       if ((scalingFactor > bestScale)) {
         // save best solution so far
         bestScale = scalingFactor;
+        bestNSat = W[priority].saturated().size();
         bestTildeDotQ = tildeDotQ;
         bestInvJP = JPinverse;
         bestDotQn = dotQn;
       }
 
       // saturate the most critical join
-      W[priority](mostCriticalJoint, mostCriticalJoint) = 0.0;
+      W[priority].saturate(mostCriticalJoint);
       isW_identity = false;
-      if (dotQ(mostCriticalJoint) > dotQmax(mostCriticalJoint)) {
+      bool saturatedHigh = dotQ(mostCriticalJoint) > dotQmax(mostCriticalJoint);
+      if (saturatedHigh) {
         dotQn(mostCriticalJoint) = dotQmax(mostCriticalJoint) - higherPriorityJointVelocity(mostCriticalJoint);
       } else {
         dotQn(mostCriticalJoint) = dotQmin(mostCriticalJoint) - higherPriorityJointVelocity(mostCriticalJoint);
       }
+      if (priority == 0) {
+        m_saturationSide(mostCriticalJoint) = saturatedHigh ? 1 : -1;
+      }
 
       if (priority == 0) {  //for the primary task higherPriorityNull==I
-        barP = W[0];
-        projectorSaturated = (I - W[0]);
+        // barP = W  -->  J * barP = J * W
+        W[0].getSaturatedSelectionMatrix(&projectorSaturated);  // I - W
+        W[0].selectFreeColumns(jacobian, &ws.JP);
       } else {
-        temp = (I - W[priority]);
-        reachedSingularity |= !pinv_forBarP(temp, higherPriorityNull, &projectorSaturated);
+        reachedSingularity |= !pinv_forBarP(W[priority].saturated(), higherPriorityNull,
+                                            &projectorSaturated, &ws.pinvBarP);
 
-        barP = (I - projectorSaturated) * higherPriorityNull;
+        // barP = (I - projectorSaturated) * higherPriorityNull
+        barP = higherPriorityNull;
+        barP.noalias() -= projectorSaturated * higherPriorityNull;
+        sotTask.multiply(barP, &ws.JP);
       }
 
-      temp = jacobian * barP;
-
-      reachedSingularity |= !pinv(temp, &JPinverse);
+      reachedSingularity |= !pinv(ws.JP, &JPinverse, &ws.pinvJP);
+
+      if (reachedSingularity && warmStarted && bestScale < 0.0) {
+        // The saturation set of the previous call did not lead to a solution: start again with
+        // all joints free, and count the iterations of the warm start as lost
+        m_warmStartStats.iterationsSaved -= warmStartSaving + count;
+        warmStarted = false;
+        reachedSingularity = false;
+        bestScale = -1.0;
+        W[priority].reset(n_dof);
+        dotQn.setZero(n_dof);
+        *nullSpaceProjector = higherPriorityNull;
+        isW_identity = true;
+        count = 0;
+        continue;
+      }
 
       if (reachedSingularity) {
         if (bestScale >= 0.0) {
           ROS_DEBUG("best solution %f",bestScale);
           dotQn = bestDotQn;
-          dotQ = bestTildeDotQ + bestInvJP * (bestScale * task - jacobian * bestTildeDotQ);
+          ws.taskErr = bestScale * task;
+          sotTask.subtractProduct(bestTildeDotQ, &ws.taskErr);
+          dotQ = bestTildeDotQ;
+          dotQ.noalias() += bestInvJP * ws.taskErr;
           //use the best solution found... no further saturation possible
           (*jointVelocity) = dotQ;
+          // W is the saturation set of the solution, for the warm start
+          while (priority == 0 && int(W[0].saturated().size()) > bestNSat) {
+            W[0].release(W[0].saturated().back());
+          }
         } else {
           // the task is not executed
           ROS_WARN("task not executed: reached sing");
@@ -334,33 +556,39 @@ double SNSVelocityIK::SNSsingle(int priority,
 
 void SNSVelocityIK::getTaskScalingFactor(const Eigen::ArrayXd &a,
                                          const Eigen::ArrayXd &b,
-                                         const Eigen::MatrixXd &W, double *scalingFactor,
+                                         const JointMask &W, double *scalingFactor,
                                          int *mostCriticalJoint)
 {
-  Eigen::ArrayXd Smin, Smax;
-  double temp, smax, smin;
+  double temp, smax, smin, sMin, sMax;
   double inf = INF;
-  int col;
-
-  Smin = (dotQmin - b) / a;
-  Smax = (dotQmax - b) / a;
 
+  // equivalent to Smin = (dotQmin - b) / a, Smax = (dotQmax - b) / a, without temporary arrays
+  smax = inf;
+  smin = -inf;
+  *mostCriticalJoint = 0;
   for (int i = 0; i < a.rows(); i++) {
+    sMin = (dotQmin(i) - b(i)) / a(i);
+    sMax = (dotQmax(i) - b(i)) / a(i);
     //switch
-    if (Smin(i) > Smax(i)) {
-      temp = Smin(i);
-      Smin(i) = Smax(i);
-      Smax(i) = temp;
+    if (sMin > sMax) {
+      temp = sMin;
+      sMin = sMax;
+      sMax = temp;
     }
     //remove saturated
-    if ((W(i, i) < 0.2) || (a(i) == 0)) {  // if it is not 1 (safer)
-      Smin(i) = -INF;
-      Smax(i) = INF;
+    if (!W.isFree(i) || (a(i) == 0)) {
+      sMin = -INF;
+      sMax = INF;
     }
-  }
 
-  smax = Smax.minCoeff(mostCriticalJoint, &col);
-  smin = Smin.maxCoeff();
+    if (i == 0 || sMax < smax) {
+      smax = sMax;
+      *mostCriticalJoint = i;
+    }
+    if (i == 0 || sMin > smin) {
+      smin = sMin;
+    }
+  }
 
   if ((smin > smax) || (smax < 0.0) || (smin > 1.0) || (smax == inf)) {
     (*scalingFactor) = -1.0;  // the task is not feasible
@@ -0,0 +1,57 @@
+/** @file kinematics_codegen_models.cpp
+ *
+ * @brief Generate the kinematics backends of the test models, for sns_kinematics_codegen_test
+ *
+ * Usage: kinematics_codegen_models <output_directory>
+ *
+ *    Copyright 2018 Rethink Robotics
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <fstream>
+#include <kdl/chain.hpp>
+#include <kdl/jntarray.hpp>
+#include <ros/console.h>
+#include <string>
+#include <vector>
+
+#include <sns_ik/sns_kinematics_codegen.hpp>
+#include "sawyer_model.hpp"
+#include "test_utilities.hpp"
+
+bool writeKinematics(const KDL::Chain& chain, const std::string& className, const std::string& fileName)
+{
+  std::ofstream out(fileName);
+  if (!out) {
+    ROS_ERROR("Could not write the output file: %s", fileName.c_str());
+    return false;
+  }
+  sns_ik::generateKinematicsCode(chain, className, &out);
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc != 2) {
+    ROS_ERROR("Usage: kinematics_codegen_models <output_directory>");
+    return 1;
+  }
+  std::string dir = argv[1];
+  std::vector<std::string> jointNames;
+  KDL::JntArray qLow, qUpp;
+  bool success = writeKinematics(sns_ik::sawyer_model::getSawyerKdlChain(&jointNames),
+                                 "SawyerKinematics", dir + "/sawyer_kinematics.cpp") &&
+                 writeKinematics(sns_ik::test_util::getMixedJointChain(&qLow, &qUpp),
+                                 "MixedJointKinematics", dir + "/mixed_joint_kinematics.cpp");
+  return success ? 0 : 1;
+}
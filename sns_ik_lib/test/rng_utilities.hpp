@@ -77,7 +77,7 @@ int getRngInt(int seed = 0, int low = 0, int upp = 9);
  *              if seed == 0, then seed is ignored
  * @param trueFrac: "probability" the the function returns true
  */
-bool getRngBool(int seed, double trueFrac = 0.5) { return getRngDouble(seed, 0.0, 1.0) <= trueFrac; }
+inline bool getRngBool(int seed, double trueFrac = 0.5) { return getRngDouble(seed, 0.0, 1.0) <= trueFrac; }
 
 /*************************************************************************************************/
 
@@ -122,7 +122,7 @@ Eigen::MatrixXd getRngMatrixXdRanked(int seed, int nRows, int nCols, int nRank);
  * @param[opt] upp: upper bound on values in the data  (default: 1.0)
  * @return: a randomly generated vector
  */
-Eigen::VectorXd getRngVectorXd(int seed, int nRows, double low = 0.0, double upp = 1.0) {
+inline Eigen::VectorXd getRngVectorXd(int seed, int nRows, double low = 0.0, double upp = 1.0) {
   return getRngMatrixXd(seed, nRows, 1, low, upp).col(0);
 }
 
@@ -20,6 +20,7 @@
 
 #include <gtest/gtest.h>
 
+#include <cmath>
 #include <Eigen/Dense>
 #include <ros/console.h>
 
@@ -196,6 +197,113 @@ TEST(sns_acc_ik_base, basic_with_secondary_goal)
 
 /*************************************************************************************************/
 
+/*
+ * This test compares the fixed-size kernels (six-dimensional task on a 6, 7, or 8 joint robot)
+ * against the dynamic kernel. Both solvers must return the same solution. The mean solve time of
+ * each kernel is printed, so that this test also serves as a benchmark.
+ */
+TEST(sns_acc_ik_base, fixed_size_kernel)
+{
+  sns_ik::rng_util::setRngSeed(51729, 30218);  // set the initial seed for the random number generators
+  int nTest = 5000;
+  double tol = 1e-8;
+  int nTask = 6;
+  for (int nJoint = 6; nJoint <= 8; nJoint++) {
+    Eigen::ArrayXd ddqInf = 1e10 * Eigen::ArrayXd::Ones(nJoint);
+    sns_ik::SnsAccIkBase::uPtr fixedSolver = sns_ik::SnsAccIkBase::create(-ddqInf, ddqInf, true);
+    sns_ik::SnsAccIkBase::uPtr dynamicSolver = sns_ik::SnsAccIkBase::create(-ddqInf, ddqInf, false);
+    ASSERT_TRUE(fixedSolver.get() != nullptr);
+    ASSERT_TRUE(dynamicSolver.get() != nullptr);
+    double fixedSolveTime = 0.0;
+    double dynamicSolveTime = 0.0;
+    for (int iTest = 0; iTest < nTest; iTest++) {
+      // generate a test problem
+      Eigen::MatrixXd J = sns_ik::rng_util::getRngMatrixXd(0, nTask, nJoint, -3.0, 3.0);
+      Eigen::ArrayXd ddqLow = sns_ik::rng_util::getRngVectorXd(0, nJoint, -3.0, -1.0);
+      Eigen::ArrayXd ddqUpp = sns_ik::rng_util::getRngVectorXd(0, nJoint, 1.0, 3.0);
+      Eigen::VectorXd ddqTest = sns_ik::rng_util::getRngArrBndXd(0, ddqLow, ddqUpp).matrix();
+      Eigen::VectorXd dJdq = sns_ik::rng_util::getRngVectorXd(0, nTask, -1.0, 1.0);
+      double taskScaleMin = std::min(1.0, sns_ik::rng_util::getRngDouble(0, 0.2, 1.2));
+      Eigen::VectorXd ddx = (J * ddqTest + dJdq) / taskScaleMin;
+      ASSERT_TRUE(fixedSolver->setBounds(ddqLow, ddqUpp));
+      ASSERT_TRUE(dynamicSolver->setBounds(ddqLow, ddqUpp));
+
+      // solve with both kernels
+      Eigen::VectorXd ddqFixed, ddqDynamic;
+      double taskScaleFixed, taskScaleDynamic;
+      ros::Time startTime = ros::Time::now();
+      sns_ik::SnsIkBase::ExitCode fixedExit = fixedSolver->solve(J, dJdq, ddx, &ddqFixed, &taskScaleFixed);
+      fixedSolveTime += (ros::Time::now() - startTime).toSec();
+      startTime = ros::Time::now();
+      sns_ik::SnsIkBase::ExitCode dynamicExit = dynamicSolver->solve(J, dJdq, ddx, &ddqDynamic, &taskScaleDynamic);
+      dynamicSolveTime += (ros::Time::now() - startTime).toSec();
+
+      // check that the solutions match
+      ASSERT_TRUE(fixedExit == dynamicExit);
+      if (fixedExit == sns_ik::SnsIkBase::ExitCode::Success) {
+        ASSERT_NEAR(taskScaleFixed, taskScaleDynamic, tol);
+        sns_ik::test_util::checkEqualVector(ddqFixed, ddqDynamic, tol);
+      }
+    }
+    ROS_INFO("nTask: %d  --  nJoint: %d  --  Mean solve time: fixed: %.4f ms, dynamic: %.4f ms",
+             nTask, nJoint, 1000.0 * fixedSolveTime / nTest, 1000.0 * dynamicSolveTime / nTest);
+  }
+}
+
+/*************************************************************************************************/
+
+/*
+ * This test solves a slowly changing sequence of problems, as in a control loop, with and without
+ * the warm start. Both solvers must return valid solutions, and the warm start must not reduce the
+ * task scale. The mean number of iterations of the main loop per solve is printed for both solvers.
+ */
+TEST(sns_acc_ik_base, warm_start)
+{
+  sns_ik::rng_util::setRngSeed(20571, 83346);  // set the initial seed for the random number generators
+  int nStep = 2000;
+  double dt = 0.005;
+  double tol = 1e-8;
+  int nTask = 3;
+  int nJoint = 7;
+  Eigen::ArrayXd ddqLow = sns_ik::rng_util::getRngVectorXd(0, nJoint, -1.0, -0.3);
+  Eigen::ArrayXd ddqUpp = sns_ik::rng_util::getRngVectorXd(0, nJoint, 0.3, 1.0);
+  Eigen::MatrixXd J0 = sns_ik::rng_util::getRngMatrixXd(0, nTask, nJoint, -2.0, 2.0);
+  Eigen::MatrixXd J1 = sns_ik::rng_util::getRngMatrixXd(0, nTask, nJoint, -0.5, 0.5);
+  Eigen::VectorXd dJdq0 = sns_ik::rng_util::getRngVectorXd(0, nTask, -0.5, 0.5);
+  Eigen::VectorXd ddx0 = sns_ik::rng_util::getRngVectorXd(0, nTask, -1.0, 1.0);
+  Eigen::VectorXd ddx1 = sns_ik::rng_util::getRngVectorXd(0, nTask, -1.0, 1.0);
+  sns_ik::SnsAccIkBase::uPtr coldSolver = sns_ik::SnsAccIkBase::create(ddqLow, ddqUpp);
+  sns_ik::SnsAccIkBase::uPtr warmSolver = sns_ik::SnsAccIkBase::create(ddqLow, ddqUpp);
+  ASSERT_TRUE(coldSolver.get() != nullptr);
+  ASSERT_TRUE(warmSolver.get() != nullptr);
+  warmSolver->setUseWarmStart(true);
+  for (int iStep = 0; iStep < nStep; iStep++) {
+    // a smooth trajectory of the jacobian and of the task acceleration
+    double t = iStep * dt;
+    Eigen::MatrixXd J = J0 + std::sin(0.7 * t) * J1;
+    Eigen::VectorXd dJdq = std::cos(0.3 * t) * dJdq0;
+    Eigen::VectorXd ddx = std::cos(0.5 * t) * ddx0 + std::sin(1.1 * t) * ddx1;
+
+    Eigen::VectorXd ddqCold, ddqWarm;
+    double taskScaleCold, taskScaleWarm;
+    ASSERT_TRUE(coldSolver->solve(J, dJdq, ddx, &ddqCold, &taskScaleCold) ==
+                sns_ik::SnsIkBase::ExitCode::Success);
+    ASSERT_TRUE(warmSolver->solve(J, dJdq, ddx, &ddqWarm, &taskScaleWarm) ==
+                sns_ik::SnsIkBase::ExitCode::Success);
+    ASSERT_GE(taskScaleWarm, taskScaleCold - tol);
+    sns_ik::test_util::checkEqualVector(taskScaleWarm * ddx, J * ddqWarm + dJdq, tol);
+    sns_ik::test_util::checkVectorLimits(ddqLow, ddqWarm, ddqUpp, tol);
+  }
+  const sns_ik::SnsIkBase::IterationStatistics& coldStats = coldSolver->getIterationStatistics();
+  const sns_ik::SnsIkBase::IterationStatistics& warmStats = warmSolver->getIterationStatistics();
+  EXPECT_GT(warmStats.warmStarts, 0u);
+  EXPECT_LT(warmStats.averageIterations(), coldStats.averageIterations());
+  ROS_INFO("nTask: %d  --  nJoint: %d  --  Mean iterations: warm: %.3f, cold: %.3f",
+           nTask, nJoint, warmStats.averageIterations(), coldStats.averageIterations());
+}
+
+/*************************************************************************************************/
+
 // Run all the tests that were declared with TEST()
 int main(int argc, char **argv){
   ros::Time::init();
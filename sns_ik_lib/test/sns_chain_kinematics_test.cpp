@@ -0,0 +1,180 @@
+/**  @file sns_chain_kinematics_test.cpp
+ *
+ *  @brief Unit Test: forward kinematics and Jacobian of ChainKinematics
+ *
+ *    Copyright 2018 Rethink Robotics
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <Eigen/Dense>
+#include <kdl/chain.hpp>
+#include <kdl/chainfksolverpos_recursive.hpp>
+#include <kdl/chainjnttojacsolver.hpp>
+#include <ros/console.h>
+#include <ros/time.h>
+#include <string>
+#include <vector>
+
+#include <sns_ik/sns_chain_kinematics.hpp>
+#include "rng_utilities.hpp"
+#include "sawyer_model.hpp"
+#include "test_utilities.hpp"
+
+/*************************************************************************************************
+ *                               Utilities Functions                                             *
+ *************************************************************************************************/
+
+/*
+ * Check that ChainKinematics matches the KDL forward kinematics and Jacobian solvers.
+ * @param chain: kinematic chain
+ * @param qLow: lower bound on the joints
+ * @param qUpp: upper bound on the joints
+ */
+void checkMatchesKdl(const KDL::Chain& chain, const KDL::JntArray& qLow, const KDL::JntArray& qUpp)
+{
+  double tol = 1e-12;
+  int nTest = 100;
+  int nJnt = chain.getNrOfJoints();
+  sns_ik::ChainKinematics kinematics(chain);
+  ASSERT_EQ(nJnt, kinematics.getNrOfJoints());
+  KDL::ChainFkSolverPos_recursive fwdKin(chain);
+  KDL::ChainJntToJacSolver jacSolver(chain);
+  KDL::Jacobian jacKdl(nJnt);
+  for (int iTest = 0; iTest < nTest; iTest++) {
+    KDL::JntArray q = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+    KDL::Frame poseKdl, pose, poseOnly;
+    ASSERT_GE(fwdKin.JntToCart(q, poseKdl), 0);
+    ASSERT_GE(jacSolver.JntToJac(q, jacKdl), 0);
+    Eigen::MatrixXd jac;
+    kinematics.computePoseAndJacobian(q.data, &pose, &jac);
+    kinematics.computePose(q.data, &poseOnly);
+    ASSERT_TRUE(KDL::Equal(poseKdl, pose, tol));
+    ASSERT_TRUE(KDL::Equal(poseKdl, poseOnly, tol));
+    ASSERT_EQ(6, jac.rows());
+    ASSERT_EQ(nJnt, jac.cols());
+    ASSERT_LT((jac - jacKdl.data).lpNorm<Eigen::Infinity>(), tol);
+  }
+}
+
+/*************************************************************************************************/
+
+/*
+ * Check dJ/dt * qd against a central difference of J(q) * qd along the direction qd.
+ * @param chain: kinematic chain
+ * @param qLow: lower bound on the joints
+ * @param qUpp: upper bound on the joints
+ */
+void checkJacobianDotQdot(const KDL::Chain& chain, const KDL::JntArray& qLow, const KDL::JntArray& qUpp)
+{
+  double tol = 1e-6;
+  double h = 1e-5;  // time step for the finite difference
+  int nTest = 100;
+  sns_ik::ChainKinematics kinematics(chain);
+  int nJnt = kinematics.getNrOfJoints();
+  KDL::Frame pose;
+  Eigen::MatrixXd jacLow, jacUpp;
+  Eigen::VectorXd jdotQdot;
+  for (int iTest = 0; iTest < nTest; iTest++) {
+    Eigen::VectorXd q = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp).data;
+    Eigen::VectorXd qd = sns_ik::rng_util::getRngVectorXd(0, nJnt, -2.0, 2.0);
+    kinematics.computeJacobianDotQdot(q, qd, &jdotQdot);
+    kinematics.computePoseAndJacobian(q - h * qd, &pose, &jacLow);
+    kinematics.computePoseAndJacobian(q + h * qd, &pose, &jacUpp);
+    Eigen::VectorXd jdotQdotFd = (jacUpp - jacLow) * qd / (2.0 * h);
+    ASSERT_EQ(6, jdotQdot.size());
+    ASSERT_LT((jdotQdot - jdotQdotFd).lpNorm<Eigen::Infinity>(), tol);
+  }
+}
+
+/*************************************************************************************************
+ *                                        Tests                                                  *
+ *************************************************************************************************/
+
+TEST(sns_chain_kinematics, sawyer_matches_kdl)
+{
+  sns_ik::rng_util::setRngSeed(41421, 35623);
+  std::vector<std::string> jointNames;
+  KDL::Chain chain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::JntArray qLow, qUpp, vMax, aMax;
+  sns_ik::sawyer_model::getSawyerJointLimits(&qLow, &qUpp, &vMax, &aMax);
+  checkMatchesKdl(chain, qLow, qUpp);
+  checkJacobianDotQdot(chain, qLow, qUpp);
+}
+
+TEST(sns_chain_kinematics, mixed_joints_match_kdl)
+{
+  sns_ik::rng_util::setRngSeed(73205, 8075);
+  KDL::JntArray qLow, qUpp;
+  KDL::Chain chain = sns_ik::test_util::getMixedJointChain(&qLow, &qUpp);
+  checkMatchesKdl(chain, qLow, qUpp);
+  checkJacobianDotQdot(chain, qLow, qUpp);
+}
+
+/*************************************************************************************************/
+
+/*
+ * Benchmark: one call to ChainKinematics::computePoseAndJacobian() against one call to each of
+ * KDL::ChainFkSolverPos_recursive::JntToCart() and KDL::ChainJntToJacSolver::JntToJac(), which
+ * is what the position solver used to do at each iteration.
+ */
+TEST(sns_chain_kinematics, benchmark_against_kdl)
+{
+  sns_ik::rng_util::setRngSeed(14142, 17320);
+  std::vector<std::string> jointNames;
+  KDL::Chain chain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::JntArray qLow, qUpp, vMax, aMax;
+  sns_ik::sawyer_model::getSawyerJointLimits(&qLow, &qUpp, &vMax, &aMax);
+  int nJnt = chain.getNrOfJoints();
+  int nTest = 20000;
+  std::vector<KDL::JntArray> qList(nTest);
+  for (KDL::JntArray& q : qList) {
+    q = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+  }
+
+  KDL::ChainFkSolverPos_recursive fwdKin(chain);
+  KDL::ChainJntToJacSolver jacSolver(chain);
+  KDL::Jacobian jacKdl(nJnt);
+  KDL::Frame pose;
+  double checkSum = 0.0;  // prevents the compiler from removing the calls
+  ros::Time startTime = ros::Time::now();
+  for (const KDL::JntArray& q : qList) {
+    fwdKin.JntToCart(q, pose);
+    jacSolver.JntToJac(q, jacKdl);
+    checkSum += pose.p.x() + jacKdl.data(0, 0);
+  }
+  double kdlTime = (ros::Time::now() - startTime).toSec();
+
+  sns_ik::ChainKinematics kinematics(chain);
+  Eigen::MatrixXd jac(6, nJnt);
+  startTime = ros::Time::now();
+  for (const KDL::JntArray& q : qList) {
+    kinematics.computePoseAndJacobian(q.data, &pose, &jac);
+    checkSum -= pose.p.x() + jac(0, 0);
+  }
+  double fusedTime = (ros::Time::now() - startTime).toSec();
+
+  EXPECT_LT(std::abs(checkSum), 1e-6);
+  ROS_INFO("Kinematics Benchmark  -->  KDL FK + Jacobian: %f us,  fused: %f us,  speed-up: %f",
+           1e6 * kdlTime / nTest, 1e6 * fusedTime / nTest, kdlTime / fusedTime);
+}
+
+/*************************************************************************************************/
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv){
+  ros::Time::init();
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -20,10 +20,14 @@
 #include <gtest/gtest.h>
 
 #include <Eigen/Dense>
+#include <cmath>
 #include <ros/console.h>
+#include <vector>
 
 #include "rng_utilities.hpp"
 #include "sns_ik_math_utils.hpp"
+#include "sns_joint_mask.hpp"
+#include "sns_linear_solver.hpp"
 
 /*************************************************************************************************
  *                               Utilities Functions                                             *
@@ -287,6 +291,51 @@ TEST(sns_ik_math_utils, pinv_forBarP_test)
 
 /*************************************************************************************************/
 
+/*
+ * Unit test for sns_ik::JointMask: saturate and release random joints, and check the mask against
+ * the equivalent diagonal selection matrix W.
+ */
+TEST(sns_ik_math_utils, jointMask_test)
+{
+  double low = -2.0;  double upp = 2.0;  // bounds on values in the test matrix
+  int seed = 51807;
+  for (int iTest = 0; iTest < 20; iTest++) {
+    seed++;
+    int nDim = sns_ik::rng_util::getRngInt(seed + 11863, 1, 11);
+    Eigen::MatrixXd A = sns_ik::rng_util::getRngMatrixXd(seed + 70254, nDim, nDim, low, upp);
+    Eigen::MatrixXd W = Eigen::MatrixXd::Identity(nDim, nDim);  // selection matrix
+    Eigen::MatrixXd I = Eigen::MatrixXd::Identity(nDim, nDim);
+    Eigen::MatrixXd AW, IWA, IW;
+    sns_ik::JointMask mask(nDim);
+    ASSERT_TRUE(mask.allFree());
+    for (int iUpdate = 0; iUpdate < 2 * nDim; iUpdate++) {
+      int idx = sns_ik::rng_util::getRngInt(0, 0, nDim - 1);
+      if (sns_ik::rng_util::getRngBool(0, 0.7)) {
+        mask.saturate(idx);
+        W(idx, idx) = 0.0;
+      } else {
+        mask.release(idx);
+        W(idx, idx) = 1.0;
+      }
+      int nSat = 0;
+      for (int i = 0; i < nDim; i++) {
+        ASSERT_EQ(W(i, i) > 0.5, mask.isFree(i));
+        if (!mask.isFree(i)) { nSat++; }
+      }
+      ASSERT_EQ(nSat, int(mask.saturated().size()));
+      ASSERT_EQ(nSat == 0, mask.allFree());
+      mask.selectFreeColumns(A, &AW);
+      checkEqualMatrices(AW, A*W, 0.0);
+      mask.selectSaturatedRows(A, &IWA);
+      checkEqualMatrices(IWA, (I - W)*A, 0.0);
+      mask.getSaturatedSelectionMatrix(&IW);
+      checkEqualMatrices(IW, I - W, 0.0);
+    }
+  }
+}
+
+/*************************************************************************************************/
+
 /*
  * Unit test for the method sns_ik::pinv_QR()
  * TODO: pass arbitrary size matrices into pinv_QR() once the code is fixed to support it
@@ -360,6 +409,31 @@ TEST(sns_ik_math_utils, pinv_QR_Z_test)
 
 /*************************************************************************************************/
 
+/*
+ * Unit test for pinv_QR_Z_product(): same result as pinv_QR_Z() for a full-rank task
+ * (for a rank-deficient task, the null space basis depends on the rounding errors)
+ */
+TEST(sns_ik_math_utils, pinv_QR_Z_product_test)
+{
+  double tolMat = 1e-9;
+  sns_ik::PinvWorkspace ws;
+  for (int iTest = 0; iTest < 25; iTest++) {
+    int seed = 37016 + 13 * iTest;
+    int nJoint = sns_ik::rng_util::getRngInt(seed + 21507, 4, 12);
+    int nTask = sns_ik::rng_util::getRngInt(seed + 63351, 2, nJoint);
+    Eigen::MatrixXd J1 = sns_ik::rng_util::getRngMatrixXd(seed + 83107, nTask, nJoint, -2.0, 2.0);
+    Eigen::MatrixXd Za0 = sns_ik::rng_util::getRngMatrixXd(seed + 11984, nJoint, nJoint, -2.0, 2.0);
+    Eigen::MatrixXd Jstar, Za1, JstarProd, Za1Prod;
+    ASSERT_TRUE(sns_ik::pinv_QR_Z(J1, Za0, &Jstar, &Za1));
+    Eigen::MatrixXd J1Za0 = J1 * Za0;
+    ASSERT_TRUE(sns_ik::pinv_QR_Z_product(J1Za0, Za0, &JstarProd, &Za1Prod, &ws));
+    checkEqualMatrices(JstarProd, Jstar, tolMat);
+    checkEqualMatrices(Za1Prod, Za1, tolMat);
+  }
+}
+
+/*************************************************************************************************/
+
 // Unit test for isIdentity()
 TEST(sns_ik_math_utils, isIdentity_test)
 {
@@ -371,6 +445,49 @@ TEST(sns_ik_math_utils, isIdentity_test)
 
 /*************************************************************************************************/
 
+// Unit test for haltonPoint()
+TEST(sns_ik_math_utils, haltonPoint_test)
+{
+  double tol = 1e-15;
+  Eigen::VectorXd point(3);
+  sns_ik::haltonPoint(1, &point);
+  checkEqualMatrices(point, Eigen::Vector3d(1.0 / 2.0, 1.0 / 3.0, 1.0 / 5.0), tol);
+  sns_ik::haltonPoint(6, &point);  // 6 = 110 (base 2) = 20 (base 3) = 11 (base 5)
+  checkEqualMatrices(point, Eigen::Vector3d(3.0 / 8.0, 2.0 / 9.0, 6.0 / 25.0), tol);
+
+  // Points are in the unit cube and distinct
+  Eigen::VectorXd prev(7);
+  Eigen::VectorXd next(7);
+  sns_ik::haltonPoint(1, &prev);
+  for (int i = 2; i < 100; i++) {
+    sns_ik::haltonPoint(i, &next);
+    ASSERT_GE(next.minCoeff(), 0.0);
+    ASSERT_LT(next.maxCoeff(), 1.0);
+    ASSERT_GT((next - prev).norm(), 0.0);
+    prev = next;
+  }
+}
+
+/*************************************************************************************************/
+
+// Unit test for wrapAngle()
+TEST(sns_ik_math_utils, wrapAngle_test)
+{
+  double tol = 1e-12;
+  EXPECT_NEAR(0.5, sns_ik::wrapAngle(0.5), tol);
+  EXPECT_NEAR(-0.5, sns_ik::wrapAngle(-0.5), tol);
+  EXPECT_NEAR(0.5, sns_ik::wrapAngle(0.5 + 4.0 * M_PI), tol);
+  EXPECT_NEAR(-0.5, sns_ik::wrapAngle(-0.5 - 6.0 * M_PI), tol);
+  EXPECT_NEAR(-3.0, sns_ik::wrapAngle(2.0 * M_PI - 3.0), tol);
+  for (int i = -20; i <= 20; i++) {
+    double angle = sns_ik::wrapAngle(0.7 * i);
+    EXPECT_LE(std::abs(angle), M_PI);
+    EXPECT_NEAR(0.0, std::remainder(angle - 0.7 * i, 2.0 * M_PI), tol);
+  }
+}
+
+/*************************************************************************************************/
+
 /*
  * Unit test for pseudoInverse() with full rank A matrix
  *  -- this is primarily a regression test, confirming that the new implementation of the pseudo-
@@ -496,6 +613,68 @@ TEST(sns_ik_math_utils, solveLinearSystem_rankDeficient_test)
   }
 }
 
+/*************************************************************************************************/
+
+/*
+ * Remove the columns of A, one at a time and in a random order, and check that the updated linear
+ * solver matches a linear solve of the reduced matrix from scratch.
+ * @param A: matrix in the linear system
+ * @param b: right hand side of the linear system
+ * @param tol: tolerance on equality checks
+ */
+template <typename MatrixType>
+void checkRemoveColumn(const MatrixType& A,
+                       const typename sns_ik::SnsLinearSolverT<MatrixType>::RhsVector& b, double tol)
+{
+  int m = A.cols();
+  sns_ik::SnsLinearSolverT<MatrixType> solver;
+  typename sns_ik::SnsLinearSolverT<MatrixType>::SolutionVector x;
+  Eigen::MatrixXd Ared = A;  // A, with the removed columns set to zero
+  Eigen::MatrixXd xRef;  // reference solution
+  int rankRef;  // reference rank
+  std::vector<int> colIdx(m);  // columns that have not been removed yet
+  for (int j = 0; j < m; j++) { colIdx[j] = j; }
+  solver.compute(A);
+  while (!colIdx.empty()) {
+    int k = sns_ik::rng_util::getRngInt(0, 0, colIdx.size() - 1);
+    int j = colIdx[k];
+    colIdx.erase(colIdx.begin() + k);
+    solver.removeColumn(j);
+    Ared.col(j).setZero();
+    ASSERT_TRUE(solver.info() == Eigen::ComputationInfo::Success);
+    checkEqualMatrices(solver.matrix(), Ared, 0.0);
+    ASSERT_TRUE(sns_ik::solveLinearSystem(Ared, b, &xRef, &rankRef, nullptr));
+    ASSERT_EQ(rankRef, int(solver.rank()));
+    solver.solve(b, &x);
+    checkEqualMatrices(x, xRef, tol);
+  }
+}
+
+/*************************************************************************************************/
+
+TEST(sns_ik_math_utils, linearSolver_removeColumn_test)
+{
+  // test parameters
+  double tol = 1e-10;  // tolerance for matrix equality check
+  int nTest = 25;
+  int s1 = 29377;  // seed for the integer RNG
+  int s2 = 70143;  // seed for the floating point RNG
+  double low = -2.0;  double upp = 2.0;  // bounds on values in the A matrix
+  for (int iTest = 0; iTest < nTest; iTest++) {
+    // dynamic-size solver: wide, square, and tall matrices
+    int n = sns_ik::rng_util::getRngInt(s1, 1, 7);  // number of equations
+    int m = sns_ik::rng_util::getRngInt(0, 1, 9);  // number of decision variables
+    Eigen::MatrixXd A = sns_ik::rng_util::getRngMatrixXd(s2, n, m, low, upp);
+    Eigen::VectorXd b = sns_ik::rng_util::getRngVectorXd(0, n, low, upp);
+    checkRemoveColumn(A, b, tol);
+
+    // fixed-size solver, as used by the SNS-IK kernel
+    Eigen::Matrix<double, 6, 7> Afix = sns_ik::rng_util::getRngMatrixXd(0, 6, 7, low, upp);
+    Eigen::Matrix<double, 6, 1> bFix = sns_ik::rng_util::getRngVectorXd(0, 6, low, upp);
+    checkRemoveColumn(Afix, bFix, tol);
+    s1 = s2 = 0; // let the RNG automatically increment after the first iteration
+  }
+}
 
 // Run all the tests that were declared with TEST()
 int main(int argc, char **argv){
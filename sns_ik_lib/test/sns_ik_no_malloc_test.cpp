@@ -0,0 +1,267 @@
+/*! \file sns_ik_no_malloc_test.cpp
+ * \brief Unit Test: the velocity solvers do not allocate memory once they are warmed up
+ */
+/*
+ *    Copyright 2018 Rethink Robotics
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+/*
+ * This test (and the solver library that it is linked with) is compiled with
+ * EIGEN_RUNTIME_NO_MALLOC. Any heap allocation by Eigen while the allocation check is enabled
+ * fails an eigen_assert(), which aborts the test.
+ */
+#ifndef EIGEN_RUNTIME_NO_MALLOC
+#error "sns_ik_no_malloc_test must be compiled with EIGEN_RUNTIME_NO_MALLOC"
+#endif
+#ifdef NDEBUG
+#error "sns_ik_no_malloc_test requires eigen_assert(): do not define NDEBUG"
+#endif
+
+#include <gtest/gtest.h>
+
+#include <Eigen/Dense>
+#include <kdl/chain.hpp>
+#include <ros/console.h>
+#include <string>
+#include <vector>
+
+#include "rng_utilities.hpp"
+#include "sawyer_model.hpp"
+#include <sns_ik/sns_acc_ik_base.hpp>
+#include <sns_ik/sns_ik.hpp>
+#include <sns_ik/sns_vel_ik_base.hpp>
+
+/*************************************************************************************************
+ *                               Utilities Functions                                             *
+ *************************************************************************************************/
+
+// Number of test problems for each solver
+static const int NO_MALLOC_TEST_COUNT = 50;
+
+/*
+ * Solve every test problem twice. The first pass sets the size of the solver workspace. The
+ * second pass solves the same problems (and so the same task shapes) and must not allocate.
+ * @param nProblem: number of test problems
+ * @param solve: solve(i) solves the i-th test problem
+ */
+template <typename Solve>
+void checkNoMallocAfterWarmUp(int nProblem, const Solve& solve)
+{
+  for (int i = 0; i < nProblem; i++) {
+    solve(i);
+  }
+  Eigen::internal::set_is_malloc_allowed(false);
+  for (int i = 0; i < nProblem; i++) {
+    solve(i);
+  }
+  Eigen::internal::set_is_malloc_allowed(true);
+}
+
+/*************************************************************************************************/
+
+/*
+ * Test problem for the top-level velocity solver. The twist is scaled so that some of the
+ * problems are infeasible, which exercises the saturation loop of each solver.
+ */
+struct VelNoMallocProblem {
+  KDL::JntArray q;  // joint angles
+  KDL::Twist dp;  // task velocity
+  KDL::JntArray qBias;  // nullspace bias (joint angles)
+  KDL::JntArray dqBias;  // joint velocity bias
+};
+
+/*************************************************************************************************/
+
+/*
+ * Run SNS_IK::CartToJntVel() and a velocity session on the sawyer model, with and without the
+ * secondary tasks.
+ * @param seed: seed for the random number generators
+ * @param solverType: velocity solver to test
+ */
+void runNoMallocVelTest(int seed, sns_ik::VelocitySolveType solverType)
+{
+  sns_ik::rng_util::setRngSeed(seed, seed);
+
+  // Create a sawyer model:
+  std::vector<std::string> jointNames;
+  KDL::Chain sawyerChain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::JntArray qLow, qUpp, vMax, aMax;
+  sns_ik::sawyer_model::getSawyerJointLimits(&qLow, &qUpp, &vMax, &aMax);
+  int nJnt = sawyerChain.getNrOfJoints();
+  std::vector<std::string> biasNames(jointNames.begin(), jointNames.begin() + 3);
+
+  // Generate the test problems
+  std::vector<VelNoMallocProblem> problems(NO_MALLOC_TEST_COUNT);
+  for (VelNoMallocProblem& problem : problems) {
+    problem.q = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+    double scale = sns_ik::rng_util::getRngDouble(0, 0.1, 3.0);
+    Eigen::VectorXd dp = scale * sns_ik::rng_util::getRngVectorXd(0, 6, -1.0, 1.0);
+    problem.dp = KDL::Twist(KDL::Vector(dp(0), dp(1), dp(2)), KDL::Vector(dp(3), dp(4), dp(5)));
+    problem.qBias.resize(biasNames.size());
+    for (size_t i = 0; i < biasNames.size(); i++) {
+      problem.qBias(i) = sns_ik::rng_util::getRngDouble(0, qLow(i), qUpp(i));
+    }
+    problem.dqBias.resize(nJnt);
+    for (int i = 0; i < nJnt; i++) {
+      problem.dqBias(i) = sns_ik::rng_util::getRngDouble(0, -vMax(i), vMax(i));
+    }
+  }
+
+  // Each task stack is solved by a separate solver: changing the stack changes the task shape
+  for (int iStack = 0; iStack < 4; iStack++) {
+    bool useNullspaceBias = iStack & 1;
+    bool useVelocityBias = iStack & 2;
+    if (solverType == sns_ik::VelocitySolveType::SNS_Base && useNullspaceBias) {
+      continue;  // the base solver supports a configuration space task (velocity bias) only
+    }
+    sns_ik::SNS_IK ikSolver(sawyerChain, qLow, qUpp, vMax, aMax, jointNames);
+    ikSolver.setVelocitySolveType(solverType);
+    KDL::JntArray noBias(0);
+    std::vector<std::string> noBiasNames;
+    KDL::JntArray dqSoln(nJnt);
+    checkNoMallocAfterWarmUp(problems.size(), [&](int i) {
+      const VelNoMallocProblem& problem = problems[i];
+      int exitCode = ikSolver.CartToJntVel(problem.q, problem.dp,
+                                           useNullspaceBias ? problem.qBias : noBias,
+                                           useNullspaceBias ? biasNames : noBiasNames,
+                                           useVelocityBias ? problem.dqBias : noBias, dqSoln);
+      EXPECT_GE(exitCode, 0);
+    });
+
+    // The same problems with the joint vectors in the columns of matrices
+    Eigen::MatrixXd qColumns(nJnt, problems.size()), dqColumns(nJnt, problems.size());
+    for (size_t i = 0; i < problems.size(); i++) {
+      qColumns.col(i) = problems[i].q.data;
+    }
+    checkNoMallocAfterWarmUp(problems.size(), [&](int i) {
+      const VelNoMallocProblem& problem = problems[i];
+      int exitCode = ikSolver.CartToJntVel(qColumns.col(i), problem.dp,
+                                           useNullspaceBias ? problem.qBias.data : noBias.data,
+                                           useNullspaceBias ? biasNames : noBiasNames,
+                                           useVelocityBias ? problem.dqBias.data : noBias.data,
+                                           dqColumns.col(i));
+      EXPECT_GE(exitCode, 0);
+    });
+
+    // The same problems with a velocity session
+    std::shared_ptr<sns_ik::SNS_IK::VelocityIkSession> session =
+        ikSolver.createVelocitySession(useNullspaceBias ? biasNames : noBiasNames, useVelocityBias);
+    checkNoMallocAfterWarmUp(problems.size(), [&](int i) {
+      const VelNoMallocProblem& problem = problems[i];
+      int exitCode = session->step(problem.q, problem.dp, useNullspaceBias ? problem.qBias : noBias,
+                                   useVelocityBias ? problem.dqBias : noBias, &dqSoln);
+      EXPECT_GE(exitCode, 0);
+    });
+  }
+}
+
+/*************************************************************************************************
+ *                                        Tests                                                  *
+ *************************************************************************************************/
+
+TEST(sns_ik_no_malloc, vel_ik_SNS_test) {
+    runNoMallocVelTest(28463, sns_ik::VelocitySolveType::SNS); }
+TEST(sns_ik_no_malloc, vel_ik_SNS_Base_test) {
+    runNoMallocVelTest(28463, sns_ik::VelocitySolveType::SNS_Base); }
+TEST(sns_ik_no_malloc, vel_ik_SNS_Optimal_test) {
+    runNoMallocVelTest(28463, sns_ik::VelocitySolveType::SNS_Optimal); }
+TEST(sns_ik_no_malloc, vel_ik_SNS_OptimalScaleMargin_test) {
+    runNoMallocVelTest(28463, sns_ik::VelocitySolveType::SNS_OptimalScaleMargin); }
+TEST(sns_ik_no_malloc, vel_ik_SNS_Fast_test) {
+    runNoMallocVelTest(28463, sns_ik::VelocitySolveType::SNS_Fast); }
+TEST(sns_ik_no_malloc, vel_ik_SNS_FastOptimal_test) {
+    runNoMallocVelTest(28463, sns_ik::VelocitySolveType::SNS_FastOptimal); }
+
+/*************************************************************************************************/
+
+/*
+ * SnsVelIkBase::solve(), with and without a configuration space task, using both the fixed-size
+ * kernel (six-dimensional task, seven joints) and the dynamic kernel, with and without the warm start.
+ */
+TEST(sns_ik_no_malloc, vel_ik_base)
+{
+  sns_ik::rng_util::setRngSeed(51932, 7713);
+  int nTask = 6;
+  int nJoint = 7;
+  Eigen::ArrayXd dqLow = sns_ik::rng_util::getRngVectorXd(0, nJoint, -2.0, -0.5);
+  Eigen::ArrayXd dqUpp = sns_ik::rng_util::getRngVectorXd(0, nJoint, 0.5, 2.0);
+  std::vector<Eigen::MatrixXd> J(NO_MALLOC_TEST_COUNT);
+  std::vector<Eigen::VectorXd> dx(NO_MALLOC_TEST_COUNT), dqCS(NO_MALLOC_TEST_COUNT);
+  for (int i = 0; i < NO_MALLOC_TEST_COUNT; i++) {
+    J[i] = sns_ik::rng_util::getRngMatrixXd(0, nTask, nJoint, -2.0, 2.0);
+    dx[i] = sns_ik::rng_util::getRngVectorXd(0, nTask, -4.0, 4.0);
+    dqCS[i] = sns_ik::rng_util::getRngArrBndXd(0, dqLow, dqUpp).matrix();
+  }
+
+  for (bool useFixedSizeKernel : {true, false}) {
+    for (bool useWarmStart : {false, true}) {
+      sns_ik::SnsVelIkBase::uPtr ikSolver = sns_ik::SnsVelIkBase::create(dqLow, dqUpp,
+                                                                         useFixedSizeKernel);
+      ASSERT_TRUE(ikSolver.get() != nullptr);
+      ikSolver->setUseWarmStart(useWarmStart);
+      Eigen::VectorXd dq(nJoint);
+      double taskScale, taskScaleCS;
+      checkNoMallocAfterWarmUp(NO_MALLOC_TEST_COUNT, [&](int i) {
+        EXPECT_TRUE(ikSolver->solve(J[i], dx[i], &dq, &taskScale) ==
+                    sns_ik::SnsIkBase::ExitCode::Success);
+        EXPECT_TRUE(ikSolver->solve(J[i], dx[i], dqCS[i], &dq, &taskScale, &taskScaleCS) ==
+                    sns_ik::SnsIkBase::ExitCode::Success);
+      });
+    }
+  }
+}
+
+/*************************************************************************************************/
+
+/*
+ * SnsAccIkBase::solve(), using both the fixed-size kernel and the dynamic kernel, with and without
+ * the warm start.
+ */
+TEST(sns_ik_no_malloc, acc_ik_base)
+{
+  sns_ik::rng_util::setRngSeed(90417, 3329);
+  int nTask = 6;
+  int nJoint = 7;
+  Eigen::ArrayXd ddqLow = sns_ik::rng_util::getRngVectorXd(0, nJoint, -2.0, -0.5);
+  Eigen::ArrayXd ddqUpp = sns_ik::rng_util::getRngVectorXd(0, nJoint, 0.5, 2.0);
+  std::vector<Eigen::MatrixXd> J(NO_MALLOC_TEST_COUNT);
+  std::vector<Eigen::VectorXd> dJdq(NO_MALLOC_TEST_COUNT), ddx(NO_MALLOC_TEST_COUNT);
+  for (int i = 0; i < NO_MALLOC_TEST_COUNT; i++) {
+    J[i] = sns_ik::rng_util::getRngMatrixXd(0, nTask, nJoint, -2.0, 2.0);
+    dJdq[i] = sns_ik::rng_util::getRngVectorXd(0, nTask, -0.5, 0.5);
+    ddx[i] = sns_ik::rng_util::getRngVectorXd(0, nTask, -4.0, 4.0);
+  }
+
+  for (bool useFixedSizeKernel : {true, false}) {
+    for (bool useWarmStart : {false, true}) {
+      sns_ik::SnsAccIkBase::uPtr ikSolver = sns_ik::SnsAccIkBase::create(ddqLow, ddqUpp,
+                                                                         useFixedSizeKernel);
+      ASSERT_TRUE(ikSolver.get() != nullptr);
+      ikSolver->setUseWarmStart(useWarmStart);
+      Eigen::VectorXd ddq(nJoint);
+      double taskScale;
+      checkNoMallocAfterWarmUp(NO_MALLOC_TEST_COUNT, [&](int i) {
+        ikSolver->solve(J[i], dJdq[i], ddx[i], &ddq, &taskScale);
+      });
+    }
+  }
+}
+
+/*************************************************************************************************/
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv){
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -24,10 +24,14 @@
 #include <Eigen/Dense>
 #include <kdl/chain.hpp>
 #include <kdl/chainfksolvervel_recursive.hpp>
+#include <algorithm>
+#include <limits>
 #include <map>
 #include <ros/console.h>
 #include <ros/duration.h>
 #include <ros/time.h>
+#include <atomic>
+#include <thread>
 
 #include "rng_utilities.hpp"
 #include "sawyer_model.hpp"
@@ -62,6 +66,9 @@ static const std::vector<double> POS_IK_TEST_DELTA_SCORE = {0.05, 0.1, 0.25, 0.6
 // Perturbation to apply to the null-space bias
 static const double POS_IK_TEST_BIAS_DELTA = 0.1;  // radians
 
+// How many goals should be solved by each batch position IK test?
+static const int POS_IK_BATCH_TEST_COUNT = 200;
+
 /*************************************************************************************************
  *                               Utilities Functions                                             *
  *************************************************************************************************/
@@ -225,6 +232,44 @@ void runSnsPosIkTest(int seed, sns_ik::VelocitySolveType solverType) {
   runGeneralPosIkTest(seed, fwdKin, invKin, qLow, qUpp, sns_ik::toStr(solverType));
 }
 
+/*
+ * A batch of position IK problems on the sawyer model
+ */
+struct PosBatchProblem {
+  std::vector<KDL::JntArray> qInit;  // joint seeds
+  std::vector<KDL::Frame> pGoal;  // goal frames
+  std::vector<KDL::JntArray> qBias;  // nullspace bias (all joints)
+};
+
+/*
+ * Generate a batch of position IK problems, with seeds that range from close to far.
+ * @param seed: seed to pass to the RNG
+ * @param fwdKin: forward kinematics solver
+ * @param qLow: lower joint limits
+ * @param qUpp: upper joint limits
+ * @param nGoal: number of goals in the batch
+ * @return: batch of test problems
+ */
+PosBatchProblem getPosBatchProblem(int seed, KDL::ChainFkSolverPos_recursive& fwdKin,
+                                   const KDL::JntArray& qLow, const KDL::JntArray& qUpp,
+                                   int nGoal)
+{
+  sns_ik::rng_util::setRngSeed(seed, seed);
+  PosBatchProblem problem;
+  int nDel = POS_IK_TEST_DELTA_LIST.size();
+  for (int iGoal = 0; iGoal < nGoal; iGoal++) {
+    KDL::JntArray qTest = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+    KDL::Frame zTest;
+    fwdKin.JntToCart(qTest, zTest);
+    problem.pGoal.push_back(zTest);
+    problem.qInit.push_back(sns_ik::rng_util::getNearbyJoints(0, qTest,
+                            POS_IK_TEST_DELTA_LIST[iGoal % nDel], qLow, qUpp));
+    problem.qBias.push_back(sns_ik::rng_util::getNearbyJoints(0, qTest,
+                            POS_IK_TEST_BIAS_DELTA, qLow, qUpp));
+  }
+  return problem;
+}
+
 /*************************************************************************************************
  *                                        Tests                                                  *
  *************************************************************************************************/
@@ -275,6 +320,757 @@ TEST(sns_ik, pos_ik_SNS_Fast_test) {
 TEST(sns_ik, pos_ik_SNS_FastOptimal_test) {
     runSnsPosIkTest(82025, sns_ik::VelocitySolveType::SNS_FastOptimal); }
 
+/*************************************************************************************************/
+
+/*
+ * Check that CartToJntBatch() returns the same solutions and return codes as calling CartToJnt()
+ * on each goal, with and without a nullspace bias.
+ */
+TEST(sns_ik_pos, batch_matches_serial_test)
+{
+  std::vector<std::string> jointNames;
+  KDL::Chain sawyerChain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::JntArray qLow, qUpp, vMax, aMax;
+  sns_ik::sawyer_model::getSawyerJointLimits(&qLow, &qUpp, &vMax, &aMax);
+  KDL::ChainFkSolverPos_recursive fwdKin(sawyerChain);
+  PosBatchProblem problem = getPosBatchProblem(49201, fwdKin, qLow, qUpp, POS_IK_BATCH_TEST_COUNT);
+  int nGoal = problem.pGoal.size();
+
+  for (bool useBias : {false, true}) {
+    std::vector<KDL::JntArray> qBias = useBias ? problem.qBias : std::vector<KDL::JntArray>();
+    std::vector<std::string> biasNames = useBias ? jointNames : std::vector<std::string>();
+
+    // Reference: solve each goal in turn
+    sns_ik::SNS_IK serialSolver(sawyerChain, qLow, qUpp, vMax, aMax, jointNames);
+    std::vector<KDL::JntArray> qSerial(nGoal);
+    std::vector<int> resultSerial(nGoal);
+    int nSolvedSerial = 0;
+    for (int i = 0; i < nGoal; i++) {
+      resultSerial[i] = serialSolver.CartToJnt(problem.qInit[i], problem.pGoal[i],
+                                               useBias ? qBias[i] : KDL::JntArray(0), biasNames,
+                                               qSerial[i]);
+      if (resultSerial[i] >= 0) { nSolvedSerial++; }
+    }
+
+    sns_ik::SNS_IK batchSolver(sawyerChain, qLow, qUpp, vMax, aMax, jointNames);
+    batchSolver.setBatchThreadCount(3);
+    std::vector<KDL::JntArray> qBatch;
+    std::vector<int> resultBatch;
+    int nSolved = batchSolver.CartToJntBatch(problem.qInit, problem.pGoal, qBias, biasNames,
+                                             &qBatch, &resultBatch);
+    EXPECT_EQ(nSolvedSerial, nSolved);
+    ASSERT_EQ(nGoal, int(qBatch.size()));
+    ASSERT_EQ(nGoal, int(resultBatch.size()));
+    for (int i = 0; i < nGoal; i++) {
+      EXPECT_EQ(resultSerial[i], resultBatch[i]);
+      if (resultSerial[i] >= 0) {
+        ASSERT_EQ(qSerial[i].rows(), qBatch[i].rows());
+        EXPECT_LT((qSerial[i].data - qBatch[i].data).lpNorm<Eigen::Infinity>(), 1e-12);
+      }
+    }
+  }
+
+  // Invalid input: the number of seeds does not match the number of goals
+  sns_ik::SNS_IK ikSolver(sawyerChain, qLow, qUpp, vMax, aMax, jointNames);
+  std::vector<KDL::JntArray> qOut;
+  std::vector<int> results;
+  std::vector<KDL::JntArray> qInit(problem.qInit.begin(), problem.qInit.begin() + 2);
+  EXPECT_EQ(-1, ikSolver.CartToJntBatch(qInit, problem.pGoal, &qOut, &results));
+}
+
+/*
+ * Benchmark: time CartToJntBatch() on the same batch of goals for one thread up to the number of
+ * hardware threads, and report the speed-up relative to a single thread.
+ */
+TEST(sns_ik_pos, batch_scaling_test)
+{
+  std::vector<std::string> jointNames;
+  KDL::Chain sawyerChain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::JntArray qLow, qUpp, vMax, aMax;
+  sns_ik::sawyer_model::getSawyerJointLimits(&qLow, &qUpp, &vMax, &aMax);
+  KDL::ChainFkSolverPos_recursive fwdKin(sawyerChain);
+  PosBatchProblem problem = getPosBatchProblem(77316, fwdKin, qLow, qUpp, POS_IK_BATCH_TEST_COUNT);
+
+  sns_ik::SNS_IK ikSolver(sawyerChain, qLow, qUpp, vMax, aMax, jointNames);
+  int nThreadMax = std::max(int(std::thread::hardware_concurrency()), 1);
+  double singleThreadTime = 0.0;
+  int singleThreadSolved = 0;
+  for (int nThread = 1; nThread <= nThreadMax; nThread++) {
+    ikSolver.setBatchThreadCount(nThread);
+    std::vector<KDL::JntArray> qOut;
+    std::vector<int> results;
+    ros::Time startTime = ros::Time::now();
+    int nSolved = ikSolver.CartToJntBatch(problem.qInit, problem.pGoal, &qOut, &results);
+    double solveTime = (ros::Time::now() - startTime).toSec();
+    if (nThread == 1) {
+      singleThreadTime = solveTime;
+      singleThreadSolved = nSolved;
+    }
+    EXPECT_EQ(singleThreadSolved, nSolved);
+    if (POS_IK_TEST_VERBOSE) {
+      ROS_INFO("Batch Position IK Test  -->  threads: %d, solved: %d / %d  --  %f ms  --  speed-up: %f",
+               nThread, nSolved, int(problem.pGoal.size()), 1000.0 * solveTime,
+               singleThreadTime / solveTime);
+    }
+  }
+}
+
+/*************************************************************************************************/
+
+/*
+ * Solve from seeds that are far from the solution: racing several seeds must solve at least as
+ * many problems as the single seed, and NearestSolution mode must return a solution that is no
+ * further from the user's seed than the one returned in FirstSolution mode.
+ */
+TEST(sns_ik_pos, multi_seed_test)
+{
+  sns_ik::rng_util::setRngSeed(27182, 27182);
+  std::vector<std::string> jointNames;
+  KDL::Chain sawyerChain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::JntArray qLow, qUpp, vMax, aMax;
+  sns_ik::sawyer_model::getSawyerJointLimits(&qLow, &qUpp, &vMax, &aMax);
+  KDL::ChainFkSolverPos_recursive fwdKin(sawyerChain);
+
+  sns_ik::SNS_IK ikSolver(sawyerChain, qLow, qUpp, vMax, aMax, jointNames);
+  ikSolver.setBatchThreadCount(4);
+  ikSolver.setMultiSeedCount(8);
+  int nTest = 50;
+  int nSingle = 0;
+  int nMulti = 0;
+  for (int iTest = 0; iTest < nTest; iTest++) {
+    KDL::JntArray qTest = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+    KDL::JntArray qInit = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+    KDL::Frame pGoal;
+    fwdKin.JntToCart(qTest, pGoal);
+
+    KDL::JntArray qSingle, qFirst, qNearest;
+    if (ikSolver.CartToJnt(qInit, pGoal, qSingle) >= 0) { nSingle++; }
+    ikSolver.setMultiSeedMode(sns_ik::FirstSolution);
+    int exitFirst = ikSolver.CartToJntMultiSeed(qInit, pGoal, qFirst);
+    ikSolver.setMultiSeedMode(sns_ik::NearestSolution);
+    int exitNearest = ikSolver.CartToJntMultiSeed(qInit, pGoal, qNearest);
+    EXPECT_EQ(exitFirst >= 0, exitNearest >= 0);
+    if (exitFirst < 0) { continue; }
+    nMulti++;
+
+    KDL::Frame pFirst, pNearest;
+    fwdKin.JntToCart(qFirst, pFirst);
+    fwdKin.JntToCart(qNearest, pNearest);
+    EXPECT_TRUE(KDL::Equal(pGoal, pFirst, 1e-4));
+    EXPECT_TRUE(KDL::Equal(pGoal, pNearest, 1e-4));
+    EXPECT_LE((qNearest.data - qInit.data).norm(), (qFirst.data - qInit.data).norm() + 1e-9);
+  }
+  EXPECT_GE(nMulti, nSingle);
+
+  // A seed with the wrong number of joints is rejected
+  KDL::JntArray qLong(sawyerChain.getNrOfJoints() + 2), qOut;
+  EXPECT_EQ(-1, ikSolver.CartToJntMultiSeed(qLong, KDL::Frame(), qOut));
+
+  // The caller's cached seed setting is left unchanged by the multi-seed solve
+  std::shared_ptr<sns_ik::SNSPositionIK> posSolver;
+  ASSERT_TRUE(ikSolver.getPositionSolver(posSolver));
+  posSolver->setUseCachedSeed(false);
+  KDL::JntArray qInit = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+  ikSolver.CartToJntMultiSeed(qInit, KDL::Frame(), qOut);
+  EXPECT_FALSE(posSolver->getUseCachedSeed());
+  posSolver->setUseCachedSeed(true);
+  ROS_INFO("Multi-seed Position IK Test  -->  single seed: %d / %d, multi-seed: %d / %d",
+           nSingle, nTest, nMulti, nTest);
+}
+
+/*
+ * The position solver returns CANCELLED when its cancellation flag is set.
+ */
+TEST(sns_ik_pos, cancel_test)
+{
+  std::vector<std::string> jointNames;
+  KDL::Chain sawyerChain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::JntArray qLow, qUpp, vMax, aMax;
+  sns_ik::sawyer_model::getSawyerJointLimits(&qLow, &qUpp, &vMax, &aMax);
+  KDL::ChainFkSolverPos_recursive fwdKin(sawyerChain);
+  sns_ik::SNS_IK ikSolver(sawyerChain, qLow, qUpp, vMax, aMax, jointNames);
+  std::shared_ptr<sns_ik::SNSPositionIK> posSolver;
+  ASSERT_TRUE(ikSolver.getPositionSolver(posSolver));
+
+  KDL::JntArray qTest = sns_ik::rng_util::getRngBoundedJoints(31415, qLow, qUpp);
+  KDL::JntArray qInit = sns_ik::rng_util::getNearbyJoints(0, qTest, 0.5, qLow, qUpp);
+  KDL::Frame pGoal;
+  fwdKin.JntToCart(qTest, pGoal);
+  KDL::JntArray qSoln;
+  std::atomic<bool> cancel(true);
+  posSolver->setCancelFlag(&cancel);
+  EXPECT_EQ(sns_ik::SNSPositionIK::CANCELLED, posSolver->CartToJnt(qInit, pGoal, &qSoln));
+  cancel = false;
+  EXPECT_GE(posSolver->CartToJnt(qInit, pGoal, &qSoln), 0);
+  posSolver->setCancelFlag(nullptr);
+}
+
+/*
+ * A tiny time limit stops the solve with TIMED_OUT and returns the best iterate, while a generous
+ * time limit does not change the solution.
+ */
+TEST(sns_ik_pos, timeout_test)
+{
+  std::vector<std::string> jointNames;
+  KDL::Chain sawyerChain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::JntArray qLow, qUpp, vMax, aMax;
+  sns_ik::sawyer_model::getSawyerJointLimits(&qLow, &qUpp, &vMax, &aMax);
+  KDL::ChainFkSolverPos_recursive fwdKin(sawyerChain);
+  sns_ik::SNS_IK ikSolver(sawyerChain, qLow, qUpp, vMax, aMax, jointNames);
+
+  KDL::JntArray qTest = sns_ik::rng_util::getRngBoundedJoints(16180, qLow, qUpp);
+  KDL::JntArray qInit = sns_ik::rng_util::getNearbyJoints(0, qTest, 0.5, qLow, qUpp);
+  KDL::Frame pGoal;
+  fwdKin.JntToCart(qTest, pGoal);
+
+  KDL::JntArray qRef;
+  ASSERT_GE(ikSolver.CartToJnt(qInit, pGoal, qRef), 0);
+
+  // The solver keeps the time limit when the velocity solver is changed
+  ikSolver.setTimeout(1e-9);
+  ikSolver.setVelocitySolveType(sns_ik::VelocitySolveType::SNS_Fast);
+  ikSolver.setVelocitySolveType(sns_ik::VelocitySolveType::SNS);
+  EXPECT_EQ(1e-9, ikSolver.getTimeout());
+  KDL::JntArray qSoln;
+  EXPECT_EQ(sns_ik::SNSPositionIK::TIMED_OUT, ikSolver.CartToJnt(qInit, pGoal, qSoln));
+  ASSERT_EQ(qInit.rows(), qSoln.rows());
+  for (int i = 0; i < int(qSoln.rows()); i++) {
+    EXPECT_GE(qSoln(i), qLow(i));
+    EXPECT_LE(qSoln(i), qUpp(i));
+  }
+
+  ikSolver.setTimeout(10.0);
+  ASSERT_GE(ikSolver.CartToJnt(qInit, pGoal, qSoln), 0);
+  EXPECT_LT((qSoln.data - qRef.data).lpNorm<Eigen::Infinity>(), 1e-12);
+}
+
+/*
+ * The adaptive step needs fewer iterations than the fixed step on goals that are far from the
+ * seed, and solves at least about as many of them.
+ */
+TEST(sns_ik_pos, adaptive_step_test)
+{
+  sns_ik::rng_util::setRngSeed(14142, 14142);
+  std::vector<std::string> jointNames;
+  KDL::Chain sawyerChain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::JntArray qLow, qUpp, vMax, aMax;
+  sns_ik::sawyer_model::getSawyerJointLimits(&qLow, &qUpp, &vMax, &aMax);
+  KDL::ChainFkSolverPos_recursive fwdKin(sawyerChain);
+  sns_ik::SNS_IK ikSolver(sawyerChain, qLow, qUpp, vMax, aMax, jointNames);
+  std::shared_ptr<sns_ik::SNSPositionIK> posSolver;
+  ASSERT_TRUE(ikSolver.getPositionSolver(posSolver));
+
+  int nTest = 100;
+  std::vector<int> adaptiveIterations, fixedIterations;
+  for (int iTest = 0; iTest < nTest; iTest++) {
+    KDL::JntArray qTest = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+    KDL::JntArray qInit = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+    KDL::Frame pGoal;
+    fwdKin.JntToCart(qTest, pGoal);
+    KDL::JntArray qSoln;
+    posSolver->setUseAdaptiveStep(true);
+    if (posSolver->CartToJnt(qInit, pGoal, &qSoln) >= 0) {
+      adaptiveIterations.push_back(posSolver->getLastIterationCount());
+      for (int i = 0; i < int(qSoln.rows()); i++) {
+        EXPECT_GE(qSoln(i), qLow(i));
+        EXPECT_LE(qSoln(i), qUpp(i));
+      }
+    }
+    posSolver->setUseAdaptiveStep(false);
+    if (posSolver->CartToJnt(qInit, pGoal, &qSoln) >= 0) {
+      fixedIterations.push_back(posSolver->getLastIterationCount());
+    }
+  }
+  ASSERT_FALSE(adaptiveIterations.empty());
+  ASSERT_FALSE(fixedIterations.empty());
+  std::sort(adaptiveIterations.begin(), adaptiveIterations.end());
+  std::sort(fixedIterations.begin(), fixedIterations.end());
+  int adaptiveMedian = adaptiveIterations[adaptiveIterations.size() / 2];
+  int fixedMedian = fixedIterations[fixedIterations.size() / 2];
+  EXPECT_LT(adaptiveMedian, fixedMedian);
+  EXPECT_GE(adaptiveIterations.size() + nTest / 20, fixedIterations.size());
+  ROS_INFO("Adaptive Step Test  -->  adaptive: %d / %d solved, median %d iterations; "
+           "fixed: %d / %d solved, median %d iterations", int(adaptiveIterations.size()), nTest,
+           adaptiveMedian, int(fixedIterations.size()), nTest, fixedMedian);
+}
+
+/*
+ * Broyden updates of the Jacobian between the exact Jacobians reach the same accuracy, with
+ * about as many solved problems and iterations as the exact Jacobian at every iteration.
+ */
+TEST(sns_ik_pos, broyden_jacobian_test)
+{
+  sns_ik::rng_util::setRngSeed(17320, 17320);
+  std::vector<std::string> jointNames;
+  KDL::Chain sawyerChain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::JntArray qLow, qUpp, vMax, aMax;
+  sns_ik::sawyer_model::getSawyerJointLimits(&qLow, &qUpp, &vMax, &aMax);
+  KDL::ChainFkSolverPos_recursive fwdKin(sawyerChain);
+  sns_ik::SNS_IK ikSolver(sawyerChain, qLow, qUpp, vMax, aMax, jointNames);
+  std::shared_ptr<sns_ik::SNSPositionIK> posSolver;
+  ASSERT_TRUE(ikSolver.getPositionSolver(posSolver));
+
+  int nTest = 100;
+  std::vector<KDL::JntArray> qInit;
+  std::vector<KDL::Frame> pGoal;
+  for (int iTest = 0; iTest < nTest; iTest++) {
+    KDL::JntArray qTest = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+    qInit.push_back(sns_ik::rng_util::getNearbyJoints(0, qTest, 0.5, qLow, qUpp));
+    pGoal.push_back(KDL::Frame());
+    fwdKin.JntToCart(qTest, pGoal.back());
+  }
+
+  std::vector<int> periodList = {1, 3};
+  std::vector<int> nSolved(periodList.size(), 0);
+  std::vector<int> nIteration(periodList.size(), 0);
+  for (size_t iPeriod = 0; iPeriod < periodList.size(); iPeriod++) {
+    posSolver->setJacobianUpdatePeriod(periodList[iPeriod]);
+    EXPECT_EQ(periodList[iPeriod], posSolver->getJacobianUpdatePeriod());
+    ros::Time startTime = ros::Time::now();
+    for (int iTest = 0; iTest < nTest; iTest++) {
+      KDL::JntArray qSoln;
+      if (posSolver->CartToJnt(qInit[iTest], pGoal[iTest], &qSoln) < 0) { continue; }
+      nSolved[iPeriod]++;
+      nIteration[iPeriod] += posSolver->getLastIterationCount();
+      KDL::Frame pSoln;
+      fwdKin.JntToCart(qSoln, pSoln);
+      EXPECT_TRUE(KDL::Equal(pGoal[iTest], pSoln, 1e-4));
+    }
+    double solveTime = (ros::Time::now() - startTime).toSec();
+    ROS_INFO("Broyden Jacobian Test  -->  period: %d, solved: %d / %d, mean iterations: %f, "
+             "time: %f ms", periodList[iPeriod], nSolved[iPeriod], nTest,
+             double(nIteration[iPeriod]) / double(std::max(nSolved[iPeriod], 1)), 1000.0 * solveTime);
+  }
+  EXPECT_GE(nSolved[1] + nTest / 20, nSolved[0]);
+  EXPECT_LE(nIteration[1], 2 * nIteration[0]);
+}
+
+/*
+ * Restarts on stagnation solve more problems from random seeds, within the same iteration limit,
+ * and the solutions are within the joint limits.
+ */
+TEST(sns_ik_pos, restart_test)
+{
+  sns_ik::rng_util::setRngSeed(22360, 22360);
+  std::vector<std::string> jointNames;
+  KDL::Chain sawyerChain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::JntArray qLow, qUpp, vMax, aMax;
+  sns_ik::sawyer_model::getSawyerJointLimits(&qLow, &qUpp, &vMax, &aMax);
+  KDL::ChainFkSolverPos_recursive fwdKin(sawyerChain);
+  sns_ik::SNS_IK ikSolver(sawyerChain, qLow, qUpp, vMax, aMax, jointNames);
+  std::shared_ptr<sns_ik::SNSPositionIK> posSolver;
+  ASSERT_TRUE(ikSolver.getPositionSolver(posSolver));
+
+  int nTest = 100;
+  int nRestartSolved = 0, nRestart = 0, nSolved = 0;
+  ros::Duration restartTime(0.0), solveTime(0.0);
+  for (int iTest = 0; iTest < nTest; iTest++) {
+    KDL::JntArray qTest = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+    KDL::JntArray qInit = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+    KDL::Frame pGoal;
+    fwdKin.JntToCart(qTest, pGoal);
+    KDL::JntArray qSoln;
+
+    posSolver->setUseRestarts(true);
+    ros::Time startTime = ros::Time::now();
+    if (posSolver->CartToJnt(qInit, pGoal, &qSoln) >= 0) {
+      nRestartSolved++;
+      KDL::Frame pSoln;
+      fwdKin.JntToCart(qSoln, pSoln);
+      EXPECT_TRUE(KDL::Equal(pGoal, pSoln, 1e-4));
+      for (int i = 0; i < int(qSoln.rows()); i++) {
+        EXPECT_GE(qSoln(i), qLow(i));
+        EXPECT_LE(qSoln(i), qUpp(i));
+      }
+    }
+    restartTime += ros::Time::now() - startTime;
+    nRestart += posSolver->getLastRestartCount();
+
+    posSolver->setUseRestarts(false);
+    startTime = ros::Time::now();
+    if (posSolver->CartToJnt(qInit, pGoal, &qSoln) >= 0) {
+      nSolved++;
+    }
+    solveTime += ros::Time::now() - startTime;
+    EXPECT_EQ(0, posSolver->getLastRestartCount());
+  }
+  EXPECT_GT(nRestart, 0);
+  EXPECT_GE(nRestartSolved, nSolved);
+  ROS_INFO("Restart Test  -->  with restarts: %d / %d solved, %d restarts, %f ms per solution; "
+           "without: %d / %d solved, %f ms per solution", nRestartSolved, nTest, nRestart,
+           1000.0 * restartTime.toSec() / std::max(nRestartSolved, 1), nSolved, nTest,
+           1000.0 * solveTime.toSec() / std::max(nSolved, 1));
+}
+
+/*
+ * Solves that are run a few iterations at a time with begin() and step(), and interleaved between
+ * two solvers, return the same solutions as CartToJnt(), even if a begin() with an invalid seed
+ * is rejected in the middle of a solve. The best joint angles get closer to the goal as the solve
+ * runs.
+ */
+TEST(sns_ik_pos, step_test)
+{
+  sns_ik::rng_util::setRngSeed(26457, 26457);
+  std::vector<std::string> jointNames;
+  KDL::Chain sawyerChain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::JntArray qLow, qUpp, vMax, aMax;
+  sns_ik::sawyer_model::getSawyerJointLimits(&qLow, &qUpp, &vMax, &aMax);
+  KDL::ChainFkSolverPos_recursive fwdKin(sawyerChain);
+  sns_ik::SNS_IK ikSolverA(sawyerChain, qLow, qUpp, vMax, aMax, jointNames);
+  sns_ik::SNS_IK ikSolverB(sawyerChain, qLow, qUpp, vMax, aMax, jointNames);
+  std::vector<std::shared_ptr<sns_ik::SNSPositionIK>> posSolver(2);
+  ASSERT_TRUE(ikSolverA.getPositionSolver(posSolver[0]));
+  ASSERT_TRUE(ikSolverB.getPositionSolver(posSolver[1]));
+
+  int nTest = 20;
+  for (int iTest = 0; iTest < nTest; iTest++) {
+    std::vector<KDL::JntArray> qInit(2);
+    std::vector<KDL::Frame> pGoal(2);
+    std::vector<int> exitRef(2);
+    std::vector<KDL::JntArray> qRef(2);
+    std::vector<int> iterationRef(2);
+    for (int i = 0; i < 2; i++) {
+      KDL::JntArray qTest = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+      qInit[i] = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+      fwdKin.JntToCart(qTest, pGoal[i]);
+      exitRef[i] = posSolver[i]->CartToJnt(qInit[i], pGoal[i], &qRef[i]);
+      iterationRef[i] = posSolver[i]->getLastIterationCount();
+    }
+
+    // Interleave the two solves, a few iterations at a time
+    for (int i = 0; i < 2; i++) {
+      ASSERT_TRUE(posSolver[i]->begin(qInit[i], pGoal[i]));
+    }
+    // A rejected begin() does not disturb the solve in progress
+    EXPECT_FALSE(posSolver[0]->begin(KDL::JntArray(qInit[0].rows() + 1), pGoal[0]));
+    std::vector<int> exitStep(2, sns_ik::SNSPositionIK::IN_PROGRESS);
+    std::vector<double> bestErr(2, std::numeric_limits<double>::infinity());
+    while (exitStep[0] == sns_ik::SNSPositionIK::IN_PROGRESS ||
+           exitStep[1] == sns_ik::SNSPositionIK::IN_PROGRESS) {
+      for (int i = 0; i < 2; i++) {
+        exitStep[i] = posSolver[i]->step(3);
+        KDL::JntArray qBest;
+        double err = posSolver[i]->best(&qBest);
+        EXPECT_LE(err, bestErr[i]);
+        bestErr[i] = err;
+      }
+    }
+
+    for (int i = 0; i < 2; i++) {
+      EXPECT_EQ(exitRef[i], exitStep[i]);
+      EXPECT_EQ(iterationRef[i], posSolver[i]->getLastIterationCount());
+      EXPECT_EQ(exitStep[i], posSolver[i]->step(3));  // the solve has finished
+      if (exitStep[i] < 0) { continue; }
+      KDL::JntArray qSoln;
+      posSolver[i]->best(&qSoln);
+      EXPECT_LT((qSoln.data - qRef[i].data).lpNorm<Eigen::Infinity>(), 1e-12);
+    }
+  }
+}
+
+/*
+ * Check that a set of solutions reach the goal within the joint limits, and are distinct.
+ * @return: true if all checks passed
+ */
+bool checkMultiSolution(const std::vector<KDL::JntArray>& solutions, const KDL::Frame& pGoal,
+                        KDL::ChainFkSolverPos_recursive& fwdKin, const KDL::JntArray& qLow,
+                        const KDL::JntArray& qUpp, double minDistance)
+{
+  bool pass = true;
+  for (size_t i = 0; i < solutions.size(); i++) {
+    KDL::Frame pSoln;
+    fwdKin.JntToCart(solutions[i], pSoln);
+    pass = pass && KDL::Equal(pGoal, pSoln, 1e-4);
+    for (int j = 0; j < int(qLow.rows()); j++) {
+      pass = pass && solutions[i](j) >= qLow(j) && solutions[i](j) <= qUpp(j);
+    }
+    for (size_t k = 0; k < i; k++) {
+      pass = pass && (solutions[i].data - solutions[k].data).norm() >= minDistance;
+    }
+  }
+  return pass;
+}
+
+/*
+ * CartToJntMultiSolution() returns distinct solutions that reach the goal, starting with the
+ * solution of CartToJnt(). Sweeping the null space finds them faster than solving from random
+ * seeds.
+ */
+TEST(sns_ik_pos, multi_solution_test)
+{
+  sns_ik::rng_util::setRngSeed(31622, 31622);
+  std::vector<std::string> jointNames;
+  KDL::Chain sawyerChain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::JntArray qLow, qUpp, vMax, aMax;
+  sns_ik::sawyer_model::getSawyerJointLimits(&qLow, &qUpp, &vMax, &aMax);
+  KDL::ChainFkSolverPos_recursive fwdKin(sawyerChain);
+  sns_ik::SNS_IK ikSolver(sawyerChain, qLow, qUpp, vMax, aMax, jointNames);
+
+  int nTest = 20;
+  size_t maxSolutions = 5;
+  double minDistance = 0.5;
+  int nSweep = 0, nRandom = 0;
+  ros::Duration sweepTime(0.0), randomTime(0.0);
+  for (int iTest = 0; iTest < nTest; iTest++) {
+    KDL::JntArray qTest = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+    KDL::JntArray qInit = sns_ik::rng_util::getNearbyJoints(0, qTest, 0.3, qLow, qUpp);
+    KDL::Frame pGoal;
+    fwdKin.JntToCart(qTest, pGoal);
+    KDL::JntArray qRef;
+    ASSERT_GE(ikSolver.CartToJnt(qInit, pGoal, qRef), 0);
+
+    std::vector<KDL::JntArray> solutions;
+    ros::Time startTime = ros::Time::now();
+    int nSolution = ikSolver.CartToJntMultiSolution(qInit, pGoal, maxSolutions, &solutions, minDistance);
+    sweepTime += ros::Time::now() - startTime;
+    ASSERT_GE(nSolution, 1);
+    ASSERT_EQ(size_t(nSolution), solutions.size());
+    EXPECT_LE(solutions.size(), maxSolutions);
+    EXPECT_LT((solutions[0].data - qRef.data).lpNorm<Eigen::Infinity>(), 1e-12);
+    EXPECT_TRUE(checkMultiSolution(solutions, pGoal, fwdKin, qLow, qUpp, minDistance));
+    nSweep += nSolution;
+
+    // Reference: distinct solutions from random seeds, with as many solves as the sweep
+    std::vector<KDL::JntArray> randomSolutions;
+    startTime = ros::Time::now();
+    for (size_t iSeed = 0; iSeed < 4 * maxSolutions && randomSolutions.size() < maxSolutions; iSeed++) {
+      KDL::JntArray qSoln;
+      if (ikSolver.CartToJnt(sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp), pGoal, qSoln) < 0) {
+        continue;
+      }
+      bool distinct = true;
+      for (const KDL::JntArray& solution : randomSolutions) {
+        distinct = distinct && (qSoln.data - solution.data).norm() >= minDistance;
+      }
+      if (distinct) { randomSolutions.push_back(qSoln); }
+    }
+    randomTime += ros::Time::now() - startTime;
+    nRandom += randomSolutions.size();
+  }
+  EXPECT_GT(nSweep, 2 * nTest);
+  EXPECT_EQ(-1, ikSolver.CartToJntMultiSolution(qLow, KDL::Frame(), maxSolutions, nullptr));
+  ROS_INFO("Multi-Solution Test  -->  null space sweep: %f solutions per goal, %f ms per solution; "
+           "random seeds: %f solutions per goal, %f ms per solution", double(nSweep) / nTest,
+           1000.0 * sweepTime.toSec() / nSweep, double(nRandom) / nTest,
+           1000.0 * randomTime.toSec() / std::max(nRandom, 1));
+}
+
+/*
+ * Solve with tolerances on the goal frame: position-only goals, and a free rotation about the
+ * z axis of the goal with small tolerances on the other axes. The solutions must be within the
+ * tolerances, and dropping the rotation rows from the task should reduce the iterations.
+ */
+TEST(sns_ik_pos, tolerance_test)
+{
+  sns_ik::rng_util::setRngSeed(27182, 81828);
+  std::vector<std::string> jointNames;
+  KDL::Chain sawyerChain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::JntArray qLow, qUpp, vMax, aMax;
+  sns_ik::sawyer_model::getSawyerJointLimits(&qLow, &qUpp, &vMax, &aMax);
+  KDL::ChainFkSolverPos_recursive fwdKin(sawyerChain);
+  sns_ik::SNS_IK ikSolver(sawyerChain, qLow, qUpp, vMax, aMax, jointNames);
+  std::shared_ptr<sns_ik::SNSPositionIK> posSolver;
+  ASSERT_TRUE(ikSolver.getPositionSolver(posSolver));
+
+  std::vector<KDL::Twist> bounds(3);
+  bounds[0] = KDL::Twist::Zero();
+  bounds[1] = KDL::Twist(KDL::Vector::Zero(), KDL::Vector(M_PI, M_PI, M_PI));
+  bounds[2] = KDL::Twist(KDL::Vector(0.002, 0.002, 0.002), KDL::Vector(0.01, 0.01, M_PI));
+  int nTest = 100;
+  std::vector<int> nSuccess(bounds.size(), 0), nIteration(bounds.size(), 0);
+  for (int iTest = 0; iTest < nTest; iTest++) {
+    KDL::JntArray qTest = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+    KDL::JntArray qInit = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+    KDL::Frame pGoal;
+    fwdKin.JntToCart(qTest, pGoal);
+    for (size_t iBound = 0; iBound < bounds.size(); iBound++) {
+      KDL::JntArray qSoln;
+      if (posSolver->CartToJnt(qInit, pGoal, &qSoln, bounds[iBound]) < 0) {
+        continue;
+      }
+      nSuccess[iBound]++;
+      nIteration[iBound] += posSolver->getLastIterationCount();
+
+      // Error in the goal frame
+      KDL::Frame pSoln;
+      fwdKin.JntToCart(qSoln, pSoln);
+      KDL::Twist error(pGoal.M.Inverse() * (pSoln.p - pGoal.p), (pGoal.M.Inverse() * pSoln.M).GetRot());
+      for (int k = 0; k < 6; k++) {
+        EXPECT_LE(std::abs(error[k]), bounds[iBound][k] + 1e-4);
+      }
+    }
+  }
+  for (size_t iBound = 0; iBound < bounds.size(); iBound++) {
+    ROS_INFO("Tolerance Test %d  -->  success: %d / %d, mean iterations: %f", int(iBound),
+             nSuccess[iBound], nTest, double(nIteration[iBound]) / std::max(nSuccess[iBound], 1));
+  }
+  EXPECT_GE(nSuccess[1], nSuccess[0]);
+  EXPECT_LT(double(nIteration[1]) / nSuccess[1], double(nIteration[0]) / nSuccess[0]);
+  EXPECT_GT(nSuccess[2], nTest * 9 / 10);
+}
+
+/*
+ * Continuous joint: the last joint of the Sawyer without limits. The seeds and the nullspace bias
+ * are several revolutions away from the joint angle of the goal; the solutions must be within half
+ * a revolution of the seed.
+ */
+TEST(sns_ik_pos, continuous_joint_test)
+{
+  sns_ik::rng_util::setRngSeed(31415, 92653);
+  std::vector<std::string> jointNames;
+  KDL::Chain sawyerChain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::JntArray qLow, qUpp, vMax, aMax;
+  sns_ik::sawyer_model::getSawyerJointLimits(&qLow, &qUpp, &vMax, &aMax);
+  int nJnt = sawyerChain.getNrOfJoints();
+  int iCont = nJnt - 1;
+  KDL::JntArray qLowCont = qLow, qUppCont = qUpp;
+  qLowCont(iCont) = std::numeric_limits<double>::lowest();
+  qUppCont(iCont) = std::numeric_limits<double>::max();
+  KDL::ChainFkSolverPos_recursive fwdKin(sawyerChain);
+  sns_ik::SNS_IK ikSolver(sawyerChain, qLowCont, qUppCont, vMax, aMax, jointNames);
+  std::shared_ptr<sns_ik::SNSPositionIK> posSolver;
+  ASSERT_TRUE(ikSolver.getPositionSolver(posSolver));
+
+  int nTest = 100;
+  int nSuccess = 0, nSuccessBias = 0, nIterationBias = 0;
+  for (int iTest = 0; iTest < nTest; iTest++) {
+    KDL::JntArray qTest = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+    KDL::JntArray qInit = sns_ik::rng_util::getNearbyJoints(0, qTest, 0.3, qLow, qUpp);
+    qInit(iCont) += 2.0 * M_PI * (iTest % 2 ? 2.0 : -3.0);
+    KDL::Frame pGoal;
+    fwdKin.JntToCart(qTest, pGoal);
+
+    KDL::JntArray qSoln;
+    if (ikSolver.CartToJnt(qInit, pGoal, qSoln) >= 0) {
+      nSuccess++;
+      EXPECT_LE(std::abs(qSoln(iCont) - qInit(iCont)), M_PI + 1e-9);
+    }
+
+    // The bias is two revolutions away, on the other side of the seed
+    KDL::JntArray qBias = qTest;
+    qBias(iCont) += 2.0 * M_PI * (iTest % 2 ? -2.0 : 3.0);
+    if (ikSolver.CartToJnt(qInit, pGoal, qBias, jointNames, qSoln) >= 0) {
+      nSuccessBias++;
+      nIterationBias += posSolver->getLastIterationCount();
+      EXPECT_LE(std::abs(qSoln(iCont) - qInit(iCont)), M_PI + 1e-9);
+    }
+  }
+  ROS_INFO("Continuous Joint Test  -->  success: %d / %d, with bias: %d / %d, mean iterations: %f",
+           nSuccess, nTest, nSuccessBias, nTest, double(nIterationBias) / std::max(nSuccessBias, 1));
+  EXPECT_GT(nSuccess, nTest * 9 / 10);
+  EXPECT_GT(nSuccessBias, nTest * 9 / 10);
+}
+
+/*
+ * Dense Cartesian path: the trajectory solve must match CartToJnt() seeded from the previous
+ * solution, and flag the waypoint that is far from the path.
+ */
+TEST(sns_ik_pos, trajectory_test)
+{
+  sns_ik::rng_util::setRngSeed(16180, 33988);
+  std::vector<std::string> jointNames;
+  KDL::Chain sawyerChain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::JntArray qLow, qUpp, vMax, aMax;
+  sns_ik::sawyer_model::getSawyerJointLimits(&qLow, &qUpp, &vMax, &aMax);
+  int nJnt = sawyerChain.getNrOfJoints();
+  KDL::ChainFkSolverPos_recursive fwdKin(sawyerChain);
+  sns_ik::SNS_IK ikSolver(sawyerChain, qLow, qUpp, vMax, aMax, jointNames);
+
+  // Path of the end effector along a straight line in the joint space
+  int nWaypoint = 1000;
+  KDL::JntArray qStart = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+  KDL::JntArray qEnd = sns_ik::rng_util::getNearbyJoints(0, qStart, 0.5, qLow, qUpp);
+  std::vector<KDL::Frame> path(nWaypoint);
+  KDL::JntArray q(nJnt);
+  for (int i = 0; i < nWaypoint; i++) {
+    q.data = qStart.data + (double(i) / (nWaypoint - 1)) * (qEnd.data - qStart.data);
+    fwdKin.JntToCart(q, path[i]);
+  }
+
+  double maxJointStep = 0.05;
+  std::vector<double> qTrajectory(nJnt * nWaypoint);
+  std::vector<int> results(nWaypoint);
+  std::vector<size_t> breaks;
+  ros::Time startTime = ros::Time::now();
+  int nSolved = ikSolver.CartToJntTrajectory(qStart, path.begin(), path.end(), qTrajectory.data(),
+                                             results.data(), &breaks, maxJointStep);
+  double solveTime = (ros::Time::now() - startTime).toSec();
+  EXPECT_EQ(nWaypoint, nSolved);
+  EXPECT_TRUE(breaks.empty());
+
+  // Same solutions as CartToJnt() from the previous solution
+  KDL::JntArray seed = qStart;
+  for (int i = 0; i < nWaypoint; i++) {
+    ASSERT_EQ(results[i], ikSolver.CartToJnt(seed, path[i], q));
+    for (int j = 0; j < nJnt; j++) {
+      ASSERT_EQ(q(j), qTrajectory[i * nJnt + j]);
+    }
+    seed = q;
+  }
+
+  // A waypoint that is far from the path is a break, and so is the return to the path
+  size_t iFar = nWaypoint / 2;
+  KDL::JntArray qFar = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+  fwdKin.JntToCart(qFar, path[iFar]);
+  ikSolver.CartToJntTrajectory(qStart, path.begin(), path.end(), qTrajectory.data(), nullptr,
+                               &breaks, maxJointStep);
+  ASSERT_FALSE(breaks.empty());
+  EXPECT_EQ(iFar, breaks.front());
+  EXPECT_LE(breaks.size(), 2u);
+  ROS_INFO("Trajectory Test  -->  %d waypoints, mean solve time: %f ms, breaks: %d",
+           nWaypoint, 1e3 * solveTime / nWaypoint, int(breaks.size()));
+}
+
+/*
+ * Joint angles in the memory of the caller: the Eigen overload of CartToJnt() returns the same
+ * solutions as the KDL one.
+ */
+TEST(sns_ik_pos, eigen_overload_test)
+{
+  sns_ik::rng_util::setRngSeed(57721, 56649);
+  std::vector<std::string> jointNames;
+  KDL::Chain sawyerChain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::JntArray qLow, qUpp, vMax, aMax;
+  sns_ik::sawyer_model::getSawyerJointLimits(&qLow, &qUpp, &vMax, &aMax);
+  int nJnt = sawyerChain.getNrOfJoints();
+  KDL::ChainFkSolverPos_recursive fwdKin(sawyerChain);
+  // One solver for each interface, so that the solution cache of one does not seed the other
+  sns_ik::SNS_IK kdlSolver(sawyerChain, qLow, qUpp, vMax, aMax, jointNames);
+  sns_ik::SNS_IK eigenSolver(sawyerChain, qLow, qUpp, vMax, aMax, jointNames);
+  std::vector<std::string> biasNames = {jointNames[1], jointNames[3]};
+
+  int nTest = 50;
+  Eigen::MatrixXd seeds(nJnt, nTest), solutions(nJnt, nTest);
+  for (int i = 0; i < nTest; i++) {
+    KDL::JntArray qGoal = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+    KDL::JntArray qSeed = sns_ik::rng_util::getNearbyJoints(0, qGoal, 0.3, qLow, qUpp);
+    KDL::Frame goal;
+    fwdKin.JntToCart(qGoal, goal);
+    seeds.col(i) = qSeed.data;
+    KDL::JntArray qBias(biasNames.size());
+    qBias(0) = qGoal(1);
+    qBias(1) = qGoal(3);
+
+    KDL::JntArray qKdl(nJnt);
+    bool useBias = i % 2;
+    int kdlResult = useBias ? kdlSolver.CartToJnt(qSeed, goal, qBias, biasNames, qKdl)
+                            : kdlSolver.CartToJnt(qSeed, goal, qKdl);
+    int eigenResult = useBias ? eigenSolver.CartToJnt(seeds.col(i), goal, qBias.data, biasNames,
+                                                      solutions.col(i))
+                              : eigenSolver.CartToJnt(seeds.col(i), goal, solutions.col(i));
+    ASSERT_EQ(kdlResult, eigenResult);
+    if (kdlResult >= 0) {
+      EXPECT_LT((qKdl.data - solutions.col(i)).lpNorm<Eigen::Infinity>(), 1e-12);
+    }
+  }
+
+  // The output must have one element per joint
+  Eigen::VectorXd qShort(nJnt - 1);
+  KDL::Frame goal;
+  fwdKin.JntToCart(KDL::JntArray(nJnt), goal);
+  EXPECT_EQ(-1, eigenSolver.CartToJnt(Eigen::VectorXd::Zero(nJnt), goal, qShort));
+}
+
 /*************************************************************************************************/
 // Run all the tests that were declared with TEST()
 int main(int argc, char **argv){
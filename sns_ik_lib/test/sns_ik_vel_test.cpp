@@ -19,18 +19,23 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <cmath>
 #include <Eigen/Dense>
 #include <kdl/chain.hpp>
 #include <kdl/chainiksolvervel_pinv.hpp>
 #include <kdl/chainfksolvervel_recursive.hpp>
 #include <map>
+#include <string>
 #include <ros/console.h>
 #include <ros/duration.h>
 #include <ros/time.h>
+#include <thread>
 
 #include "rng_utilities.hpp"
 #include "sawyer_model.hpp"
 #include <sns_ik/sns_ik.hpp>
+#include <sns_ik/sns_vel_ik_base_interface.hpp>
 
 /*
  * Define a common interface to call both SNS and KDL solvers for velocity IK
@@ -287,6 +292,425 @@ TEST(sns_ik, vel_ik_SNS_FastOptimal_test) {
 
 /*************************************************************************************************/
 
+/*
+ * Several threads share one const SNS_IK object, each with its own solve context. The solutions
+ * must match those of the non-const solver, including after the joint speed limits are changed.
+ */
+TEST(sns_ik_vel, solve_context_test)
+{
+  sns_ik::rng_util::setRngSeed(61803, 39887);
+  std::vector<std::string> jointNames;
+  KDL::Chain sawyerChain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::JntArray qLow, qUpp, vMax, aMax;
+  sns_ik::sawyer_model::getSawyerJointLimits(&qLow, &qUpp, &vMax, &aMax);
+  int nJnt = sawyerChain.getNrOfJoints();
+  std::vector<std::string> biasNames(jointNames.begin(), jointNames.begin() + 2);
+
+  // Generate the test problems: some of the twists are infeasible
+  int nTest = 50;
+  std::vector<KDL::JntArray> q(nTest), qBias(nTest);
+  std::vector<KDL::Twist> dp(nTest);
+  for (int i = 0; i < nTest; i++) {
+    q[i] = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+    Eigen::VectorXd dpVec = sns_ik::rng_util::getRngVectorXd(0, 6, -2.0, 2.0);
+    dp[i] = KDL::Twist(KDL::Vector(dpVec(0), dpVec(1), dpVec(2)), KDL::Vector(dpVec(3), dpVec(4), dpVec(5)));
+    qBias[i].resize(biasNames.size());
+    for (size_t j = 0; j < biasNames.size(); j++) {
+      qBias[i](j) = sns_ik::rng_util::getRngDouble(0, qLow(j), qUpp(j));
+    }
+  }
+
+  sns_ik::SNS_IK ikSolver(sawyerChain, qLow, qUpp, vMax, aMax, jointNames);
+  const sns_ik::SNS_IK& model = ikSolver;
+  int nThread = 4;
+  std::vector<std::shared_ptr<sns_ik::SNS_IK::SolveContext>> contexts;
+  for (int iThread = 0; iThread < nThread; iThread++) {
+    contexts.push_back(model.createSolveContext());
+  }
+  for (double vScale : {1.0, 0.5}) {
+    KDL::JntArray vLim = vMax;
+    vLim.data *= vScale;
+    ikSolver.setMaxJointVelocity(vLim);
+
+    // Reference solution: the non-const solver
+    std::vector<KDL::JntArray> dqRef(nTest, KDL::JntArray(nJnt));
+    for (int i = 0; i < nTest; i++) {
+      ASSERT_GE(ikSolver.CartToJntVel(q[i], dp[i], qBias[i], biasNames, KDL::JntArray(0), dqRef[i]), 0);
+    }
+
+    // Each thread solves every problem with its own context
+    std::vector<std::vector<KDL::JntArray>> dqSoln(nThread,
+                                                   std::vector<KDL::JntArray>(nTest, KDL::JntArray(nJnt)));
+    std::vector<std::thread> threads;
+    for (int iThread = 0; iThread < nThread; iThread++) {
+      threads.push_back(std::thread([&, iThread]() {
+        for (int i = 0; i < nTest; i++) {
+          model.CartToJntVel(contexts[iThread].get(), q[i], dp[i], qBias[i], biasNames,
+                             KDL::JntArray(0), dqSoln[iThread][i]);
+        }
+      }));
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+    for (int iThread = 0; iThread < nThread; iThread++) {
+      for (int i = 0; i < nTest; i++) {
+        EXPECT_LT((dqRef[i].data - dqSoln[iThread][i].data).lpNorm<Eigen::Infinity>(), 1e-12);
+      }
+    }
+  }
+}
+
+/*************************************************************************************************/
+
+/*
+ * Velocity session: same solutions as CartToJntVel() with each combination of biases, and a
+ * lower cost per control cycle.
+ */
+TEST(sns_ik_vel, velocity_session_test)
+{
+  sns_ik::rng_util::setRngSeed(57721, 56649);
+  std::vector<std::string> jointNames;
+  KDL::Chain sawyerChain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::JntArray qLow, qUpp, vMax, aMax;
+  sns_ik::sawyer_model::getSawyerJointLimits(&qLow, &qUpp, &vMax, &aMax);
+  int nJnt = sawyerChain.getNrOfJoints();
+  std::vector<std::string> biasNames(jointNames.begin() + 1, jointNames.begin() + 4);
+  sns_ik::SNS_IK ikSolver(sawyerChain, qLow, qUpp, vMax, aMax, jointNames);
+  EXPECT_FALSE(ikSolver.createVelocitySession(std::vector<std::string>(1, "not_a_joint")));
+
+  int nTest = 200;
+  std::vector<KDL::JntArray> q(nTest), qBias(nTest), dqBias(nTest);
+  std::vector<KDL::Twist> dp(nTest);
+  for (int i = 0; i < nTest; i++) {
+    q[i] = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+    Eigen::VectorXd dpVec = sns_ik::rng_util::getRngVectorXd(0, 6, -1.0, 1.0);
+    dp[i] = KDL::Twist(KDL::Vector(dpVec(0), dpVec(1), dpVec(2)), KDL::Vector(dpVec(3), dpVec(4), dpVec(5)));
+    qBias[i].resize(biasNames.size());
+    for (size_t j = 0; j < biasNames.size(); j++) {
+      qBias[i](j) = sns_ik::rng_util::getRngDouble(0, qLow(j + 1), qUpp(j + 1));
+    }
+    dqBias[i] = KDL::JntArray(nJnt);
+    dqBias[i].data = sns_ik::rng_util::getRngVectorXd(0, nJnt, -0.5, 0.5);
+  }
+
+  KDL::JntArray noBias(0);
+  std::vector<std::string> noBiasNames;
+  KDL::JntArray dqRef(nJnt), dqSoln(nJnt);
+  for (int iStack = 0; iStack < 4; iStack++) {
+    bool useNullspaceBias = iStack & 1;
+    bool useVelocityBias = iStack & 2;
+    std::shared_ptr<sns_ik::SNS_IK::VelocityIkSession> session =
+        ikSolver.createVelocitySession(useNullspaceBias ? biasNames : noBiasNames, useVelocityBias);
+    ASSERT_TRUE(session.get() != nullptr);
+    double refTime = 0.0, sessionTime = 0.0;
+    for (int i = 0; i < nTest; i++) {
+      const KDL::JntArray& nsBias = useNullspaceBias ? qBias[i] : noBias;
+      const KDL::JntArray& velBias = useVelocityBias ? dqBias[i] : noBias;
+      ros::Time startTime = ros::Time::now();
+      ASSERT_GE(ikSolver.CartToJntVel(q[i], dp[i], nsBias, useNullspaceBias ? biasNames : noBiasNames,
+                                      velBias, dqRef), 0);
+      refTime += (ros::Time::now() - startTime).toSec();
+      startTime = ros::Time::now();
+      ASSERT_GE(session->step(q[i], dp[i], nsBias, velBias, &dqSoln), 0);
+      sessionTime += (ros::Time::now() - startTime).toSec();
+      EXPECT_LT((dqRef.data - dqSoln.data).lpNorm<Eigen::Infinity>(), 1e-12);
+    }
+    ROS_INFO("Velocity Session Test %d  -->  mean time: CartToJntVel %f us, session %f us",
+             iStack, 1e6 * refTime / nTest, 1e6 * sessionTime / nTest);
+
+    // The bias arrays must match the session
+    EXPECT_EQ(-1, session->step(q[0], dp[0], useNullspaceBias ? noBias : qBias[0],
+                                useVelocityBias ? dqBias[0] : noBias, &dqSoln));
+  }
+}
+
+/*************************************************************************************************/
+
+/*
+ * Warm start of the SNS solver: solving the same problem twice, the second solve starts from the
+ * saturated joints of the first one. It must return the solution of a cold start, in fewer SNS
+ * iterations.
+ */
+TEST(sns_ik_vel, warm_start_test)
+{
+  sns_ik::rng_util::setRngSeed(14142, 13562);
+  std::vector<std::string> jointNames;
+  KDL::Chain sawyerChain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::JntArray qLow, qUpp, vMax, aMax;
+  sns_ik::sawyer_model::getSawyerJointLimits(&qLow, &qUpp, &vMax, &aMax);
+  int nJnt = sawyerChain.getNrOfJoints();
+  sns_ik::SNS_IK ikSolver(sawyerChain, qLow, qUpp, vMax, aMax, jointNames);
+  std::shared_ptr<sns_ik::SNSVelocityIK> velSolver;
+  ASSERT_TRUE(ikSolver.getVelocitySolver(velSolver));
+
+  // Some of the twists are infeasible, so that joints saturate
+  int nTest = 100;
+  int nDiff = 0;
+  uint64_t coldIterations = 0, warmIterations = 0;
+  for (int i = 0; i < nTest; i++) {
+    KDL::JntArray q = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+    Eigen::VectorXd dpVec = sns_ik::rng_util::getRngVectorXd(0, 6, -2.0, 2.0);
+    KDL::Twist dp(KDL::Vector(dpVec(0), dpVec(1), dpVec(2)), KDL::Vector(dpVec(3), dpVec(4), dpVec(5)));
+    KDL::JntArray dqCold(nJnt), dqWarm(nJnt);
+
+    velSolver->setUseWarmStart(false);
+    velSolver->resetWarmStartStatistics();
+    ASSERT_GE(ikSolver.CartToJntVel(q, dp, dqCold), 0);
+    coldIterations += velSolver->getWarmStartStatistics().iterations;
+
+    velSolver->setUseWarmStart(true);
+    ASSERT_GE(ikSolver.CartToJntVel(q, dp, dqWarm), 0);
+    velSolver->resetWarmStartStatistics();
+    ASSERT_GE(ikSolver.CartToJntVel(q, dp, dqWarm), 0);
+    sns_ik::SNSVelocityIK::WarmStartStatistics stats = velSolver->getWarmStartStatistics();
+    warmIterations += stats.iterations;
+    if ((dqCold.data - dqWarm.data).lpNorm<Eigen::Infinity>() > 1e-9) { nDiff++; }
+  }
+  velSolver->setUseWarmStart(false);
+  ROS_INFO("Warm Start Test  -->  SNS iterations: cold %d, warm %d, different %d", int(coldIterations), int(warmIterations), nDiff);
+  EXPECT_EQ(0, nDiff);
+  EXPECT_LT(warmIterations, coldIterations);
+}
+
+/*************************************************************************************************/
+
+/*
+ * The velocity solvers use the structure of the bias tasks (selection of some joints and identity)
+ * to skip some products. Check that they return the same solution as with dense tasks.
+ */
+TEST(sns_ik_vel, structured_task_test)
+{
+  sns_ik::rng_util::setRngSeed(27182, 81828);
+  std::vector<std::string> jointNames;
+  KDL::Chain sawyerChain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::JntArray qLow, qUpp, vMax, aMax;
+  sns_ik::sawyer_model::getSawyerJointLimits(&qLow, &qUpp, &vMax, &aMax);
+  int nJnt = sawyerChain.getNrOfJoints();
+  std::vector<int> biasJoints = {1, 3, 5};
+  std::vector<sns_ik::VelocitySolveType> solverTypes = {
+      sns_ik::SNS, sns_ik::SNS_Optimal, sns_ik::SNS_OptimalScaleMargin, sns_ik::SNS_Fast,
+      sns_ik::SNS_FastOptimal, sns_ik::SNS_Base};
+  for (sns_ik::VelocitySolveType solverType : solverTypes) {
+    sns_ik::SNS_IK ikSolver(sawyerChain, qLow, qUpp, vMax, aMax, jointNames);
+    ikSolver.setVelocitySolveType(solverType);
+    std::shared_ptr<sns_ik::SNSVelocityIK> velSolver;
+    ASSERT_TRUE(ikSolver.getVelocitySolver(velSolver));
+
+    int nDiff = 0;
+    for (int i = 0; i < 50; i++) {
+      KDL::JntArray q = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+      std::vector<sns_ik::Task> sot(3);
+      sot[0].jacobian = sns_ik::rng_util::getRngMatrixXd(0, 6, nJnt, -1.0, 1.0);
+      sot[0].desired = sns_ik::rng_util::getRngVectorXd(0, 6, -2.0, 2.0);
+      sot[1].setSelection(biasJoints, nJnt);
+      sot[1].desired = sns_ik::rng_util::getRngVectorXd(0, biasJoints.size(), -1.0, 1.0);
+      sot[2].setIdentity(nJnt);
+      sot[2].desired = sns_ik::rng_util::getRngVectorXd(0, nJnt, -0.5, 0.5);
+      std::vector<sns_ik::Task> denseSot = sot;
+      for (sns_ik::Task& task : denseSot) { task.structure = sns_ik::Task::Dense; }
+
+      // The optimal solvers depend on the previous call: solve the same problem first
+      Eigen::VectorXd dqStructured, dqDense;
+      velSolver->getJointVelocity(&dqDense, denseSot, q.data);
+      velSolver->getJointVelocity(&dqStructured, sot, q.data);
+      velSolver->getJointVelocity(&dqDense, denseSot, q.data);
+      if ((dqStructured - dqDense).lpNorm<Eigen::Infinity>() > 1e-9) { nDiff++; }
+    }
+    ROS_INFO("Structured Task Test  -->  %s: different %d", sns_ik::toStr(solverType).c_str(), nDiff);
+    EXPECT_EQ(0, nDiff);
+  }
+}
+
+/*************************************************************************************************/
+
+/*
+ * Tasks and joint vectors in the memory of the caller: the task views and the Eigen overload of
+ * CartToJntVel() return the same solutions as the tasks and the KDL arrays.
+ */
+TEST(sns_ik_vel, task_view_test)
+{
+  sns_ik::rng_util::setRngSeed(16180, 33988);
+  std::vector<std::string> jointNames;
+  KDL::Chain sawyerChain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::JntArray qLow, qUpp, vMax, aMax;
+  sns_ik::sawyer_model::getSawyerJointLimits(&qLow, &qUpp, &vMax, &aMax);
+  int nJnt = sawyerChain.getNrOfJoints();
+  sns_ik::SNS_IK ikSolver(sawyerChain, qLow, qUpp, vMax, aMax, jointNames);
+  std::shared_ptr<sns_ik::SNSVelocityIK> velSolver;
+  ASSERT_TRUE(ikSolver.getVelocitySolver(velSolver));
+  std::vector<int> biasJoints = {0, 2, 4};
+  std::vector<std::string> biasNames = {jointNames[0], jointNames[2], jointNames[4]};
+
+  int nTest = 50;
+  for (int i = 0; i < nTest; i++) {
+    KDL::JntArray q = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+    Eigen::VectorXd dpVec = sns_ik::rng_util::getRngVectorXd(0, 6, -2.0, 2.0);
+    KDL::Twist dp(KDL::Vector(dpVec(0), dpVec(1), dpVec(2)), KDL::Vector(dpVec(3), dpVec(4), dpVec(5)));
+
+    // Both tasks are stored in one matrix: the views refer to its rows
+    Eigen::MatrixXd jacobians = sns_ik::rng_util::getRngMatrixXd(0, 9, nJnt, -1.0, 1.0);
+    jacobians.bottomRows(3).setZero();
+    for (int j = 0; j < 3; j++) { jacobians(6 + j, biasJoints[j]) = 1.0; }
+    Eigen::VectorXd desired = sns_ik::rng_util::getRngVectorXd(0, 9, -1.0, 1.0);
+    std::vector<sns_ik::TaskView> views;
+    views.emplace_back(jacobians.topRows(6), desired.head(6));
+    views.emplace_back(jacobians.bottomRows(3), desired.tail(3), sns_ik::Task::Selection,
+                       biasJoints.data());
+    std::vector<sns_ik::Task> sot(2);
+    sot[0].jacobian = jacobians.topRows(6);
+    sot[0].desired = desired.head(6);
+    sot[1].setSelection(biasJoints, nJnt);
+    sot[1].desired = desired.tail(3);
+    Eigen::VectorXd dqView, dqTask;
+    velSolver->getJointVelocity(&dqView, views, q.data);
+    velSolver->getJointVelocity(&dqTask, sot, q.data);
+    EXPECT_LT((dqView - dqTask).lpNorm<Eigen::Infinity>(), 1e-12);
+
+    // Joint vectors in the columns of a matrix and in a std::vector
+    KDL::JntArray qBias(3), dqBias(nJnt), dqKdl(nJnt);
+    qBias.data = desired.tail(3);
+    dqBias.data = sns_ik::rng_util::getRngVectorXd(0, nJnt, -0.5, 0.5);
+    Eigen::MatrixXd buffer(nJnt, 2);
+    buffer.col(0) = q.data;
+    std::vector<double> dqBiasBuffer(dqBias.data.data(), dqBias.data.data() + nJnt);
+    ASSERT_GE(ikSolver.CartToJntVel(q, dp, qBias, biasNames, dqBias, dqKdl), 0);
+    ASSERT_GE(ikSolver.CartToJntVel(buffer.col(0), dp, qBias.data, biasNames,
+                                    Eigen::Map<const Eigen::VectorXd>(dqBiasBuffer.data(), nJnt),
+                                    buffer.col(1)), 0);
+    EXPECT_LT((dqKdl.data - buffer.col(1)).lpNorm<Eigen::Infinity>(), 1e-12);
+  }
+
+  // The output must have one element per joint
+  Eigen::VectorXd dqShort(nJnt - 1);
+  EXPECT_EQ(-1, ikSolver.CartToJntVel(Eigen::VectorXd::Zero(nJnt), KDL::Twist::Zero(), dqShort));
+}
+
+/*************************************************************************************************/
+
+/*
+ * The SNS_Base solver with a nullspace bias of all joints runs the configuration space solve of
+ * SnsVelIkBase, whether the bias task is tagged as the identity, as a selection of all joints in
+ * order, or as a dense task.
+ */
+TEST(sns_ik_vel, base_configuration_space_task_test)
+{
+  sns_ik::rng_util::setRngSeed(57721, 56649);
+  std::vector<std::string> jointNames;
+  KDL::Chain sawyerChain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::JntArray qLow, qUpp, vMax, aMax;
+  sns_ik::sawyer_model::getSawyerJointLimits(&qLow, &qUpp, &vMax, &aMax);
+  int nJnt = sawyerChain.getNrOfJoints();
+  std::vector<int> allJoints(nJnt);
+  for (int j = 0; j < nJnt; j++) { allJoints[j] = j; }
+
+  // Without position limits, the velocity bounds are the shaped maximum velocities
+  sns_ik::SNSVelIKBaseInterface velSolver(nJnt, 0.01);
+  ASSERT_TRUE(velSolver.setJointsCapabilities(qLow.data, qUpp.data, vMax.data, aMax.data));
+  velSolver.usePositionLimits(false);
+  Eigen::ArrayXd dqUpp = sns_ik::SHAPE_MARGIN * vMax.data.array();
+  sns_ik::SnsVelIkBase::uPtr baseSolver = sns_ik::SnsVelIkBase::create(-dqUpp, dqUpp);
+  ASSERT_TRUE(baseSolver.get() != nullptr);
+
+  for (int i = 0; i < 100; i++) {
+    KDL::JntArray q = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+    std::vector<sns_ik::Task> sot(2);
+    sot[0].jacobian = sns_ik::rng_util::getRngMatrixXd(0, 6, nJnt, -1.0, 1.0);
+    sot[0].desired = sns_ik::rng_util::getRngVectorXd(0, 6, -2.0, 2.0);
+    Eigen::VectorXd dqCS = sns_ik::rng_util::getRngVectorXd(0, nJnt, -1.0, 1.0);
+    Eigen::VectorXd dqBase;
+    double taskScale, taskScaleCS;
+    ASSERT_TRUE(baseSolver->solve(sot[0].jacobian, sot[0].desired, dqCS, &dqBase, &taskScale,
+                                  &taskScaleCS) == sns_ik::SnsIkBase::ExitCode::Success);
+
+    for (sns_ik::Task::Structure structure : {sns_ik::Task::Identity, sns_ik::Task::Selection,
+                                              sns_ik::Task::Dense}) {
+      sot[1].setSelection(allJoints, nJnt);
+      sot[1].structure = structure;
+      if (structure != sns_ik::Task::Selection) { sot[1].indices.clear(); }
+      sot[1].desired = dqCS;
+      Eigen::VectorXd dq;
+      ASSERT_EQ(1.0, velSolver.getJointVelocity(&dq, sot, q.data));
+      EXPECT_LT((dq - dqBase).lpNorm<Eigen::Infinity>(), 1e-12);
+      std::vector<double> scaleFactors = velSolver.getTasksScaleFactor();
+      EXPECT_EQ(taskScale, scaleFactors[0]);
+      EXPECT_EQ(taskScaleCS, scaleFactors[1]);
+    }
+  }
+}
+
+/*************************************************************************************************/
+
+/*
+ * Benchmark of the velocity solvers on stacks of three (pose, elbow, posture) and four (position,
+ * orientation, elbow, posture) tasks. The SNS_Base solver must return a solution within the joint
+ * velocity limits that meets the primary task with its task scale. The mean solve time and the
+ * mean scale of each task are printed for each solver.
+ */
+TEST(sns_ik_vel, multi_task_benchmark)
+{
+  sns_ik::rng_util::setRngSeed(14142, 13562);
+  std::vector<std::string> jointNames;
+  KDL::Chain sawyerChain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::JntArray qLow, qUpp, vMax, aMax;
+  sns_ik::sawyer_model::getSawyerJointLimits(&qLow, &qUpp, &vMax, &aMax);
+  int nJnt = sawyerChain.getNrOfJoints();
+  int nTest = 500;
+  double tol = 1e-6;
+  std::vector<sns_ik::VelocitySolveType> solverTypes = {sns_ik::SNS, sns_ik::SNS_Fast,
+                                                        sns_ik::SNS_Base};
+  for (const std::vector<int>& taskRows : {std::vector<int>{6, 2}, std::vector<int>{3, 3, 2}}) {
+    // The same problems are solved by each solver: the last task of each stack is the posture
+    int nLevel = taskRows.size() + 1;
+    std::vector<KDL::JntArray> qTest;
+    std::vector<std::vector<sns_ik::Task>> sotTest;
+    for (int i = 0; i < nTest; i++) {
+      qTest.push_back(sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp));
+      std::vector<sns_ik::Task> sot(nLevel);
+      for (int k = 0; k < nLevel - 1; k++) {
+        sot[k].jacobian = sns_ik::rng_util::getRngMatrixXd(0, taskRows[k], nJnt, -1.0, 1.0);
+        sot[k].desired = sns_ik::rng_util::getRngVectorXd(0, taskRows[k], -2.0, 2.0);
+      }
+      sot.back().setIdentity(nJnt);
+      sot.back().desired = sns_ik::rng_util::getRngVectorXd(0, nJnt, -0.5, 0.5);
+      sotTest.push_back(sot);
+    }
+
+    for (sns_ik::VelocitySolveType solverType : solverTypes) {
+      sns_ik::SNS_IK ikSolver(sawyerChain, qLow, qUpp, vMax, aMax, jointNames);
+      ikSolver.setVelocitySolveType(solverType);
+      std::shared_ptr<sns_ik::SNSVelocityIK> velSolver;
+      ASSERT_TRUE(ikSolver.getVelocitySolver(velSolver));
+      double meanSolveTime = 0.0;
+      std::vector<double> meanTaskScale(nLevel, 0.0);
+      for (int i = 0; i < nTest; i++) {
+        Eigen::VectorXd dq;
+        ros::Time startTime = ros::Time::now();
+        velSolver->getJointVelocity(&dq, sotTest[i], qTest[i].data);
+        meanSolveTime += (ros::Time::now() - startTime).toSec();
+        std::vector<double> taskScale = velSolver->getTasksScaleFactor();
+        for (int k = 0; k < nLevel; k++) {
+          meanTaskScale[k] += std::max(0.0, taskScale[k]) / nTest;  // -1 flags a task not executed
+        }
+        if (solverType == sns_ik::SNS_Base) {
+          for (int j = 0; j < nJnt; j++) {
+            ASSERT_LE(std::abs(dq(j)), vMax(j) + tol);
+          }
+          Eigen::VectorXd taskErr = sotTest[i][0].jacobian * dq - taskScale[0] * sotTest[i][0].desired;
+          ASSERT_LT(taskErr.lpNorm<Eigen::Infinity>(), tol);
+        }
+      }
+      std::string scales;
+      for (double scale : meanTaskScale) { scales += " " + std::to_string(scale); }
+      ROS_INFO("Multi-task benchmark  -->  %s, %d tasks: mean solve time: %.4f ms, mean task scales:%s",
+               sns_ik::toStr(solverType).c_str(), nLevel, meanSolveTime * 1000.0 / nTest,
+               scales.c_str());
+    }
+  }
+}
+
+/*************************************************************************************************/
+
 // Run all the tests that were declared with TEST()
 int main(int argc, char **argv){
   ros::Time::init();
@@ -0,0 +1,197 @@
+/**  @file sns_kinematics_codegen_test.cpp
+ *
+ *  @brief Unit Test: kinematics backends generated by generateKinematicsCode()
+ *
+ *  The backends of the Sawyer model and of the mixed joint chain are generated at build time by
+ *  kinematics_codegen_models, and compiled into this test.
+ *
+ *    Copyright 2018 Rethink Robotics
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <Eigen/Dense>
+#include <kdl/chain.hpp>
+#include <memory>
+#include <ros/console.h>
+#include <ros/time.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sns_ik/sns_chain_kinematics.hpp>
+#include <sns_ik/sns_kinematics_backend.hpp>
+#include <sns_ik/sns_kinematics_codegen.hpp>
+#include "rng_utilities.hpp"
+#include "sawyer_model.hpp"
+#include "test_utilities.hpp"
+
+// Defined in the generated code
+namespace sns_ik {
+std::shared_ptr<const KinematicsBackend> createSawyerKinematics();
+std::shared_ptr<const KinematicsBackend> createMixedJointKinematics();
+}
+
+/*************************************************************************************************
+ *                               Utilities Functions                                             *
+ *************************************************************************************************/
+
+/*
+ * Check that a generated backend matches ChainKinematics
+ * @param generated: generated kinematics backend
+ * @param chain: kinematic chain
+ * @param qLow: lower bound on the joints
+ * @param qUpp: upper bound on the joints
+ */
+void checkMatchesRuntime(const sns_ik::KinematicsBackend& generated, const KDL::Chain& chain,
+                         const KDL::JntArray& qLow, const KDL::JntArray& qUpp)
+{
+  double tol = 1e-12;
+  int nTest = 100;
+  sns_ik::ChainKinematics runtime(chain);
+  int nJnt = runtime.getNrOfJoints();
+  ASSERT_EQ(nJnt, generated.getNrOfJoints());
+  for (int iTest = 0; iTest < nTest; iTest++) {
+    Eigen::VectorXd q = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp).data;
+    Eigen::VectorXd qd = sns_ik::rng_util::getRngVectorXd(0, nJnt, -2.0, 2.0);
+    KDL::Frame poseRuntime, pose, poseOnly;
+    Eigen::MatrixXd jacRuntime, jac;
+    Eigen::VectorXd jdotQdotRuntime, jdotQdot;
+    runtime.computePoseAndJacobian(q, &poseRuntime, &jacRuntime);
+    runtime.computeJacobianDotQdot(q, qd, &jdotQdotRuntime);
+    generated.computePoseAndJacobian(q, &pose, &jac);
+    generated.computePose(q, &poseOnly);
+    generated.computeJacobianDotQdot(q, qd, &jdotQdot);
+    ASSERT_TRUE(KDL::Equal(poseRuntime, pose, tol));
+    ASSERT_TRUE(KDL::Equal(poseRuntime, poseOnly, tol));
+    ASSERT_EQ(6, jac.rows());
+    ASSERT_EQ(nJnt, jac.cols());
+    ASSERT_LT((jac - jacRuntime).lpNorm<Eigen::Infinity>(), tol);
+    ASSERT_EQ(6, jdotQdot.size());
+    ASSERT_LT((jdotQdot - jdotQdotRuntime).lpNorm<Eigen::Infinity>(), 1e3 * tol);
+  }
+}
+
+/*************************************************************************************************
+ *                                        Tests                                                  *
+ *************************************************************************************************/
+
+TEST(sns_kinematics_codegen, chain_hash)
+{
+  std::vector<std::string> jointNames;
+  KDL::Chain chain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::Chain copy = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  EXPECT_EQ(sns_ik::computeChainHash(chain), sns_ik::computeChainHash(copy));
+  copy.addSegment(KDL::Segment(KDL::Joint(KDL::Joint::None), KDL::Frame(KDL::Vector(0.0, 0.0, 0.1))));
+  EXPECT_NE(sns_ik::computeChainHash(chain), sns_ik::computeChainHash(copy));
+}
+
+TEST(sns_kinematics_codegen, registry_selects_generated_backend)
+{
+  // The generated backends were registered during static initialization
+  std::vector<std::string> jointNames;
+  KDL::Chain chain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  std::shared_ptr<const sns_ik::KinematicsBackend> backend = sns_ik::createKinematicsBackend(chain);
+  ASSERT_TRUE(backend != nullptr);
+  EXPECT_TRUE(dynamic_cast<const sns_ik::ChainKinematics*>(backend.get()) == nullptr);
+  EXPECT_FALSE(sns_ik::registerKinematicsBackend(sns_ik::computeChainHash(chain),
+                                                 sns_ik::createSawyerKinematics));
+
+  // Any other chain uses the runtime kinematics
+  chain.addSegment(KDL::Segment(KDL::Joint(KDL::Joint::None), KDL::Frame(KDL::Vector(0.0, 0.0, 0.1))));
+  backend = sns_ik::createKinematicsBackend(chain);
+  ASSERT_TRUE(backend != nullptr);
+  EXPECT_TRUE(dynamic_cast<const sns_ik::ChainKinematics*>(backend.get()) != nullptr);
+}
+
+TEST(sns_kinematics_codegen, sawyer_matches_runtime)
+{
+  sns_ik::rng_util::setRngSeed(22360, 67977);
+  std::vector<std::string> jointNames;
+  KDL::Chain chain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::JntArray qLow, qUpp, vMax, aMax;
+  sns_ik::sawyer_model::getSawyerJointLimits(&qLow, &qUpp, &vMax, &aMax);
+  checkMatchesRuntime(*sns_ik::createSawyerKinematics(), chain, qLow, qUpp);
+}
+
+TEST(sns_kinematics_codegen, mixed_joints_match_runtime)
+{
+  sns_ik::rng_util::setRngSeed(26457, 51311);
+  KDL::JntArray qLow, qUpp;
+  KDL::Chain chain = sns_ik::test_util::getMixedJointChain(&qLow, &qUpp);
+  checkMatchesRuntime(*sns_ik::createMixedJointKinematics(), chain, qLow, qUpp);
+}
+
+TEST(sns_kinematics_codegen, generated_code_is_deterministic)
+{
+  std::vector<std::string> jointNames;
+  KDL::Chain chain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  std::ostringstream first, second;
+  sns_ik::generateKinematicsCode(chain, "SawyerKinematics", &first);
+  sns_ik::generateKinematicsCode(chain, "SawyerKinematics", &second);
+  EXPECT_EQ(first.str(), second.str());
+  EXPECT_NE(std::string::npos, first.str().find("class SawyerKinematics : public KinematicsBackend"));
+}
+
+/*************************************************************************************************/
+
+/*
+ * Benchmark: the generated Sawyer kinematics against ChainKinematics
+ */
+TEST(sns_kinematics_codegen, benchmark_against_runtime)
+{
+  sns_ik::rng_util::setRngSeed(31622, 77660);
+  std::vector<std::string> jointNames;
+  KDL::Chain chain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::JntArray qLow, qUpp, vMax, aMax;
+  sns_ik::sawyer_model::getSawyerJointLimits(&qLow, &qUpp, &vMax, &aMax);
+  int nJnt = chain.getNrOfJoints();
+  int nTest = 20000;
+  std::vector<Eigen::VectorXd> qList(nTest);
+  for (Eigen::VectorXd& q : qList) {
+    q = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp).data;
+  }
+
+  sns_ik::ChainKinematics runtime(chain);
+  std::shared_ptr<const sns_ik::KinematicsBackend> generated = sns_ik::createSawyerKinematics();
+  KDL::Frame pose;
+  Eigen::MatrixXd jac(6, nJnt);
+  double checkSum = 0.0;  // prevents the compiler from removing the calls
+  ros::Time startTime = ros::Time::now();
+  for (const Eigen::VectorXd& q : qList) {
+    runtime.computePoseAndJacobian(q, &pose, &jac);
+    checkSum += pose.p.x() + jac(0, 0);
+  }
+  double runtimeTime = (ros::Time::now() - startTime).toSec();
+
+  startTime = ros::Time::now();
+  for (const Eigen::VectorXd& q : qList) {
+    generated->computePoseAndJacobian(q, &pose, &jac);
+    checkSum -= pose.p.x() + jac(0, 0);
+  }
+  double generatedTime = (ros::Time::now() - startTime).toSec();
+
+  EXPECT_LT(std::abs(checkSum), 1e-6);
+  ROS_INFO("Codegen Benchmark  -->  runtime: %f us,  generated: %f us,  speed-up: %f",
+           1e6 * runtimeTime / nTest, 1e6 * generatedTime / nTest, runtimeTime / generatedTime);
+}
+
+/*************************************************************************************************/
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv){
+  ros::Time::init();
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
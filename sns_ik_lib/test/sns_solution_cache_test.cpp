@@ -0,0 +1,248 @@
+/**  @file sns_solution_cache_test.cpp
+ *
+ *  @brief Unit Test: SolutionCache, and warm starts of the position solver from the cache
+ *
+ *    Copyright 2018 Rethink Robotics
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <Eigen/Dense>
+#include <kdl/chainfksolverpos_recursive.hpp>
+#include <memory>
+#include <ros/console.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sns_ik/sns_ik.hpp>
+#include <sns_ik/sns_solution_cache.hpp>
+#include "rng_utilities.hpp"
+#include "sawyer_model.hpp"
+
+/*************************************************************************************************
+ *                               Utilities Functions                                             *
+ *************************************************************************************************/
+
+/*
+ * @return: joint array with all joints equal to value
+ */
+KDL::JntArray getConstantJoints(int nJnt, double value)
+{
+  KDL::JntArray q(nJnt);
+  q.data.setConstant(value);
+  return q;
+}
+
+/*************************************************************************************************
+ *                                        Tests                                                  *
+ *************************************************************************************************/
+
+TEST(sns_solution_cache, lookup_nearest_test)
+{
+  sns_ik::SolutionCache cache(100, 0.01, 0.05);
+  KDL::JntArray q(3);
+  KDL::Frame poseA(KDL::Rotation::RPY(0.1, 0.2, 0.3), KDL::Vector(0.5, 0.2, 0.3));
+  KDL::Frame poseB(KDL::Rotation::RPY(0.1, 0.2, 0.3), KDL::Vector(0.5, 0.2, 0.315));
+  EXPECT_FALSE(cache.lookup(poseA, &q));
+
+  cache.insert(poseA, getConstantJoints(3, 1.0));
+  cache.insert(poseB, getConstantJoints(3, 2.0));
+  EXPECT_EQ(2u, cache.size());
+
+  // Nearest pose, including across a cell boundary
+  KDL::Frame goal(KDL::Rotation::RPY(0.1, 0.2, 0.31), KDL::Vector(0.5, 0.2, 0.302));
+  ASSERT_TRUE(cache.lookup(goal, &q));
+  EXPECT_EQ(1.0, q(0));
+  goal.p = KDL::Vector(0.5, 0.2, 0.3099);
+  ASSERT_TRUE(cache.lookup(goal, &q));
+  EXPECT_EQ(2.0, q(0));
+
+  // Too far in position or in angle
+  goal.p = KDL::Vector(0.5, 0.2, 0.28);
+  EXPECT_FALSE(cache.lookup(goal, &q));
+  goal = KDL::Frame(KDL::Rotation::RPY(0.1, 0.2, 0.4), poseA.p);
+  EXPECT_FALSE(cache.lookup(goal, &q));
+
+  sns_ik::SolutionCache::Statistics stats = cache.getStatistics();
+  EXPECT_EQ(5u, stats.lookups);
+  EXPECT_EQ(2u, stats.hits);
+  EXPECT_EQ(2u, stats.insertions);
+  EXPECT_NEAR(0.4, stats.hitRate, 1e-12);
+}
+
+TEST(sns_solution_cache, replace_nearby_test)
+{
+  sns_ik::SolutionCache cache(100, 0.01, 0.05);
+  KDL::Frame pose(KDL::Rotation::RPY(0.1, 0.2, 0.3), KDL::Vector(0.5, 0.2, 0.3));
+  cache.insert(pose, getConstantJoints(3, 1.0));
+  pose.p += KDL::Vector(0.0, 0.001, 0.0);
+  cache.insert(pose, getConstantJoints(3, 2.0));
+  EXPECT_EQ(1u, cache.size());
+  KDL::JntArray q;
+  ASSERT_TRUE(cache.lookup(pose, &q));
+  EXPECT_EQ(2.0, q(0));
+}
+
+TEST(sns_solution_cache, invalid_input_test)
+{
+  // Distances that are not positive are replaced by the defaults
+  sns_ik::SolutionCache cache(100, 0.0, -1.0);
+  EXPECT_EQ(0.01, cache.getMaxPositionDistance());
+  EXPECT_EQ(0.05, cache.getMaxAngleDistance());
+
+  // Poses far away from the origin, beyond the range of the grid cell indices
+  KDL::JntArray q;
+  for (double x : {1e12, -1e12, 1e300, -1e300}) {
+    KDL::Frame pose(KDL::Vector(x, 0.2, 0.3));
+    cache.insert(pose, getConstantJoints(3, x));
+    ASSERT_TRUE(cache.lookup(pose, &q));
+    EXPECT_EQ(x, q(0));
+  }
+  EXPECT_FALSE(cache.lookup(KDL::Frame(KDL::Vector(0.5, 0.2, 0.3)), &q));
+}
+
+TEST(sns_solution_cache, bounded_size_test)
+{
+  int nInsert = 1000;
+  sns_ik::SolutionCache cache(64, 0.01, 0.05);
+  for (int i = 0; i < nInsert; i++) {
+    KDL::Frame pose(KDL::Vector(0.05 * (i % 10), 0.05 * ((i / 10) % 10), 0.05 * (i / 100)));
+    cache.insert(pose, getConstantJoints(3, i));
+  }
+  EXPECT_LE(cache.size(), cache.getCapacity());
+  sns_ik::SolutionCache::Statistics stats = cache.getStatistics();
+  EXPECT_EQ(uint64_t(nInsert), stats.insertions);
+  EXPECT_EQ(stats.insertions - cache.size(), stats.evictions);
+
+  // The most recent solution is still in the cache
+  KDL::JntArray q;
+  ASSERT_TRUE(cache.lookup(KDL::Frame(KDL::Vector(0.45, 0.45, 0.45)), &q));
+  EXPECT_EQ(nInsert - 1, q(0));
+
+  cache.clear();
+  EXPECT_EQ(0u, cache.size());
+  EXPECT_EQ(0u, cache.getStatistics().lookups);
+}
+
+/*
+ * Readers and writers on several threads. Each thread inserts solutions that encode their pose,
+ * so that a lookup can check that it did not get a torn entry.
+ */
+TEST(sns_solution_cache, concurrent_test)
+{
+  int nThread = 4;
+  int nOperation = 5000;
+  sns_ik::SolutionCache cache(256, 0.01, 0.05);
+  sns_ik::rng_util::setRngSeed(13579, 24680);  // the generator is not thread-safe: draw up front
+  std::vector<std::vector<KDL::Vector>> positions(nThread);
+  for (std::vector<KDL::Vector>& list : positions) {
+    for (int i = 0; i < nOperation; i++) {
+      Eigen::VectorXd p = sns_ik::rng_util::getRngVectorXd(0, 3, 0.0, 0.2);
+      list.push_back(KDL::Vector(p(0), p(1), p(2)));
+    }
+  }
+  auto worker = [&](int iThread) {
+    KDL::JntArray q(3);
+    for (int i = 0; i < nOperation; i++) {
+      const KDL::Vector& position = positions[iThread][i];
+      KDL::Frame pose(position);
+      if (i % 3 == 0) {
+        q(0) = position.x();
+        q(1) = position.y();
+        q(2) = position.z();
+        cache.insert(pose, q);
+      } else if (cache.lookup(pose, &q)) {
+        EXPECT_LE((KDL::Vector(q(0), q(1), q(2)) - position).Norm(), 0.01 + 1e-12);
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int i = 0; i < nThread; i++) {
+    threads.push_back(std::thread(worker, i));
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  sns_ik::SolutionCache::Statistics stats = cache.getStatistics();
+  EXPECT_EQ(uint64_t(nThread * (nOperation - (nOperation + 2) / 3)), stats.lookups);
+  EXPECT_GT(stats.hits, 0u);
+  EXPECT_LE(cache.size(), cache.getCapacity());
+}
+
+/*************************************************************************************************/
+
+/*
+ * Solve a set of goals, then goals that are close to them, from seeds that are far from the
+ * solution. The second pass should be seeded from the cache and need fewer iterations.
+ */
+TEST(sns_solution_cache, position_ik_warm_start_test)
+{
+  int nGoal = 40;
+  sns_ik::rng_util::setRngSeed(76543, 21098);
+  std::vector<std::string> jointNames;
+  KDL::Chain sawyerChain = sns_ik::sawyer_model::getSawyerKdlChain(&jointNames);
+  KDL::JntArray qLow, qUpp, vMax, aMax;
+  sns_ik::sawyer_model::getSawyerJointLimits(&qLow, &qUpp, &vMax, &aMax);
+  KDL::ChainFkSolverPos_recursive fwdKin(sawyerChain);
+  sns_ik::SNS_IK ikSolver(sawyerChain, qLow, qUpp, vMax, aMax, jointNames);
+  std::shared_ptr<sns_ik::SolutionCache> cache = std::make_shared<sns_ik::SolutionCache>();
+  ikSolver.setSolutionCache(cache);
+  ASSERT_EQ(cache, ikSolver.getSolutionCache());
+
+  std::vector<KDL::Frame> goals;
+  std::vector<KDL::JntArray> seeds;
+  for (int i = 0; i < nGoal; i++) {
+    KDL::JntArray qGoal = sns_ik::rng_util::getRngBoundedJoints(0, qLow, qUpp);
+    KDL::Frame goal;
+    fwdKin.JntToCart(qGoal, goal);
+    goals.push_back(goal);
+    seeds.push_back(sns_ik::rng_util::getNearbyJoints(0, qGoal, 0.6, qLow, qUpp));
+  }
+
+  int nSolvedFirst = 0;
+  for (int i = 0; i < nGoal; i++) {
+    KDL::JntArray q;
+    if (ikSolver.CartToJnt(seeds[i], goals[i], q) >= 0) {
+      nSolvedFirst++;
+    }
+  }
+  sns_ik::SolutionCache::Statistics stats = cache->getStatistics();
+  EXPECT_EQ(0u, stats.hits);
+  EXPECT_EQ(uint64_t(nSolvedFirst), stats.insertions);
+
+  int nSolvedSecond = 0;
+  for (int i = 0; i < nGoal; i++) {
+    KDL::Frame goal = goals[i];
+    goal.p += KDL::Vector(0.002, -0.001, 0.001);
+    KDL::JntArray q;
+    if (ikSolver.CartToJnt(seeds[i], goal, q) >= 0) {
+      nSolvedSecond++;
+    }
+  }
+  stats = cache->getStatistics();
+  EXPECT_EQ(uint64_t(nSolvedFirst), stats.hits);
+  EXPECT_GE(nSolvedSecond, nSolvedFirst);
+  EXPECT_GT(stats.iterationsSaved, 0.0);
+  ROS_INFO("Solution cache: solved %d then %d of %d goals, hit rate: %f, iterations saved: %f",
+           nSolvedFirst, nSolvedSecond, nGoal, stats.hitRate, stats.iterationsSaved);
+}
+
+/*************************************************************************************************/
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv){
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
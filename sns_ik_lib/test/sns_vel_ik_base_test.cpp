@@ -20,8 +20,10 @@
 
 #include <gtest/gtest.h>
 
+#include <cmath>
 #include <Eigen/Dense>
 #include <ros/console.h>
+#include <vector>
 
 #include <sns_ik/sns_vel_ik_base.hpp>
 #include <sns_ik/sns_ik_base.hpp>
@@ -194,6 +196,230 @@ TEST(sns_vel_ik_base, basic_with_secondary_goal)
            nPass, nFail, nSubOpt, meanSolveTime*1000.0, meanTaskScaleCS);
 }
 
+/*************************************************************************************************/
+
+/*
+ * This test compares the fixed-size kernels (six-dimensional task on a 6, 7, or 8 joint robot)
+ * against the dynamic kernel. Both solvers must return the same solution. The mean solve time of
+ * each kernel is printed, so that this test also serves as a benchmark.
+ */
+TEST(sns_vel_ik_base, fixed_size_kernel)
+{
+  sns_ik::rng_util::setRngSeed(34862, 90177);  // set the initial seed for the random number generators
+  int nTest = 5000;
+  double tol = 1e-8;
+  int nTask = 6;
+  for (int nJoint = 6; nJoint <= 8; nJoint++) {
+    Eigen::ArrayXd dqInf = 1e10 * Eigen::ArrayXd::Ones(nJoint);
+    sns_ik::SnsVelIkBase::uPtr fixedSolver = sns_ik::SnsVelIkBase::create(-dqInf, dqInf, true);
+    sns_ik::SnsVelIkBase::uPtr dynamicSolver = sns_ik::SnsVelIkBase::create(-dqInf, dqInf, false);
+    ASSERT_TRUE(fixedSolver.get() != nullptr);
+    ASSERT_TRUE(dynamicSolver.get() != nullptr);
+    double fixedSolveTime = 0.0;
+    double dynamicSolveTime = 0.0;
+    for (int iTest = 0; iTest < nTest; iTest++) {
+      // generate a test problem
+      Eigen::MatrixXd J = sns_ik::rng_util::getRngMatrixXd(0, nTask, nJoint, -2.0, 2.0);
+      Eigen::ArrayXd dqLow = sns_ik::rng_util::getRngVectorXd(0, nJoint, -5.0, -0.5);
+      Eigen::ArrayXd dqUpp = sns_ik::rng_util::getRngVectorXd(0, nJoint, 0.5, 5.0);
+      Eigen::VectorXd dqTest = sns_ik::rng_util::getRngArrBndXd(0, dqLow, dqUpp).matrix();
+      double taskScaleMin = std::min(1.0, sns_ik::rng_util::getRngDouble(0, 0.2, 1.2));
+      Eigen::VectorXd dx = J * dqTest / taskScaleMin;
+      ASSERT_TRUE(fixedSolver->setBounds(dqLow, dqUpp));
+      ASSERT_TRUE(dynamicSolver->setBounds(dqLow, dqUpp));
+
+      // solve with both kernels
+      Eigen::VectorXd dqFixed, dqDynamic;
+      double taskScaleFixed, taskScaleDynamic;
+      ros::Time startTime = ros::Time::now();
+      sns_ik::SnsIkBase::ExitCode fixedExit = fixedSolver->solve(J, dx, &dqFixed, &taskScaleFixed);
+      fixedSolveTime += (ros::Time::now() - startTime).toSec();
+      startTime = ros::Time::now();
+      sns_ik::SnsIkBase::ExitCode dynamicExit = dynamicSolver->solve(J, dx, &dqDynamic, &taskScaleDynamic);
+      dynamicSolveTime += (ros::Time::now() - startTime).toSec();
+
+      // check that the solutions match
+      ASSERT_TRUE(fixedExit == dynamicExit);
+      if (fixedExit == sns_ik::SnsIkBase::ExitCode::Success) {
+        ASSERT_NEAR(taskScaleFixed, taskScaleDynamic, tol);
+        sns_ik::test_util::checkEqualVector(dqFixed, dqDynamic, tol);
+      }
+    }
+    ROS_INFO("nTask: %d  --  nJoint: %d  --  Mean solve time: fixed: %.4f ms, dynamic: %.4f ms",
+             nTask, nJoint, 1000.0 * fixedSolveTime / nTest, 1000.0 * dynamicSolveTime / nTest);
+  }
+}
+
+/*************************************************************************************************/
+
+/*
+ * This test solves a slowly changing sequence of problems, as in a control loop, with and without
+ * the warm start. Both solvers must return valid solutions, and the warm start must not reduce the
+ * task scale. The mean number of iterations of the main loop per solve is printed for both solvers,
+ * so that this test also serves as a benchmark, and the warm start must reduce it.
+ */
+TEST(sns_vel_ik_base, warm_start)
+{
+  sns_ik::rng_util::setRngSeed(48203, 61190);  // set the initial seed for the random number generators
+  int nStep = 2000;
+  double dt = 0.005;
+  double tol = 1e-8;
+  for (int nTask : {6, 3}) {  // the 6 x 7 problem runs on the fixed-size kernel
+    int nJoint = 7;
+    Eigen::ArrayXd dqLow = sns_ik::rng_util::getRngVectorXd(0, nJoint, -1.0, -0.3);
+    Eigen::ArrayXd dqUpp = sns_ik::rng_util::getRngVectorXd(0, nJoint, 0.3, 1.0);
+    Eigen::MatrixXd J0 = sns_ik::rng_util::getRngMatrixXd(0, nTask, nJoint, -2.0, 2.0);
+    Eigen::MatrixXd J1 = sns_ik::rng_util::getRngMatrixXd(0, nTask, nJoint, -0.5, 0.5);
+    Eigen::VectorXd dx0 = sns_ik::rng_util::getRngVectorXd(0, nTask, -1.0, 1.0);
+    Eigen::VectorXd dx1 = sns_ik::rng_util::getRngVectorXd(0, nTask, -1.0, 1.0);
+    sns_ik::SnsVelIkBase::uPtr coldSolver = sns_ik::SnsVelIkBase::create(dqLow, dqUpp);
+    sns_ik::SnsVelIkBase::uPtr warmSolver = sns_ik::SnsVelIkBase::create(dqLow, dqUpp);
+    ASSERT_TRUE(coldSolver.get() != nullptr);
+    ASSERT_TRUE(warmSolver.get() != nullptr);
+    EXPECT_FALSE(warmSolver->getUseWarmStart());
+    warmSolver->setUseWarmStart(true);
+    int nScaled = 0;
+    for (int iStep = 0; iStep < nStep; iStep++) {
+      // a smooth trajectory of the jacobian and of the task velocity
+      double t = iStep * dt;
+      Eigen::MatrixXd J = J0 + std::sin(0.7 * t) * J1;
+      Eigen::VectorXd dx = std::cos(0.5 * t) * dx0 + std::sin(1.1 * t) * dx1;
+
+      Eigen::VectorXd dqCold, dqWarm;
+      double taskScaleCold, taskScaleWarm;
+      ASSERT_TRUE(coldSolver->solve(J, dx, &dqCold, &taskScaleCold) ==
+                  sns_ik::SnsIkBase::ExitCode::Success);
+      ASSERT_TRUE(warmSolver->solve(J, dx, &dqWarm, &taskScaleWarm) ==
+                  sns_ik::SnsIkBase::ExitCode::Success);
+      ASSERT_GE(taskScaleWarm, taskScaleCold - tol);
+      sns_ik::test_util::checkEqualVector(taskScaleWarm * dx, J * dqWarm, tol);
+      sns_ik::test_util::checkVectorLimits(dqLow, dqWarm, dqUpp, tol);
+      if (taskScaleWarm < 1.0) nScaled++;
+    }
+    const sns_ik::SnsIkBase::IterationStatistics& coldStats = coldSolver->getIterationStatistics();
+    const sns_ik::SnsIkBase::IterationStatistics& warmStats = warmSolver->getIterationStatistics();
+    EXPECT_EQ(coldStats.solves, uint64_t(nStep));
+    EXPECT_EQ(coldStats.warmStarts, 0u);
+    EXPECT_EQ(warmStats.solves, uint64_t(nStep));
+    EXPECT_GT(warmStats.warmStarts, 0u);
+    EXPECT_LT(warmStats.averageIterations(), coldStats.averageIterations());
+    ROS_INFO("nTask: %d  --  nJoint: %d  --  scaled: %d / %d  --  Mean iterations: warm: %.3f, cold: %.3f",
+             nTask, nJoint, nScaled, nStep, warmStats.averageIterations(),
+             coldStats.averageIterations());
+
+    // after a reset of the active set and of the counters, the next solve starts cold
+    warmSolver->resetWarmStart();
+    warmSolver->resetIterationStatistics();
+    Eigen::VectorXd dq;
+    double taskScale;
+    ASSERT_TRUE(warmSolver->solve(J0, dx0, &dq, &taskScale) == sns_ik::SnsIkBase::ExitCode::Success);
+    EXPECT_EQ(warmSolver->getIterationStatistics().solves, 1u);
+    EXPECT_EQ(warmSolver->getIterationStatistics().warmStarts, 0u);
+  }
+}
+
+/*************************************************************************************************/
+
+/*
+ * This test is for the SnsVelIkBase::solve() with a stack of tasks. Without joint limits, a stack
+ * of tasks with fewer rows than joints must be solved exactly. With joint limits, the solution must
+ * be within the limits, the primary task must be met with its task scale, and the lower priority
+ * tasks must not change the velocity of the higher priority tasks that are executed: the solution
+ * of the first levels of the stack is compared against the solution of the full stack.
+ */
+TEST(sns_vel_ik_base, multi_task)
+{
+  sns_ik::rng_util::setRngSeed(90210, 31415);  // set the initial seed for the random number generators
+  int nTest = 1000;
+  double tol = 1e-8;
+  for (int iTest = 0; iTest < nTest; iTest++) {
+    int nLevel = sns_ik::rng_util::getRngInt(0, 2, 4);
+    int nJoint = sns_ik::rng_util::getRngInt(0, 2 * nLevel, 2 * nLevel + 4);
+    std::vector<Eigen::MatrixXd> J(nLevel);
+    std::vector<Eigen::VectorXd> dx(nLevel);
+    int nRow = 0;
+    for (int i = 0; i < nLevel; i++) {
+      int nTask = sns_ik::rng_util::getRngInt(0, 1, (nJoint - nRow) - 2 * (nLevel - i - 1));
+      nRow += nTask;
+      J[i] = sns_ik::rng_util::getRngMatrixXd(0, nTask, nJoint, -1.0, 1.0);
+      dx[i] = sns_ik::rng_util::getRngVectorXd(0, nTask, -1.0, 1.0);
+    }
+    Eigen::VectorXd dq;
+    std::vector<double> taskScale;
+    sns_ik::SnsVelIkBase::uPtr ikSolver = sns_ik::SnsVelIkBase::create(nJoint);
+    ASSERT_TRUE(ikSolver.get() != nullptr);
+    ASSERT_TRUE(ikSolver->solve(J, dx, &dq, &taskScale) == sns_ik::SnsIkBase::ExitCode::Success);
+    ASSERT_EQ(taskScale.size(), size_t(nLevel));
+    for (int i = 0; i < nLevel; i++) {
+      ASSERT_NEAR(taskScale[i], 1.0, tol);
+      sns_ik::test_util::checkEqualVector(dx[i], J[i] * dq, tol);
+    }
+  }
+
+  int nPass = 0;
+  int nNotExecuted = 0;
+  double meanSolveTime = 0.0;
+  for (int iTest = 0; iTest < nTest; iTest++) {
+    // generate a stack of tasks: the lower priority tasks may have more rows than joints
+    int nLevel = sns_ik::rng_util::getRngInt(0, 2, 4);
+    int nJoint = sns_ik::rng_util::getRngInt(0, 5, 9);
+    Eigen::ArrayXd dqLow = sns_ik::rng_util::getRngVectorXd(0, nJoint, -1.5, -0.5);
+    Eigen::ArrayXd dqUpp = sns_ik::rng_util::getRngVectorXd(0, nJoint, 0.5, 1.5);
+    std::vector<Eigen::MatrixXd> J(nLevel);
+    std::vector<Eigen::VectorXd> dx(nLevel);
+    for (int i = 0; i < nLevel; i++) {
+      int nTask = sns_ik::rng_util::getRngInt(0, 1, i == 0 ? nJoint - 1 : nJoint);
+      J[i] = sns_ik::rng_util::getRngMatrixXd(0, nTask, nJoint, -2.0, 2.0);
+      dx[i] = sns_ik::rng_util::getRngVectorXd(0, nTask, -2.0, 2.0);
+    }
+
+    // solve the full stack
+    Eigen::VectorXd dq;
+    std::vector<double> taskScale;
+    sns_ik::SnsVelIkBase::uPtr ikSolver = sns_ik::SnsVelIkBase::create(dqLow, dqUpp);
+    ASSERT_TRUE(ikSolver.get() != nullptr);
+    ros::Time startTime = ros::Time::now();
+    ASSERT_TRUE(ikSolver->solve(J, dx, &dq, &taskScale) == sns_ik::SnsIkBase::ExitCode::Success);
+    meanSolveTime += (ros::Time::now() - startTime).toSec();
+    nPass++;
+    sns_ik::test_util::checkVectorLimits(dqLow, dq, dqUpp, tol);
+    sns_ik::test_util::checkEqualVector(taskScale[0] * dx[0], J[0] * dq, tol);
+    for (int i = 0; i < nLevel; i++) {
+      ASSERT_GE(taskScale[i], 0.0);
+      ASSERT_LE(taskScale[i], 1.0 + tol);
+      if (taskScale[i] == 0.0) nNotExecuted++;
+    }
+
+    // the lower priority tasks do not change the solution of the higher priority tasks
+    for (int nSub = 1; nSub < nLevel; nSub++) {
+      std::vector<Eigen::MatrixXd> Jsub(J.begin(), J.begin() + nSub);
+      std::vector<Eigen::VectorXd> dxSub(dx.begin(), dx.begin() + nSub);
+      Eigen::VectorXd dqSub;
+      std::vector<double> taskScaleSub;
+      ASSERT_TRUE(ikSolver->solve(Jsub, dxSub, &dqSub, &taskScaleSub) ==
+                  sns_ik::SnsIkBase::ExitCode::Success);
+      for (int i = 0; i < nSub; i++) {
+        ASSERT_NEAR(taskScaleSub[i], taskScale[i], tol);
+        if (taskScale[i] > 0.0) {  // a task that is not executed has no null space
+          sns_ik::test_util::checkEqualVector(J[i] * dqSub, J[i] * dq, 1e-6);
+        }
+      }
+    }
+  }
+  meanSolveTime /= static_cast<double>(nPass);
+  ROS_INFO("Pass: %d  --  Lower priority tasks not executed: %d  --  Mean solve time: %.4f ms",
+           nPass, nNotExecuted, meanSolveTime*1000.0);
+
+  // invalid stacks of tasks
+  sns_ik::SnsVelIkBase::uPtr ikSolver = sns_ik::SnsVelIkBase::create(4);
+  Eigen::VectorXd dq;
+  std::vector<double> taskScale;
+  std::vector<Eigen::MatrixXd> J = {Eigen::MatrixXd::Ones(2, 4), Eigen::MatrixXd::Ones(1, 3)};
+  std::vector<Eigen::VectorXd> dx = {Eigen::VectorXd::Ones(2), Eigen::VectorXd::Ones(1)};
+  EXPECT_TRUE(ikSolver->solve(J, dx, &dq, &taskScale) == sns_ik::SnsIkBase::ExitCode::BadUserInput);
+  dx.pop_back();
+  EXPECT_TRUE(ikSolver->solve(J, dx, &dq, &taskScale) == sns_ik::SnsIkBase::ExitCode::BadUserInput);
+}
 
 /*************************************************************************************************/
 
@@ -17,6 +17,8 @@
 #include <gtest/gtest.h>
 
 #include <Eigen/Dense>
+#include <kdl/chain.hpp>
+#include <kdl/jntarray.hpp>
 #include <ros/console.h>
 
 #include "test_utilities.hpp"
@@ -50,5 +52,33 @@ void checkVectorLimits(const Eigen::VectorXd& low, const Eigen::VectorXd& val, c
 
 /*************************************************************************************************/
 
+KDL::Chain getMixedJointChain(KDL::JntArray* qLow, KDL::JntArray* qUpp)
+{
+  using KDL::Frame;
+  using KDL::Joint;
+  using KDL::Rotation;
+  using KDL::Segment;
+  using KDL::Vector;
+  KDL::Chain chain;
+  chain.addSegment(Segment(Joint(Joint::None), Frame(Rotation::RPY(0.1, 0.2, 0.3), Vector(0.1, 0.0, 0.2))));
+  chain.addSegment(Segment(Joint(Joint::RotX, 1.5, 0.2), Frame(Rotation::RPY(0.5, -0.3, 0.0), Vector(0.0, 0.3, 0.1))));
+  chain.addSegment(Segment(Joint(Joint::TransZ, -0.5, 0.1), Frame(Rotation::RPY(0.0, 0.4, 1.0), Vector(0.2, 0.0, 0.0))));
+  chain.addSegment(Segment(Joint(Joint::None), Frame(Rotation::RPY(-0.7, 0.0, 0.2), Vector(0.0, 0.0, 0.15))));
+  chain.addSegment(Segment(Joint(Joint::RotY), Frame(Rotation::RPY(0.3, 0.3, 0.3), Vector(0.1, -0.2, 0.3))));
+  chain.addSegment(Segment(Joint(Joint::RotZ, 1.0, -0.3), Frame(Rotation::RPY(0.0, -1.2, 0.0), Vector(0.0, 0.1, 0.0))));
+  chain.addSegment(Segment(Joint(Joint::TransX, 2.0), Frame(Rotation::RPY(0.0, 0.0, 0.6), Vector(0.05, 0.0, 0.0))));
+  chain.addSegment(Segment(Joint(Joint::None), Frame(Rotation::RPY(0.2, 0.0, 0.0), Vector(0.0, 0.0, 0.1))));
+  int nJnt = chain.getNrOfJoints();
+  qLow->resize(nJnt);
+  qUpp->resize(nJnt);
+  for (int i = 0; i < nJnt; i++) {
+    (*qLow)(i) = -3.0;
+    (*qUpp)(i) = 3.0;
+  }
+  return chain;
+}
+
+/*************************************************************************************************/
+
 } // namespace test_util
 } // namespace sns_ik
\ No newline at end of file
@@ -29,6 +29,8 @@
 #define SNS_IK_LIB_TEST_UTILITIES_H
 
 #include <Eigen/Dense>
+#include <kdl/chain.hpp>
+#include <kdl/jntarray.hpp>
 
 namespace sns_ik {
 namespace test_util {
@@ -43,6 +45,14 @@ void checkEqualVector(const Eigen::VectorXd& A, const Eigen::VectorXd& B, double
  */
 void checkVectorLimits(const Eigen::VectorXd& low, const Eigen::VectorXd& val, const Eigen::VectorXd& upp, double tol);
 
+/**
+ * A chain with fixed segments, translational joints, and joints with a scale and an offset.
+ * @param[out] qLow: lower bound on the joints (for generating test configurations)
+ * @param[out] qUpp: upper bound on the joints (for generating test configurations)
+ * @return: kinematic chain
+ */
+KDL::Chain getMixedJointChain(KDL::JntArray* qLow, KDL::JntArray* qUpp);
+
 }  // namespace test_util
 }  // namespace sns_ik
 
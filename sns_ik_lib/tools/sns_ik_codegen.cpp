@@ -0,0 +1,80 @@
+/** @file sns_ik_codegen.cpp
+ *
+ * @brief Generate the kinematics backend of a chain from a URDF file
+ *
+ * Usage: sns_ik_codegen <urdf_file> <base_link> <tip_link> <class_name> <output_file>
+ *
+ * The output is a C++ source file that implements sns_ik::KinematicsBackend for the chain from
+ * base_link to tip_link, and registers it so that SNS_IK uses it for this chain. Add it to the
+ * sources of an executable or a shared library that links to sns_ik. See generateKinematicsCode().
+ *
+ *    Copyright 2018 Rethink Robotics
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <fstream>
+#include <kdl/chain.hpp>
+#include <kdl/tree.hpp>
+#include <kdl_parser/kdl_parser.hpp>
+#include <ros/console.h>
+#include <sstream>
+#include <string>
+#include <urdf/model.h>
+
+#include <sns_ik/sns_kinematics_codegen.hpp>
+
+int main(int argc, char** argv)
+{
+  if (argc != 6) {
+    ROS_ERROR("Usage: sns_ik_codegen <urdf_file> <base_link> <tip_link> <class_name> <output_file>");
+    return 1;
+  }
+  std::string urdfFile = argv[1];
+  std::string baseLink = argv[2];
+  std::string tipLink = argv[3];
+  std::string className = argv[4];
+  std::string outputFile = argv[5];
+
+  std::ifstream urdfStream(urdfFile);
+  if (!urdfStream) {
+    ROS_ERROR("Could not read the URDF file: %s", urdfFile.c_str());
+    return 1;
+  }
+  std::stringstream xml;
+  xml << urdfStream.rdbuf();
+  urdf::Model robotModel;
+  if (!robotModel.initString(xml.str())) {
+    ROS_ERROR("Could not parse the URDF file: %s", urdfFile.c_str());
+    return 1;
+  }
+  KDL::Tree tree;
+  if (!kdl_parser::treeFromUrdfModel(robotModel, tree)) {
+    ROS_ERROR("Failed to extract kdl tree from xml robot description.");
+    return 1;
+  }
+  KDL::Chain chain;
+  if (!tree.getChain(baseLink, tipLink, chain)) {
+    ROS_ERROR("Couldn't find chain %s to %s", baseLink.c_str(), tipLink.c_str());
+    return 1;
+  }
+
+  std::ofstream out(outputFile);
+  if (!out) {
+    ROS_ERROR("Could not write the output file: %s", outputFile.c_str());
+    return 1;
+  }
+  sns_ik::generateKinematicsCode(chain, className, &out);
+  ROS_INFO("Wrote the kinematics of the chain %s to %s (%d joints) to %s", baseLink.c_str(),
+           tipLink.c_str(), chain.getNrOfJoints(), outputFile.c_str());
+  return 0;
+}
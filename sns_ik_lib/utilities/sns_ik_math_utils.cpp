@@ -21,6 +21,8 @@
  */
 
 #include <ros/console.h>
+#include <algorithm>
+#include <cmath>
 #include <limits>
 
 #include "sns_ik_math_utils.hpp"
@@ -33,18 +35,24 @@ namespace {
 namespace sns_ik {
 
 bool pinv(const Eigen::MatrixXd &A, Eigen::MatrixXd *invA, double eps) {
+  PinvWorkspace ws;
+  return pinv(A, invA, &ws, eps);
+}
+
+bool pinv(const Eigen::MatrixXd &A, Eigen::MatrixXd *invA, PinvWorkspace *ws, double eps) {
 
   //A (m x n) usually comes from a redundant task jacobian, therfore we consider m<n
   int m = A.rows() - 1;
-  Eigen::VectorXd sigma;  //vector of singular values
 
-  Eigen::JacobiSVD<Eigen::MatrixXd> svd_A(A.transpose(), Eigen::ComputeThinU | Eigen::ComputeThinV);
-  sigma = svd_A.singularValues();
-  if (((m > 0) && (sigma(m) > eps)) || ((m == 0) && (A.array().abs() > eps).any())) {
+  ws->At = A.transpose();
+  ws->svd.compute(ws->At, Eigen::ComputeThinU | Eigen::ComputeThinV);
+  ws->sigma = ws->svd.singularValues();  //vector of singular values
+  if (((m > 0) && (ws->sigma(m) > eps)) || ((m == 0) && (A.array().abs() > eps).any())) {
     for (int i = 0; i <= m; i++) {
-      sigma(i) = 1.0 / sigma(i);
+      ws->sigma(i) = 1.0 / ws->sigma(i);
     }
-    (*invA) = svd_A.matrixU() * sigma.asDiagonal() * svd_A.matrixV().transpose();
+    ws->US.noalias() = ws->svd.matrixU() * ws->sigma.asDiagonal();
+    invA->noalias() = ws->US * ws->svd.matrixV().transpose();
     return true;
   } else {
     return false;
@@ -52,19 +60,26 @@ bool pinv(const Eigen::MatrixXd &A, Eigen::MatrixXd *invA, double eps) {
 }
 
 bool pinv_P(const Eigen::MatrixXd &A, Eigen::MatrixXd *invA, Eigen::MatrixXd *P, double eps) {
+  PinvWorkspace ws;
+  return pinv_P(A, invA, P, &ws, eps);
+}
+
+bool pinv_P(const Eigen::MatrixXd &A, Eigen::MatrixXd *invA, Eigen::MatrixXd *P, PinvWorkspace *ws,
+            double eps) {
 
   //A (m x n) usually comes from a redundant task jacobian, therfore we consider m<n
   int m = A.rows() - 1;
-  Eigen::VectorXd sigma;  //vector of singular values
 
-  Eigen::JacobiSVD<Eigen::MatrixXd> svd_A(A.transpose(), Eigen::ComputeThinU | Eigen::ComputeThinV);
-  sigma = svd_A.singularValues();
-  if (((m > 0) && (sigma(m) > eps)) || ((m == 0) && (A.array().abs() > eps).any())) {
+  ws->At = A.transpose();
+  ws->svd.compute(ws->At, Eigen::ComputeThinU | Eigen::ComputeThinV);
+  ws->sigma = ws->svd.singularValues();  //vector of singular values
+  if (((m > 0) && (ws->sigma(m) > eps)) || ((m == 0) && (A.array().abs() > eps).any())) {
     for (int i = 0; i <= m; i++) {
-      sigma(i) = 1.0 / sigma(i);
+      ws->sigma(i) = 1.0 / ws->sigma(i);
     }
-    (*invA) = svd_A.matrixU() * sigma.asDiagonal() * svd_A.matrixV().transpose();
-    (*P) = ((*P) - svd_A.matrixU() * svd_A.matrixU().transpose()).eval();
+    ws->US.noalias() = ws->svd.matrixU() * ws->sigma.asDiagonal();
+    invA->noalias() = ws->US * ws->svd.matrixV().transpose();
+    P->noalias() -= ws->svd.matrixU() * ws->svd.matrixU().transpose();
     return true;
   } else {
     return false;
@@ -73,64 +88,90 @@ bool pinv_P(const Eigen::MatrixXd &A, Eigen::MatrixXd *invA, Eigen::MatrixXd *P,
 }
 
 bool pinv_damped_P(const Eigen::MatrixXd &A, Eigen::MatrixXd *invA, Eigen::MatrixXd *P, double lambda_max, double eps) {
+  PinvWorkspace ws;
+  return pinv_damped_P(A, invA, P, &ws, lambda_max, eps);
+}
+
+bool pinv_damped_P(const Eigen::MatrixXd &A, Eigen::MatrixXd *invA, Eigen::MatrixXd *P,
+                   PinvWorkspace *ws, double lambda_max, double eps) {
 
   //A (m x n) usually comes from a redundant task jacobian, therfore we consider m<n
   int m = A.rows() - 1;
   int r = 0;  //rank
   double lambda2;
 
-  Eigen::JacobiSVD<Eigen::MatrixXd> svd_A(A.transpose(), Eigen::ComputeThinU | Eigen::ComputeThinV);
-  Eigen::VectorXd sigma = svd_A.singularValues();
+  ws->At = A.transpose();
+  ws->svd.compute(ws->At, Eigen::ComputeThinU | Eigen::ComputeThinV);
+  ws->sigma = ws->svd.singularValues();
+  Eigen::VectorXd &sigma = ws->sigma;
 
   if (((m > 0) && (sigma(m) > eps)) || ((m == 0) && (A.array().abs() > eps).any())) {
     for (int i = 0; i <= m; i++) {
       sigma(i) = 1.0 / sigma(i);
     }
-    (*invA) = svd_A.matrixU() * sigma.asDiagonal() * svd_A.matrixV().transpose();
-    if (P){ *P = ((*P) - svd_A.matrixU() * svd_A.matrixU().transpose()).eval(); }
+    ws->US.noalias() = ws->svd.matrixU() * sigma.asDiagonal();
+    invA->noalias() = ws->US * ws->svd.matrixV().transpose();
+    if (P){ P->noalias() -= ws->svd.matrixU() * ws->svd.matrixU().transpose(); }
     return true;
   } else {
     lambda2 = (1 - (sigma(m) / eps) * (sigma(m) / eps)) * lambda_max * lambda_max;
-    Eigen::VectorXd subSigma = Eigen::VectorXd::Ones(m + 1);
+    // The singular values are sorted, so the first r of them are non-zero. The damped inverse
+    // is set to zero for the others, rather than removing them: this keeps the size fixed.
     for (int i = 0; i <= m; i++) {
       if (sigma(i) > EPSQ) {
-        subSigma(r++) = (sigma(i) / (sigma(i) * sigma(i) + lambda2));
+        sigma(i) = (sigma(i) / (sigma(i) * sigma(i) + lambda2));
+        r++;
+      } else {
+        sigma(i) = 0.0;
       }
     }
 
     //only U till the rank
-    Eigen::MatrixXd subU = svd_A.matrixU().block(0, 0, A.cols(), r);
-    Eigen::MatrixXd subV = svd_A.matrixV().block(0, 0, A.rows(), r);
-    if (P){ *P = ((*P) - subU * subU.transpose()).eval(); }
-    (*invA) = subU * subSigma.head(r).asDiagonal() * subV.transpose();
+    if (P){ P->noalias() -= ws->svd.matrixU().leftCols(r) * ws->svd.matrixU().leftCols(r).transpose(); }
+    ws->US.noalias() = ws->svd.matrixU() * sigma.asDiagonal();
+    invA->noalias() = ws->US * ws->svd.matrixV().transpose();
     return false;
   }
 
 }
 
 bool pinv_QR(const Eigen::MatrixXd &A, Eigen::MatrixXd *invA, double eps) {
-  Eigen::MatrixXd At = A.transpose();
-  Eigen::HouseholderQR < Eigen::MatrixXd > qr = At.householderQr();
-  int m = A.rows();
-  //int n = A.cols();
+  PinvWorkspace ws;
+  return pinv_QR(A, A.rows(), invA, &ws, eps);
+}
+
+bool pinv_QR(const Eigen::MatrixXd &A, int nRows, Eigen::MatrixXd *invA, PinvWorkspace *ws,
+             double eps) {
+  // The Householder reflections for the first nRows columns of A' do not depend on the
+  // other columns, so they are simply set to zero. A' is also padded with rows of zeros until it
+  // is at least square: the zero rows do not change R, and a wide QR decomposition would allocate
+  // memory in Eigen's blocked Householder update.
+  int m = nRows;
+  int n = A.cols();
+  ws->At.setZero(std::max(A.cols(), A.rows()), A.rows());
+  ws->At.topLeftCorner(n, m) = A.topRows(m).transpose();
+  ws->qr.compute(ws->At);
 
-  Eigen::MatrixXd Rt = Eigen::MatrixXd::Zero(m, m);
   bool invertible;
 
-  Eigen::MatrixXd hR = (Eigen::MatrixXd) qr.matrixQR();
-  Eigen::MatrixXd Y = ((Eigen::MatrixXd) qr.householderQ()).leftCols(m);
+  ws->qr.householderQ().evalTo(ws->Q, ws->hWork);
+  const Eigen::MatrixXd &hR = ws->qr.matrixQR();
 
   //take the useful part of R
+  ws->Rt.setZero(m, m);
   for (int i = 0; i < m; i++) {
     for (int j = 0; j <= i; j++)
-      Rt(i, j) = hR(j, i);
+      ws->Rt(i, j) = hR(j, i);
   }
-  Eigen::FullPivLU < Eigen::MatrixXd > invRt(Rt);
 
-  invertible = fabs(invRt.determinant()) > eps;
+  invertible = fabs(ws->Rt.diagonal().prod()) > eps;
 
   if (invertible) {
-    *invA = Y * invRt.inverse();
+    // invA = Y * inv(Rt), with Y = Q.leftCols(m)
+    ws->X.setZero(A.cols(), A.rows());
+    ws->X.leftCols(m) = ws->Q.topLeftCorner(n, m);
+    ws->Rt.triangularView<Eigen::Lower>().solveInPlace<Eigen::OnTheRight>(ws->X.leftCols(m));
+    *invA = ws->X;
     return true;
   } else {
     return false;
@@ -139,83 +180,130 @@ bool pinv_QR(const Eigen::MatrixXd &A, Eigen::MatrixXd *invA, double eps) {
 }
 
 bool pinv_QR_Z(const Eigen::MatrixXd &A, const Eigen::MatrixXd &Z0, Eigen::MatrixXd *invA, Eigen::MatrixXd *Z, double lambda_max, double eps) {
-  Eigen::VectorXd sigma;  //vector of singular values
+  PinvWorkspace ws;
+  return pinv_QR_Z(A, Z0, invA, Z, &ws, lambda_max, eps);
+}
+
+/*
+ * pinv_QR_Z() once (A * Z0)' is in ws->At
+ */
+static bool pinv_QR_Z_transposed(const Eigen::MatrixXd &Z0, Eigen::MatrixXd *invA,
+                                 Eigen::MatrixXd *Z, PinvWorkspace *ws, double lambda_max,
+                                 double eps) {
   double lambda2;
 
-  Eigen::MatrixXd AZ0t = (A * Z0).transpose();
-  Eigen::HouseholderQR < Eigen::MatrixXd > qr = AZ0t.householderQr();
+  ws->qr.compute(ws->At);
 
-  int m = A.rows();
+  int m = ws->At.cols();
   int p = Z0.cols();
 
-  Eigen::MatrixXd Rt = Eigen::MatrixXd::Zero(m, m);
   bool invertible;
-  Eigen::MatrixXd hR = (Eigen::MatrixXd) qr.matrixQR();
-  Eigen::MatrixXd Y = ((Eigen::MatrixXd) qr.householderQ()).leftCols(m);
+  ws->qr.householderQ().evalTo(ws->Q, ws->hWork);
+  const Eigen::MatrixXd &hR = ws->qr.matrixQR();
 
   //take the useful part of R
+  ws->Rt.setZero(m, m);
   for (int i = 0; i < m; i++) {
     for (int j = 0; j <= i; j++)
-      Rt(i, j) = hR(j, i);
+      ws->Rt(i, j) = hR(j, i);
   }
 
-  Eigen::FullPivLU < Eigen::MatrixXd > invRt(Rt);
-  invertible = fabs(invRt.determinant()) > eps;
+  invertible = fabs(ws->Rt.diagonal().prod()) > eps;
 
   if (invertible) {
-    *invA = Z0 * Y * invRt.inverse();
-    *Z = Z0 * (((Eigen::MatrixXd) qr.householderQ()).rightCols(p - m));
+    // invA = Z0 * Y * inv(Rt), with Y = Q.leftCols(m)
+    ws->Y = ws->Q.leftCols(m);
+    ws->Rt.triangularView<Eigen::Lower>().solveInPlace<Eigen::OnTheRight>(ws->Y);
+    invA->noalias() = Z0 * ws->Y;
+    Z->noalias() = Z0 * ws->Q.rightCols(p - m);
     return true;
   } else {
-    Eigen::MatrixXd R = Eigen::MatrixXd::Zero(m, m);
     //take the useful part of R
-    for (int i = 0; i < m; i++) {
-      for (int j = i; j < m; j++)
-        R(i, j) = hR(i, j);
-    }
+    ws->R = ws->Rt.transpose();
 
     //perform the SVD of R
-    Eigen::JacobiSVD<Eigen::MatrixXd> svd_R(R, Eigen::ComputeThinU | Eigen::ComputeThinV);
-    sigma = svd_R.singularValues();
+    ws->svd.compute(ws->R, Eigen::ComputeThinU | Eigen::ComputeThinV);
+    ws->sigma = ws->svd.singularValues();
+    Eigen::VectorXd &sigma = ws->sigma;
     lambda2 = (1 - (sigma(m - 1) / eps) * (sigma(m - 1) / eps)) * lambda_max * lambda_max;
     for (int i = 0; i < m; i++) {
       sigma(i) = sigma(i) / (sigma(i) * sigma(i) + lambda2);
     }
-    (*invA) = Z0 * Y * svd_R.matrixU() * sigma.asDiagonal() * svd_R.matrixV().transpose();
+    // invA = Z0 * Y * U * diag(sigma) * V'
+    ws->US.noalias() = ws->svd.matrixU() * sigma.asDiagonal();
+    ws->X.noalias() = ws->US * ws->svd.matrixV().transpose();
+    ws->Y.noalias() = ws->Q.leftCols(m) * ws->X;
+    invA->noalias() = Z0 * ws->Y;
 
-    *Z = Z0 * (((Eigen::MatrixXd) qr.householderQ()).rightCols(p - m));
+    Z->noalias() = Z0 * ws->Q.rightCols(p - m);
     return false;
   }
 
 }
 
-bool pinv_forBarP(const Eigen::MatrixXd &W, const Eigen::MatrixXd &P, Eigen::MatrixXd *inv) {
-
-  Eigen::MatrixXd tmp;
-  bool invertible;
+bool pinv_QR_Z(const Eigen::MatrixXd &A, const Eigen::MatrixXd &Z0, Eigen::MatrixXd *invA,
+               Eigen::MatrixXd *Z, PinvWorkspace *ws, double lambda_max, double eps) {
+  ws->At.noalias() = Z0.transpose() * A.transpose();  // (A * Z0)'
+  return pinv_QR_Z_transposed(Z0, invA, Z, ws, lambda_max, eps);
+}
 
-  int sizeBarW = (W.diagonal().array() > 0.99).cast<int>().sum();
-  Eigen::MatrixXd barW(sizeBarW, W.cols());
-  int rowsBarW = 0;
+bool pinv_QR_Z_product(const Eigen::MatrixXd &AZ0, const Eigen::MatrixXd &Z0, Eigen::MatrixXd *invA,
+                       Eigen::MatrixXd *Z, PinvWorkspace *ws, double lambda_max, double eps) {
+  ws->At = AZ0.transpose();
+  return pinv_QR_Z_transposed(Z0, invA, Z, ws, lambda_max, eps);
+}
 
+bool pinv_forBarP(const Eigen::MatrixXd &W, const Eigen::MatrixXd &P, Eigen::MatrixXd *inv) {
+  std::vector<int> select;
   for (int i = 0; i < W.rows(); i++) {
     if (W(i, i) > 0.99) {  //equal to 1 (safer)
-      barW.row(rowsBarW++) = W.row(i);
+      select.push_back(i);
     }
   }
+  PinvWorkspace ws;
+  return pinv_forBarP(select, P, inv, &ws);
+}
 
-  tmp = barW * P * barW.transpose();
-  Eigen::FullPivLU < Eigen::MatrixXd > inversePbar(tmp);
+bool pinv_forBarP(const std::vector<int> &select, const Eigen::MatrixXd &P, Eigen::MatrixXd *inv,
+                  PinvWorkspace *ws) {
 
-  invertible = inversePbar.isInvertible();
+  int n = P.rows();
 
-  if (invertible) {
-    (*inv) = P * barW.transpose() * inversePbar.inverse() * barW;
-    return true;
-  } else {
-    (*inv) = Eigen::MatrixXd::Zero(W.rows(), W.rows());
+  /*
+   * Rather than extracting the sub-matrix barW * P * barW' (which changes size with W), copy the
+   * selected entries of P into the identity matrix. The inverse of this matrix has the inverse of
+   * the sub-matrix in the selected rows and columns.
+   */
+  ws->M.setIdentity(n, n);
+  for (int i : select) {
+    for (int j : select) {
+      ws->M(i, j) = P(i, j);
+    }
+  }
+  ws->lu.compute(ws->M);
+
+  if (!ws->lu.isInvertible()) {
+    inv->setZero(n, n);
     return false;
   }
+
+  // invM = Q * inv(U) * inv(L) * P, same as FullPivLU::inverse(), without temporary storage
+  ws->X.setZero(n, n);
+  for (int i = 0; i < n; i++) {
+    ws->X(ws->lu.permutationP().indices()(i), i) = 1.0;
+  }
+  ws->lu.matrixLU().triangularView<Eigen::UnitLower>().solveInPlace(ws->X);
+  ws->lu.matrixLU().triangularView<Eigen::Upper>().solveInPlace(ws->X);
+  ws->invM.noalias() = ws->lu.permutationQ() * ws->X;
+
+  // project the inverse of the sub-matrix back: P * barW' * inv(barW * P * barW') * barW
+  inv->setZero(n, n);
+  for (int j : select) {
+    for (int i : select) {
+      inv->col(j) += ws->invM(i, j) * P.col(i);
+    }
+  }
+  return true;
 }
 
 bool isIdentity(const Eigen::MatrixXd &A) {
@@ -325,4 +413,35 @@ bool solveLinearSystem(const Eigen::MatrixXd& A, const Eigen::MatrixXd& b,
 
 /*************************************************************************************************/
 
+void haltonPoint(int index, Eigen::VectorXd* point) {
+  int base = 1;
+  for (int i = 0; i < point->size(); i++) {
+    // next prime number
+    bool isPrime = false;
+    while (!isPrime) {
+      base++;
+      isPrime = true;
+      for (int k = 2; k * k <= base; k++) {
+        if (base % k == 0) { isPrime = false; break; }
+      }
+    }
+    // radical inverse of index in the base
+    double value = 0.0;
+    double scale = 1.0 / base;
+    for (int n = index; n > 0; n /= base) {
+      value += scale * (n % base);
+      scale /= base;
+    }
+    (*point)(i) = value;
+  }
+}
+
+/*************************************************************************************************/
+
+double wrapAngle(double angle) {
+  return std::remainder(angle, 2.0 * M_PI);
+}
+
+/*************************************************************************************************/
+
 } // namespace sns_ik
@@ -25,6 +25,7 @@
 #define SNS_IKL_MATH_UTILS
 
 #include <Eigen/Dense>
+#include <vector>
 
 #include "sns_ik_math_utils.hpp"
 
@@ -44,6 +45,26 @@ static const double INF = std::numeric_limits<double>::max();
  *         in a core solver that is running on a robot.
  */
 
+/*
+ * Preallocated memory for the pseudoinverse functions below. Each function has an overload that
+ * uses a workspace for all of its intermediate results. Once a workspace has been used with a
+ * given problem size, later calls with the same size do not allocate memory. Use a separate
+ * workspace for each call site: sharing one between problems of different sizes would resize it.
+ */
+struct PinvWorkspace {
+  Eigen::MatrixXd At;  // transpose of the input matrix
+  Eigen::JacobiSVD<Eigen::MatrixXd> svd;
+  Eigen::VectorXd sigma;  // (inverse) singular values
+  Eigen::MatrixXd US;  // left singular vectors, scaled by the inverse singular values
+  Eigen::HouseholderQR<Eigen::MatrixXd> qr;
+  Eigen::MatrixXd Q;  // orthogonal factor of the QR decomposition
+  Eigen::VectorXd hWork;  // workspace for evaluating Householder sequences
+  Eigen::MatrixXd R, Rt;  // triangular factor of the QR decomposition, and its transpose
+  Eigen::MatrixXd Y, X;  // products of the QR factors
+  Eigen::FullPivLU<Eigen::MatrixXd> lu;
+  Eigen::MatrixXd M, invM;  // square matrix for the LU decomposition, and its inverse
+};
+
 /*
  * Compute the pseudoinverse of A using an algorithm based on singular value decomposition.
  * @param A: input matrix
@@ -53,6 +74,7 @@ static const double INF = std::numeric_limits<double>::max();
  * @return: true if A is full rank, false if A is rank deficient
  */
 bool pinv(const Eigen::MatrixXd &A, Eigen::MatrixXd *invA, double eps = 1e-6);
+bool pinv(const Eigen::MatrixXd &A, Eigen::MatrixXd *invA, PinvWorkspace *ws, double eps = 1e-6);
 
 /*
  * Compute the pseudoinverse of A along with the nullspace projector matrix.
@@ -66,6 +88,8 @@ bool pinv(const Eigen::MatrixXd &A, Eigen::MatrixXd *invA, double eps = 1e-6);
  * @return: true if A is full rank, false if A is rank deficient
  */
 bool pinv_P(const Eigen::MatrixXd &A, Eigen::MatrixXd *invA, Eigen::MatrixXd *P, double eps = 1e-6);
+bool pinv_P(const Eigen::MatrixXd &A, Eigen::MatrixXd *invA, Eigen::MatrixXd *P, PinvWorkspace *ws,
+            double eps = 1e-6);
 
 /*
  * Compute the pseudoinverse of A along with the nullspace projector matrix.
@@ -81,6 +105,8 @@ bool pinv_P(const Eigen::MatrixXd &A, Eigen::MatrixXd *invA, Eigen::MatrixXd *P,
  */
 bool pinv_damped_P(const Eigen::MatrixXd &A, Eigen::MatrixXd *invA, Eigen::MatrixXd *P = nullptr,
                    double lambda_max = 1e-6, double eps = 1e-6);
+bool pinv_damped_P(const Eigen::MatrixXd &A, Eigen::MatrixXd *invA, Eigen::MatrixXd *P,
+                   PinvWorkspace *ws, double lambda_max = 1e-6, double eps = 1e-6);
 
 /*
  * Compute the pseudoinverse of A using an algorithm based on QR decomposition
@@ -92,6 +118,21 @@ bool pinv_damped_P(const Eigen::MatrixXd &A, Eigen::MatrixXd *invA, Eigen::Matri
  */
 bool pinv_QR(const Eigen::MatrixXd &A, Eigen::MatrixXd *invA, double eps = 1e-6);
 
+/*
+ * Compute the pseudoinverse of the first nRows rows of A using an algorithm based on QR
+ * decomposition. The size of the matrices does not depend on nRows, so the memory in the
+ * workspace can be reused when the number of rows changes between calls.
+ * @param A: input matrix of size [m, n]. Only the first nRows rows are used, nRows <= n
+ * @param nRows: number of rows of A to use
+ * @param[out] invA: matrix of size [n, m]. The first nRows columns are the pseudoinverse of
+ *                   A.topRows(nRows), the other columns are set to zero.
+ * @param ws: preallocated memory
+ * @param[opt] eps: singular values smaller than this will be set to zero
+ * @return: true if A.topRows(nRows) is full rank, false if it is rank deficient
+ */
+bool pinv_QR(const Eigen::MatrixXd &A, int nRows, Eigen::MatrixXd *invA, PinvWorkspace *ws,
+             double eps = 1e-6);
+
 /*
  * This code is used to compute the equations 6-10 in the main SNS-IK paper.
  * The variable names are taken to match those in the paper, letting k = 1.
@@ -112,6 +153,17 @@ bool pinv_QR(const Eigen::MatrixXd &A, Eigen::MatrixXd *invA, double eps = 1e-6)
  */
 bool pinv_QR_Z(const Eigen::MatrixXd &J1, const Eigen::MatrixXd &Za0, Eigen::MatrixXd *Jstar,
                Eigen::MatrixXd *Za1, double lambda_max = 1e-6, double eps = 1e-6);
+bool pinv_QR_Z(const Eigen::MatrixXd &J1, const Eigen::MatrixXd &Za0, Eigen::MatrixXd *Jstar,
+               Eigen::MatrixXd *Za1, PinvWorkspace *ws, double lambda_max = 1e-6, double eps = 1e-6);
+
+/*
+ * Same as pinv_QR_Z(), with the product J1*Za0 computed by the caller, for example from the
+ * structure of the task jacobian (see Task::multiply()).
+ * @param J1Za0: product of the task jacobian and the previous nullSpaceProjector, size [m, n]
+ */
+bool pinv_QR_Z_product(const Eigen::MatrixXd &J1Za0, const Eigen::MatrixXd &Za0, Eigen::MatrixXd *Jstar,
+                       Eigen::MatrixXd *Za1, PinvWorkspace *ws, double lambda_max = 1e-6,
+                       double eps = 1e-6);
 
 /*
  * This function computes the inverse of the projection of the P matrix onto the dimensions that
@@ -136,7 +188,6 @@ bool pinv_QR_Z(const Eigen::MatrixXd &J1, const Eigen::MatrixXd &Za0, Eigen::Mat
  *
  *   FIXME: remove direct inverse, replace with linear solve
  *   FIXME: remove hard-coded constants embedded in code
- *   FIXME: is it possible to replace W with a boolean vector?
  *
  * @param W: selection matrix, diagonal entries are either zero or one, other entries are zero.
       W(i, i) == 1 indicates that dimension i should be used, otherwise ignore dimension i
@@ -150,6 +201,15 @@ bool pinv_QR_Z(const Eigen::MatrixXd &J1, const Eigen::MatrixXd &Za0, Eigen::Mat
  */
 bool pinv_forBarP(const Eigen::MatrixXd &W, const Eigen::MatrixXd &P, Eigen::MatrixXd *C);
 
+/*
+ * Same as pinv_forBarP() above, but the selection matrix W is given by the list of dimensions
+ * that it selects: W(i, i) == 1 iff i is in select. The back-projection C = P*K only uses the
+ * selected columns of P. Once the workspace has been used with a given size of P, this function
+ * does not allocate memory.
+ */
+bool pinv_forBarP(const std::vector<int> &select, const Eigen::MatrixXd &P, Eigen::MatrixXd *C,
+                  PinvWorkspace *ws);
+
 /*
  * @return true iff the diagonal elements are near unity
  *   FIXME: if A.rows() >= A.cols() causes a failed assertion
@@ -183,6 +243,22 @@ bool solveLinearSystem(const Eigen::MatrixXd& A, const Eigen::MatrixXd& b,
                        Eigen::MatrixXd* x,
                        int* rank = nullptr, double* err = nullptr);
 
+/*
+ * Compute a point of the Halton sequence: a low-discrepancy (quasi-random) sequence of points
+ * in the unit cube. Dimension i of the point is the radical inverse of index in base p(i),
+ * where p(i) is the i-th prime number.
+ * @param index: index of the point in the sequence, index >= 1
+ * @param[out] point: the point, of size point->size(), with each entry in [0, 1)
+ */
+void haltonPoint(int index, Eigen::VectorXd* point);
+
+/*
+ * Wrap an angle, or a difference of angles, to the shortest equivalent angle.
+ * @param angle: angle in radians
+ * @return: the angle plus a multiple of 2*pi, in [-pi, pi]
+ */
+double wrapAngle(double angle);
+
 }  // namespace sns_ik
 
 #endif
@@ -0,0 +1,154 @@
+/** @file sns_joint_mask.hpp
+ *
+ * @brief Set of saturated joints, used by the SNS-IK solvers in place of a selection matrix
+ */
+
+/**
+ *    Copyright 2018 Rethink Robotics
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef SNS_IK_LIB__SNS_JOINT_MASK_H_
+#define SNS_IK_LIB__SNS_JOINT_MASK_H_
+
+#include <Eigen/Dense>
+#include <algorithm>
+#include <vector>
+
+namespace sns_ik {
+
+/*
+ * The SNS papers describe the set of saturated joints with the diagonal selection matrix W:
+ * W(i, i) == 1 if joint i is free and W(i, i) == 0 if joint i is saturated. This class stores the
+ * same information as a flag for each joint plus the list of saturated joints, so that products
+ * with W or (I - W) reduce to copying rows or columns.
+ *
+ * The list of saturated joints is kept in the order in which the joints were saturated. Once the
+ * mask has been reset with a given number of joints, it does not allocate memory.
+ */
+class JointMask {
+
+public:
+
+  JointMask() {}
+
+  /*
+   * Create a mask with all joints free
+   * @param nJnt: number of joints
+   */
+  explicit JointMask(int nJnt) { reset(nJnt); }
+
+  /*
+   * Set all joints to be free.  (W = I)
+   * @param nJnt: number of joints
+   */
+  void reset(int nJnt)
+  {
+    isFree_.assign(nJnt, true);
+    saturated_.clear();
+    saturated_.reserve(nJnt);
+  }
+
+  /*
+   * @return: number of joints
+   */
+  int size() const { return isFree_.size(); }
+
+  /*
+   * @return: true iff joint i is free.  (W(i, i) == 1)
+   */
+  bool isFree(int i) const { return isFree_[i]; }
+
+  /*
+   * @return: true iff no joint is saturated.  (W == I)
+   */
+  bool allFree() const { return saturated_.empty(); }
+
+  /*
+   * @return: the indices of the saturated joints, in the order in which they were saturated
+   */
+  const std::vector<int>& saturated() const { return saturated_; }
+
+  /*
+   * Mark joint i as saturated.  (W(i, i) = 0)
+   */
+  void saturate(int i)
+  {
+    if (isFree_[i]) {
+      isFree_[i] = false;
+      saturated_.push_back(i);
+    }
+  }
+
+  /*
+   * Mark joint i as free.  (W(i, i) = 1)
+   */
+  void release(int i)
+  {
+    if (!isFree_[i]) {
+      isFree_[i] = true;
+      saturated_.erase(std::find(saturated_.begin(), saturated_.end(), i));
+    }
+  }
+
+  /*
+   * Compute A * W: copy A and set the columns of the saturated joints to zero.
+   * @param A: matrix with one column per joint
+   * @param[out] AW: A * W
+   */
+  template <typename Derived, typename OutType>
+  void selectFreeColumns(const Eigen::MatrixBase<Derived>& A, OutType* AW) const
+  {
+    *AW = A;
+    for (int j : saturated_) {
+      AW->col(j).setZero();
+    }
+  }
+
+  /*
+   * Compute (I - W) * A: copy the rows of the saturated joints from A and set all other rows to zero.
+   * @param A: matrix with one row per joint
+   * @param[out] IWA: (I - W) * A
+   */
+  template <typename Derived, typename OutType>
+  void selectSaturatedRows(const Eigen::MatrixBase<Derived>& A, OutType* IWA) const
+  {
+    IWA->setZero(A.rows(), A.cols());
+    for (int i : saturated_) {
+      IWA->row(i) = A.row(i);
+    }
+  }
+
+  /*
+   * Compute the dense matrix I - W, which selects the saturated joints.
+   * @param[out] IW: I - W
+   */
+  template <typename OutType>
+  void getSaturatedSelectionMatrix(OutType* IW) const
+  {
+    IW->setZero(size(), size());
+    for (int i : saturated_) {
+      (*IW)(i, i) = 1.0;
+    }
+  }
+
+private:
+
+  std::vector<bool> isFree_;  // isFree_[i] == true iff joint i is free
+  std::vector<int> saturated_;  // indices of the saturated joints
+
+};  // class JointMask
+
+}  // namespace sns_ik
+
+#endif  // SNS_IK_LIB__SNS_JOINT_MASK_H_
@@ -30,6 +30,9 @@
 #define SNS_IK_LIB__SNS_LINEAR_SOLVER_H_
 
 #include <Eigen/Dense>
+#include <algorithm>
+#include <cmath>
+#include <utility>
 
 namespace sns_ik {
 
@@ -118,6 +121,353 @@ private:
 
 #endif  // EIGEN_VERSION_AT_LEAST(3,3,4)  //- - - - - - - - - - - - - - - - - - - - - - - - - - //
 
+/*
+ * Linear solver for a specific matrix type, used by the SNS-IK kernels. It is templated so that
+ * the fixed-size kernels can keep the decomposition in fixed-size Eigen objects.
+ *
+ * The SNS-IK loop saturates one joint at a time, which removes one column from the matrix in the
+ * linear system. The removeColumn() method updates the decomposition for such a change, which is
+ * much cheaper than computing it again from scratch.
+ *
+ * When the matrix A has full row rank, the solver keeps the QR decomposition A' = Q*R. The minimum
+ * norm solution of A*x = b is then x = Q*inv(R')*b, and removing column j of A is a rank-one
+ * update of the QR decomposition, computed with Givens rotations. Otherwise (A has more rows than
+ * columns or is close to rank deficient) the solver falls back to a complete orthogonal
+ * decomposition, which reveals the rank and computes the least-squares solution.
+ *
+ * The solve() method writes into a preallocated solution and keeps its intermediate results in
+ * member variables. Once the solver has been used with a given matrix size, compute(), solve(),
+ * and removeColumn() do not allocate memory. This does not hold for the legacy solver (Eigen
+ * older than 3.3.4), which does not have the QR update either.
+ */
+template <typename MatrixType>
+class SnsLinearSolverT {
+
+public:
+
+  typedef Eigen::Matrix<double, MatrixType::RowsAtCompileTime, 1> RhsVector;
+  typedef Eigen::Matrix<double, MatrixType::ColsAtCompileTime, 1> SolutionVector;
+
+  /*
+   * Set and decompose the matrix in the linear system.
+   */
+  void compute(const MatrixType& A);
+
+  /*
+   * Set column j of the matrix in the linear system to zero, and update the decomposition.
+   * @param j: index of the column to remove
+   */
+  void removeColumn(int j);
+
+  /*
+   * Find x to minimize:  ||A*x - b||^2
+   * @param b: right hand side of the linear system
+   * @param[out] x: solution to the optimization problem
+   */
+  void solve(const RhsVector& b, SolutionVector* x);
+
+  /*
+   * Compute the Lagrange multipliers of the minimum norm solution of A*x = b: the vector y such
+   * that x = A'*y and A*A'*y = b. Only available while the solver uses the QR decomposition.
+   * @param b: right hand side of the linear system
+   * @param[out] y: Lagrange multipliers
+   * @return: true iff successful, false if A is not known to have full row rank
+   */
+  bool solveMultipliers(const RhsVector& b, RhsVector* y);
+
+  /*
+   * @return: status of the solver
+   */
+  Eigen::ComputationInfo info() const;
+
+  /*
+   * @return: the rank of the matrix A
+   */
+  unsigned int rank() const;
+
+  /*
+   * @return: the matrix A that is currently set in the solver
+   */
+  const MatrixType& matrix() const { return A_; }
+
+private:
+
+  MatrixType A_;  // the matrix in the linear system
+
+#if EIGEN_VERSION_AT_LEAST(3,3,4)
+  typedef Eigen::Matrix<double, MatrixType::ColsAtCompileTime,
+                        MatrixType::RowsAtCompileTime> TransposeMatrix;
+  typedef Eigen::Matrix<double, MatrixType::ColsAtCompileTime,
+                        MatrixType::ColsAtCompileTime> OrthogonalMatrix;
+
+  // The QR decomposition is used while min(abs(diag(R))) > QR_MIN_PIVOT_RATIO * qrPivotScale_.
+  // Removing columns does not increase the rank, so the pivots after the updates are compared to
+  // the largest pivot of the original decomposition.
+  static constexpr double QR_MIN_PIVOT_RATIO = 1e-8;
+
+  /*
+   * Compute the QR decomposition A' = Q*R. Falls back to the complete orthogonal decomposition if
+   * A does not have full row rank.
+   */
+  void computeQR();
+
+  /*
+   * @return: true if the R in the QR decomposition is well conditioned
+   */
+  bool isQrFullRank() const;
+
+  /*
+   * Apply the Householder reflection H = I - tau * [1; essential] * [1; essential]' to v, in place.
+   * Same operation as MatrixBase::applyHouseholderOnTheLeft(), which allocates a temporary for
+   * dynamic-size vectors.
+   */
+  template <typename VectorType, typename EssentialType>
+  static void applyHouseholder(VectorType&& v, const EssentialType& essential, double tau);
+
+  bool useQR_ = false;  // true: solve with Q and R;  false: solve with the COD
+
+  // QR decomposition of A'
+  Eigen::HouseholderQR<TransposeMatrix> qr_;
+  OrthogonalMatrix Q_;
+  TransposeMatrix R_;
+  double qrPivotScale_ = 0.0;  // max(abs(diag(R))) when the QR decomposition was computed
+  SolutionVector w_;  // Q' * e_j, used by the rank-one update
+  RhsVector r_;  // column j of A, used by the rank-one update
+  SolutionVector hWork_;  // workspace for computing Q
+  RhsVector z_;  // inv(R') * b
+
+  // Complete orthogonal decomposition of A
+  Eigen::CompleteOrthogonalDecomposition<MatrixType> solver_;
+  RhsVector c_;  // Q^T * b
+  SolutionVector y_;  // solution, before the column permutation is applied
+#else
+  SnsLinearSolver solver_;
+#endif
+
+};
+
+/*************************************************************************************************/
+
+#if EIGEN_VERSION_AT_LEAST(3,3,4)
+
+template <typename MatrixType>
+constexpr double SnsLinearSolverT<MatrixType>::QR_MIN_PIVOT_RATIO;
+
+/*************************************************************************************************/
+
+template <typename MatrixType>
+void SnsLinearSolverT<MatrixType>::compute(const MatrixType& A)
+{
+  A_ = A;
+  if (A_.rows() > 0 && A_.rows() <= A_.cols()) {
+    computeQR();
+  } else {
+    useQR_ = false;
+    solver_.compute(A_);
+  }
+}
+
+/*************************************************************************************************/
+
+template <typename MatrixType>
+void SnsLinearSolverT<MatrixType>::removeColumn(int j)
+{
+  r_ = A_.col(j);
+  A_.col(j).setZero();
+  if (!useQR_) {
+    solver_.compute(A_);
+    return;
+  }
+
+  // Removing column j of A removes row j of A':
+  //   A' - e_j*r' = Q*(R - w*r'),  where r = A.col(j) and w = Q'*e_j
+  const Eigen::Index n = R_.rows();
+  const Eigen::Index m = R_.cols();
+  Eigen::JacobiRotation<double> G;
+  w_ = Q_.row(j).transpose();
+
+  // Rotate w to a multiple of e_1. This makes R upper Hessenberg.
+  for (Eigen::Index k = n - 1; k > 0; k--) {
+    G.makeGivens(w_(k - 1), w_(k), &w_(k - 1));
+    w_(k) = 0.0;
+    if (k - 1 < m) {
+      R_.applyOnTheLeft(k - 1, k, G.adjoint());
+    }
+    Q_.applyOnTheRight(k - 1, k, G);
+  }
+  R_.row(0) -= w_(0) * r_.transpose();
+
+  // Rotate the upper Hessenberg matrix back to upper triangular
+  for (Eigen::Index k = 0; k < m && k < n - 1; k++) {
+    G.makeGivens(R_(k, k), R_(k + 1, k));
+    R_.applyOnTheLeft(k, k + 1, G.adjoint());
+    R_(k + 1, k) = 0.0;
+    Q_.applyOnTheRight(k, k + 1, G);
+  }
+
+  if (!isQrFullRank()) {  // the rank-revealing decomposition decides the rank
+    useQR_ = false;
+    solver_.compute(A_);
+  }
+}
+
+/*************************************************************************************************/
+
+template <typename MatrixType>
+void SnsLinearSolverT<MatrixType>::solve(const RhsVector& b, SolutionVector* x)
+{
+  if (useQR_) {
+    // A*x = R'*Q'*x = b  -->  x = Q*z,  R'*z = b
+    const Eigen::Index m = R_.cols();
+    z_ = b;
+    R_.topRows(m).template triangularView<Eigen::Upper>().transpose().solveInPlace(z_);
+    x->noalias() = Q_.leftCols(m) * z_;
+    return;
+  }
+
+  // Same algorithm as CompleteOrthogonalDecomposition::solve(), but without temporary storage
+  const Eigen::Index rank = solver_.rank();
+  const Eigen::Index cols = solver_.cols();
+  if (rank == 0) {
+    x->setZero(cols);
+    return;
+  }
+
+  // Compute c = Q^T * b
+  const Eigen::Index rows = solver_.rows();
+  c_ = b;
+  for (Eigen::Index k = 0; k < rank; k++) {
+    applyHouseholder(c_.tail(rows - k), solver_.matrixQTZ().col(k).tail(rows - k - 1),
+                     solver_.hCoeffs()(k));
+  }
+
+  // Solve T * z = c(1:rank)
+  y_.resize(cols);
+  y_.head(rank) = c_.head(rank);
+  solver_.matrixQTZ().topLeftCorner(rank, rank).template triangularView<Eigen::Upper>()
+         .solveInPlace(y_.head(rank));
+
+  // Compute y = Z^T * [z; 0]
+  if (rank < cols) {
+    y_.tail(cols - rank).setZero();
+    for (Eigen::Index k = 0; k < rank; k++) {
+      if (k != rank - 1) { std::swap(y_(k), y_(rank - 1)); }
+      applyHouseholder(y_.segment(rank - 1, cols - rank + 1),
+                       solver_.matrixQTZ().row(k).tail(cols - rank).transpose(),
+                       solver_.zCoeffs()(k));
+      if (k != rank - 1) { std::swap(y_(k), y_(rank - 1)); }
+    }
+  }
+
+  // Undo the column permutation: x = P * y
+  x->noalias() = solver_.colsPermutation() * y_;
+}
+
+/*************************************************************************************************/
+
+template <typename MatrixType>
+bool SnsLinearSolverT<MatrixType>::solveMultipliers(const RhsVector& b, RhsVector* y)
+{
+  if (!useQR_) {
+    return false;
+  }
+  // A*A'*y = R'*R*y = b  -->  R'*z = b,  R*y = z
+  const Eigen::Index m = R_.cols();
+  *y = b;
+  R_.topRows(m).template triangularView<Eigen::Upper>().transpose().solveInPlace(*y);
+  R_.topRows(m).template triangularView<Eigen::Upper>().solveInPlace(*y);
+  return true;
+}
+
+/*************************************************************************************************/
+
+template <typename MatrixType>
+Eigen::ComputationInfo SnsLinearSolverT<MatrixType>::info() const
+{
+  return useQR_ ? Eigen::Success : solver_.info();
+}
+
+/*************************************************************************************************/
+
+template <typename MatrixType>
+unsigned int SnsLinearSolverT<MatrixType>::rank() const
+{
+  return useQR_ ? R_.cols() : solver_.rank();
+}
+
+/*************************************************************************************************/
+
+template <typename MatrixType>
+void SnsLinearSolverT<MatrixType>::computeQR()
+{
+  qr_.compute(A_.transpose());
+  qr_.householderQ().evalTo(Q_, hWork_);
+  R_ = qr_.matrixQR().template triangularView<Eigen::Upper>();
+  qrPivotScale_ = R_.diagonal().cwiseAbs().maxCoeff();
+  useQR_ = isQrFullRank();
+  if (!useQR_) {
+    solver_.compute(A_);
+  }
+}
+
+/*************************************************************************************************/
+
+template <typename MatrixType>
+bool SnsLinearSolverT<MatrixType>::isQrFullRank() const
+{
+  double minPivot = R_.diagonal().cwiseAbs().minCoeff();
+  return qrPivotScale_ > 0.0 && minPivot > QR_MIN_PIVOT_RATIO * qrPivotScale_;
+}
+
+/*************************************************************************************************/
+
+template <typename MatrixType>
+template <typename VectorType, typename EssentialType>
+void SnsLinearSolverT<MatrixType>::applyHouseholder(VectorType&& v, const EssentialType& essential,
+                                                    double tau)
+{
+  if (v.size() == 1) {
+    v(0) *= (1.0 - tau);
+  } else if (tau != 0.0) {
+    double tmp = essential.dot(v.tail(v.size() - 1)) + v(0);
+    v(0) -= tau * tmp;
+    v.tail(v.size() - 1) -= tau * essential * tmp;
+  }
+}
+
+#else  // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - //
+
+template <typename MatrixType>
+void SnsLinearSolverT<MatrixType>::compute(const MatrixType& A)
+{
+  A_ = A;
+  solver_.compute(A_);
+}
+
+template <typename MatrixType>
+void SnsLinearSolverT<MatrixType>::removeColumn(int j)
+{
+  A_.col(j).setZero();
+  solver_.compute(A_);
+}
+
+template <typename MatrixType>
+void SnsLinearSolverT<MatrixType>::solve(const RhsVector& b, SolutionVector* x)
+{
+  *x = solver_.solve(b);
+}
+
+template <typename MatrixType>
+bool SnsLinearSolverT<MatrixType>::solveMultipliers(const RhsVector&, RhsVector*) { return false; }
+
+template <typename MatrixType>
+Eigen::ComputationInfo SnsLinearSolverT<MatrixType>::info() const { return solver_.info(); }
+
+template <typename MatrixType>
+unsigned int SnsLinearSolverT<MatrixType>::rank() const { return solver_.rank(); }
+
+#endif  // EIGEN_VERSION_AT_LEAST(3,3,4)
+
 }  // namespace sns_ik
 
 #endif // SNS_IK_LIB__SNS_LINEAR_SOLVER_H_